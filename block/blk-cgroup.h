@@ -28,6 +28,11 @@
 #define CFQ_WEIGHT_MAX		1000
 #define CFQ_WEIGHT_DEFAULT	500
 
+/* FIOPS specific, out here for blkcg->fiops_weight */
+#define FIOPS_WEIGHT_MIN	10
+#define FIOPS_WEIGHT_MAX	1000
+#define FIOPS_WEIGHT_DEFAULT	500
+
 #ifdef CONFIG_BLK_CGROUP
 
 enum blkg_rwstat_type {
@@ -53,6 +58,7 @@ struct blkcg {
 	/* TODO: per-policy storage in blkcg */
 	unsigned int			cfq_weight;	/* belongs to cfq */
 	unsigned int			cfq_leaf_weight;
+	unsigned int			fiops_weight;	/* belongs to fiops */
 };
 
 struct blkg_stat {
@@ -113,6 +113,8 @@ void blk_rq_init(struct request_queue *q, struct request *rq)
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
 	rq->part = NULL;
+	if (q)
+		blk_lat_hist_init(q, rq);
 }
 EXPORT_SYMBOL(blk_rq_init);
 
@@ -2150,6 +2152,8 @@ void blk_account_io_completion(struct request *req, unsigned int bytes)
 
 void blk_account_io_done(struct request *req)
 {
+	blk_lat_hist_done(req);
+
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
 	 * normal IO on queueing nor completion.  Accounting the
@@ -2384,6 +2388,7 @@ void blk_start_request(struct request *req)
 		req->next_rq->resid_len = blk_rq_bytes(req->next_rq);
 
 	BUG_ON(test_bit(REQ_ATOM_COMPLETE, &req->atomic_flags));
+	blk_lat_hist_issue(req->q, req);
 	blk_add_timer(req);
 }
 EXPORT_SYMBOL(blk_start_request);
@@ -0,0 +1,197 @@
+/*
+ * Per-queue request latency histograms
+ *
+ * Every file system request is stamped when it is allocated, when it is
+ * moved to the dispatch list and when the driver starts it.  On
+ * completion the three intervals - queue (time spent in the I/O
+ * scheduler), dispatch (waiting on the dispatch list or in the blk-mq
+ * software queue) and service (owned by the driver/device) - are added
+ * to log2 histograms split by operation and request size.
+ *
+ * The stamps are only taken while the histograms are enabled through
+ * the queue's latency_hist_enable attribute, so a disabled queue pays a
+ * single test_bit per hook.  Counting is a lock-free atomic_inc.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+
+#include "blk.h"
+
+enum {
+	BLK_LAT_QUEUE,
+	BLK_LAT_DISPATCH,
+	BLK_LAT_SERVICE,
+	BLK_LAT_STAGES,
+};
+
+/* <= 4k, 16k, 64k, 256k and larger */
+#define BLK_LAT_SIZES		5
+/* first bucket is < 2^14ns (~16us), last one is >= 2^32ns (~4s) */
+#define BLK_LAT_SHIFT		14
+#define BLK_LAT_BUCKETS		20
+
+struct blk_lat_hist {
+	atomic_t hist[BLK_LAT_OPS][BLK_LAT_STAGES][BLK_LAT_SIZES]
+		     [BLK_LAT_BUCKETS];
+};
+
+static const char *blk_lat_stage_name[BLK_LAT_STAGES] = {
+	"queue", "dispatch", "service",
+};
+
+static const char *blk_lat_size_name[BLK_LAT_SIZES] = {
+	"4k", "16k", "64k", "256k", "large",
+};
+
+static int blk_lat_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return BLK_LAT_DISCARD;
+	/* flush_rq and empty REQ_FLUSH, data with FUA counts as write */
+	if ((rq->cmd_flags & REQ_FLUSH) && !rq->lat_bytes)
+		return BLK_LAT_FLUSH;
+	return rq_data_dir(rq) == READ ? BLK_LAT_READ : BLK_LAT_WRITE;
+}
+
+static int blk_lat_size(unsigned int bytes)
+{
+	int i;
+
+	for (i = 0; i < BLK_LAT_SIZES - 1; i++)
+		if (bytes <= (4096U << (2 * i)))
+			break;
+	return i;
+}
+
+static void blk_lat_account(struct blk_lat_hist *hist, int op, int stage,
+			    int size, u64 start, u64 end)
+{
+	u64 delta;
+	int bucket;
+
+	if (!start || end < start)
+		return;
+
+	delta = end - start;
+	bucket = min_t(int, fls64(delta >> BLK_LAT_SHIFT),
+		       BLK_LAT_BUCKETS - 1);
+	atomic_inc(&hist->hist[op][stage][size][bucket]);
+}
+
+/*
+ * Called from blk_account_io_done() for both the legacy and blk-mq
+ * completion paths.
+ */
+void blk_lat_hist_done(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_lat_hist *hist;
+	int op, size;
+	u64 now;
+
+	if (!q || !blk_queue_lat_hist(q))
+		return;
+	/* pairs with smp_wmb() in blk_lat_hist_enable() */
+	smp_rmb();
+	hist = ACCESS_ONCE(q->lat_hist);
+	if (!hist || rq->cmd_type != REQ_TYPE_FS || !rq->lat_issue_ns)
+		return;
+
+	now = ktime_get_ns();
+	op = blk_lat_op(rq);
+	size = blk_lat_size(rq->lat_bytes);
+
+	blk_lat_account(hist, op, BLK_LAT_QUEUE, size,
+			rq->lat_alloc_ns, rq->lat_dispatch_ns);
+	blk_lat_account(hist, op, BLK_LAT_DISPATCH, size,
+			rq->lat_dispatch_ns, rq->lat_issue_ns);
+	blk_lat_account(hist, op, BLK_LAT_SERVICE, size,
+			rq->lat_issue_ns, now);
+}
+
+/*
+ * The histograms are allocated on first enable and stay around until
+ * the queue is released, so completions racing with a disable never
+ * see them freed.  Called with q->sysfs_lock held.
+ */
+int blk_lat_hist_enable(struct request_queue *q, bool enable)
+{
+	if (enable && !q->lat_hist) {
+		struct blk_lat_hist *hist;
+
+		hist = kzalloc_node(sizeof(*hist), GFP_KERNEL, q->node);
+		if (!hist)
+			return -ENOMEM;
+		q->lat_hist = hist;
+		smp_wmb();
+	}
+
+	spin_lock_irq(q->queue_lock);
+	if (enable)
+		queue_flag_set(QUEUE_FLAG_LAT_HIST, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_LAT_HIST, q);
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+
+ssize_t blk_lat_hist_show(struct request_queue *q, int op, char *page)
+{
+	struct blk_lat_hist *hist = q->lat_hist;
+	ssize_t len;
+	int stage, size, i;
+
+	len = scnprintf(page, PAGE_SIZE, "usecs");
+	for (i = 0; i < BLK_LAT_BUCKETS - 1; i++)
+		len += scnprintf(page + len, PAGE_SIZE - len, " <%llu",
+				 (unsigned long long)div_u64(
+					1ULL << (BLK_LAT_SHIFT + i),
+					NSEC_PER_USEC));
+	len += scnprintf(page + len, PAGE_SIZE - len, " more\n");
+
+	if (!hist)
+		return len;
+
+	for (stage = 0; stage < BLK_LAT_STAGES; stage++) {
+		for (size = 0; size < BLK_LAT_SIZES; size++) {
+			atomic_t *row = hist->hist[op][stage][size];
+			unsigned int counts[BLK_LAT_BUCKETS];
+			bool empty = true;
+
+			for (i = 0; i < BLK_LAT_BUCKETS; i++) {
+				counts[i] = atomic_read(&row[i]);
+				if (counts[i])
+					empty = false;
+			}
+			if (empty)
+				continue;
+
+			len += scnprintf(page + len, PAGE_SIZE - len,
+					 "%s_%s", blk_lat_stage_name[stage],
+					 blk_lat_size_name[size]);
+			for (i = 0; i < BLK_LAT_BUCKETS; i++)
+				len += scnprintf(page + len, PAGE_SIZE - len,
+						 " %u", counts[i]);
+			len += scnprintf(page + len, PAGE_SIZE - len, "\n");
+		}
+	}
+
+	return len;
+}
+
+void blk_lat_hist_clear(struct request_queue *q, int op)
+{
+	struct blk_lat_hist *hist = q->lat_hist;
+	int stage, size, i;
+
+	if (!hist)
+		return;
+
+	for (stage = 0; stage < BLK_LAT_STAGES; stage++)
+		for (size = 0; size < BLK_LAT_SIZES; size++)
+			for (i = 0; i < BLK_LAT_BUCKETS; i++)
+				atomic_set(&hist->hist[op][stage][size][i], 0);
+}
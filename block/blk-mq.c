@@ -135,6 +135,7 @@ void blk_mq_freeze_queue(struct request_queue *q)
 	blk_mq_freeze_queue_start(q);
 	blk_mq_freeze_queue_wait(q);
 }
+EXPORT_SYMBOL_GPL(blk_mq_freeze_queue);
 
 static void blk_mq_unfreeze_queue(struct request_queue *q)
 {
@@ -179,6 +180,7 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	set_start_time_ns(rq);
 	rq->io_start_time_ns = 0;
 #endif
+	blk_lat_hist_init(q, rq);
 	rq->nr_phys_segments = 0;
 #if defined(CONFIG_BLK_DEV_INTEGRITY)
 	rq->nr_integrity_segments = 0;
@@ -385,6 +387,7 @@ void blk_mq_start_request(struct request *rq)
 	if (unlikely(blk_bidi_rq(rq)))
 		rq->next_rq->resid_len = blk_rq_bytes(rq->next_rq);
 
+	blk_lat_hist_issue(q, rq);
 	blk_add_timer(rq);
 
 	/*
@@ -777,7 +780,8 @@ void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
 	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
 		return;
 
-	if (!async && cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask))
+	if (!async && !(hctx->flags & BLK_MQ_F_BLOCKING) &&
+	    cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask))
 		__blk_mq_run_hw_queue(hctx);
 	else if (hctx->queue->nr_hw_queues == 1)
 		kblockd_schedule_delayed_work(&hctx->run_work, 0);
@@ -789,6 +793,21 @@ void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
 	}
 }
 
+/*
+ * ->queue_rq() of a BLK_MQ_F_BLOCKING queue may sleep. Sync IO is still
+ * dispatched from the submitting task, once it has let go of its software
+ * queue, everything else is left to kblockd.
+ */
+static void blk_mq_run_hw_queue_blocking(struct blk_mq_hw_ctx *hctx,
+					 bool async)
+{
+	if (!async && !test_bit(BLK_MQ_S_STOPPED, &hctx->state) &&
+	    cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask))
+		__blk_mq_run_hw_queue(hctx);
+	else
+		blk_mq_run_hw_queue(hctx, true);
+}
+
 void blk_mq_run_queues(struct request_queue *q, bool async)
 {
 	struct blk_mq_hw_ctx *hctx;
@@ -903,6 +922,7 @@ static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
 
 	trace_block_rq_insert(hctx->queue, rq);
+	blk_lat_hist_dispatch(hctx->queue, rq);
 
 	if (at_head)
 		list_add(&rq->queuelist, &ctx->rq_list);
@@ -1100,7 +1120,10 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 			hctx);
 	rq = __blk_mq_alloc_request(&alloc_data, rw);
 	if (unlikely(!rq)) {
-		__blk_mq_run_hw_queue(hctx);
+		if (hctx->flags & BLK_MQ_F_BLOCKING)
+			blk_mq_run_hw_queue(hctx, true);
+		else
+			__blk_mq_run_hw_queue(hctx);
 		blk_mq_put_ctx(ctx);
 		trace_block_sleeprq(q, bio, rw);
 
@@ -1148,7 +1171,7 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		goto run_queue;
 	}
 
-	if (is_sync) {
+	if (is_sync && !(data.hctx->flags & BLK_MQ_F_BLOCKING)) {
 		int ret;
 
 		blk_mq_bio_to_request(rq, bio);
@@ -1180,6 +1203,12 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		 * dispatching.
 		 */
 run_queue:
+		if (data.hctx->flags & BLK_MQ_F_BLOCKING) {
+			blk_mq_put_ctx(data.ctx);
+			blk_mq_run_hw_queue_blocking(data.hctx,
+						     !is_sync || is_flush_fua);
+			return;
+		}
 		blk_mq_run_hw_queue(data.hctx, !is_sync || is_flush_fua);
 	}
 done:
@@ -1255,6 +1284,12 @@ static void blk_sq_make_request(struct request_queue *q, struct bio *bio)
 		 * dispatching.
 		 */
 run_queue:
+		if (data.hctx->flags & BLK_MQ_F_BLOCKING) {
+			blk_mq_put_ctx(data.ctx);
+			blk_mq_run_hw_queue_blocking(data.hctx,
+						     !is_sync || is_flush_fua);
+			return;
+		}
 		blk_mq_run_hw_queue(data.hctx, !is_sync || is_flush_fua);
 	}
 
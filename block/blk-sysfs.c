@@ -223,6 +223,52 @@ QUEUE_SYSFS_BIT_FNS(random, ADD_RANDOM, 0);
 QUEUE_SYSFS_BIT_FNS(iostats, IO_STAT, 0);
 #undef QUEUE_SYSFS_BIT_FNS
 
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+static ssize_t queue_lat_hist_enable_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_lat_hist(q), page);
+}
+
+static ssize_t
+queue_lat_hist_enable_store(struct request_queue *q, const char *page,
+			    size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_lat_hist_enable(q, !!val);
+	if (err)
+		return err;
+	return ret;
+}
+
+/* reading shows the histograms, writing anything clears them */
+#define QUEUE_LAT_HIST_FNS(name, op)					\
+static ssize_t								\
+queue_lat_hist_##name##_show(struct request_queue *q, char *page)	\
+{									\
+	return blk_lat_hist_show(q, op, page);				\
+}									\
+static ssize_t								\
+queue_lat_hist_##name##_store(struct request_queue *q, const char *page, \
+			      size_t count)				\
+{									\
+	blk_lat_hist_clear(q, op);					\
+	return count;							\
+}
+
+QUEUE_LAT_HIST_FNS(read, BLK_LAT_READ);
+QUEUE_LAT_HIST_FNS(write, BLK_LAT_WRITE);
+QUEUE_LAT_HIST_FNS(flush, BLK_LAT_FLUSH);
+QUEUE_LAT_HIST_FNS(discard, BLK_LAT_DISCARD);
+#undef QUEUE_LAT_HIST_FNS
+#endif
+
 static ssize_t queue_nomerges_show(struct request_queue *q, char *page)
 {
 	return queue_var_show((blk_queue_nomerges(q) << 1) |
@@ -404,6 +450,27 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+static struct queue_sysfs_entry queue_lat_hist_enable_entry = {
+	.attr = {.name = "latency_hist_enable", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lat_hist_enable_show,
+	.store = queue_lat_hist_enable_store,
+};
+
+#define QUEUE_LAT_HIST_ENTRY(name)					\
+static struct queue_sysfs_entry queue_lat_hist_##name##_entry = {	\
+	.attr = {.name = "latency_hist_" #name, .mode = S_IRUGO | S_IWUSR }, \
+	.show = queue_lat_hist_##name##_show,				\
+	.store = queue_lat_hist_##name##_store,				\
+}
+
+QUEUE_LAT_HIST_ENTRY(read);
+QUEUE_LAT_HIST_ENTRY(write);
+QUEUE_LAT_HIST_ENTRY(flush);
+QUEUE_LAT_HIST_ENTRY(discard);
+#undef QUEUE_LAT_HIST_ENTRY
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -427,6 +494,13 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	&queue_lat_hist_enable_entry.attr,
+	&queue_lat_hist_read_entry.attr,
+	&queue_lat_hist_write_entry.attr,
+	&queue_lat_hist_flush_entry.attr,
+	&queue_lat_hist_discard_entry.attr,
+#endif
 	NULL,
 };
 
@@ -520,6 +594,10 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_trace_shutdown(q);
 
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	kfree(q->lat_hist);
+#endif
+
 	bdi_destroy(&q->backing_dev_info);
 
 	ida_simple_remove(&blk_queue_ida, q->id);
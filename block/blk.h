@@ -2,6 +2,7 @@
 #define BLK_INTERNAL_H
 
 #include <linux/idr.h>
+#include <linux/ktime.h>
 #include <linux/blk-mq.h>
 #include "blk-mq.h"
 
@@ -286,4 +287,64 @@ static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+/*
+ * Internal latency histogram interface
+ */
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE,
+	BLK_LAT_FLUSH,
+	BLK_LAT_DISCARD,
+	BLK_LAT_OPS,
+};
+
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+extern void blk_lat_hist_done(struct request *rq);
+extern int blk_lat_hist_enable(struct request_queue *q, bool enable);
+extern ssize_t blk_lat_hist_show(struct request_queue *q, int op, char *page);
+extern void blk_lat_hist_clear(struct request_queue *q, int op);
+
+/* request allocated or (for blk-mq) recycled; stamps are not zeroed there */
+static inline void blk_lat_hist_init(struct request_queue *q,
+				     struct request *rq)
+{
+	rq->lat_alloc_ns = blk_queue_lat_hist(q) ? ktime_get_ns() : 0;
+	rq->lat_dispatch_ns = 0;
+	rq->lat_issue_ns = 0;
+}
+
+/* request handed from the scheduler to the dispatch list */
+static inline void blk_lat_hist_dispatch(struct request_queue *q,
+					 struct request *rq)
+{
+	if (blk_queue_lat_hist(q))
+		rq->lat_dispatch_ns = ktime_get_ns();
+}
+
+/* request started by the driver */
+static inline void blk_lat_hist_issue(struct request_queue *q,
+				      struct request *rq)
+{
+	u64 now;
+
+	if (!blk_queue_lat_hist(q))
+		return;
+
+	now = ktime_get_ns();
+	/* inserted straight onto the dispatch list (flush_rq, bypass) */
+	if (!rq->lat_dispatch_ns)
+		rq->lat_dispatch_ns = now;
+	rq->lat_issue_ns = now;
+	rq->lat_bytes = blk_rq_bytes(rq);
+}
+#else /* CONFIG_BLK_DEV_LATENCY_HIST */
+static inline void blk_lat_hist_done(struct request *rq) { }
+static inline void blk_lat_hist_init(struct request_queue *q,
+				     struct request *rq) { }
+static inline void blk_lat_hist_dispatch(struct request_queue *q,
+					 struct request *rq) { }
+static inline void blk_lat_hist_issue(struct request_queue *q,
+				      struct request *rq) { }
+#endif /* CONFIG_BLK_DEV_LATENCY_HIST */
+
 #endif /* BLK_INTERNAL_H */
@@ -388,6 +388,7 @@ void elv_dispatch_sort(struct request_queue *q, struct request *rq)
 			break;
 	}
 
+	blk_lat_hist_dispatch(q, rq);
 	list_add(&rq->queuelist, entry);
 }
 EXPORT_SYMBOL(elv_dispatch_sort);
@@ -408,6 +409,7 @@ void elv_dispatch_add_tail(struct request_queue *q, struct request *rq)
 
 	q->end_sector = rq_end_sector(rq);
 	q->boundary_rq = rq;
+	blk_lat_hist_dispatch(q, rq);
 	list_add_tail(&rq->queuelist, &q->queue_head);
 }
 EXPORT_SYMBOL(elv_dispatch_add_tail);
@@ -617,12 +619,14 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 	case ELEVATOR_INSERT_REQUEUE:
 	case ELEVATOR_INSERT_FRONT:
 		rq->cmd_flags |= REQ_SOFTBARRIER;
+		blk_lat_hist_dispatch(q, rq);
 		list_add(&rq->queuelist, &q->queue_head);
 		break;
 
 	case ELEVATOR_INSERT_BACK:
 		rq->cmd_flags |= REQ_SOFTBARRIER;
 		elv_drain_elevator(q);
+		blk_lat_hist_dispatch(q, rq);
 		list_add_tail(&rq->queuelist, &q->queue_head);
 		/*
 		 * We kick the queue here for the following reasons.
@@ -12,6 +12,7 @@
 #include <linux/ioprio.h>
 #include <linux/blktrace_api.h>
 #include "blk.h"
+#include "blk-cgroup.h"
 
 #define VIOS_SCALE_SHIFT 10
 #define VIOS_SCALE (1 << VIOS_SCALE_SHIFT)
@@ -39,10 +40,33 @@ enum wl_prio_t {
 	FIOPS_PRIO_NR,
 };
 
+/*
+ * Per blkio cgroup scheduling entity. Groups are served in order of their
+ * vios, which are charged scaled by the inverse of the group weight; the
+ * iocs inside a group are then served by their own vios as before.
+ */
+struct fiops_group {
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	/* must be the first member */
+	struct blkg_policy_data pd;
+#endif
+	struct rb_node rb_node;
+	u64 vios; /* key in group_tree */
+
+	unsigned int weight;
+	unsigned int new_weight;
+
+	struct fiops_rb_root service_tree[FIOPS_PRIO_NR];
+	unsigned int busy_queues;
+
+	u64 dispatched;
+};
+
 struct fiops_data {
 	struct request_queue *queue;
 
-	struct fiops_rb_root service_tree[FIOPS_PRIO_NR];
+	struct fiops_rb_root group_tree;
+	struct fiops_group *root_group;
 
 	unsigned int busy_queues;
 	unsigned int in_flight[2];
@@ -60,6 +84,7 @@ struct fiops_ioc {
 
 	unsigned int flags;
 	struct fiops_data *fiopsd;
+	struct fiops_group *group;
 	struct rb_node rb_node;
 	u64 vios; /* key in service_tree */
 	struct fiops_rb_root *service_tree;
@@ -74,7 +99,7 @@ struct fiops_ioc {
 	enum wl_prio_t wl_type;
 };
 
-#define ioc_service_tree(ioc) (&((ioc)->fiopsd->service_tree[(ioc)->wl_type]))
+#define ioc_service_tree(ioc) (&((ioc)->group->service_tree[(ioc)->wl_type]))
 #define RQ_CIC(rq)		icq_to_cic((rq)->elv.icq)
 
 enum ioc_state_flags {
@@ -128,6 +153,89 @@ static inline struct fiops_ioc *fiops_cic_lookup(struct fiops_data *fiopsd,
 	return NULL;
 }
 
+static void fiops_init_group(struct fiops_group *group, unsigned int weight)
+{
+	int i;
+
+	RB_CLEAR_NODE(&group->rb_node);
+	for (i = IDLE_WORKLOAD; i <= RT_WORKLOAD; i++)
+		group->service_tree[i] = FIOPS_RB_ROOT;
+	group->weight = weight;
+}
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+static struct blkcg_policy blkcg_policy_fiops;
+
+static inline struct fiops_group *pd_to_fiopsg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct fiops_group, pd) : NULL;
+}
+
+static inline struct fiops_group *blkg_to_fiopsg(struct blkcg_gq *blkg)
+{
+	return pd_to_fiopsg(blkg_to_pd(blkg, &blkcg_policy_fiops));
+}
+
+static inline void fiops_get_group(struct fiops_group *group)
+{
+	blkg_get(pd_to_blkg(&group->pd));
+}
+
+static inline void fiops_put_group(struct fiops_group *group)
+{
+	blkg_put(pd_to_blkg(&group->pd));
+}
+
+/*
+ * Find or create the group of blkcg on this queue. request_queue lock and
+ * rcu read lock must be held.
+ */
+static struct fiops_group *fiops_lookup_create_group(struct fiops_data *fiopsd,
+	struct blkcg *blkcg)
+{
+	struct blkcg_gq *blkg;
+
+	/* avoid lookup for the common case where there's no blkcg */
+	if (blkcg == &blkcg_root)
+		return fiopsd->root_group;
+
+	blkg = blkg_lookup_create(blkcg, fiopsd->queue);
+	if (IS_ERR(blkg))
+		return NULL;
+
+	return blkg_to_fiopsg(blkg);
+}
+
+/*
+ * Move the ioc to the group of the cgroup it now issues IO from. An ioc
+ * with requests queued stays in its old group until they are dispatched.
+ */
+static void fiops_check_group(struct fiops_data *fiopsd,
+	struct fiops_ioc *ioc, struct bio *bio)
+{
+	struct fiops_group *group;
+
+	if (fiops_ioc_on_rr(ioc))
+		return;
+
+	rcu_read_lock();
+	group = fiops_lookup_create_group(fiopsd, bio_blkcg(bio));
+	if (group && group != ioc->group) {
+		fiops_log_ioc(fiopsd, ioc, "move group, weight %u",
+			group->weight);
+		fiops_get_group(group);
+		fiops_put_group(ioc->group);
+		ioc->group = group;
+		/* vios are only comparable within a group */
+		ioc->vios = ioc_service_tree(ioc)->min_vios;
+	}
+	rcu_read_unlock();
+}
+#else
+static inline void fiops_get_group(struct fiops_group *group) { }
+static inline void fiops_put_group(struct fiops_group *group) { }
+#endif
+
 /*
  * The below is leftmost cache rbtree addon
  */
@@ -179,8 +287,66 @@ static void fiops_update_min_vios(struct fiops_rb_root *service_tree)
 	service_tree->min_vios = max_vios(service_tree->min_vios, ioc->vios);
 }
 
+static struct fiops_group *fiops_group_first(struct fiops_data *fiopsd)
+{
+	struct fiops_rb_root *group_tree = &fiopsd->group_tree;
+
+	if (!group_tree->count)
+		return NULL;
+
+	if (!group_tree->left)
+		group_tree->left = rb_first(&group_tree->rb);
+
+	return rb_entry(group_tree->left, struct fiops_group, rb_node);
+}
+
 /*
- * The fiopsd->service_trees holds all pending fiops_ioc's that have
+ * The fiopsd->group_tree holds all groups that have a busy fiops_ioc,
+ * sorted by the vios they have been charged.
+ */
+static void fiops_group_tree_add(struct fiops_data *fiopsd,
+	struct fiops_group *group)
+{
+	struct fiops_rb_root *group_tree = &fiopsd->group_tree;
+	struct rb_node **p = &group_tree->rb.rb_node, *parent = NULL;
+	struct fiops_group *__group;
+	int left = 1;
+
+	if (RB_EMPTY_NODE(&group->rb_node))
+		group->vios = max_vios(group_tree->min_vios, group->vios);
+	else
+		fiops_rb_erase(&group->rb_node, group_tree);
+
+	if (group->new_weight) {
+		group->weight = group->new_weight;
+		group->new_weight = 0;
+	}
+
+	while (*p) {
+		parent = *p;
+		__group = rb_entry(parent, struct fiops_group, rb_node);
+
+		if (group->vios < __group->vios)
+			p = &parent->rb_left;
+		else {
+			p = &parent->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		group_tree->left = &group->rb_node;
+
+	rb_link_node(&group->rb_node, parent, p);
+	rb_insert_color(&group->rb_node, &group_tree->rb);
+	group_tree->count++;
+
+	group_tree->min_vios = max_vios(group_tree->min_vios,
+					fiops_group_first(fiopsd)->vios);
+}
+
+/*
+ * The group->service_trees holds all pending fiops_ioc's that have
  * requests waiting to be processed. It is sorted in the order that
  * we will service the queues.
  */
@@ -265,6 +431,8 @@ static void fiops_add_ioc_rr(struct fiops_data *fiopsd, struct fiops_ioc *ioc)
 	fiops_mark_ioc_on_rr(ioc);
 
 	fiopsd->busy_queues++;
+	if (!ioc->group->busy_queues++)
+		fiops_group_tree_add(fiopsd, ioc->group);
 
 	fiops_resort_rr_list(fiopsd, ioc);
 }
@@ -283,6 +451,9 @@ static void fiops_del_ioc_rr(struct fiops_data *fiopsd, struct fiops_ioc *ioc)
 		ioc->service_tree = NULL;
 	}
 
+	if (!--ioc->group->busy_queues)
+		fiops_rb_erase(&ioc->group->rb_node, &fiopsd->group_tree);
+
 	BUG_ON(!fiopsd->busy_queues);
 	fiopsd->busy_queues--;
 }
@@ -356,20 +527,24 @@ static u64 fiops_dispatch_request(struct fiops_data *fiopsd,
 
 static int fiops_forced_dispatch(struct fiops_data *fiopsd)
 {
+	struct fiops_group *group;
 	struct fiops_ioc *ioc;
 	int dispatched = 0;
 	int i;
 
-	for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
-		while (!RB_EMPTY_ROOT(&fiopsd->service_tree[i].rb)) {
-			ioc = fiops_rb_first(&fiopsd->service_tree[i]);
-
-			while (!list_empty(&ioc->fifo)) {
-				fiops_dispatch_request(fiopsd, ioc);
-				dispatched++;
+	/* the group leaves group_tree once its last ioc is deleted */
+	while ((group = fiops_group_first(fiopsd))) {
+		for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
+			while (!RB_EMPTY_ROOT(&group->service_tree[i].rb)) {
+				ioc = fiops_rb_first(&group->service_tree[i]);
+
+				while (!list_empty(&ioc->fifo)) {
+					fiops_dispatch_request(fiopsd, ioc);
+					dispatched++;
+				}
+				if (fiops_ioc_on_rr(ioc))
+					fiops_del_ioc_rr(fiopsd, ioc);
 			}
-			if (fiops_ioc_on_rr(ioc))
-				fiops_del_ioc_rr(fiopsd, ioc);
 		}
 	}
 	return dispatched;
@@ -377,14 +552,19 @@ static int fiops_forced_dispatch(struct fiops_data *fiopsd)
 
 static struct fiops_ioc *fiops_select_ioc(struct fiops_data *fiopsd)
 {
+	struct fiops_group *group;
 	struct fiops_ioc *ioc;
 	struct fiops_rb_root *service_tree = NULL;
 	int i;
 	struct request *rq;
 
+	group = fiops_group_first(fiopsd);
+	if (!group)
+		return NULL;
+
 	for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
-		if (!RB_EMPTY_ROOT(&fiopsd->service_tree[i].rb)) {
-			service_tree = &fiopsd->service_tree[i];
+		if (!RB_EMPTY_ROOT(&group->service_tree[i].rb)) {
+			service_tree = &group->service_tree[i];
 			break;
 		}
 	}
@@ -401,7 +581,8 @@ static struct fiops_ioc *fiops_select_ioc(struct fiops_data *fiopsd)
 	 * to be starved, don't delay
 	 */
 	if (!rq_is_sync(rq) && fiopsd->in_flight[1] != 0 &&
-			service_tree->count == 1) {
+			service_tree->count == 1 &&
+			fiopsd->group_tree.count == 1) {
 		fiops_log_ioc(fiopsd, ioc,
 				"postpone async, in_flight async %d sync %d",
 				fiopsd->in_flight[0], fiopsd->in_flight[1]);
@@ -415,7 +596,11 @@ static void fiops_charge_vios(struct fiops_data *fiopsd,
 	struct fiops_ioc *ioc, u64 vios)
 {
 	struct fiops_rb_root *service_tree = ioc->service_tree;
+	struct fiops_group *group = ioc->group;
+
 	ioc->vios += vios;
+	group->vios += div_u64(vios * FIOPS_WEIGHT_DEFAULT, group->weight);
+	group->dispatched++;
 
 	fiops_log_ioc(fiopsd, ioc, "charge vios %lld, new vios %lld", vios, ioc->vios);
 
@@ -425,6 +610,10 @@ static void fiops_charge_vios(struct fiops_data *fiopsd,
 		fiops_resort_rr_list(fiopsd, ioc);
 
 	fiops_update_min_vios(service_tree);
+
+	/* reposition the group by its new vios */
+	if (group->busy_queues)
+		fiops_group_tree_add(fiopsd, group);
 }
 
 static int fiops_dispatch_requests(struct request_queue *q, int force)
@@ -592,12 +781,31 @@ static int fiops_allow_merge(struct request_queue *q, struct request *rq,
 	return cic == RQ_CIC(rq);
 }
 
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+static int fiops_set_request(struct request_queue *q, struct request *rq,
+	struct bio *bio, gfp_t gfp_mask)
+{
+	struct fiops_data *fiopsd = q->elevator->elevator_data;
+
+	spin_lock_irq(q->queue_lock);
+	fiops_check_group(fiopsd, RQ_CIC(rq), bio);
+	spin_unlock_irq(q->queue_lock);
+
+	return 0;
+}
+#endif
+
 static void fiops_exit_queue(struct elevator_queue *e)
 {
 	struct fiops_data *fiopsd = e->elevator_data;
 
 	cancel_work_sync(&fiopsd->unplug_work);
 
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	blkcg_deactivate_policy(fiopsd->queue, &blkcg_policy_fiops);
+#else
+	kfree(fiopsd->root_group);
+#endif
 	kfree(fiopsd);
 }
 
@@ -615,8 +823,8 @@ static void fiops_kick_queue(struct work_struct *work)
 static int fiops_init_queue(struct request_queue *q, struct elevator_type *e)
 {
 	struct fiops_data *fiopsd;
-	int i;
 	struct elevator_queue *eq;
+	int ret;
 
 	eq = elevator_alloc(q, e);
 	if (!eq)
@@ -634,8 +842,23 @@ static int fiops_init_queue(struct request_queue *q, struct elevator_type *e)
 	q->elevator = eq;
 	spin_unlock_irq(q->queue_lock);
 
-	for (i = IDLE_WORKLOAD; i <= RT_WORKLOAD; i++)
-		fiopsd->service_tree[i] = FIOPS_RB_ROOT;
+	fiopsd->group_tree = FIOPS_RB_ROOT;
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	ret = blkcg_activate_policy(q, &blkcg_policy_fiops);
+	if (ret)
+		goto out_free;
+
+	fiopsd->root_group = blkg_to_fiopsg(q->root_blkg);
+#else
+	ret = -ENOMEM;
+	fiopsd->root_group = kzalloc_node(sizeof(*fiopsd->root_group),
+					  GFP_KERNEL, q->node);
+	if (!fiopsd->root_group)
+		goto out_free;
+
+	fiops_init_group(fiopsd->root_group, FIOPS_WEIGHT_DEFAULT);
+#endif
 
 	INIT_WORK(&fiopsd->unplug_work, fiops_kick_queue);
 
@@ -645,6 +868,11 @@ static int fiops_init_queue(struct request_queue *q, struct elevator_type *e)
 	fiopsd->async_scale = VIOS_ASYNC_SCALE;
 
 	return 0;
+
+out_free:
+	kfree(fiopsd);
+	kobject_put(&eq->kobj);
+	return ret;
 }
 
 static void fiops_init_icq(struct io_cq *icq)
@@ -657,11 +885,20 @@ static void fiops_init_icq(struct io_cq *icq)
 	ioc->sort_list = RB_ROOT;
 
 	ioc->fiopsd = fiopsd;
+	ioc->group = fiopsd->root_group;
+	fiops_get_group(ioc->group);
 
 	ioc->pid = current->pid;
 	fiops_mark_ioc_prio_changed(ioc);
 }
 
+static void fiops_exit_icq(struct io_cq *icq)
+{
+	struct fiops_ioc *ioc = icq_to_cic(icq);
+
+	fiops_put_group(ioc->group);
+}
+
 /*
  * sysfs parts below -->
  */
@@ -731,9 +968,13 @@ static struct elevator_type iosched_fiops = {
 		.elevator_dispatch_fn =		fiops_dispatch_requests,
 		.elevator_add_req_fn =		fiops_insert_request,
 		.elevator_completed_req_fn =	fiops_completed_request,
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+		.elevator_set_req_fn =		fiops_set_request,
+#endif
 		.elevator_former_req_fn =	elv_rb_former_request,
 		.elevator_latter_req_fn =	elv_rb_latter_request,
 		.elevator_init_icq_fn =		fiops_init_icq,
+		.elevator_exit_icq_fn =		fiops_exit_icq,
 		.elevator_init_fn =		fiops_init_queue,
 		.elevator_exit_fn =		fiops_exit_queue,
 	},
@@ -744,13 +985,101 @@ static struct elevator_type iosched_fiops = {
 	.elevator_owner =	THIS_MODULE,
 };
 
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+static void fiops_pd_init(struct blkcg_gq *blkg)
+{
+	fiops_init_group(blkg_to_fiopsg(blkg), blkg->blkcg->fiops_weight);
+}
+
+static int fiops_print_weight(struct seq_file *sf, void *v)
+{
+	seq_printf(sf, "%u\n", css_to_blkcg(seq_css(sf))->fiops_weight);
+	return 0;
+}
+
+static int fiops_set_weight(struct cgroup_subsys_state *css,
+	struct cftype *cft, u64 val)
+{
+	struct blkcg *blkcg = css_to_blkcg(css);
+	struct blkcg_gq *blkg;
+
+	if (val < FIOPS_WEIGHT_MIN || val > FIOPS_WEIGHT_MAX)
+		return -EINVAL;
+
+	spin_lock_irq(&blkcg->lock);
+
+	blkcg->fiops_weight = val;
+
+	/* picked up the next time the group is queued */
+	hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
+		struct fiops_group *group = blkg_to_fiopsg(blkg);
+
+		if (group)
+			group->new_weight = val;
+	}
+
+	spin_unlock_irq(&blkcg->lock);
+	return 0;
+}
+
+static u64 fiopsg_prfill_dispatched(struct seq_file *sf,
+	struct blkg_policy_data *pd, int off)
+{
+	return __blkg_prfill_u64(sf, pd, pd_to_fiopsg(pd)->dispatched);
+}
+
+static int fiopsg_print_dispatched(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)),
+			  fiopsg_prfill_dispatched, &blkcg_policy_fiops,
+			  0, false);
+	return 0;
+}
+
+static struct cftype fiops_blkcg_files[] = {
+	{
+		.name = "fiops_weight",
+		.seq_show = fiops_print_weight,
+		.write_u64 = fiops_set_weight,
+	},
+	{
+		.name = "fiops_dispatched",
+		.seq_show = fiopsg_print_dispatched,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_fiops = {
+	.pd_size		= sizeof(struct fiops_group),
+	.cftypes		= fiops_blkcg_files,
+
+	.pd_init_fn		= fiops_pd_init,
+};
+#endif
+
 static int __init fiops_init(void)
 {
-	return elv_register(&iosched_fiops);
+	int ret;
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	ret = blkcg_policy_register(&blkcg_policy_fiops);
+	if (ret)
+		return ret;
+#endif
+
+	ret = elv_register(&iosched_fiops);
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	if (ret)
+		blkcg_policy_unregister(&blkcg_policy_fiops);
+#endif
+	return ret;
 }
 
 static void __exit fiops_exit(void)
 {
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	blkcg_policy_unregister(&blkcg_policy_fiops);
+#endif
 	elv_unregister(&iosched_fiops);
 }
 
@@ -0,0 +1,529 @@
+/*
+ * Latency target IO scheduler
+ * Based on Noop, Deadline and SIO IO schedulers.
+ *
+ * Requests are split into four classes: sync reads, sync writes, async
+ * writes and discards. They are dispatched in that order of preference,
+ * with a fifo expire time per class so that the lower ones are never
+ * starved.
+ *
+ * Async writes and discards need a token to be dispatched, and there are
+ * only async_depth of them. Completion latency is recorded per class in a
+ * log2 histogram; once per window the 99th percentile of read latency is
+ * compared against target_read_lat, and async_depth is halved when reads
+ * missed it or grown by one when they did not. On eMMC this keeps bulk
+ * writeback from filling the device queue ahead of the reads the UI is
+ * waiting for.
+ */
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+enum lat_class {
+	LAT_SYNC_READ,
+	LAT_SYNC_WRITE,
+	LAT_ASYNC_WRITE,
+	LAT_DISCARD,
+	LAT_NR_CLASSES,
+};
+
+/* Bucket i holds latencies below 128us << i, the last one is open ended */
+#define LAT_HIST_SHIFT		7
+#define LAT_HIST_BUCKETS	16
+
+/* Tunables */
+static const int sync_read_expire   = HZ / 8;	/* max time before a sync read is submitted. */
+static const int sync_write_expire  = HZ / 2;	/* max time before a sync write is submitted. */
+static const int async_write_expire = 2 * HZ;	/* ditto for async writes, if a token is free. */
+static const int discard_expire     = 5 * HZ;	/* ditto for discards, if a token is free. */
+
+static const int target_read_lat = 10000;	/* read p99 to aim for, in usecs. */
+static const int window = HZ / 10;		/* how often async_depth is adjusted. */
+static const int async_depth_max = 16;		/* max async writes and discards in flight. */
+
+struct lat_data {
+	struct request_queue *queue;
+
+	/* Requests are only present on fifo_list */
+	struct list_head fifo_list[LAT_NR_CLASSES];
+
+	/* Async write tokens */
+	int async_in_flight;
+	int async_depth;
+	bool throttled;
+	struct work_struct unplug_work;
+
+	/* Completion latency, in usecs */
+	unsigned long hist[LAT_NR_CLASSES][LAT_HIST_BUCKETS];
+	unsigned long window_hist[LAT_HIST_BUCKETS];	/* sync reads only */
+	unsigned long window_start;
+
+	/* Settings */
+	int fifo_expire[LAT_NR_CLASSES];
+	int target_read_lat;
+	int window;
+	int async_depth_max;
+};
+
+/* Queue time and class are kept in the elevator private data */
+#define RQ_STAMP(rq)	((unsigned long)(rq)->elv.priv[0])
+#define RQ_CLASS(rq)	((enum lat_class)(unsigned long)(rq)->elv.priv[1])
+
+static inline unsigned long lat_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
+static enum lat_class lat_rq_class(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return LAT_DISCARD;
+	if (rq_data_dir(rq) == READ)
+		return LAT_SYNC_READ;
+	return rq_is_sync(rq) ? LAT_SYNC_WRITE : LAT_ASYNC_WRITE;
+}
+
+static inline bool lat_needs_token(enum lat_class c)
+{
+	return c >= LAT_ASYNC_WRITE;
+}
+
+static inline int lat_hist_bucket(unsigned long lat)
+{
+	return min_t(int, fls_long(lat >> LAT_HIST_SHIFT),
+		     LAT_HIST_BUCKETS - 1);
+}
+
+static inline unsigned long lat_bucket_limit(int bucket)
+{
+	return 1UL << (LAT_HIST_SHIFT + bucket);
+}
+
+static void
+lat_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	/*
+	 * If next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo.
+	 * rq also inherits the older queue time of the two.
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(next->fifo_time, rq->fifo_time)) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq->fifo_time = next->fifo_time;
+		}
+	}
+	if (time_before(RQ_STAMP(next), RQ_STAMP(rq)))
+		rq->elv.priv[0] = next->elv.priv[0];
+
+	/* Delete next request */
+	rq_fifo_clear(next);
+}
+
+static void
+lat_add_request(struct request_queue *q, struct request *rq)
+{
+	struct lat_data *ld = q->elevator->elevator_data;
+	enum lat_class c = lat_rq_class(rq);
+
+	rq->elv.priv[0] = (void *)lat_now_us();
+	rq->elv.priv[1] = (void *)(unsigned long)c;
+
+	rq->fifo_time = jiffies + ld->fifo_expire[c];
+	list_add_tail(&rq->queuelist, &ld->fifo_list[c]);
+}
+
+static inline bool
+lat_may_dispatch(struct lat_data *ld, enum lat_class c, int force)
+{
+	return force || !lat_needs_token(c) ||
+	       ld->async_in_flight < ld->async_depth;
+}
+
+static struct request *
+lat_expired_request(struct lat_data *ld, enum lat_class c)
+{
+	struct list_head *list = &ld->fifo_list[c];
+	struct request *rq;
+
+	if (list_empty(list))
+		return NULL;
+
+	rq = rq_entry_fifo(list->next);
+	if (time_after_eq(jiffies, rq->fifo_time))
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+lat_choose_request(struct lat_data *ld, int force)
+{
+	struct request *rq;
+	int c;
+
+	/* Expired requests first, then strictly by class */
+	for (c = 0; c < LAT_NR_CLASSES; c++) {
+		if (!lat_may_dispatch(ld, c, force))
+			continue;
+		rq = lat_expired_request(ld, c);
+		if (rq)
+			return rq;
+	}
+
+	for (c = 0; c < LAT_NR_CLASSES; c++) {
+		if (list_empty(&ld->fifo_list[c]))
+			continue;
+		if (!lat_may_dispatch(ld, c, force)) {
+			/* Rerun the queue when a token comes back */
+			ld->throttled = true;
+			continue;
+		}
+		return rq_entry_fifo(ld->fifo_list[c].next);
+	}
+
+	return NULL;
+}
+
+static int
+lat_dispatch_requests(struct request_queue *q, int force)
+{
+	struct lat_data *ld = q->elevator->elevator_data;
+	struct request *rq;
+
+	rq = lat_choose_request(ld, force);
+	if (!rq)
+		return 0;
+
+	if (lat_needs_token(RQ_CLASS(rq)))
+		ld->async_in_flight++;
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(q, rq);
+
+	return 1;
+}
+
+/*
+ * Estimate the 99th percentile of the reads completed in this window,
+ * interpolating linearly inside the bucket it falls in.
+ */
+static unsigned long lat_read_p99(struct lat_data *ld, unsigned long total)
+{
+	unsigned long want = DIV_ROUND_UP(total * 99, 100);
+	unsigned long seen = 0, lo, hi, n;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS - 1; i++) {
+		n = ld->window_hist[i];
+		if (seen + n >= want) {
+			lo = i ? lat_bucket_limit(i - 1) : 0;
+			hi = lat_bucket_limit(i);
+			return lo + (hi - lo) * (want - seen) / n;
+		}
+		seen += n;
+	}
+
+	return lat_bucket_limit(LAT_HIST_BUCKETS - 2);
+}
+
+static void lat_adjust_depth(struct lat_data *ld)
+{
+	unsigned long reads = 0;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		reads += ld->window_hist[i];
+
+	if (reads &&
+	    lat_read_p99(ld, reads) > (unsigned long)ld->target_read_lat)
+		ld->async_depth = max(ld->async_depth / 2, 1);
+	else
+		ld->async_depth = min(ld->async_depth + 1,
+				      ld->async_depth_max);
+
+	memset(ld->window_hist, 0, sizeof(ld->window_hist));
+	ld->window_start = jiffies;
+}
+
+static void
+lat_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct lat_data *ld = q->elevator->elevator_data;
+	enum lat_class c = RQ_CLASS(rq);
+	int bucket = lat_hist_bucket(lat_now_us() - RQ_STAMP(rq));
+
+	ld->hist[c][bucket]++;
+	if (c == LAT_SYNC_READ)
+		ld->window_hist[bucket]++;
+	else if (lat_needs_token(c))
+		ld->async_in_flight--;
+
+	if (time_after_eq(jiffies, ld->window_start + ld->window))
+		lat_adjust_depth(ld);
+
+	if (ld->throttled && ld->async_in_flight < ld->async_depth) {
+		ld->throttled = false;
+		kblockd_schedule_work(&ld->unplug_work);
+	}
+}
+
+static struct request *
+lat_former_request(struct request_queue *q, struct request *rq)
+{
+	struct lat_data *ld = q->elevator->elevator_data;
+
+	if (rq->queuelist.prev == &ld->fifo_list[RQ_CLASS(rq)])
+		return NULL;
+
+	/* Return former request */
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+lat_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct lat_data *ld = q->elevator->elevator_data;
+
+	if (rq->queuelist.next == &ld->fifo_list[RQ_CLASS(rq)])
+		return NULL;
+
+	/* Return latter request */
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void lat_kick_queue(struct work_struct *work)
+{
+	struct lat_data *ld = container_of(work, struct lat_data, unplug_work);
+	struct request_queue *q = ld->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static int lat_init_queue(struct request_queue *q, struct elevator_type *e)
+{
+	struct lat_data *ld;
+	struct elevator_queue *eq;
+	int c;
+
+	eq = elevator_alloc(q, e);
+	if (!eq)
+		return -ENOMEM;
+
+	/* Allocate structure */
+	ld = kzalloc_node(sizeof(*ld), GFP_KERNEL, q->node);
+	if (!ld) {
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+	eq->elevator_data = ld;
+
+	/* Initialize fifo lists */
+	for (c = 0; c < LAT_NR_CLASSES; c++)
+		INIT_LIST_HEAD(&ld->fifo_list[c]);
+
+	/* Initialize data */
+	ld->queue = q;
+	INIT_WORK(&ld->unplug_work, lat_kick_queue);
+	ld->fifo_expire[LAT_SYNC_READ] = sync_read_expire;
+	ld->fifo_expire[LAT_SYNC_WRITE] = sync_write_expire;
+	ld->fifo_expire[LAT_ASYNC_WRITE] = async_write_expire;
+	ld->fifo_expire[LAT_DISCARD] = discard_expire;
+	ld->target_read_lat = target_read_lat;
+	ld->window = window;
+	ld->async_depth_max = async_depth_max;
+	ld->async_depth = async_depth_max;
+	ld->window_start = jiffies;
+
+	spin_lock_irq(q->queue_lock);
+	q->elevator = eq;
+	spin_unlock_irq(q->queue_lock);
+
+	return 0;
+}
+
+static void
+lat_exit_queue(struct elevator_queue *e)
+{
+	struct lat_data *ld = e->elevator_data;
+	int c;
+
+	cancel_work_sync(&ld->unplug_work);
+
+	for (c = 0; c < LAT_NR_CLASSES; c++)
+		BUG_ON(!list_empty(&ld->fifo_list[c]));
+
+	/* Free structure */
+	kfree(ld);
+}
+
+/*
+ * sysfs code
+ */
+
+static ssize_t
+lat_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+lat_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct lat_data *ld = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return lat_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(lat_sync_read_expire_show, ld->fifo_expire[LAT_SYNC_READ], 1);
+SHOW_FUNCTION(lat_sync_write_expire_show, ld->fifo_expire[LAT_SYNC_WRITE], 1);
+SHOW_FUNCTION(lat_async_write_expire_show, ld->fifo_expire[LAT_ASYNC_WRITE], 1);
+SHOW_FUNCTION(lat_discard_expire_show, ld->fifo_expire[LAT_DISCARD], 1);
+SHOW_FUNCTION(lat_target_read_lat_show, ld->target_read_lat, 0);
+SHOW_FUNCTION(lat_window_show, ld->window, 1);
+SHOW_FUNCTION(lat_async_depth_max_show, ld->async_depth_max, 0);
+SHOW_FUNCTION(lat_async_depth_show, ld->async_depth, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct lat_data *ld = e->elevator_data;				\
+	int __data;							\
+	int ret = lat_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(lat_sync_read_expire_store, &ld->fifo_expire[LAT_SYNC_READ], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_sync_write_expire_store, &ld->fifo_expire[LAT_SYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_async_write_expire_store, &ld->fifo_expire[LAT_ASYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_discard_expire_store, &ld->fifo_expire[LAT_DISCARD], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_target_read_lat_store, &ld->target_read_lat, 0, INT_MAX, 0);
+STORE_FUNCTION(lat_window_store, &ld->window, 1, INT_MAX, 1);
+STORE_FUNCTION(lat_async_depth_max_store, &ld->async_depth_max, 1, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+/*
+ * One line per bucket, "<limit count" in usecs. Writing anything to the
+ * file clears the histogram.
+ */
+static ssize_t
+lat_hist_show(struct lat_data *ld, enum lat_class c, char *page)
+{
+	char *p = page;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS - 1; i++)
+		p += sprintf(p, "<%lu %lu\n", lat_bucket_limit(i),
+			     ld->hist[c][i]);
+	p += sprintf(p, ">=%lu %lu\n", lat_bucket_limit(i - 1),
+		     ld->hist[c][i]);
+
+	return p - page;
+}
+
+static ssize_t
+lat_hist_store(struct lat_data *ld, enum lat_class c, size_t count)
+{
+	spin_lock_irq(ld->queue->queue_lock);
+	memset(ld->hist[c], 0, sizeof(ld->hist[c]));
+	spin_unlock_irq(ld->queue->queue_lock);
+
+	return count;
+}
+
+#define HIST_FUNCTION(__NAME, __CLASS)					\
+static ssize_t lat_##__NAME##_show(struct elevator_queue *e, char *page) \
+{									\
+	return lat_hist_show(e->elevator_data, __CLASS, page);		\
+}									\
+static ssize_t lat_##__NAME##_store(struct elevator_queue *e,		\
+				    const char *page, size_t count)	\
+{									\
+	return lat_hist_store(e->elevator_data, __CLASS, count);	\
+}
+HIST_FUNCTION(sync_read_hist, LAT_SYNC_READ);
+HIST_FUNCTION(sync_write_hist, LAT_SYNC_WRITE);
+HIST_FUNCTION(async_write_hist, LAT_ASYNC_WRITE);
+HIST_FUNCTION(discard_hist, LAT_DISCARD);
+#undef HIST_FUNCTION
+
+#define DD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, lat_##name##_show, \
+				      lat_##name##_store)
+
+static struct elv_fs_entry lat_attrs[] = {
+	DD_ATTR(sync_read_expire),
+	DD_ATTR(sync_write_expire),
+	DD_ATTR(async_write_expire),
+	DD_ATTR(discard_expire),
+	DD_ATTR(target_read_lat),
+	DD_ATTR(window),
+	DD_ATTR(async_depth_max),
+	__ATTR(async_depth, S_IRUGO, lat_async_depth_show, NULL),
+	DD_ATTR(sync_read_hist),
+	DD_ATTR(sync_write_hist),
+	DD_ATTR(async_write_hist),
+	DD_ATTR(discard_hist),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_latency = {
+	.ops = {
+		.elevator_merge_req_fn		= lat_merged_requests,
+		.elevator_dispatch_fn		= lat_dispatch_requests,
+		.elevator_add_req_fn		= lat_add_request,
+		.elevator_completed_req_fn	= lat_completed_request,
+		.elevator_former_req_fn		= lat_former_request,
+		.elevator_latter_req_fn		= lat_latter_request,
+		.elevator_init_fn		= lat_init_queue,
+		.elevator_exit_fn		= lat_exit_queue,
+	},
+
+	.elevator_attrs = lat_attrs,
+	.elevator_name = "latency",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init lat_init(void)
+{
+	/* Register elevator */
+	return elv_register(&iosched_latency);
+}
+
+static void __exit lat_exit(void)
+{
+	/* Unregister elevator */
+	elv_unregister(&iosched_latency);
+}
+
+module_init(lat_init);
+module_exit(lat_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Latency target IO scheduler");
@@ -10,6 +10,11 @@
  * handling to allow for read biases. By prioritizing reads, simple tasks should
  * improve in performance. Maple also uses hooks for the state notifier driver
  * to increase expirations when power is suspended to decrease workload.
+ *
+ * While the display is off, async writes are held back and dispatched in
+ * sector ordered batches of up to batch_budget_kb, so the device sees long
+ * sequential runs and idles in between. While it is on, small sync reads
+ * are put on a fast track ahead of everything but starved writes.
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
@@ -19,7 +24,7 @@
 #include <linux/slab.h>
 #include <linux/fb.h>
 
-#define MAPLE_IOSCHED_PATCHLEVEL	(8)
+#define MAPLE_IOSCHED_PATCHLEVEL	(9)
 
 enum { ASYNC, SYNC };
 
@@ -31,6 +36,8 @@ static const int async_write_expire = 450;	/* ditto for write async, these limit
 static const int fifo_batch = 16;		/* # of sequential requests treated as one by the above parameters. */
 static const int writes_starved = 4;		/* max times reads can starve a write */
 static const int sleep_latency_multiple = 10;	/* multple for expire time when device is asleep */
+static const int batch_budget_kb = 4096;	/* async writes dispatched per batch when asleep */
+static const int small_read_kb = 32;		/* sync reads up to this size are fast tracked when awake */
 
 /* Elevator data */
 struct maple_data {
@@ -46,57 +53,160 @@ struct maple_data {
 	int fifo_batch;
 	int writes_starved;
 	int sleep_latency_multiple;
+	int batch_budget_kb;
+	int small_read_kb;
+
+	/* Small sync reads, only filled while the display is on */
+	struct list_head fast_list;
+
+	/* Async writes sorted by sector, batched while the display is off */
+	struct rb_root sort_list;
+	struct request *next_rq;
+	unsigned int async_write_nr;
+	unsigned long async_write_bytes;
+	long batch_left;
+
+	/* Stats, indexed by display state */
+	unsigned long long dispatched_bytes[2];
+	unsigned long long merged_bytes[2];
+	unsigned long batches;
 
 	/* Display state */
+	struct request_queue *queue;
 	struct notifier_block fb_notifier;
 	int display_on;
 };
 
+/* The fifo list a request was queued on */
+#define RQ_LIST(rq)	((struct list_head *)(rq)->elv.priv[0])
+/* Bytes an async write holds in async_write_bytes, 0 for anything else */
+#define RQ_CHARGED(rq)	((unsigned long)(rq)->elv.priv[1])
+
+static inline void
+maple_charge_request(struct maple_data *mdata, struct request *rq,
+		     unsigned long bytes)
+{
+	mdata->async_write_bytes += bytes - RQ_CHARGED(rq);
+	rq->elv.priv[1] = (void *)bytes;
+}
+
 static inline struct maple_data *
 maple_get_data(struct request_queue *q) {
 	return q->elevator->elevator_data;
 }
 
+static inline bool
+maple_async_write(struct request *rq)
+{
+	return !rq_is_sync(rq) && rq_data_dir(rq) == WRITE;
+}
+
+static void
+maple_del_rq_rb(struct maple_data *mdata, struct request *rq)
+{
+	if (mdata->next_rq == rq)
+		mdata->next_rq = elv_rb_latter_request(rq->q, rq);
+
+	elv_rb_del(&mdata->sort_list, rq);
+	mdata->async_write_nr--;
+}
+
 static void
 maple_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
 {
+	struct maple_data *mdata = maple_get_data(q);
+
 	/*
 	 * If next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo.
+	 * rq then lives on next's fifo list, which may be a different one.
 	 */
 	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
 		if (time_before(next->fifo_time, rq->fifo_time)) {
 			list_move(&rq->queuelist, &next->queuelist);
 			rq->fifo_time = next->fifo_time;
+			rq->elv.priv[0] = next->elv.priv[0];
 		}
 	}
 
-	/* Delete next request */
+	/*
+	 * Delete next request. Its bytes are now part of rq, which only
+	 * holds them in async_write_bytes if it is an async write itself.
+	 */
+	if (RQ_CHARGED(rq))
+		maple_charge_request(mdata, rq, blk_rq_bytes(rq));
+	maple_charge_request(mdata, next, 0);
+	if (maple_async_write(next))
+		maple_del_rq_rb(mdata, next);
 	rq_fifo_clear(next);
 }
 
+static void
+maple_merged_request(struct request_queue *q, struct request *rq, int type)
+{
+	struct maple_data *mdata = maple_get_data(q);
+
+	/* A front merge moves the request in the sector sort */
+	if (type == ELEVATOR_FRONT_MERGE && maple_async_write(rq)) {
+		maple_del_rq_rb(mdata, rq);
+		elv_rb_add(&mdata->sort_list, rq);
+		mdata->async_write_nr++;
+	}
+}
+
+static void
+maple_bio_merged(struct request_queue *q, struct request *rq, struct bio *bio)
+{
+	struct maple_data *mdata = maple_get_data(q);
+
+	mdata->merged_bytes[mdata->display_on] += bio->bi_iter.bi_size;
+	if (RQ_CHARGED(rq))
+		maple_charge_request(mdata, rq,
+				     RQ_CHARGED(rq) + bio->bi_iter.bi_size);
+}
+
+static void
+maple_queue_request(struct maple_data *mdata, struct request *rq,
+		    struct list_head *list, unsigned int expire)
+{
+	rq->fifo_time = jiffies + expire;
+	rq->elv.priv[0] = list;
+	rq->elv.priv[1] = NULL;
+	list_add_tail(&rq->queuelist, list);
+
+	if (maple_async_write(rq)) {
+		elv_rb_add(&mdata->sort_list, rq);
+		mdata->async_write_nr++;
+		maple_charge_request(mdata, rq, blk_rq_bytes(rq));
+	}
+}
+
 static void
 maple_add_request(struct request_queue *q, struct request *rq)
 {
 	struct maple_data *mdata = maple_get_data(q);
 	const int sync = rq_is_sync(rq);
 	const int dir = rq_data_dir(rq);
+	struct list_head *list = &mdata->fifo_list[sync][dir];
 
 	/* increase expiration when device is asleep */
 	unsigned int fifo_expire_suspended = mdata->fifo_expire[sync][dir] * sleep_latency_multiple;
 
+	/* fast track small sync reads when device is awake */
+	if (mdata->display_on && sync && dir == READ &&
+	    blk_rq_bytes(rq) <= (unsigned int)mdata->small_read_kb << 10)
+		list = &mdata->fast_list;
+
 	/*
 	 * Add request to the proper fifo list and set its
 	 * expire time.
 	 */
-	if (mdata->display_on && mdata->fifo_expire[sync][dir]) {
-		rq->fifo_time = jiffies + mdata->fifo_expire[sync][dir];
-		list_add_tail(&rq->queuelist, &mdata->fifo_list[sync][dir]);
-	} else if (!mdata->display_on && fifo_expire_suspended) {
-		rq->fifo_time = jiffies + fifo_expire_suspended;
-		list_add_tail(&rq->queuelist, &mdata->fifo_list[sync][dir]);
-	}
+	if (mdata->display_on && mdata->fifo_expire[sync][dir])
+		maple_queue_request(mdata, rq, list,
+				    mdata->fifo_expire[sync][dir]);
+	else if (!mdata->display_on && fifo_expire_suspended)
+		maple_queue_request(mdata, rq, list, fifo_expire_suspended);
 }
 
 static struct request *
@@ -119,12 +229,13 @@ maple_expired_request(struct maple_data *mdata, int sync, int data_dir)
 }
 
 static struct request *
-maple_choose_expired_request(struct maple_data *mdata)
+maple_choose_expired_request(struct maple_data *mdata, bool hold)
 {
 	struct request *rq_sync_read = maple_expired_request(mdata, SYNC, READ);
 	struct request *rq_sync_write = maple_expired_request(mdata, SYNC, WRITE);
 	struct request *rq_async_read = maple_expired_request(mdata, ASYNC, READ);
-	struct request *rq_async_write = maple_expired_request(mdata, ASYNC, WRITE);
+	struct request *rq_async_write = hold ? NULL :
+				maple_expired_request(mdata, ASYNC, WRITE);
 
 	/* Reset (non-expired-)batch-counter */
 	mdata->batched = 0;
@@ -156,10 +267,11 @@ maple_choose_expired_request(struct maple_data *mdata)
 }
 
 static struct request *
-maple_choose_request(struct maple_data *mdata, int data_dir)
+maple_choose_request(struct maple_data *mdata, int data_dir, bool hold)
 {
 	struct list_head *sync = mdata->fifo_list[SYNC];
 	struct list_head *async = mdata->fifo_list[ASYNC];
+	bool held[2] = { false, hold };	/* async lists held back, by dir */
 
 	/* Increase (non-expired-)batch-counter */
 	mdata->batched++;
@@ -169,19 +281,67 @@ maple_choose_request(struct maple_data *mdata, int data_dir)
 	 * Asynchronous requests have priority over synchronous.
 	 * Read requests have priority over write.
 	 */
-	if (!list_empty(&async[data_dir]))
+	if (!list_empty(&async[data_dir]) && !held[data_dir])
 		return rq_entry_fifo(async[data_dir].next);
 	if (!list_empty(&sync[data_dir]))
 		return rq_entry_fifo(sync[data_dir].next);
 
-	if (!list_empty(&async[!data_dir]))
+	if (!list_empty(&async[!data_dir]) && !held[!data_dir])
 		return rq_entry_fifo(async[!data_dir].next);
 	if (!list_empty(&sync[!data_dir]))
 		return rq_entry_fifo(sync[!data_dir].next);
 
+	/* Fast tracked reads left over from when the display was on */
+	if (!list_empty(&mdata->fast_list))
+		return rq_entry_fifo(mdata->fast_list.next);
+
 	return NULL;
 }
 
+/*
+ * Open a batch of async writes once a budget worth of them is queued,
+ * they hold half of the request pool or the oldest one has expired.
+ */
+static bool
+maple_start_batch(struct request_queue *q, struct maple_data *mdata,
+		  int force)
+{
+	if (!force &&
+	    mdata->async_write_bytes <
+			(unsigned long)mdata->batch_budget_kb << 10 &&
+	    mdata->async_write_nr < q->nr_requests / 2 &&
+	    !maple_expired_request(mdata, ASYNC, WRITE))
+		return false;
+
+	mdata->batch_left = (long)mdata->batch_budget_kb << 10;
+	mdata->next_rq = NULL;
+	mdata->batches++;
+
+	return true;
+}
+
+static struct request *
+maple_batch_request(struct maple_data *mdata)
+{
+	struct rb_node *node;
+
+	if (mdata->next_rq)
+		return mdata->next_rq;
+
+	node = rb_first(&mdata->sort_list);
+	return node ? rb_entry_rq(node) : NULL;
+}
+
+/* Come back when the oldest held write expires */
+static void
+maple_delay_batch(struct request_queue *q, struct maple_data *mdata)
+{
+	struct request *rq = rq_entry_fifo(mdata->fifo_list[ASYNC][WRITE].next);
+	long delay = (long)(rq->fifo_time - jiffies);
+
+	blk_delay_queue(q, jiffies_to_msecs(max(delay, 1L)));
+}
+
 static inline void
 maple_dispatch_request(struct maple_data *mdata, struct request *rq)
 {
@@ -190,6 +350,23 @@ maple_dispatch_request(struct maple_data *mdata, struct request *rq)
 	 * and dispatch it.
 	 */
 	rq_fifo_clear(rq);
+
+	if (maple_async_write(rq)) {
+		/* Batches carry on from the next write in sector order */
+		struct request *next = elv_rb_latter_request(rq->q, rq);
+
+		maple_del_rq_rb(mdata, rq);
+		mdata->next_rq = next;
+		maple_charge_request(mdata, rq, 0);
+
+		if (mdata->batch_left > 0) {
+			mdata->batch_left -= blk_rq_bytes(rq);
+			if (!mdata->async_write_nr)
+				mdata->batch_left = 0;
+		}
+	}
+
+	mdata->dispatched_bytes[mdata->display_on] += blk_rq_bytes(rq);
 	elv_dispatch_add_tail(rq->q, rq);
 
 	if (rq_data_dir(rq)) {
@@ -207,13 +384,28 @@ maple_dispatch_requests(struct request_queue *q, int force)
 	struct maple_data *mdata = maple_get_data(q);
 	struct request *rq = NULL;
 	int data_dir = READ;
+	bool hold = false;
+
+	/* Hold async writes back until a batch can be opened while asleep */
+	if (!mdata->display_on && mdata->batch_left <= 0 &&
+	    mdata->async_write_nr)
+		hold = !maple_start_batch(q, mdata, force);
+
+	/* Small sync reads first, unless writes are starved */
+	if (mdata->starved < mdata->writes_starved &&
+	    !list_empty(&mdata->fast_list))
+		rq = rq_entry_fifo(mdata->fast_list.next);
+
+	/* Then the open batch, in sector order */
+	if (!rq && !mdata->display_on && mdata->batch_left > 0)
+		rq = maple_batch_request(mdata);
 
 	/*
 	 * Retrieve any expired request after a batch of
 	 * sequential requests.
 	 */
-	if (mdata->batched >= mdata->fifo_batch)
-		rq = maple_choose_expired_request(mdata);
+	if (!rq && mdata->batched >= mdata->fifo_batch)
+		rq = maple_choose_expired_request(mdata, hold);
 
 	/* Retrieve request */
 	if (!rq) {
@@ -224,9 +416,12 @@ maple_dispatch_requests(struct request_queue *q, int force)
 		else if (!mdata->display_on && mdata->starved >= 1)
 			data_dir = WRITE;
 
-		rq = maple_choose_request(mdata, data_dir);
-		if (!rq)
+		rq = maple_choose_request(mdata, data_dir, hold);
+		if (!rq) {
+			if (hold)
+				maple_delay_batch(q, mdata);
 			return 0;
+		}
 	}
 
 	/* Dispatch request */
@@ -238,11 +433,7 @@ maple_dispatch_requests(struct request_queue *q, int force)
 static struct request *
 maple_former_request(struct request_queue *q, struct request *rq)
 {
-	struct maple_data *mdata = maple_get_data(q);
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
-
-	if (rq->queuelist.prev == &mdata->fifo_list[sync][data_dir])
+	if (rq->queuelist.prev == RQ_LIST(rq))
 		return NULL;
 
 	/* Return former request */
@@ -252,11 +443,7 @@ maple_former_request(struct request_queue *q, struct request *rq)
 static struct request *
 maple_latter_request(struct request_queue *q, struct request *rq)
 {
-	struct maple_data *mdata = maple_get_data(q);
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
-
-	if (rq->queuelist.next == &mdata->fifo_list[sync][data_dir])
+	if (rq->queuelist.next == RQ_LIST(rq))
 		return NULL;
 
 	/* Return latter request */
@@ -268,14 +455,21 @@ static int fb_notifier_callback(struct notifier_block *self,
 {
 	struct maple_data *mdata = container_of(self,
 						struct maple_data, fb_notifier);
+	struct request_queue *q = mdata->queue;
 	struct fb_event *evdata = data;
+	unsigned long flags;
 	int *blank;
 
 	if (evdata && evdata->data && event == FB_EVENT_BLANK) {
 		blank = evdata->data;
+		spin_lock_irqsave(q->queue_lock, flags);
 		switch (*blank) {
 		case FB_BLANK_UNBLANK:
 			mdata->display_on = 1;
+			/* Let go of writes held for a batch */
+			mdata->batch_left = 0;
+			if (mdata->async_write_nr)
+				blk_run_queue_async(q);
 			break;
 		case FB_BLANK_POWERDOWN:
 		case FB_BLANK_HSYNC_SUSPEND:
@@ -284,6 +478,7 @@ static int fb_notifier_callback(struct notifier_block *self,
 			mdata->display_on = 0;
 			break;
 		}
+		spin_unlock_irqrestore(q->queue_lock, flags);
 	}
 
 	return 0;
@@ -299,21 +494,20 @@ static int maple_init_queue(struct request_queue *q, struct elevator_type *e)
 		return -ENOMEM;
 
 	/* Allocate structure */
-	mdata = kmalloc_node(sizeof(*mdata), GFP_KERNEL, q->node);
+	mdata = kzalloc_node(sizeof(*mdata), GFP_KERNEL, q->node);
 	if (!mdata) {
 		kobject_put(&eq->kobj);
 		return -ENOMEM;
 	}
 	eq->elevator_data = mdata;
 
-	mdata->fb_notifier.notifier_call = fb_notifier_callback;
-	fb_register_client(&mdata->fb_notifier);
-
 	/* Initialize fifo lists */
 	INIT_LIST_HEAD(&mdata->fifo_list[SYNC][READ]);
 	INIT_LIST_HEAD(&mdata->fifo_list[SYNC][WRITE]);
 	INIT_LIST_HEAD(&mdata->fifo_list[ASYNC][READ]);
 	INIT_LIST_HEAD(&mdata->fifo_list[ASYNC][WRITE]);
+	INIT_LIST_HEAD(&mdata->fast_list);
+	mdata->sort_list = RB_ROOT;
 
 	/* Initialize data */
 	mdata->batched = 0;
@@ -324,10 +518,17 @@ static int maple_init_queue(struct request_queue *q, struct elevator_type *e)
 	mdata->fifo_batch = fifo_batch;
 	mdata->writes_starved = writes_starved;
 	mdata->sleep_latency_multiple = sleep_latency_multiple;
+	mdata->batch_budget_kb = batch_budget_kb;
+	mdata->small_read_kb = small_read_kb;
+	mdata->display_on = 1;
+	mdata->queue = q;
 
 	spin_lock_irq(q->queue_lock);
 	q->elevator = eq;
 	spin_unlock_irq(q->queue_lock);
+
+	mdata->fb_notifier.notifier_call = fb_notifier_callback;
+	fb_register_client(&mdata->fb_notifier);
 	return 0;
 }
 
@@ -380,6 +581,8 @@ SHOW_FUNCTION(maple_async_write_expire_show, mdata->fifo_expire[ASYNC][WRITE], 1
 SHOW_FUNCTION(maple_fifo_batch_show, mdata->fifo_batch, 0);
 SHOW_FUNCTION(maple_writes_starved_show, mdata->writes_starved, 0);
 SHOW_FUNCTION(maple_sleep_latency_multiple_show, mdata->sleep_latency_multiple, 0);
+SHOW_FUNCTION(maple_batch_budget_kb_show, mdata->batch_budget_kb, 0);
+SHOW_FUNCTION(maple_small_read_kb_show, mdata->small_read_kb, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -405,8 +608,24 @@ STORE_FUNCTION(maple_async_write_expire_store, &mdata->fifo_expire[ASYNC][WRITE]
 STORE_FUNCTION(maple_fifo_batch_store, &mdata->fifo_batch, 1, INT_MAX, 0);
 STORE_FUNCTION(maple_writes_starved_store, &mdata->writes_starved, 1, INT_MAX, 0);
 STORE_FUNCTION(maple_sleep_latency_multiple_store, &mdata->sleep_latency_multiple, 1, INT_MAX, 0);
+STORE_FUNCTION(maple_batch_budget_kb_store, &mdata->batch_budget_kb, 4, INT_MAX >> 10, 0);
+STORE_FUNCTION(maple_small_read_kb_store, &mdata->small_read_kb, 0, INT_MAX >> 10, 0);
 #undef STORE_FUNCTION
 
+#define STAT_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct maple_data *mdata = e->elevator_data;			\
+	return snprintf(page, PAGE_SIZE, "%llu\n",			\
+			(unsigned long long)(__VAR));			\
+}
+STAT_FUNCTION(maple_awake_dispatched_kb_show, mdata->dispatched_bytes[1] >> 10);
+STAT_FUNCTION(maple_awake_merged_kb_show, mdata->merged_bytes[1] >> 10);
+STAT_FUNCTION(maple_asleep_dispatched_kb_show, mdata->dispatched_bytes[0] >> 10);
+STAT_FUNCTION(maple_asleep_merged_kb_show, mdata->merged_bytes[0] >> 10);
+STAT_FUNCTION(maple_asleep_batches_show, mdata->batches);
+#undef STAT_FUNCTION
+
 #define DD_ATTR(name) \
 	__ATTR(name, 0644, maple_##name##_show, \
 				      maple_##name##_store)
@@ -419,12 +638,21 @@ static struct elv_fs_entry maple_attrs[] = {
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
 	DD_ATTR(sleep_latency_multiple),
+	DD_ATTR(batch_budget_kb),
+	DD_ATTR(small_read_kb),
+	__ATTR(awake_dispatched_kb, 0444, maple_awake_dispatched_kb_show, NULL),
+	__ATTR(awake_merged_kb, 0444, maple_awake_merged_kb_show, NULL),
+	__ATTR(asleep_dispatched_kb, 0444, maple_asleep_dispatched_kb_show, NULL),
+	__ATTR(asleep_merged_kb, 0444, maple_asleep_merged_kb_show, NULL),
+	__ATTR(asleep_batches, 0444, maple_asleep_batches_show, NULL),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_maple = {
 	.ops = {
 		.elevator_merge_req_fn		= maple_merged_requests,
+		.elevator_merged_fn		= maple_merged_request,
+		.elevator_bio_merged_fn		= maple_bio_merged,
 		.elevator_dispatch_fn		= maple_dispatch_requests,
 		.elevator_add_req_fn		= maple_add_request,
 		.elevator_former_req_fn		= maple_former_request,
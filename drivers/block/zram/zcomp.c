@@ -40,6 +40,7 @@ static void zcomp_strm_free(struct zcomp_strm *zstrm)
 	if (!IS_ERR_OR_NULL(zstrm->tfm))
 		crypto_free_comp(zstrm->tfm);
 	free_pages((unsigned long)zstrm->buffer, 1);
+	free_pages((unsigned long)zstrm->stage, ZCOMP_STAGE_ORDER);
 	kfree(zstrm);
 }
 
@@ -59,7 +60,8 @@ static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
 	 * case when compressed size is larger than the original one
 	 */
 	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (IS_ERR_OR_NULL(zstrm->tfm) || !zstrm->buffer) {
+	zstrm->stage = (void *)__get_free_pages(GFP_KERNEL, ZCOMP_STAGE_ORDER);
+	if (IS_ERR_OR_NULL(zstrm->tfm) || !zstrm->buffer || !zstrm->stage) {
 		zcomp_strm_free(zstrm);
 		zstrm = NULL;
 	}
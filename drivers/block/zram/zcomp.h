@@ -10,9 +10,15 @@
 #ifndef _ZCOMP_H_
 #define _ZCOMP_H_
 
+/* Room for compressed pages waiting for their handles, see zram_write_batch() */
+#define ZCOMP_STAGE_ORDER	2
+#define ZCOMP_STAGE_SIZE	(PAGE_SIZE << ZCOMP_STAGE_ORDER)
+
 struct zcomp_strm {
 	/* compression/decompression buffer */
 	void *buffer;
+	/* compressed output staged while the stream is held */
+	void *stage;
 	struct crypto_comp *tfm;
 };
 
@@ -0,0 +1,286 @@
+/*
+ * Content based deduplication for zram
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/err.h>
+#include <crypto/hash.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket per 1K pages, at least 1K buckets */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 10)
+#define ZRAM_HASH_SIZE_MAX	(1UL << 31)
+
+static inline struct zram_hash *zram_dedup_hash(struct zram_meta *meta,
+				u32 checksum)
+{
+	return &meta->hash[checksum % meta->hash_size];
+}
+
+/*
+ * "crc32" resolves to the ARMv8 CRC32 instruction implementation when
+ * crc32-arm64 is available and to the generic table driven one otherwise.
+ */
+u32 zram_dedup_checksum(struct zram_meta *meta, unsigned char *mem)
+{
+	SHASH_DESC_ON_STACK(desc, meta->tfm);
+	u32 crc = 0;
+
+	desc->tfm = meta->tfm;
+	desc->flags = 0;
+	crypto_shash_digest(desc, mem, PAGE_SIZE, (u8 *)&crc);
+
+	return crc;
+}
+
+void zram_dedup_insert(struct zram_meta *meta, struct zram_entry *new,
+				u32 checksum)
+{
+	struct zram_hash *hash;
+	struct rb_root *rb_root;
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	new->checksum = checksum;
+	hash = zram_dedup_hash(meta, checksum);
+	rb_root = &hash->rb_root;
+
+	spin_lock(&hash->lock);
+	rb_node = &rb_root->rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else if (checksum > entry->checksum)
+			rb_node = &parent->rb_right;
+		else
+			rb_node = &parent->rb_left;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Take @entry out of the index if the caller holds the only reference,
+ * e.g. because its object is about to be re-encoded. Returns false if
+ * the entry is shared.
+ */
+bool zram_dedup_unlink(struct zram_meta *meta, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_dedup_hash(meta, entry->checksum);
+
+	spin_lock(&hash->lock);
+	if (entry->refcount != 1) {
+		spin_unlock(&hash->lock);
+		return false;
+	}
+
+	if (!RB_EMPTY_NODE(&entry->rb_node)) {
+		rb_erase(&entry->rb_node, &hash->rb_root);
+		RB_CLEAR_NODE(&entry->rb_node);
+	}
+	spin_unlock(&hash->lock);
+
+	return true;
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+				unsigned char *mem)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zcomp_strm *zstrm;
+	unsigned char *cmem;
+	bool match = false;
+
+	cmem = zs_map_object(meta->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE) {
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	} else {
+		zstrm = zcomp_stream_get(zram->comp);
+		if (!zcomp_decompress(zstrm, cmem, entry->len, zstrm->buffer))
+			match = !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+		zcomp_stream_put(zram->comp);
+	}
+	zs_unmap_object(meta->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Compare @mem against every entry carrying the same checksum as @entry,
+ * starting with the left-most one. Called with hash->lock held, which is
+ * dropped. The reference held on the entry being compared keeps it in
+ * the tree, so its neighbours can be looked up once the lock is retaken.
+ */
+static struct zram_entry *__zram_dedup_find(struct zram *zram,
+				struct zram_hash *hash, unsigned char *mem,
+				struct zram_entry *entry)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zram_entry *tmp, *prev = NULL;
+	struct rb_node *rb_node;
+
+	/* find left-most entry with same checksum */
+	while ((rb_node = rb_prev(&entry->rb_node))) {
+		tmp = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (tmp->checksum != entry->checksum)
+			break;
+		entry = tmp;
+	}
+
+again:
+	entry->refcount++;
+	spin_unlock(&hash->lock);
+
+	if (prev)
+		zram_entry_put(meta, prev);
+
+	if (zram_dedup_match(zram, entry, mem))
+		return entry;
+
+	spin_lock(&hash->lock);
+	rb_node = rb_next(&entry->rb_node);
+	if (rb_node) {
+		tmp = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (tmp->checksum == entry->checksum) {
+			prev = entry;
+			entry = tmp;
+			goto again;
+		}
+	}
+	spin_unlock(&hash->lock);
+
+	zram_entry_put(meta, entry);
+	return NULL;
+}
+
+/*
+ * Look for a stored object with the same content as @mem. On success a
+ * reference to the entry is returned to the caller.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, unsigned char *mem,
+				u32 checksum)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zram_hash *hash = zram_dedup_hash(meta, checksum);
+	struct zram_entry *entry;
+	struct rb_node *rb_node;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			return __zram_dedup_find(zram, hash, mem, entry);
+
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+struct zram_entry *zram_entry_alloc(struct zram_meta *meta,
+				unsigned long handle, unsigned int len,
+				gfp_t flags)
+{
+	struct zram_entry *entry;
+
+	entry = kzalloc(sizeof(*entry),
+			flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (!entry)
+		return NULL;
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->handle = handle;
+	entry->len = len;
+	entry->refcount = 1;
+
+	return entry;
+}
+
+/*
+ * Drop a reference to @entry. Returns true if it was the last one, in
+ * which case the compressed object is freed as well.
+ */
+bool zram_entry_put(struct zram_meta *meta, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_dedup_hash(meta, entry->checksum);
+
+	spin_lock(&hash->lock);
+	entry->refcount--;
+	if (entry->refcount) {
+		spin_unlock(&hash->lock);
+		return false;
+	}
+
+	if (!RB_EMPTY_NODE(&entry->rb_node))
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	zs_free(meta->mem_pool, entry->handle);
+	kfree(entry);
+
+	return true;
+}
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages)
+{
+	int i;
+	struct zram_hash *hash;
+
+	meta->tfm = crypto_alloc_shash("crc32", 0, 0);
+	if (IS_ERR(meta->tfm)) {
+		pr_err("Cannot allocate crc32 for deduplication\n");
+		meta->tfm = NULL;
+		return -ENOMEM;
+	}
+
+	meta->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	meta->hash_size = min_t(size_t, ZRAM_HASH_SIZE_MAX, meta->hash_size);
+	meta->hash_size = max_t(size_t, ZRAM_HASH_SIZE_MIN, meta->hash_size);
+	meta->hash = vzalloc(meta->hash_size * sizeof(struct zram_hash));
+	if (!meta->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		crypto_free_shash(meta->tfm);
+		meta->tfm = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < meta->hash_size; i++) {
+		hash = &meta->hash[i];
+		spin_lock_init(&hash->lock);
+		hash->rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram_meta *meta)
+{
+	vfree(meta->hash);
+	meta->hash = NULL;
+	meta->hash_size = 0;
+
+	if (meta->tfm)
+		crypto_free_shash(meta->tfm);
+	meta->tfm = NULL;
+}
@@ -0,0 +1,81 @@
+/*
+ * Content based deduplication for zram
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+struct zram;
+struct zram_meta;
+
+/*
+ * With dedup, table[index].handle points to one of these instead of
+ * holding the zsmalloc handle itself, so identical pages can share
+ * one compressed object.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 len;
+	u32 checksum;
+	unsigned long refcount;
+	unsigned long handle;
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+#ifdef CONFIG_ZRAM_DEDUP
+u32 zram_dedup_checksum(struct zram_meta *meta, unsigned char *mem);
+void zram_dedup_insert(struct zram_meta *meta, struct zram_entry *new,
+				u32 checksum);
+bool zram_dedup_unlink(struct zram_meta *meta, struct zram_entry *entry);
+struct zram_entry *zram_dedup_find(struct zram *zram, unsigned char *mem,
+				u32 checksum);
+
+struct zram_entry *zram_entry_alloc(struct zram_meta *meta,
+				unsigned long handle, unsigned int len,
+				gfp_t flags);
+bool zram_entry_put(struct zram_meta *meta, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages);
+void zram_dedup_fini(struct zram_meta *meta);
+#else
+static inline u32 zram_dedup_checksum(struct zram_meta *meta,
+				unsigned char *mem) { return 0; }
+static inline void zram_dedup_insert(struct zram_meta *meta,
+				struct zram_entry *new, u32 checksum) { }
+static inline bool zram_dedup_unlink(struct zram_meta *meta,
+				struct zram_entry *entry) { return false; }
+static inline struct zram_entry *zram_dedup_find(struct zram *zram,
+				unsigned char *mem, u32 checksum)
+{
+	return NULL;
+}
+
+static inline struct zram_entry *zram_entry_alloc(struct zram_meta *meta,
+				unsigned long handle, unsigned int len,
+				gfp_t flags)
+{
+	return NULL;
+}
+static inline bool zram_entry_put(struct zram_meta *meta,
+				struct zram_entry *entry) { return false; }
+
+static inline int zram_dedup_init(struct zram_meta *meta, size_t num_pages)
+{
+	return 0;
+}
+static inline void zram_dedup_fini(struct zram_meta *meta) { }
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
@@ -32,6 +32,8 @@
 #include <linux/idr.h>
 #include <linux/sysfs.h>
 #include <linux/ratelimit.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 
 #include "zram_drv.h"
 
@@ -104,6 +106,26 @@ static void zram_set_obj_size(struct zram_meta *meta,
 	meta->table[index].value = (flags << ZRAM_FLAG_SHIFT) | size;
 }
 
+static inline bool zram_allocated(struct zram_meta *meta, u32 index)
+{
+	return zram_get_obj_size(meta, index) ||
+			zram_test_flag(meta, index, ZRAM_SAME) ||
+			zram_test_flag(meta, index, ZRAM_WB);
+}
+
+/*
+ * zsmalloc handle of a slot that is neither same filled nor written
+ * back. With dedup the table holds a zram_entry instead.
+ */
+static inline unsigned long zram_get_handle(struct zram_meta *meta, u32 index)
+{
+	unsigned long handle = meta->table[index].handle;
+
+	if (zram_dedup_enabled(meta))
+		return ((struct zram_entry *)handle)->handle;
+	return handle;
+}
+
 static inline bool is_partial_io(struct bio_vec *bvec)
 {
 	return bvec->bv_len != PAGE_SIZE;
@@ -324,6 +346,43 @@ static ssize_t comp_algorithm_store(struct device *dev,
 	return len;
 }
 
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", (int)val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtoint(buf, 10, &val) || (val != 0 && val != 1))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+	return len;
+}
+
+static DEVICE_ATTR_RW(use_dedup);
+#endif
+
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
@@ -351,11 +410,13 @@ static ssize_t io_stat_show(struct device *dev,
 
 	down_read(&zram->init_lock);
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8llu\n",
+			"%8llu %8llu %8llu %8llu %8llu %8llu\n",
 			(u64)atomic64_read(&zram->stats.failed_reads),
 			(u64)atomic64_read(&zram->stats.failed_writes),
 			(u64)atomic64_read(&zram->stats.invalid_io),
-			(u64)atomic64_read(&zram->stats.notify_free));
+			(u64)atomic64_read(&zram->stats.notify_free),
+			(u64)atomic64_read(&zram->stats.batch_writes),
+			(u64)atomic64_read(&zram->stats.batch_pages));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -382,14 +443,16 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu\n",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
 			zram->limit_pages << PAGE_SHIFT,
 			max_used << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.same_pages),
-			pool_stats.pages_compacted);
+			pool_stats.pages_compacted,
+			(u64)atomic64_read(&zram->stats.dup_data_size),
+			(u64)atomic64_read(&zram->stats.meta_data_size));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -398,15 +461,28 @@ static ssize_t mm_stat_show(struct device *dev,
 static ssize_t debug_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
-	int version = 1;
+	int version = 2;
 	struct zram *zram = dev_to_zram(dev);
 	ssize_t ret;
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+	int i;
+#endif
 
 	down_read(&zram->init_lock);
 	ret = scnprintf(buf, PAGE_SIZE,
 			"version: %d\n%8llu\n",
 			version,
 			(u64)atomic64_read(&zram->stats.writestall));
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+			"%8d %8d\n",
+			atomic_read(&zram->stats.async_depth),
+			atomic_read(&zram->stats.async_max_depth));
+	for (i = 0; i < ZRAM_ASYNC_LAT_BUCKETS; i++)
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "%8llu ",
+			(u64)atomic64_read(&zram->stats.async_lat[i]));
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "\n");
+#endif
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -416,6 +492,797 @@ static DEVICE_ATTR_RO(io_stat);
 static DEVICE_ATTR_RO(mm_stat);
 static DEVICE_ATTR_RO(debug_stat);
 
+static void zram_free_page(struct zram *zram, size_t index);
+static int __zram_decompress_page(struct zram *zram, char *mem, u32 index);
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index);
+
+#if defined(CONFIG_ZRAM_WRITEBACK) || defined(CONFIG_ZRAM_RECOMPRESS)
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages;
+	unsigned long index;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		/*
+		 * Do not mark ZRAM_UNDER_WB slot as ZRAM_IDLE to close race.
+		 * See the comment in writeback_store and
+		 * zram_recompress_slot.
+		 */
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (zram_allocated(meta, index) &&
+				!zram_test_flag(meta, index, ZRAM_UNDER_WB))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		cond_resched();
+	}
+
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static DEVICE_ATTR_WO(idle);
+#endif
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+#define FOUR_K(x) ((x) * (1 << (PAGE_SHIFT - 12)))
+
+static inline bool zram_wb_enabled(struct zram *zram)
+{
+	return zram->backing_dev;
+}
+
+static void reset_bdev(struct zram *zram)
+{
+	struct block_device *bdev;
+
+	if (!zram_wb_enabled(zram))
+		return;
+
+	bdev = zram->bdev;
+	if (zram->old_block_size)
+		set_blocksize(bdev, zram->old_block_size);
+	blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
+	/* hope filp_close flush all of IO */
+	filp_close(zram->backing_dev, NULL);
+	zram->backing_dev = NULL;
+	zram->old_block_size = 0;
+	zram->bdev = NULL;
+
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *file;
+	char *p;
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	file = zram->backing_dev;
+	if (!file) {
+		memcpy(buf, "none\n", 5);
+		up_read(&zram->init_lock);
+		return 5;
+	}
+
+	p = d_path(&file->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char *file_name;
+	size_t sz;
+	struct file *backing_dev = NULL;
+	struct inode *inode;
+	struct address_space *mapping;
+	unsigned int bitmap_sz, old_block_size = 0;
+	unsigned long nr_pages, *bitmap = NULL;
+	struct block_device *bdev = NULL;
+	int err;
+	struct zram *zram = dev_to_zram(dev);
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	backing_dev = filp_open(file_name, O_RDWR|O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		backing_dev = NULL;
+		goto out;
+	}
+
+	mapping = backing_dev->f_mapping;
+	inode = mapping->host;
+
+	/* Support only block device in this moment */
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0) {
+		bdev = NULL;
+		goto out;
+	}
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap_sz = BITS_TO_LONGS(nr_pages) * sizeof(long);
+	bitmap = vzalloc(bitmap_sz);
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	old_block_size = block_size(bdev);
+	err = set_blocksize(bdev, PAGE_SIZE);
+	if (err)
+		goto out;
+
+	reset_bdev(zram);
+
+	zram->old_block_size = old_block_size;
+	zram->bdev = bdev;
+	zram->backing_dev = backing_dev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+
+	return len;
+out:
+	vfree(bitmap);
+
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+
+	if (backing_dev)
+		filp_close(backing_dev, NULL);
+
+	up_write(&zram->init_lock);
+
+	kfree(file_name);
+
+	return err;
+}
+
+static unsigned long alloc_block_bdev(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+retry:
+	/* skip 0 bit to confuse zram.handle = 0 */
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx == zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic64_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	int was_set;
+
+	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
+	WARN_ON_ONCE(!was_set);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+static void zram_page_end_io(struct bio *bio, int err)
+{
+	struct page *page = bio->bi_io_vec[0].bv_page;
+
+	page_endio(page, READ, err);
+	bio_put(bio);
+}
+
+/*
+ * Returns 1 if the submission is successful.
+ */
+static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
+			unsigned long entry, struct bio *parent)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_ATOMIC, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_iter.bi_sector = entry * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, bvec->bv_page, bvec->bv_len, bvec->bv_offset)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	if (!parent)
+		bio->bi_end_io = zram_page_end_io;
+	else
+		bio_chain(bio, parent);
+
+	atomic64_inc(&zram->stats.bd_reads);
+	submit_bio(READ, bio);
+	return 1;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long entry;
+	char *mem;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+	struct zram *zram = zw->zram;
+	struct page *page;
+	struct bio *bio;
+	void *src;
+
+	zw->ret = -ENOMEM;
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		goto out;
+
+	bio->bi_iter.bi_sector = zw->entry * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		zw->ret = -EIO;
+		goto out_put;
+	}
+
+	atomic64_inc(&zram->stats.bd_reads);
+	zw->ret = submit_bio_wait(READ, bio);
+	if (!zw->ret) {
+		src = kmap_atomic(page);
+		memcpy(zw->mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	}
+out_put:
+	bio_put(bio);
+out:
+	__free_page(page);
+}
+
+/*
+ * Block layer want one ->make_request_fn to be active at a time
+ * so if we wait for a bio submitted from the same context we would
+ * deadlock. To avoid it, the read is issued from worker thread context.
+ * The caller must be able to sleep.
+ */
+static int read_from_bdev_sync(struct zram *zram, char *mem,
+				unsigned long entry)
+{
+	struct zram_work work;
+
+	work.zram = zram;
+	work.entry = entry;
+	work.mem = mem;
+	work.ret = 0;
+
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+
+	return work.ret;
+}
+
+static int write_to_bdev(struct zram *zram, struct page *page,
+			unsigned long entry)
+{
+	struct bio bio;
+	struct bio_vec bio_vec;
+
+	bio_init(&bio);
+	bio.bi_io_vec = &bio_vec;
+	bio.bi_max_vecs = 1;
+	bio.bi_bdev = zram->bdev;
+	bio.bi_iter.bi_sector = entry * (PAGE_SIZE >> SECTOR_SHIFT);
+	if (!bio_add_page(&bio, page, PAGE_SIZE, 0))
+		return -EIO;
+
+	return submit_bio_wait(WRITE, &bio);
+}
+
+#define HUGE_WRITEBACK 0x1
+#define IDLE_WRITEBACK 0x2
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+	unsigned long blk_idx = 0;
+	struct page *page;
+	void *mem;
+	ssize_t ret = len;
+	int mode;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_WRITEBACK;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_WRITEBACK;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram_wb_enabled(zram)) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto release_init_lock;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		int err;
+
+		if (!blk_idx) {
+			blk_idx = alloc_block_bdev(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (!zram_allocated(meta, index))
+			goto next;
+
+		if (zram_test_flag(meta, index, ZRAM_WB) ||
+				zram_test_flag(meta, index, ZRAM_SAME) ||
+				zram_test_flag(meta, index, ZRAM_UNDER_WB))
+			goto next;
+
+		if ((mode & IDLE_WRITEBACK &&
+			  !zram_test_flag(meta, index, ZRAM_IDLE)) ||
+		    (mode & HUGE_WRITEBACK &&
+			  !zram_test_flag(meta, index, ZRAM_HUGE)))
+			goto next;
+		/*
+		 * Clearing ZRAM_UNDER_WB is duty of caller.
+		 * IOW, zram_free_page never clear it.
+		 */
+		zram_set_flag(meta, index, ZRAM_UNDER_WB);
+		/* Need for hugepage writeback racing */
+		zram_set_flag(meta, index, ZRAM_IDLE);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+		mem = kmap(page);
+		err = zram_decompress_page(zram, mem, index);
+		kunmap(page);
+		if (!err)
+			err = write_to_bdev(zram, page, blk_idx);
+
+		if (err) {
+			bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_clear_flag(meta, index, ZRAM_IDLE);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			/* Return the last IO error, if any */
+			ret = err;
+			continue;
+		}
+
+		atomic64_inc(&zram->stats.bd_writes);
+		/*
+		 * We released the slot lock so need to check if the slot was
+		 * changed. If there is freeing for the slot, we can catch it
+		 * easily by zram_allocated.
+		 * A subtle case is the slot is freed/reallocated/marked as
+		 * ZRAM_IDLE again. To close the race, idle_store doesn't
+		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+		 * Thus, we could close the race by checking ZRAM_IDLE bit.
+		 */
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (!zram_allocated(meta, index) ||
+			  !zram_test_flag(meta, index, ZRAM_IDLE)) {
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_clear_flag(meta, index, ZRAM_IDLE);
+			goto next;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+		zram_set_flag(meta, index, ZRAM_WB);
+		zram_set_element(meta, index, blk_idx);
+		blk_idx = 0;
+		atomic64_inc(&zram->stats.pages_stored);
+next:
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		cond_resched();
+	}
+
+	if (blk_idx)
+		free_block_bdev(zram, blk_idx);
+	__free_page(page);
+release_init_lock:
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+		"%8llu %8llu %8llu\n",
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_count)),
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_reads)),
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(writeback);
+static DEVICE_ATTR_RO(bd_stat);
+#else
+static inline bool zram_wb_enabled(struct zram *zram) { return false; }
+static inline void reset_bdev(struct zram *zram) {}
+static inline void free_block_bdev(struct zram *zram, unsigned long blk_idx) {}
+
+static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
+			unsigned long entry, struct bio *parent)
+{
+	return -EIO;
+}
+
+static int read_from_bdev_sync(struct zram *zram, char *mem,
+				unsigned long entry)
+{
+	return -EIO;
+}
+#endif
+
+#ifdef CONFIG_ZRAM_RECOMPRESS
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (!zram->recomp_compressor[0])
+		sz = scnprintf(buf, PAGE_SIZE, "none\n");
+	else
+		sz = zcomp_available_show(zram->recomp_compressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	/* "none" disables recompression */
+	if (!strcmp(compressor, "none"))
+		compressor[0] = 0x00;
+	else if (!zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strlcpy(zram->recomp_compressor, compressor,
+			sizeof(zram->recomp_compressor));
+	up_write(&zram->init_lock);
+	return len;
+}
+
+#define RECOMP_IDLE 0x1
+#define RECOMP_HUGE 0x2
+
+/*
+ * Re-encode slot @index with the secondary algorithm. @mem is a PAGE_SIZE
+ * scratch buffer.
+ *
+ * Like writeback, the slot is decompressed under the slot lock and then
+ * marked ZRAM_UNDER_WB and ZRAM_IDLE so the expensive compression can run
+ * without it. Any access in between clears ZRAM_IDLE (and idle_store
+ * leaves ZRAM_UNDER_WB slots alone), so the result is only installed if
+ * the bit survived. ZRAM_UNDER_WB also keeps writeback off the slot.
+ */
+static int zram_recompress_slot(struct zram *zram, u32 index, char *mem,
+				int mode)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zram_entry *entry;
+	struct zcomp_strm *zstrm;
+	unsigned long handle, old_handle;
+	unsigned int size_old, size_new;
+	unsigned char *cmem;
+	bool was_idle;
+	int ret = 0;
+
+	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	if (!meta->table[index].handle ||
+			zram_test_flag(meta, index, ZRAM_SAME) ||
+			zram_test_flag(meta, index, ZRAM_WB) ||
+			zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+			zram_test_flag(meta, index, ZRAM_RECOMP) ||
+			zram_test_flag(meta, index, ZRAM_INCOMPRESSIBLE))
+		goto out_unlock;
+
+	was_idle = zram_test_flag(meta, index, ZRAM_IDLE);
+	if ((mode & RECOMP_IDLE && !was_idle) ||
+	    (mode & RECOMP_HUGE && !zram_test_flag(meta, index, ZRAM_HUGE)))
+		goto out_unlock;
+
+	ret = __zram_decompress_page(zram, mem, index);
+	if (ret)
+		goto out_unlock;
+
+	old_handle = meta->table[index].handle;
+	size_old = zram_get_obj_size(meta, index);
+	zram_set_flag(meta, index, ZRAM_UNDER_WB);
+	zram_set_flag(meta, index, ZRAM_IDLE);
+	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+	handle = 0;
+	zstrm = zcomp_stream_get(zram->recomp_comp);
+	ret = zcomp_compress(zstrm, mem, &size_new);
+	if (!ret && size_new < size_old && size_new <= max_zpage_size) {
+		/* we hold a compression stream, so this must not sleep */
+		handle = zs_malloc(meta->mem_pool, size_new,
+				__GFP_NOWARN |
+				__GFP_HIGHMEM |
+				__GFP_MOVABLE);
+		if (handle) {
+			cmem = zs_map_object(meta->mem_pool, handle,
+					ZS_MM_WO);
+			memcpy(cmem, zstrm->buffer, size_new);
+			zs_unmap_object(meta->mem_pool, handle);
+		} else
+			ret = -ENOMEM;
+	}
+	zcomp_stream_put(zram->recomp_comp);
+
+	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+	/* freed, rewritten or read while we were compressing */
+	if (!zram_allocated(meta, index) ||
+			!zram_test_flag(meta, index, ZRAM_IDLE) ||
+			meta->table[index].handle != old_handle) {
+		zram_clear_flag(meta, index, ZRAM_IDLE);
+		goto out_free;
+	}
+
+	if (!was_idle)
+		zram_clear_flag(meta, index, ZRAM_IDLE);
+
+	if (ret)
+		goto out_free;
+
+	/*
+	 * No gain from the secondary algorithm, don't bother with this
+	 * slot again until it is rewritten.
+	 */
+	if (!handle) {
+		zram_set_flag(meta, index, ZRAM_INCOMPRESSIBLE);
+		atomic64_inc(&zram->stats.recomp_failed);
+		goto out_unlock;
+	}
+
+	/*
+	 * A deduplicated object may be shared with other slots, so only
+	 * re-encode it when this slot is the sole user. Taking it out of
+	 * the index keeps writers from sharing it for good, now that it
+	 * no longer holds primary algorithm data.
+	 */
+	if (zram_dedup_enabled(meta)) {
+		entry = (struct zram_entry *)old_handle;
+		if (!zram_dedup_unlink(meta, entry))
+			goto out_free;
+		zs_free(meta->mem_pool, entry->handle);
+		entry->handle = handle;
+		entry->len = size_new;
+	} else {
+		zs_free(meta->mem_pool, old_handle);
+		meta->table[index].handle = handle;
+	}
+	zram_set_obj_size(meta, index, size_new);
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	zram_set_flag(meta, index, ZRAM_RECOMP);
+	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+	atomic64_sub(size_old - size_new, &zram->stats.compr_data_size);
+	atomic64_add(size_old - size_new, &zram->stats.recomp_saved);
+	atomic64_inc(&zram->stats.recomp_pages);
+	return 0;
+
+out_free:
+	if (handle)
+		zs_free(meta->mem_pool, handle);
+out_unlock:
+	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	return ret;
+}
+
+static void zram_recompress_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, recomp_work);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+	char *mem;
+	int mode;
+
+	mem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!mem)
+		return;
+
+	down_read(&zram->init_lock);
+	mode = xchg(&zram->recomp_mode, 0);
+	if (!init_done(zram) || !zram->recomp_comp || !mode)
+		goto out;
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_recompress_slot(zram, index, mem, mode);
+		cond_resched();
+	}
+out:
+	up_read(&zram->init_lock);
+	kfree(mem);
+}
+
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret = len;
+	int mode;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = RECOMP_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = RECOMP_HUGE;
+	else if (sysfs_streq(buf, "huge_idle"))
+		mode = RECOMP_IDLE | RECOMP_HUGE;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!zram->recomp_comp) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	/* the pass runs in the background, off the swap-out path */
+	zram->recomp_mode = mode;
+	queue_work(system_unbound_wq, &zram->recomp_work);
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t recomp_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.recomp_pages),
+			(u64)atomic64_read(&zram->stats.recomp_saved),
+			(u64)atomic64_read(&zram->stats.recomp_failed));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static inline struct zcomp *zram_slot_comp(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram->meta, index, ZRAM_RECOMP))
+		return zram->recomp_comp;
+	return zram->comp;
+}
+
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
+static DEVICE_ATTR_RO(recomp_stat);
+#else
+static inline struct zcomp *zram_slot_comp(struct zram *zram, u32 index)
+{
+	return zram->comp;
+}
+#endif
+
 static inline bool zram_meta_get(struct zram *zram)
 {
 	if (atomic_inc_not_zero(&zram->refcount))
@@ -425,7 +1292,8 @@ static inline bool zram_meta_get(struct zram *zram)
 
 static inline void zram_meta_put(struct zram *zram)
 {
-	atomic_dec(&zram->refcount);
+	if (atomic_dec_and_test(&zram->refcount))
+		wake_up(&zram->io_done);
 }
 
 static void zram_meta_free(struct zram_meta *meta, u64 disksize)
@@ -437,24 +1305,30 @@ static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 	for (index = 0; index < num_pages; index++) {
 		unsigned long handle = meta->table[index].handle;
 		/*
-		 * No memory is allocated for same element filled pages.
-		 * Simply clear same page flag.
+		 * No memory is allocated for same element filled pages
+		 * and written back pages live on the backing device.
 		 */
-		if (!handle || zram_test_flag(meta, index, ZRAM_SAME))
+		if (!handle || zram_test_flag(meta, index, ZRAM_SAME) ||
+				zram_test_flag(meta, index, ZRAM_WB))
 			continue;
 
-		zs_free(meta->mem_pool, handle);
+		if (zram_dedup_enabled(meta))
+			zram_entry_put(meta, (struct zram_entry *)handle);
+		else
+			zs_free(meta->mem_pool, handle);
 	}
 
+	zram_dedup_fini(meta);
 	zs_destroy_pool(meta->mem_pool);
 	vfree(meta->table);
 	kfree(meta);
 }
 
-static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize)
+static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize,
+					bool use_dedup)
 {
 	size_t num_pages;
-	struct zram_meta *meta = kmalloc(sizeof(*meta), GFP_KERNEL);
+	struct zram_meta *meta = kzalloc(sizeof(*meta), GFP_KERNEL);
 
 	if (!meta)
 		return NULL;
@@ -472,8 +1346,13 @@ static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize)
 		goto out_error;
 	}
 
+	if (use_dedup && zram_dedup_init(meta, num_pages))
+		goto out_destroy_pool;
+
 	return meta;
 
+out_destroy_pool:
+	zs_destroy_pool(meta->mem_pool);
 out_error:
 	vfree(meta->table);
 	kfree(meta);
@@ -490,6 +1369,19 @@ static void zram_free_page(struct zram *zram, size_t index)
 	struct zram_meta *meta = zram->meta;
 	unsigned long handle = meta->table[index].handle;
 
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	zram_clear_flag(meta, index, ZRAM_RECOMP);
+	zram_clear_flag(meta, index, ZRAM_INCOMPRESSIBLE);
+
+	if (zram_wb_enabled(zram) && zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		free_block_bdev(zram, meta->table[index].element);
+		zram_clear_element(meta, index);
+		atomic64_dec(&zram->stats.pages_stored);
+		return;
+	}
+
 	/*
 	 * No memory is allocated for same element filled pages.
 	 * Simply clear same page flag.
@@ -504,17 +1396,31 @@ static void zram_free_page(struct zram *zram, size_t index)
 	if (!handle)
 		return;
 
-	zs_free(meta->mem_pool, handle);
-
-	atomic64_sub(zram_get_obj_size(meta, index),
-			&zram->stats.compr_data_size);
+	if (!zram_dedup_enabled(meta)) {
+		zs_free(meta->mem_pool, handle);
+		atomic64_sub(zram_get_obj_size(meta, index),
+				&zram->stats.compr_data_size);
+	} else if (zram_entry_put(meta, (struct zram_entry *)handle)) {
+		atomic64_sub(zram_get_obj_size(meta, index),
+				&zram->stats.compr_data_size);
+		atomic64_sub(sizeof(struct zram_entry),
+				&zram->stats.meta_data_size);
+	} else {
+		/* other slots still share the object */
+		atomic64_sub(zram_get_obj_size(meta, index),
+				&zram->stats.dup_data_size);
+	}
 	atomic64_dec(&zram->stats.pages_stored);
 
 	meta->table[index].handle = 0;
 	zram_set_obj_size(meta, index, 0);
 }
 
-static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
+/*
+ * Decompress a slot that lives in the zsmalloc pool (or is same filled)
+ * into @mem. Caller should hold the slot lock.
+ */
+static int __zram_decompress_page(struct zram *zram, char *mem, u32 index)
 {
 	int ret = 0;
 	unsigned char *cmem;
@@ -522,26 +1428,49 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	unsigned long handle;
 	unsigned int size;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
 	handle = meta->table[index].handle;
 	size = zram_get_obj_size(meta, index);
 
 	if (!handle || zram_test_flag(meta, index, ZRAM_SAME)) {
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 		zram_fill_page(mem, PAGE_SIZE, meta->table[index].element);
 		return 0;
 	}
 
+	handle = zram_get_handle(meta, index);
 	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_RO);
 	if (size == PAGE_SIZE) {
 		memcpy(mem, cmem, PAGE_SIZE);
 	} else {
-		struct zcomp_strm *zstrm = zcomp_stream_get(zram->comp);
+		struct zcomp *comp = zram_slot_comp(zram, index);
+		struct zcomp_strm *zstrm = zcomp_stream_get(comp);
 
 		ret = zcomp_decompress(zstrm, cmem, size, mem);
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 	}
 	zs_unmap_object(meta->mem_pool, handle);
+
+	return ret;
+}
+
+/*
+ * Fill @mem with the uncompressed content of slot @index. Slots that
+ * were written back are read synchronously from the backing device,
+ * so the caller must be able to sleep.
+ */
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
+{
+	int ret;
+	struct zram_meta *meta = zram->meta;
+
+	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	if (zram_wb_enabled(zram) && zram_test_flag(meta, index, ZRAM_WB)) {
+		unsigned long blk_idx = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		return read_from_bdev_sync(zram, mem, blk_idx);
+	}
+
+	ret = __zram_decompress_page(zram, mem, index);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -553,8 +1482,12 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/*
+ * Returns 1 if the read was handed to the backing device and will
+ * complete asynchronously through @bio (or page_endio if @bio is NULL).
+ */
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
-			  u32 index, int offset)
+			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
 	struct page *page;
@@ -563,6 +1496,15 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	page = bvec->bv_page;
 
 	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	if (zram_wb_enabled(zram) && zram_test_flag(meta, index, ZRAM_WB) &&
+			!is_partial_io(bvec)) {
+		unsigned long blk_idx = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		return read_from_bdev_async(zram, bvec, blk_idx, bio);
+	}
+
 	if (unlikely(!meta->table[index].handle) ||
 			zram_test_flag(meta, index, ZRAM_SAME)) {
 		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
@@ -571,36 +1513,40 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	}
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
-	if (is_partial_io(bvec))
+	if (is_partial_io(bvec)) {
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+		if (!uncmem) {
+			pr_err("Unable to allocate temp memory\n");
+			return -ENOMEM;
+		}
 
-	user_mem = kmap_atomic(page);
-	if (!is_partial_io(bvec))
-		uncmem = user_mem;
-
-	if (!uncmem) {
-		pr_err("Unable to allocate temp memory\n");
-		ret = -ENOMEM;
-		goto out_cleanup;
+		ret = zram_decompress_page(zram, uncmem, index);
+		if (likely(!ret)) {
+			user_mem = kmap_atomic(page);
+			memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+					bvec->bv_len);
+			kunmap_atomic(user_mem);
+			flush_dcache_page(page);
+		}
+		kfree(uncmem);
+		return ret;
 	}
 
-	ret = zram_decompress_page(zram, uncmem, index);
+	/*
+	 * The slot may be written back while we are not holding its lock,
+	 * in which case zram_decompress_page() sleeps on the backing device,
+	 * so the page can't be mapped atomically here.
+	 */
+	user_mem = kmap(page);
+	ret = zram_decompress_page(zram, user_mem, index);
+	kunmap(page);
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret))
-		goto out_cleanup;
-
-	if (is_partial_io(bvec))
-		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
-				bvec->bv_len);
+		return ret;
 
 	flush_dcache_page(page);
-	ret = 0;
-out_cleanup:
-	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-		kfree(uncmem);
-	return ret;
+	return 0;
 }
 
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
@@ -616,6 +1562,9 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	unsigned long alloced_pages;
 	static unsigned long zram_rs_time;
 	unsigned long element;
+	struct zram_entry *entry;
+	bool dup = false;
+	u32 checksum = 0;
 
 	page = bvec->bv_page;
 	if (is_partial_io(bvec)) {
@@ -659,6 +1608,24 @@ compress_again:
 		goto out;
 	}
 
+	if (zram_dedup_enabled(meta)) {
+		checksum = zram_dedup_checksum(meta, uncmem);
+		entry = zram_dedup_find(zram, uncmem, checksum);
+		if (entry) {
+			if (user_mem)
+				kunmap_atomic(user_mem);
+			/* coming from the slow path, see below */
+			if (handle)
+				zs_free(meta->mem_pool, handle);
+
+			handle = (unsigned long)entry;
+			clen = entry->len;
+			dup = true;
+			atomic64_add(clen, &zram->stats.dup_data_size);
+			goto found_dup;
+		}
+	}
+
 	zstrm = zcomp_stream_get(zram->comp);
 	ret = zcomp_compress(zstrm, uncmem, &clen);
 	if (!is_partial_io(bvec)) {
@@ -741,6 +1708,20 @@ compress_again:
 	zstrm = NULL;
 	zs_unmap_object(meta->mem_pool, handle);
 
+	if (zram_dedup_enabled(meta)) {
+		entry = zram_entry_alloc(meta, handle, clen, GFP_NOIO);
+		if (!entry) {
+			zs_free(meta->mem_pool, handle);
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		zram_dedup_insert(meta, entry, checksum);
+		atomic64_add(sizeof(*entry), &zram->stats.meta_data_size);
+		handle = (unsigned long)entry;
+	}
+
+found_dup:
 	/*
 	 * Free memory associated with this sector
 	 * before overwriting unused sectors.
@@ -750,10 +1731,13 @@ compress_again:
 
 	meta->table[index].handle = handle;
 	zram_set_obj_size(meta, index, clen);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(meta, index, ZRAM_HUGE);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
 	/* Update stats */
-	atomic64_add(clen, &zram->stats.compr_data_size);
+	if (!dup)
+		atomic64_add(clen, &zram->stats.compr_data_size);
 	atomic64_inc(&zram->stats.pages_stored);
 out:
 	if (zstrm)
@@ -802,20 +1786,25 @@ static void zram_bio_discard(struct zram *zram, u32 index,
 	}
 }
 
+/*
+ * Returns errno if it has some problem. Otherwise return 0 or 1.
+ * Returns 0 if IO request was done synchronously
+ * Returns 1 if IO request was successfully submitted.
+ */
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
-			int offset, int rw)
+			int offset, int rw, struct bio *bio)
 {
 	int ret;
 
 	if (rw == READ) {
 		atomic64_inc(&zram->stats.num_reads);
-		ret = zram_bvec_read(zram, bvec, index, offset);
+		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 	} else {
 		atomic64_inc(&zram->stats.num_writes);
 		ret = zram_bvec_write(zram, bvec, index, offset);
 	}
 
-	if (unlikely(ret)) {
+	if (unlikely(ret < 0)) {
 		if (rw == READ)
 			atomic64_inc(&zram->stats.failed_reads);
 		else
@@ -825,12 +1814,235 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 	return ret;
 }
 
+/*
+ * Compress batch pages from @i on under @zstrm until ZCOMP_STAGE_SIZE is
+ * used up, allocate their handles with one zs_malloc_bulk() call and copy
+ * the staged output out. The last page of a chunk may be left in
+ * zstrm->buffer instead of the stage, huge pages are copied from the page
+ * itself. Returns the index of the first page not stored; *@ret is set if
+ * that page failed, a non-zero *@clen if it still needs a handle of that
+ * many bytes.
+ */
+static unsigned int zram_write_chunk(struct zram *zram,
+		struct zcomp_strm *zstrm, struct zram_batch *batch,
+		unsigned int i, unsigned int *clen, int *ret)
+{
+	struct zram_meta *meta = zram->meta;
+	unsigned int slot[ZRAM_BATCH_PAGES];
+	size_t size[ZRAM_BATCH_PAGES];
+	unsigned long handle[ZRAM_BATCH_PAGES];
+	void *obj[ZRAM_BATCH_PAGES];
+	unsigned long element, alloced_pages;
+	unsigned int used = 0;
+	int n = 0, k, nr_alloced;
+	void *src, *cmem;
+
+	for (; i < batch->nr; i++) {
+		src = kmap_atomic(batch->page[i]);
+		if (page_same_filled(src, &element)) {
+			kunmap_atomic(src);
+			batch->handle[i] = element;
+			batch->clen[i] = 0;
+			continue;
+		}
+
+		*ret = zcomp_compress(zstrm, src, clen);
+		kunmap_atomic(src);
+		if (unlikely(*ret)) {
+			pr_err("Compression failed! err=%d\n", *ret);
+			break;
+		}
+
+		slot[n] = i;
+		size[n] = *clen;
+		if (unlikely(*clen > max_zpage_size)) {
+			size[n] = PAGE_SIZE;
+			obj[n++] = NULL;
+		} else if (used + *clen <= ZCOMP_STAGE_SIZE) {
+			obj[n] = zstrm->stage + used;
+			memcpy(obj[n++], zstrm->buffer, *clen);
+			used += *clen;
+		} else {
+			/* stage is full, this page ends the chunk */
+			obj[n++] = zstrm->buffer;
+			i++;
+			break;
+		}
+	}
+
+	/* stream is held, no reclaim here, see zram_bvec_write() */
+	nr_alloced = zs_malloc_bulk(meta->mem_pool, size, handle, n,
+				__GFP_NOWARN |
+				__GFP_HIGHMEM |
+				__GFP_MOVABLE);
+	if (nr_alloced) {
+		alloced_pages = zs_get_total_pages(meta->mem_pool);
+		update_used_max(zram, alloced_pages);
+		if (zram->limit_pages && alloced_pages > zram->limit_pages) {
+			for (k = 0; k < nr_alloced; k++)
+				zs_free(meta->mem_pool, handle[k]);
+			*ret = -ENOMEM;
+			return slot[0];
+		}
+	}
+
+	for (k = 0; k < nr_alloced; k++) {
+		cmem = zs_map_object(meta->mem_pool, handle[k], ZS_MM_WO);
+		if (!obj[k]) {
+			src = kmap_atomic(batch->page[slot[k]]);
+			memcpy(cmem, src, PAGE_SIZE);
+			kunmap_atomic(src);
+		} else {
+			memcpy(cmem, obj[k], size[k]);
+		}
+		zs_unmap_object(meta->mem_pool, handle[k]);
+
+		batch->handle[slot[k]] = handle[k];
+		batch->clen[slot[k]] = size[k];
+	}
+
+	if (nr_alloced < n) {
+		/* a compression error further on is hit again later */
+		*ret = 0;
+		*clen = size[nr_alloced];
+		return slot[nr_alloced];
+	}
+	*clen = 0;
+	return i;
+}
+
+/*
+ * Store the full pages queued in @batch. One compression stream is held
+ * per chunk of pages (see zram_write_chunk()) and is only dropped when a
+ * handle can't be allocated without reclaim: that page then gets its
+ * handle with GFP_NOIO, exactly like zram_bvec_write()'s slow path, and
+ * is compressed again once the stream is retaken. The table entries are
+ * updated in a single pass at the end, under the usual per-slot lock.
+ */
+static int zram_write_batch(struct zram *zram, struct zram_batch *batch)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zcomp_strm *zstrm;
+	unsigned long handle = 0, alloced_pages;
+	unsigned int i = 0, nr_done, clen;
+	unsigned int nr_stored = 0, nr_same = 0;
+	u64 compr_size = 0;
+	static unsigned long zram_rs_time;
+	void *src, *cmem;
+	int ret = 0;
+
+	zstrm = zcomp_stream_get(zram->comp);
+	while (i < batch->nr) {
+		if (handle) {
+			/* coming from the slow path, see below */
+			src = kmap_atomic(batch->page[i]);
+			ret = zcomp_compress(zstrm, src, &clen);
+			if (unlikely(ret)) {
+				kunmap_atomic(src);
+				zs_free(meta->mem_pool, handle);
+				pr_err("Compression failed! err=%d\n", ret);
+				break;
+			}
+			if (unlikely(clen > max_zpage_size))
+				clen = PAGE_SIZE;
+
+			cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_WO);
+			memcpy(cmem, clen == PAGE_SIZE ? src : zstrm->buffer,
+					clen);
+			zs_unmap_object(meta->mem_pool, handle);
+			kunmap_atomic(src);
+
+			batch->handle[i] = handle;
+			batch->clen[i] = clen;
+			handle = 0;
+			i++;
+			continue;
+		}
+
+		i = zram_write_chunk(zram, zstrm, batch, i, &clen, &ret);
+		if (ret)
+			break;
+		if (!clen)
+			continue;
+
+		/* page i can't get a handle without reclaim */
+		zcomp_stream_put(zram->comp);
+		atomic64_inc(&zram->stats.writestall);
+		handle = zs_malloc(meta->mem_pool, clen,
+				GFP_NOIO | __GFP_HIGHMEM |
+				__GFP_MOVABLE);
+		zstrm = zcomp_stream_get(zram->comp);
+		if (!handle) {
+			if (printk_timed_ratelimit(&zram_rs_time,
+						   ALLOC_ERROR_LOG_RATE_MS))
+				pr_info("Error allocating memory for compressed page: %u, size=%u\n",
+					batch->index[i], clen);
+			ret = -ENOMEM;
+			break;
+		}
+
+		alloced_pages = zs_get_total_pages(meta->mem_pool);
+		update_used_max(zram, alloced_pages);
+		if (zram->limit_pages && alloced_pages > zram->limit_pages) {
+			zs_free(meta->mem_pool, handle);
+			ret = -ENOMEM;
+			break;
+		}
+	}
+	zcomp_stream_put(zram->comp);
+	nr_done = i;
+
+	for (i = 0; i < nr_done; i++) {
+		u32 index = batch->index[i];
+
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_free_page(zram, index);
+		if (!batch->clen[i]) {
+			zram_set_flag(meta, index, ZRAM_SAME);
+			zram_set_element(meta, index, batch->handle[i]);
+			nr_same++;
+		} else {
+			meta->table[index].handle = batch->handle[i];
+			zram_set_obj_size(meta, index, batch->clen[i]);
+			if (batch->clen[i] == PAGE_SIZE)
+				zram_set_flag(meta, index, ZRAM_HUGE);
+			compr_size += batch->clen[i];
+			nr_stored++;
+		}
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	}
+
+	/* Update stats */
+	atomic64_add(compr_size, &zram->stats.compr_data_size);
+	atomic64_add(nr_stored, &zram->stats.pages_stored);
+	atomic64_add(nr_same, &zram->stats.same_pages);
+	atomic64_add(nr_done, &zram->stats.num_writes);
+	if (nr_done) {
+		atomic64_inc(&zram->stats.batch_writes);
+		atomic64_add(nr_done, &zram->stats.batch_pages);
+	}
+
+	/*
+	 * Like zram_bvec_write(), only the page that failed counts as a
+	 * failed write. The rest of the bio is failed by the caller.
+	 */
+	if (ret) {
+		atomic64_inc(&zram->stats.num_writes);
+		atomic64_inc(&zram->stats.failed_writes);
+	}
+
+	batch->nr = 0;
+	return ret;
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio)
 {
 	int offset, rw;
 	u32 index;
 	struct bio_vec bvec;
 	struct bvec_iter iter;
+	struct zram_batch batch;
+	bool batched;
 
 	index = bio->bi_iter.bi_sector >> SECTORS_PER_PAGE_SHIFT;
 	offset = (bio->bi_iter.bi_sector &
@@ -843,9 +2055,28 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 	}
 
 	rw = bio_data_dir(bio);
+	/* the batched path doesn't look up duplicates */
+	batched = rw == WRITE && bio_segments(bio) > 1 &&
+			!zram_dedup_enabled(zram->meta);
+	batch.nr = 0;
 	bio_for_each_segment(bvec, bio, iter) {
 		int max_transfer_size = PAGE_SIZE - offset;
 
+		if (batched && !offset && !is_partial_io(&bvec)) {
+			batch.index[batch.nr] = index;
+			batch.page[batch.nr] = bvec.bv_page;
+			batch.nr++;
+			if (batch.nr == ZRAM_BATCH_PAGES &&
+					zram_write_batch(zram, &batch) < 0)
+				goto out;
+
+			update_position(&index, &offset, &bvec);
+			continue;
+		}
+
+		if (batch.nr && zram_write_batch(zram, &batch) < 0)
+			goto out;
+
 		if (bvec.bv_len > max_transfer_size) {
 			/*
 			 * zram_bvec_rw() can only make operation on a single
@@ -857,20 +2088,25 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 			bv.bv_len = max_transfer_size;
 			bv.bv_offset = bvec.bv_offset;
 
-			if (zram_bvec_rw(zram, &bv, index, offset, rw) < 0)
+			if (zram_bvec_rw(zram, &bv, index, offset, rw,
+					bio) < 0)
 				goto out;
 
 			bv.bv_len = bvec.bv_len - max_transfer_size;
 			bv.bv_offset += max_transfer_size;
-			if (zram_bvec_rw(zram, &bv, index + 1, 0, rw) < 0)
+			if (zram_bvec_rw(zram, &bv, index + 1, 0, rw, bio) < 0)
 				goto out;
 		} else
-			if (zram_bvec_rw(zram, &bvec, index, offset, rw) < 0)
+			if (zram_bvec_rw(zram, &bvec, index, offset, rw,
+					bio) < 0)
 				goto out;
 
 		update_position(&index, &offset, &bvec);
 	}
 
+	if (batch.nr && zram_write_batch(zram, &batch) < 0)
+		goto out;
+
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
@@ -879,6 +2115,231 @@ out:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+static inline bool zram_async_enabled(struct zram *zram)
+{
+	return zram->async;
+}
+
+static void zram_async_account(struct zram *zram, ktime_t queued)
+{
+	s64 us = ktime_us_delta(ktime_get(), queued);
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	if (bucket >= ZRAM_ASYNC_LAT_BUCKETS)
+		bucket = ZRAM_ASYNC_LAT_BUCKETS - 1;
+	atomic64_inc(&zram->stats.async_lat[bucket]);
+}
+
+static int zram_async_thread(void *data)
+{
+	struct zram *zram = data;
+	struct zram_async *async = zram->async;
+	struct zram_async_req *req;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible_exclusive(async->wait,
+				!list_empty(&async->list) ||
+				kthread_should_stop());
+
+		spin_lock(&async->lock);
+		req = list_first_entry_or_null(&async->list,
+				struct zram_async_req, list);
+		if (req)
+			list_del(&req->list);
+		spin_unlock(&async->lock);
+
+		if (!req)
+			continue;
+
+		__zram_make_request(zram, req->bio);
+		atomic_dec(&zram->stats.async_depth);
+		zram_async_account(zram, req->queued);
+		kfree(req);
+		/* drop the reference taken in zram_make_request */
+		zram_meta_put(zram);
+	}
+
+	return 0;
+}
+
+/*
+ * Hand a write bio over to the compression threads. Returns false if
+ * the caller should handle the bio synchronously.
+ */
+static bool zram_async_write(struct zram *zram, struct bio *bio)
+{
+	struct zram_async *async = zram->async;
+	struct zram_async_req *req;
+	int depth, max_depth;
+
+	if (!async || bio_data_dir(bio) != WRITE ||
+			unlikely(bio->bi_rw & REQ_DISCARD))
+		return false;
+
+	req = kmalloc(sizeof(*req), GFP_NOIO | __GFP_NOWARN);
+	if (!req)
+		return false;
+
+	req->bio = bio;
+	req->queued = ktime_get();
+
+	spin_lock(&async->lock);
+	list_add_tail(&req->list, &async->list);
+	spin_unlock(&async->lock);
+
+	depth = atomic_inc_return(&zram->stats.async_depth);
+	max_depth = atomic_read(&zram->stats.async_max_depth);
+	while (depth > max_depth) {
+		int old = atomic_cmpxchg(&zram->stats.async_max_depth,
+				max_depth, depth);
+		if (old == max_depth)
+			break;
+		max_depth = old;
+	}
+
+	wake_up(&async->wait);
+	return true;
+}
+
+static void zram_async_stop(struct zram *zram)
+{
+	struct zram_async *async = zram->async;
+	unsigned int i;
+
+	if (!async)
+		return;
+
+	/* device is not initialised, so nothing can be queued */
+	WARN_ON(!list_empty(&async->list));
+	for (i = 0; i < async->nr_threads; i++)
+		kthread_stop(async->threads[i]);
+
+	zram->async = NULL;
+	free_cpumask_var(async->cpus);
+	kfree(async->threads);
+	kfree(async);
+}
+
+static int zram_async_start(struct zram *zram, const struct cpumask *cpus)
+{
+	struct zram_async *async;
+	struct task_struct *task;
+	unsigned int nr = cpumask_weight(cpus);
+	int err;
+
+	async = kzalloc(sizeof(*async), GFP_KERNEL);
+	if (!async)
+		return -ENOMEM;
+
+	async->threads = kcalloc(nr, sizeof(*async->threads), GFP_KERNEL);
+	if (!async->threads || !alloc_cpumask_var(&async->cpus, GFP_KERNEL)) {
+		kfree(async->threads);
+		kfree(async);
+		return -ENOMEM;
+	}
+
+	cpumask_copy(async->cpus, cpus);
+	spin_lock_init(&async->lock);
+	INIT_LIST_HEAD(&async->list);
+	init_waitqueue_head(&async->wait);
+	zram->async = async;
+
+	while (async->nr_threads < nr) {
+		task = kthread_create(zram_async_thread, zram, "%s_async/%u",
+				zram->disk->disk_name, async->nr_threads);
+		if (IS_ERR(task)) {
+			zram_async_stop(zram);
+			return PTR_ERR(task);
+		}
+
+		async->threads[async->nr_threads++] = task;
+		/* fails if none of the cpus went online meanwhile */
+		err = set_cpus_allowed_ptr(task, async->cpus);
+		if (err) {
+			zram_async_stop(zram);
+			return err;
+		}
+		wake_up_process(task);
+	}
+
+	return 0;
+}
+
+static ssize_t async_cpus_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	if (!zram->async)
+		ret = scnprintf(buf, PAGE_SIZE, "none\n");
+	else {
+		ret = cpulist_scnprintf(buf, PAGE_SIZE - 1, zram->async->cpus);
+		buf[ret++] = '\n';
+	}
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t async_cpus_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	cpumask_var_t cpus;
+	int err;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	/* "none" or an empty list makes writes synchronous again */
+	if (sysfs_streq(buf, "none"))
+		cpumask_clear(cpus);
+	else {
+		err = cpulist_parse(buf, cpus);
+		if (err)
+			goto out;
+	}
+
+	/*
+	 * Offline cpus may be listed so the threads can use them once they
+	 * come up, but at least one of them has to be usable right now.
+	 */
+	err = -EINVAL;
+	if (!cpumask_empty(cpus) &&
+			!cpumask_intersects(cpus, cpu_active_mask))
+		goto out;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't change async mode for initialized device\n");
+		err = -EBUSY;
+		goto out_unlock;
+	}
+
+	zram_async_stop(zram);
+	err = 0;
+	if (!cpumask_empty(cpus))
+		err = zram_async_start(zram, cpus);
+out_unlock:
+	up_write(&zram->init_lock);
+out:
+	free_cpumask_var(cpus);
+	return err ? err : len;
+}
+
+static DEVICE_ATTR_RW(async_cpus);
+#else
+static inline bool zram_async_enabled(struct zram *zram) { return false; }
+static inline bool zram_async_write(struct zram *zram, struct bio *bio)
+{
+	return false;
+}
+static inline void zram_async_stop(struct zram *zram) {}
+#endif
+
 /*
  * Handler function for all zram I/O requests.
  */
@@ -895,6 +2356,10 @@ static void zram_make_request(struct request_queue *queue, struct bio *bio)
 		goto put_zram;
 	}
 
+	/* the compression thread drops the meta reference */
+	if (zram_async_write(zram, bio))
+		return;
+
 	__zram_make_request(zram, bio);
 	zram_meta_put(zram);
 	return;
@@ -928,6 +2393,13 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	struct bio_vec bv;
 
 	zram = bdev->bd_disk->private_data;
+	/*
+	 * In async mode let the caller resubmit the write as a bio, which
+	 * is then queued to the compression threads.
+	 */
+	if (rw == WRITE && zram_async_enabled(zram))
+		return -EAGAIN;
+
 	if (unlikely(!zram_meta_get(zram)))
 		goto out;
 
@@ -944,7 +2416,7 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	bv.bv_len = PAGE_SIZE;
 	bv.bv_offset = 0;
 
-	err = zram_bvec_rw(zram, &bv, index, offset, rw);
+	err = zram_bvec_rw(zram, &bv, index, offset, rw, NULL);
 put_zram:
 	zram_meta_put(zram);
 out:
@@ -955,9 +2427,19 @@ out:
 	 * of rw_page(e.g., swap_readpage, __swap_writepage) and
 	 * bio->bi_end_io does things to handle the error
 	 * (e.g., SetPageError, set_page_dirty and extra works).
+	 * If the read went to the backing device, page_endio is called
+	 * from its bio completion instead.
 	 */
-	if (err == 0)
+	switch (err) {
+	case 0:
 		page_endio(page, rw, 0);
+		break;
+	case 1:
+		err = 0;
+		break;
+	default:
+		break;
+	}
 	return err;
 }
 
@@ -965,8 +2447,13 @@ static void zram_reset_device(struct zram *zram)
 {
 	struct zram_meta *meta;
 	struct zcomp *comp;
+	struct zcomp *recomp = NULL;
 	u64 disksize;
 
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	/* the worker takes init_lock, so stop it before we do */
+	cancel_work_sync(&zram->recomp_work);
+#endif
 	down_write(&zram->init_lock);
 
 	zram->limit_pages = 0;
@@ -978,6 +2465,10 @@ static void zram_reset_device(struct zram *zram)
 
 	meta = zram->meta;
 	comp = zram->comp;
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	recomp = zram->recomp_comp;
+	zram->recomp_comp = NULL;
+#endif
 	disksize = zram->disksize;
 	/*
 	 * Refcount will go down to 0 eventually and r/w handler
@@ -997,11 +2488,14 @@ static void zram_reset_device(struct zram *zram)
 
 	set_capacity(zram->disk, 0);
 	part_stat_set_all(&zram->disk->part0, 0);
+	reset_bdev(zram);
 
 	up_write(&zram->init_lock);
 	/* I/O operation under all of CPU are done so let's free */
 	zram_meta_free(meta, disksize);
 	zcomp_destroy(comp);
+	if (recomp)
+		zcomp_destroy(recomp);
 }
 
 static ssize_t disksize_store(struct device *dev,
@@ -1009,6 +2503,7 @@ static ssize_t disksize_store(struct device *dev,
 {
 	u64 disksize;
 	struct zcomp *comp;
+	struct zcomp *recomp = NULL;
 	struct zram_meta *meta;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
@@ -1018,7 +2513,12 @@ static ssize_t disksize_store(struct device *dev,
 		return -EINVAL;
 
 	disksize = PAGE_ALIGN(disksize);
-	meta = zram_meta_alloc(zram->disk->disk_name, disksize);
+#ifdef CONFIG_ZRAM_DEDUP
+	meta = zram_meta_alloc(zram->disk->disk_name, disksize,
+				zram->use_dedup);
+#else
+	meta = zram_meta_alloc(zram->disk->disk_name, disksize, false);
+#endif
 	if (!meta)
 		return -ENOMEM;
 
@@ -1030,6 +2530,19 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	if (zram->recomp_compressor[0]) {
+		recomp = zcomp_create(zram->recomp_compressor);
+		if (IS_ERR(recomp)) {
+			pr_err("Cannot initialise %s recompressing backend\n",
+					zram->recomp_compressor);
+			err = PTR_ERR(recomp);
+			recomp = NULL;
+			goto out_destroy_comp_unlocked;
+		}
+	}
+#endif
+
 	down_write(&zram->init_lock);
 	if (init_done(zram)) {
 		pr_info("Cannot change disksize for initialized device\n");
@@ -1041,6 +2554,9 @@ static ssize_t disksize_store(struct device *dev,
 	atomic_set(&zram->refcount, 1);
 	zram->meta = meta;
 	zram->comp = comp;
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	zram->recomp_comp = recomp;
+#endif
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 	zram_revalidate_disk(zram);
@@ -1050,6 +2566,11 @@ static ssize_t disksize_store(struct device *dev,
 
 out_destroy_comp:
 	up_write(&zram->init_lock);
+	if (recomp)
+		zcomp_destroy(recomp);
+#ifdef CONFIG_ZRAM_RECOMPRESS
+out_destroy_comp_unlocked:
+#endif
 	zcomp_destroy(comp);
 out_free_meta:
 	zram_meta_free(meta, disksize);
@@ -1141,6 +2662,25 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_mem_used_max.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
+#endif
+#if defined(CONFIG_ZRAM_WRITEBACK) || defined(CONFIG_ZRAM_RECOMPRESS)
+	&dev_attr_idle.attr,
+#endif
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
+	&dev_attr_recomp_stat.attr,
+#endif
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+	&dev_attr_async_cpus.attr,
+#endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
 	&dev_attr_debug_stat.attr,
@@ -1171,6 +2711,9 @@ static int zram_add(void)
 	device_id = ret;
 
 	init_rwsem(&zram->init_lock);
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	INIT_WORK(&zram->recomp_work, zram_recompress_work);
+#endif
 
 	queue = blk_alloc_queue(GFP_KERNEL);
 	if (!queue) {
@@ -1288,6 +2831,7 @@ static int zram_remove(struct zram *zram)
 	/* Make sure all the pending I/O are finished */
 	fsync_bdev(bdev);
 	zram_reset_device(zram);
+	zram_async_stop(zram);
 	bdput(bdev);
 
 	pr_info("Removed device: %s\n", zram->disk->disk_name);
@@ -1381,6 +2925,8 @@ static int __init zram_init(void)
 {
 	int ret;
 
+	BUILD_BUG_ON(__NR_ZRAM_PAGEFLAGS > BITS_PER_LONG);
+
 	ret = class_register(&zram_control_class);
 	if (ret) {
 		pr_err("Unable to register zram-control class\n");
@@ -16,10 +16,12 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/rwsem.h>
+#include <linux/workqueue.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
 
 #include "zcomp.h"
+#include "zram_dedup.h"
 
 /*-- Configurable parameters */
 
@@ -63,10 +65,29 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_SAME = ZRAM_FLAG_SHIFT,
 	ZRAM_ACCESS,	/* page is now accessed */
+	ZRAM_WB,	/* page is stored on backing_device */
+	ZRAM_UNDER_WB,	/* page is under writeback */
+	ZRAM_HUGE,	/* Incompressible page */
+	ZRAM_IDLE,	/* not accessed page since last idle marking */
+	ZRAM_RECOMP,	/* page is compressed with the secondary algorithm */
+	ZRAM_INCOMPRESSIBLE,	/* secondary algorithm can't shrink page */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/*
+ * Max number of full pages of a write bio stored by one zram_write_batch()
+ * call. A stream is held for as many of them as fit in ZCOMP_STAGE_SIZE.
+ */
+#define ZRAM_BATCH_PAGES	16
+
+/*
+ * Async write latency histogram: bucket N counts requests which took
+ * [2^(N-1), 2^N) usecs from queueing to completion, the last bucket
+ * collects everything slower.
+ */
+#define ZRAM_ASYNC_LAT_BUCKETS	16
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
@@ -90,11 +111,68 @@ struct zram_stats {
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
 	atomic64_t writestall;		/* no. of write slow paths */
+	atomic64_t dup_data_size;	/*
+					 * compressed size of pages
+					 * duplicated
+					 */
+	atomic64_t meta_data_size;	/* size of zram_entries */
+	atomic64_t batch_writes;	/* no. of batched write passes */
+	atomic64_t batch_pages;		/* no. of pages written in batches */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages in backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes from backing device */
+#endif
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+	atomic_t async_depth;		/* no. of queued async writes */
+	atomic_t async_max_depth;	/* max. of async_depth */
+	atomic64_t async_lat[ZRAM_ASYNC_LAT_BUCKETS];
+#endif
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	atomic64_t recomp_pages;	/* no. of pages recompressed */
+	atomic64_t recomp_saved;	/* bytes saved by recompression */
+	atomic64_t recomp_failed;	/* no. of pages secondary can't shrink */
+#endif
 };
 
+/* Pending full page writes of one bio, see zram_write_batch() */
+struct zram_batch {
+	unsigned int nr;
+	u32 index[ZRAM_BATCH_PAGES];
+	struct page *page[ZRAM_BATCH_PAGES];
+	/* zsmalloc handle, or the element of a same filled page */
+	unsigned long handle[ZRAM_BATCH_PAGES];
+	/* compressed size, 0 for a same filled page */
+	unsigned int clen[ZRAM_BATCH_PAGES];
+};
+
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+/* Write bio queued to the per-device compression threads */
+struct zram_async_req {
+	struct list_head list;
+	struct bio *bio;
+	ktime_t queued;
+};
+
+struct zram_async {
+	spinlock_t lock;
+	struct list_head list;
+	wait_queue_head_t wait;
+	unsigned int nr_threads;
+	struct task_struct **threads;
+	cpumask_var_t cpus;
+};
+#endif
+
 struct zram_meta {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
+#ifdef CONFIG_ZRAM_DEDUP
+	/* content index of stored objects, NULL if dedup is off */
+	struct zram_hash *hash;
+	size_t hash_size;
+	struct crypto_shash *tfm;
+#endif
 };
 
 struct zram {
@@ -118,9 +196,39 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[CRYPTO_MAX_ALG_NAME];
+#ifdef CONFIG_ZRAM_ASYNC_WRITE
+	/* compression thread pool, NULL if writes are synchronous */
+	struct zram_async *async;
+#endif
+#ifdef CONFIG_ZRAM_RECOMPRESS
+	/* secondary algorithm used for cold slots, optional */
+	struct zcomp *recomp_comp;
+	char recomp_compressor[CRYPTO_MAX_ALG_NAME];
+	struct work_struct recomp_work;
+	int recomp_mode;
+#endif
 	/*
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by bdev->bd_mutex */
+#ifdef CONFIG_ZRAM_DEDUP
+	bool use_dedup;
+#endif
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 };
+
+static inline bool zram_dedup_enabled(struct zram_meta *meta)
+{
+#ifdef CONFIG_ZRAM_DEDUP
+	return meta->hash;
+#else
+	return false;
+#endif
+}
 #endif
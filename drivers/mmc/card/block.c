@@ -207,6 +207,7 @@ static void mmc_blk_put(struct mmc_blk_data *md)
 	if (md->usage == 0) {
 		int devidx = mmc_get_devidx(md->disk);
 		blk_cleanup_queue(md->queue.queue);
+		mmc_queue_free_tag_set(&md->queue);
 
 		__clear_bit(devidx, dev_use);
 
@@ -1526,7 +1527,7 @@ static int mmc_blk_cmdq_issue_discard_rq(struct mmc_queue *mq,
 
 	if (!mmc_can_erase(card)) {
 		err = -EOPNOTSUPP;
-		blk_end_request(req, err, blk_rq_bytes(req));
+		mmc_cmdq_end_request(req, err, blk_rq_bytes(req));
 		goto out;
 	}
 
@@ -1599,7 +1600,7 @@ out:
 		goto retry;
 	if (!err)
 		mmc_blk_reset_success(md, type);
-	blk_end_request(req, err, blk_rq_bytes(req));
+	mmc_blk_end_request(req, err, blk_rq_bytes(req));
 
 	return err ? 0 : 1;
 }
@@ -1615,7 +1616,7 @@ static int mmc_blk_cmdq_issue_secdiscard_rq(struct mmc_queue *mq,
 
 	if (!(mmc_can_secure_erase_trim(card))) {
 		err = -EOPNOTSUPP;
-		blk_end_request(req, err, blk_rq_bytes(req));
+		mmc_cmdq_end_request(req, err, blk_rq_bytes(req));
 		goto out;
 	}
 
@@ -1729,7 +1730,7 @@ out_retry:
 	if (!err)
 		mmc_blk_reset_success(md, type);
 out:
-	blk_end_request(req, err, blk_rq_bytes(req));
+	mmc_blk_end_request(req, err, blk_rq_bytes(req));
 
 	return err ? 0 : 1;
 }
@@ -1781,7 +1782,7 @@ static int mmc_blk_issue_flush(struct mmc_queue *mq, struct request *req)
 	}
 
 end_req:
-	blk_end_request_all(req, ret);
+	mmc_blk_end_request_all(req, ret);
 
 	return ret ? 0 : 1;
 }
@@ -2606,12 +2607,14 @@ static int mmc_blk_cmd_err(struct mmc_blk_data *md, struct mmc_card *card,
 		if (!brq->data.fault_injected) {
 			blocks = mmc_sd_num_wr_blocks(card);
 			if (blocks != (u32)-1)
-				ret = blk_end_request(req, 0, blocks << 9);
+				ret = mmc_blk_end_request(req, 0, blocks << 9);
 		} else
-			ret = blk_end_request(req, 0, brq->data.bytes_xfered);
+			ret = mmc_blk_end_request(req, 0,
+						  brq->data.bytes_xfered);
 	} else {
 		if (!mmc_packed_cmd(mq_rq->cmd_type))
-			ret = blk_end_request(req, 0, brq->data.bytes_xfered);
+			ret = mmc_blk_end_request(req, 0,
+						  brq->data.bytes_xfered);
 	}
 	return ret;
 }
@@ -2942,7 +2945,7 @@ static bool is_cmdq_dcmd_req(struct request_queue *q, int tag)
 	struct mmc_queue_req *mq_rq;
 	struct mmc_cmdq_req *cmdq_req;
 
-	req = blk_queue_find_tag(q, tag);
+	req = mmc_cmdq_tag_to_rq(q->queuedata, tag);
 	if (WARN_ON(!req))
 		goto out;
 	mq_rq = req->special;
@@ -2970,6 +2973,7 @@ static void mmc_blk_cmdq_reset_all(struct mmc_host *host, int err)
 	struct mmc_card *card = host->card;
 	struct mmc_cmdq_context_info *ctx_info = &host->cmdq_ctx;
 	struct request_queue *q;
+	unsigned long active_reqs;
 	int itag = 0;
 	int ret = 0;
 
@@ -2978,6 +2982,7 @@ static void mmc_blk_cmdq_reset_all(struct mmc_host *host, int err)
 
 	q = mrq->req->q;
 	WARN_ON(!test_bit(CMDQ_STATE_ERR, &ctx_info->curr_state));
+	active_reqs = ctx_info->active_reqs;
 
 	pr_debug("%s: %s: active_reqs = %lu, clk_requests = %d\n",
 			mmc_hostname(host), __func__,
@@ -3002,9 +3007,7 @@ static void mmc_blk_cmdq_reset_all(struct mmc_host *host, int err)
 		mmc_put_card(card);
 	}
 
-	spin_lock_irq(q->queue_lock);
-	blk_queue_invalidate_tags(q);
-	spin_unlock_irq(q->queue_lock);
+	mmc_cmdq_requeue(q->queuedata, active_reqs);
 }
 
 static void mmc_blk_cmdq_shutdown(struct mmc_queue *mq)
@@ -3199,12 +3202,12 @@ static void mmc_blk_cmdq_remove_task(struct mmc_host *host,
 	if (mrq->cmdq_req->cmdq_req_flags & DCMD) {
 		clear_bit(CMDQ_STATE_DCMD_ACTIVE,
 				&ctx_info->curr_state);
-		blk_end_request_all(rq, err);
+		mmc_cmdq_end_request(rq, err, blk_rq_bytes(rq));
 	} else {
 		WARN_ON(!test_and_clear_bit(mrq->cmdq_req->tag,
 					&ctx_info->data_active_reqs));
 		mmc_cmdq_post_req(host, mrq->cmdq_req->tag, err);
-		blk_end_request_all(rq, err);
+		mmc_cmdq_end_request(rq, err, blk_rq_bytes(rq));
 	}
 	mmc_host_clk_release(host);
 	mmc_put_card(host->card);
@@ -3435,11 +3438,11 @@ void mmc_blk_cmdq_complete_rq(struct request *rq)
 		mmc_cmdq_post_req(host, cmdq_req->tag, err);
 	if (cmdq_req->cmdq_req_flags & DCMD) {
 		clear_bit(CMDQ_STATE_DCMD_ACTIVE, &ctx_info->curr_state);
-		blk_end_request_all(rq, err);
+		mmc_cmdq_end_request(rq, err, blk_rq_bytes(rq));
 		goto out;
 	}
 
-	blk_end_request(rq, err, cmdq_req->data.bytes_xfered);
+	mmc_cmdq_end_request(rq, err, cmdq_req->data.bytes_xfered);
 
 out:
 
@@ -3451,7 +3454,7 @@ out:
 	}
 
 	if (!ctx_info->active_reqs)
-		wake_up_interruptible(&host->cmdq_ctx.queue_empty_wq);
+		wake_up(&host->cmdq_ctx.queue_empty_wq);
 
 	if (blk_queue_stopped(mq->queue) && !ctx_info->active_reqs)
 		complete(&mq->cmdq_shutdown_complete);
@@ -3537,7 +3540,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 				ret = mmc_blk_end_packed_req(mq_rq);
 				break;
 			} else {
-				ret = blk_end_request(req, 0,
+				ret = mmc_blk_end_request(req, 0,
 						brq->data.bytes_xfered);
 			}
 
@@ -3591,7 +3594,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			 * time, so we only reach here after trying to
 			 * read a single sector.
 			 */
-			ret = blk_end_request(req, -EIO,
+			ret = mmc_blk_end_request(req, -EIO,
 						brq->data.blksz);
 			if (!ret)
 				goto start_new_req;
@@ -3634,7 +3637,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		if (mmc_card_removed(card))
 			req->cmd_flags |= REQ_QUIET;
 		while (ret)
-			ret = blk_end_request(req, -EIO,
+			ret = mmc_blk_end_request(req, -EIO,
 					blk_rq_cur_bytes(req));
 	}
 
@@ -3642,7 +3645,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	if (rqc) {
 		if (mmc_card_removed(card)) {
 			rqc->cmd_flags |= REQ_QUIET;
-			blk_end_request_all(rqc, -EIO);
+			mmc_blk_end_request_all(rqc, -EIO);
 		} else {
 			/*
 			 * If current request is packed, it needs to put back.
@@ -3742,7 +3745,8 @@ static int mmc_blk_cmdq_issue_rq(struct mmc_queue *mq, struct request *req)
 	struct mmc_host *host = card->host;
 	unsigned int cmd_flags = req ? req->cmd_flags : 0;
 
-	mmc_get_card(card);
+	/* Shared by every task issuing on this queue when it runs blk-mq */
+	mmc_get_card_ctx(card, mq);
 
 	if (!card->host->cmdq_ctx.active_reqs && mmc_card_doing_bkops(card)) {
 		ret = mmc_cmdq_halt(card->host, true);
@@ -3821,7 +3825,7 @@ static int mmc_blk_cmdq_issue_rq(struct mmc_queue *mq, struct request *req)
 
 out:
 	if (req)
-		blk_end_request_all(req, ret);
+		mmc_cmdq_end_request(req, ret, blk_rq_bytes(req));
 	mmc_put_card(card);
 
 	return ret;
@@ -3861,7 +3865,7 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 				mmc_hostname(host));
 
 		if (req) {
-			blk_end_request_all(req, -EIO);
+			mmc_blk_end_request_all(req, -EIO);
 		}
 		ret = 0;
 		goto out;
@@ -4029,7 +4033,9 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 		md->queue.cmdq_shutdown = mmc_blk_cmdq_shutdown;
 	}
 
+	/* packing pulls more requests off a legacy queue */
 	if (mmc_card_mmc(card) && !card->cmdq_init &&
+	    !md->queue.queue->mq_ops &&
 	    (area_type == MMC_BLK_DATA_AREA_MAIN) &&
 	    (md->flags & MMC_BLK_CMD23) &&
 	    card->ext_csd.packed_event_en) {
@@ -33,6 +33,22 @@
  */
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
 
+/*
+ * Drive command queue capable cards through blk-mq, issuing requests from
+ * the submitting task instead of handing each one to the mmc-cmdqd thread.
+ */
+static bool mmc_cmdq_blk_mq = IS_ENABLED(CONFIG_MMC_BLOCK_MQ);
+module_param_named(cmdq_blk_mq, mmc_cmdq_blk_mq, bool, 0444);
+MODULE_PARM_DESC(cmdq_blk_mq, "Use blk-mq for command queue capable cards");
+
+/*
+ * Drive the other cards through blk-mq too. Without a command queue engine
+ * requests are issued and waited for one at a time by the submitting task.
+ */
+static bool mmc_blk_mq;
+module_param_named(blk_mq, mmc_blk_mq, bool, 0444);
+MODULE_PARM_DESC(blk_mq, "Use blk-mq for cards without command queueing");
+
 /*
  * Prepare a MMC request. This just filters out odd stuff.
  */
@@ -81,6 +97,25 @@ static bool mmc_check_blk_queue_start_tag(struct request_queue *q,
 	return !!ret;
 }
 
+/*
+ * A request can go to the engine when:
+ * 1. If it is a flush/discard there is no other direct command active.
+ * 2. cmdq state is unhalted.
+ * 3. cmdq state isn't in error state.
+ */
+static bool mmc_cmdq_can_issue(struct mmc_host *host, struct request *req)
+{
+	struct mmc_cmdq_context_info *ctx = &host->cmdq_ctx;
+
+	return !((req->cmd_flags & (REQ_FLUSH | REQ_DISCARD))
+		  && test_bit(CMDQ_STATE_DCMD_ACTIVE, &ctx->curr_state))
+		&& !(!host->card->part_curr && !mmc_card_suspended(host->card)
+		     && mmc_host_halt(host))
+		&& !(!host->card->part_curr && mmc_host_cq_disable(host) &&
+			!mmc_card_suspended(host->card))
+		&& !test_bit(CMDQ_STATE_ERR, &ctx->curr_state);
+}
+
 static inline void mmc_cmdq_ready_wait(struct mmc_host *host,
 					struct mmc_queue *mq)
 {
@@ -88,24 +123,12 @@ static inline void mmc_cmdq_ready_wait(struct mmc_host *host,
 	struct request_queue *q = mq->queue;
 
 	/*
-	 * Wait until all of the following conditions are true:
-	 * 1. There is a request pending in the block layer queue
-	 *    to be processed.
-	 * 2. If the peeked request is flush/discard then there shouldn't
-	 *    be any other direct command active.
-	 * 3. cmdq state should be unhalted.
-	 * 4. cmdq state shouldn't be in error state.
-	 * 5. free tag available to process the new request.
+	 * Wait until there is a request pending in the block layer queue
+	 * which can be issued, and a free tag is available to process it.
 	 */
 	wait_event(ctx->wait, kthread_should_stop()
-		|| (mmc_peek_request(mq) &&
-		!((mq->cmdq_req_peeked->cmd_flags & (REQ_FLUSH | REQ_DISCARD))
-		  && test_bit(CMDQ_STATE_DCMD_ACTIVE, &ctx->curr_state))
-		&& !(!host->card->part_curr && !mmc_card_suspended(host->card)
-		     && mmc_host_halt(host))
-		&& !(!host->card->part_curr && mmc_host_cq_disable(host) &&
-			!mmc_card_suspended(host->card))
-		&& !test_bit(CMDQ_STATE_ERR, &ctx->curr_state)
+		|| (mmc_peek_request(mq)
+		&& mmc_cmdq_can_issue(host, mq->cmdq_req_peeked)
 		&& !mmc_check_blk_queue_start_tag(q, mq->cmdq_req_peeked)));
 }
 
@@ -311,6 +334,166 @@ void mmc_cmdq_setup_queue(struct mmc_queue *mq, struct mmc_card *card)
 	blk_queue_max_segments(mq->queue, host->max_segs);
 }
 
+static struct blk_mq_ops mmc_cmdq_mq_ops;
+
+/*
+ * Set up a blk-mq queue with a single hardware queue, one slot per cmdq
+ * data tag, fed from per-cpu software queues.
+ */
+static int mmc_cmdq_init_mq(struct mmc_queue *mq, struct mmc_card *card)
+{
+	struct blk_mq_tag_set *set = &mq->tag_set;
+	int ret;
+
+	memset(set, 0, sizeof(*set));
+	set->ops = &mmc_cmdq_mq_ops;
+	set->nr_hw_queues = 1;
+	/* one slot is reserved for dcmd requests */
+	set->queue_depth = card->ext_csd.cmdq_depth - 1;
+	set->numa_node = NUMA_NO_NODE;
+	set->timeout = 120 * HZ;
+	set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_SG_MERGE |
+		     BLK_MQ_F_BLOCKING;
+
+	ret = blk_mq_alloc_tag_set(set);
+	if (ret)
+		return ret;
+
+	mq->queue = blk_mq_init_queue(set);
+	if (IS_ERR(mq->queue)) {
+		ret = PTR_ERR(mq->queue);
+		goto free_tag_set;
+	}
+
+	mq->queue->queuedata = mq;
+	mutex_init(&mq->cmdq_issue_lock);
+	mmc_cmdq_setup_queue(mq, card);
+	ret = mmc_cmdq_init(mq, card);
+	if (ret)
+		goto cleanup_queue;
+
+	/* hook for pm qos cmdq init */
+	if (card->host->cmdq_ops->init)
+		card->host->cmdq_ops->init(card->host);
+
+	return 0;
+
+cleanup_queue:
+	blk_cleanup_queue(mq->queue);
+free_tag_set:
+	blk_mq_free_tag_set(set);
+	memset(set, 0, sizeof(*set));
+	mq->queue = NULL;
+	return ret;
+}
+
+/*
+ * Issue @req, NULL to finish the request in flight, and rotate the
+ * current and previous slots the way mmc_queue_thread() does.
+ */
+static void mmc_queue_issue(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_queue_req *tmp;
+	unsigned int cmd_flags = req ? req->cmd_flags : 0;
+
+	mq->mqrq_cur->req = req;
+	mq->issue_fn(mq, req);
+
+	/* special requests are finished by issue_fn already */
+	if (cmd_flags & MMC_REQ_SPECIAL_MASK)
+		mq->mqrq_cur->req = NULL;
+
+	mq->mqrq_prev->brq.mrq.data = NULL;
+	mq->mqrq_prev->req = NULL;
+	tmp = mq->mqrq_prev;
+	mq->mqrq_prev = mq->mqrq_cur;
+	mq->mqrq_cur = tmp;
+}
+
+/*
+ * blk-mq entry point for cards without command queueing. The request is
+ * issued and completed before returning, so it runs through the same
+ * issue_fn as on mmcqd with at most one request on the host. Issuers are
+ * serialized on thread_sem, which suspend takes as it did from mmcqd.
+ */
+static int mmc_mq_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			   bool last)
+{
+	struct request_queue *q = req->q;
+	struct mmc_queue *mq = q->queuedata;
+	ktime_t start;
+
+	if (!mq) {
+		req->cmd_flags |= REQ_QUIET;
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+	if (mmc_prep_request(q, req) != BLKPREP_OK)
+		return BLK_MQ_RQ_QUEUE_ERROR;
+
+	down(&mq->thread_sem);
+	/* mmc_cleanup_queue() clears queuedata under thread_sem */
+	if (!q->queuedata) {
+		up(&mq->thread_sem);
+		req->cmd_flags |= REQ_QUIET;
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+
+	start = ktime_get();
+	blk_mq_start_request(req);
+	mmc_queue_issue(mq, req);
+	if (mq->mqrq_prev->req)
+		mmc_queue_issue(mq, NULL);
+	MMC_TRACE(mq->card->host, "%s: flags 0x%llx done in %lld us\n",
+		  __func__, (unsigned long long)req->cmd_flags,
+		  ktime_us_delta(ktime_get(), start));
+	up(&mq->thread_sem);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops mmc_mq_ops = {
+	.queue_rq	= mmc_mq_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+/*
+ * Set up a blk-mq queue with a single hardware queue for a card without
+ * command queueing. Two tags, like the current and previous slots of
+ * mmcqd: one request is issued while the next one waits its turn.
+ */
+static int mmc_init_mq(struct mmc_queue *mq, struct mmc_card *card)
+{
+	struct blk_mq_tag_set *set = &mq->tag_set;
+	int ret;
+
+	memset(set, 0, sizeof(*set));
+	set->ops = &mmc_mq_ops;
+	set->nr_hw_queues = 1;
+	set->queue_depth = ARRAY_SIZE(mq->mqrq);
+	set->numa_node = NUMA_NO_NODE;
+	set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_SG_MERGE |
+		     BLK_MQ_F_BLOCKING;
+
+	ret = blk_mq_alloc_tag_set(set);
+	if (ret)
+		return ret;
+
+	mq->queue = blk_mq_init_queue(set);
+	if (IS_ERR(mq->queue)) {
+		ret = PTR_ERR(mq->queue);
+		blk_mq_free_tag_set(set);
+		memset(set, 0, sizeof(*set));
+		mq->queue = NULL;
+	}
+
+	return ret;
+}
+
+static inline bool mmc_queue_is_mq_sync(struct request_queue *q)
+{
+	return q->mq_ops == &mmc_mq_ops;
+}
+
 /**
  * mmc_init_queue - initialise a queue structure.
  * @mq: mmc queue
@@ -335,6 +518,15 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->card = card;
 	if (card->ext_csd.cmdq_support &&
 	    (area_type == MMC_BLK_DATA_AREA_MAIN)) {
+		if (mmc_cmdq_blk_mq &&
+		    (card->host->caps2 & MMC_CAP2_CMD_QUEUE)) {
+			ret = mmc_cmdq_init_mq(mq, card);
+			if (!ret)
+				return 0;
+			pr_err("%s: %d: cmdq: blk-mq set-up failed, using mmc-cmdqd\n",
+			       mmc_hostname(card->host), ret);
+		}
+
 		mq->queue = blk_init_queue(mmc_cmdq_dispatch_req, lock);
 		if (!mq->queue)
 			return -ENOMEM;
@@ -364,7 +556,15 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 		}
 	}
 
-	mq->queue = blk_init_queue(mmc_request_fn, lock);
+	mq->queue = NULL;
+	if (mmc_blk_mq) {
+		ret = mmc_init_mq(mq, card);
+		if (ret)
+			pr_err("%s: %d: blk-mq set-up failed, using mmcqd\n",
+			       mmc_hostname(card->host), ret);
+	}
+	if (!mq->queue)
+		mq->queue = blk_init_queue(mmc_request_fn, lock);
 	if (!mq->queue)
 		return -ENOMEM;
 
@@ -480,6 +680,10 @@ success:
 	if (card->host->ops->init)
 		card->host->ops->init(card->host);
 
+	/* blk-mq issues from ->queue_rq() */
+	if (mq->queue->mq_ops)
+		return 0;
+
 	mq->thread = kthread_run(mmc_queue_thread, mq, "mmcqd/%d%s",
 		host->index, subname ? subname : "");
 
@@ -507,6 +711,7 @@ success:
 	mqrq_prev->bounce_buf = NULL;
 
 	blk_cleanup_queue(mq->queue);
+	mmc_queue_free_tag_set(mq);
 	return ret;
 }
 
@@ -520,14 +725,28 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	/* Make sure the queue isn't suspended, as that will deadlock */
 	mmc_queue_resume(mq);
 
-	/* Then terminate our worker thread */
-	kthread_stop(mq->thread);
+	/* No worker thread on blk-mq, new requests fail in ->queue_rq() */
+	if (q->mq_ops && !mmc_queue_is_mq_sync(q)) {
+		q->queuedata = NULL;
+		mq->card = NULL;
+		return;
+	}
 
-	/* Empty the queue */
-	spin_lock_irqsave(q->queue_lock, flags);
-	q->queuedata = NULL;
-	blk_start_queue(q);
-	spin_unlock_irqrestore(q->queue_lock, flags);
+	if (q->mq_ops) {
+		/* Wait for the request being issued */
+		down(&mq->thread_sem);
+		q->queuedata = NULL;
+		up(&mq->thread_sem);
+	} else {
+		/* Then terminate our worker thread */
+		kthread_stop(mq->thread);
+
+		/* Empty the queue */
+		spin_lock_irqsave(q->queue_lock, flags);
+		q->queuedata = NULL;
+		blk_start_queue(q);
+		spin_unlock_irqrestore(q->queue_lock, flags);
+	}
 
 	kfree(mqrq_cur->bounce_sg);
 	mqrq_cur->bounce_sg = NULL;
@@ -597,6 +816,13 @@ void mmc_packed_clean(struct mmc_queue *mq)
 static void mmc_cmdq_softirq_done(struct request *rq)
 {
 	struct mmc_queue *mq = rq->q->queuedata;
+
+	if (rq->q->mq_ops)
+		MMC_TRACE(mq->card->host,
+			"%s: tag %d flags 0x%llx done in %lld us\n",
+			__func__, rq->tag, (unsigned long long)rq->cmd_flags,
+			ktime_us_delta(ktime_get(),
+				       mq->mqrq_cmdq[rq->tag].issue_time));
 	mq->cmdq_complete_fn(rq);
 }
 
@@ -618,6 +844,160 @@ enum blk_eh_timer_return mmc_cmdq_rq_timed_out(struct request *req)
 	return mq->cmdq_req_timed_out(req);
 }
 
+/*
+ * blk-mq entry point for command queue cards, called from the submitting
+ * task for sync IO and from kblockd otherwise. It sleeps where mmc-cmdqd
+ * would have waited, and while the queue is suspended; issuers are
+ * serialized as they were on the thread.
+ */
+static int mmc_cmdq_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			     bool last)
+{
+	struct mmc_queue *mq = req->q->queuedata;
+	struct mmc_host *host;
+
+	if (!mq) {
+		req->cmd_flags |= REQ_QUIET;
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+	host = mq->card->host;
+
+	mutex_lock(&mq->cmdq_issue_lock);
+	wait_event(host->cmdq_ctx.wait,
+		   !test_bit(MMC_QUEUE_SUSPENDED, &mq->flags) &&
+		   mmc_cmdq_can_issue(host, req));
+
+	mq->mqrq_cmdq[req->tag].issue_time = ktime_get();
+	blk_mq_start_request(req);
+	/* Errors are recovered from the completion path, as on mmc-cmdqd */
+	mq->cmdq_issue_fn(mq, req);
+	mutex_unlock(&mq->cmdq_issue_lock);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static enum blk_eh_timer_return mmc_cmdq_mq_timed_out(struct request *req,
+						      bool reserved)
+{
+	return mmc_cmdq_rq_timed_out(req);
+}
+
+static struct blk_mq_ops mmc_cmdq_mq_ops = {
+	.queue_rq	= mmc_cmdq_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= mmc_cmdq_softirq_done,
+	.timeout	= mmc_cmdq_mq_timed_out,
+};
+
+static void mmc_cmdq_busy_iter(struct blk_mq_hw_ctx *hctx,
+			       struct request *req, void *data, bool reserved)
+{
+	*(bool *)data = true;
+}
+
+/* Whether any request is allocated, issued or not */
+static bool mmc_cmdq_mq_busy(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	bool busy = false;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_tag_busy_iter(hctx, mmc_cmdq_busy_iter, &busy);
+
+	return busy;
+}
+
+/**
+ * mmc_cmdq_end_request - complete a command queue request
+ * @req: request to complete
+ * @err: error to complete it with
+ * @nr_bytes: number of bytes transferred
+ *
+ * Counterpart of blk_end_request() that works for requests from either
+ * the legacy or the blk-mq queue.
+ */
+void mmc_cmdq_end_request(struct request *req, int err, unsigned int nr_bytes)
+{
+	if (!req->q->mq_ops) {
+		blk_end_request(req, err, nr_bytes);
+		return;
+	}
+
+	if (blk_update_request(req, err, nr_bytes)) {
+		/* Short transfer, send the remainder again */
+		blk_mq_requeue_request(req);
+		blk_mq_kick_requeue_list(req->q);
+		return;
+	}
+	__blk_mq_end_request(req, err);
+}
+
+/**
+ * mmc_blk_end_request - complete part of a request
+ * @req: request to complete
+ * @err: error to complete it with
+ * @nr_bytes: number of bytes to complete
+ *
+ * blk_end_request() for requests from either the legacy or the blk-mq
+ * queue. Returns %true while bytes of @req are left.
+ */
+bool mmc_blk_end_request(struct request *req, int err, unsigned int nr_bytes)
+{
+	if (!req->q->mq_ops)
+		return blk_end_request(req, err, nr_bytes);
+
+	if (blk_update_request(req, err, nr_bytes))
+		return true;
+	__blk_mq_end_request(req, err);
+	return false;
+}
+
+/* blk_end_request_all() for requests from either queue */
+void mmc_blk_end_request_all(struct request *req, int err)
+{
+	if (!req->q->mq_ops) {
+		blk_end_request_all(req, err);
+		return;
+	}
+
+	blk_mq_end_request(req, err);
+}
+
+struct request *mmc_cmdq_tag_to_rq(struct mmc_queue *mq, int tag)
+{
+	/* blk-mq issues flushes on their own request, the slot knows which */
+	if (mq->queue->mq_ops)
+		return mq->mqrq_cmdq[tag].req;
+
+	return blk_queue_find_tag(mq->queue, tag);
+}
+
+/**
+ * mmc_cmdq_requeue - put requests back after a reset
+ * @mq: mmc queue
+ * @tags: tags that were active when the engine was reset
+ *
+ * Legacy queues get all their busy tags invalidated, blk-mq queues get
+ * each request that was in flight requeued.
+ */
+void mmc_cmdq_requeue(struct mmc_queue *mq, unsigned long tags)
+{
+	struct request_queue *q = mq->queue;
+	int tag;
+
+	if (!q->mq_ops) {
+		spin_lock_irq(q->queue_lock);
+		blk_queue_invalidate_tags(q);
+		spin_unlock_irq(q->queue_lock);
+		return;
+	}
+
+	for_each_set_bit(tag, &tags, mq->tag_set.queue_depth)
+		blk_mq_requeue_request(mq->mqrq_cmdq[tag].req);
+	blk_mq_kick_requeue_list(q);
+}
+
 int mmc_cmdq_init(struct mmc_queue *mq, struct mmc_card *card)
 {
 	int i, ret = 0;
@@ -653,11 +1033,14 @@ int mmc_cmdq_init(struct mmc_queue *mq, struct mmc_card *card)
 		}
 	}
 
-	ret = blk_queue_init_tags(mq->queue, q_depth, NULL);
-	if (ret) {
-		pr_warn("%s: unable to allocate cmdq tags %d\n",
-				mmc_card_name(card), q_depth);
-		goto free_mqrq_sg;
+	/* blk-mq queues come with their tags from the tag set */
+	if (!mq->queue->mq_ops) {
+		ret = blk_queue_init_tags(mq->queue, q_depth, NULL);
+		if (ret) {
+			pr_warn("%s: unable to allocate cmdq tags %d\n",
+					mmc_card_name(card), q_depth);
+			goto free_mqrq_sg;
+		}
 	}
 
 	blk_queue_softirq_done(mq->queue, mmc_cmdq_softirq_done);
@@ -685,9 +1068,11 @@ void mmc_cmdq_clean(struct mmc_queue *mq, struct mmc_card *card)
 	int i;
 	int q_depth = card->ext_csd.cmdq_depth - 1;
 
-	blk_free_tags(mq->queue->queue_tags);
-	mq->queue->queue_tags = NULL;
-	blk_queue_free_tags(mq->queue);
+	if (!mq->queue->mq_ops) {
+		blk_free_tags(mq->queue->queue_tags);
+		mq->queue->queue_tags = NULL;
+		blk_queue_free_tags(mq->queue);
+	}
 
 	for (i = 0; i < q_depth; i++)
 		kfree(mq->mqrq_cmdq[i].sg);
@@ -695,6 +1080,13 @@ void mmc_cmdq_clean(struct mmc_queue *mq, struct mmc_card *card)
 	mq->mqrq_cmdq = NULL;
 }
 
+/* Must only be called once the queue itself has been cleaned up */
+void mmc_queue_free_tag_set(struct mmc_queue *mq)
+{
+	if (mq->tag_set.tags)
+		blk_mq_free_tag_set(&mq->tag_set);
+}
+
 /**
  * mmc_queue_suspend - suspend a MMC request queue
  * @mq: MMC queue to suspend
@@ -712,6 +1104,57 @@ int mmc_queue_suspend(struct mmc_queue *mq, int wait)
 	struct mmc_card *card = mq->card;
 	struct request *req;
 
+	if (mmc_queue_is_mq_sync(q)) {
+		if (test_and_set_bit(MMC_QUEUE_SUSPENDED, &mq->flags))
+			goto out;
+
+		/* Issuers hold thread_sem until their request is done */
+		blk_mq_stop_hw_queues(q);
+		if (wait) {
+			down(&mq->thread_sem);
+		} else if (down_trylock(&mq->thread_sem)) {
+			clear_bit(MMC_QUEUE_SUSPENDED, &mq->flags);
+			blk_mq_start_stopped_hw_queues(q, true);
+			rc = -EBUSY;
+		}
+
+		goto out;
+	}
+
+	if (q->mq_ops) {
+		struct mmc_host *host = card->host;
+
+		if (test_bit(MMC_QUEUE_SUSPENDED, &mq->flags))
+			goto out;
+
+		if (wait) {
+			/*
+			 * Issuers sleep on a suspended queue, so drain it
+			 * before flagging it and shutting down cmdq. The
+			 * queue stays frozen, it is torn down by
+			 * mmc_blk_put() once the last user is gone.
+			 */
+			blk_mq_freeze_queue(q);
+			blk_mq_stop_hw_queues(q);
+			set_bit(MMC_QUEUE_SUSPENDED, &mq->flags);
+			wait_event(host->cmdq_ctx.queue_empty_wq,
+				   !host->cmdq_ctx.active_reqs);
+			mq->cmdq_shutdown(mq);
+			goto out;
+		}
+
+		set_bit(MMC_QUEUE_SUSPENDED, &mq->flags);
+		blk_mq_stop_hw_queues(q);
+		if (host->cmdq_ctx.active_reqs || mmc_cmdq_mq_busy(q)) {
+			clear_bit(MMC_QUEUE_SUSPENDED, &mq->flags);
+			wake_up(&host->cmdq_ctx.wait);
+			blk_mq_start_stopped_hw_queues(q, true);
+			rc = -EBUSY;
+		}
+
+		goto out;
+	}
+
 	if (card->cmdq_init && blk_queue_tagged(q)) {
 		struct mmc_host *host = card->host;
 
@@ -794,6 +1237,15 @@ void mmc_queue_resume(struct mmc_queue *mq)
 
 	if (test_and_clear_bit(MMC_QUEUE_SUSPENDED, &mq->flags)) {
 
+		if (q->mq_ops) {
+			if (mmc_queue_is_mq_sync(q))
+				up(&mq->thread_sem);
+			else
+				wake_up(&card->host->cmdq_ctx.wait);
+			blk_mq_start_stopped_hw_queues(q, true);
+			return;
+		}
+
 		if (!(card->cmdq_init && blk_queue_tagged(q)))
 			up(&mq->thread_sem);
 
@@ -1,6 +1,8 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/blk-mq.h>
+
 #define MMC_REQ_SPECIAL_MASK	(REQ_DISCARD | REQ_FLUSH)
 
 struct request;
@@ -42,6 +44,7 @@ struct mmc_queue_req {
 	enum mmc_packed_type	cmd_type;
 	struct mmc_packed	*packed;
 	struct mmc_cmdq_req	cmdq_req;
+	ktime_t			issue_time;	/* blk-mq dispatch time */
 };
 
 struct mmc_queue {
@@ -60,6 +63,8 @@ struct mmc_queue {
 	enum blk_eh_timer_return (*cmdq_req_timed_out)(struct request *);
 	void			*data;
 	struct request_queue	*queue;
+	struct blk_mq_tag_set	tag_set;	/* blk-mq queues only */
+	struct mutex		cmdq_issue_lock;	/* cmdq on blk-mq */
 	struct mmc_queue_req	mqrq[2];
 	struct mmc_queue_req	*mqrq_cur;
 	struct mmc_queue_req	*mqrq_prev;
@@ -98,5 +103,14 @@ extern void print_mmc_packing_stats(struct mmc_card *card);
 
 extern int mmc_cmdq_init(struct mmc_queue *mq, struct mmc_card *card);
 extern void mmc_cmdq_clean(struct mmc_queue *mq, struct mmc_card *card);
+extern void mmc_queue_free_tag_set(struct mmc_queue *mq);
+
+extern void mmc_cmdq_end_request(struct request *req, int err,
+				 unsigned int nr_bytes);
+extern bool mmc_blk_end_request(struct request *req, int err,
+				unsigned int nr_bytes);
+extern void mmc_blk_end_request_all(struct request *req, int err);
+extern struct request *mmc_cmdq_tag_to_rq(struct mmc_queue *mq, int tag);
+extern void mmc_cmdq_requeue(struct mmc_queue *mq, unsigned long tags);
 
 #endif
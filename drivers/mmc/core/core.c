@@ -1988,9 +1988,23 @@ unsigned int mmc_align_data_size(struct mmc_card *card, unsigned int sz)
 }
 EXPORT_SYMBOL(mmc_align_data_size);
 
+/*
+ * A claim made on behalf of a context is shared by every task that claims
+ * with the same context, plain claims only nest within the claiming task.
+ * Tasks sharing a context claim may exit while it is held, so claimer is
+ * left NULL for those.
+ */
+static inline bool mmc_claimed_by(struct mmc_host *host, void *ctx)
+{
+	if (ctx && host->claim_ctx == ctx)
+		return true;
+	return host->claimer == current && !host->claim_ctx;
+}
+
 /**
- *	__mmc_claim_host - exclusively claim a host
+ *	__mmc_claim_host_ctx - exclusively claim a host for a context
  *	@host: mmc host to claim
+ *	@ctx: context to claim the host for, NULL for the current task
  *	@abort: whether or not the operation should be aborted
  *
  *	Claim a host for a set of operations.  If @abort is non null and
@@ -1998,7 +2012,7 @@ EXPORT_SYMBOL(mmc_align_data_size);
  *	that non-zero value without acquiring the lock.  Returns zero
  *	with the lock held otherwise.
  */
-int __mmc_claim_host(struct mmc_host *host, atomic_t *abort)
+int __mmc_claim_host_ctx(struct mmc_host *host, void *ctx, atomic_t *abort)
 {
 	DECLARE_WAITQUEUE(wait, current);
 	unsigned long flags;
@@ -2012,7 +2026,7 @@ int __mmc_claim_host(struct mmc_host *host, atomic_t *abort)
 	while (1) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
 		stop = abort ? atomic_read(abort) : 0;
-		if (stop || !host->claimed || host->claimer == current)
+		if (stop || !host->claimed || mmc_claimed_by(host, ctx))
 			break;
 		spin_unlock_irqrestore(&host->lock, flags);
 		schedule();
@@ -2020,8 +2034,11 @@ int __mmc_claim_host(struct mmc_host *host, atomic_t *abort)
 	}
 	set_current_state(TASK_RUNNING);
 	if (!stop) {
+		if (!host->claimed)
+			host->claim_ctx = ctx;
 		host->claimed = 1;
-		host->claimer = current;
+		if (!host->claim_ctx)
+			host->claimer = current;
 		host->claim_cnt += 1;
 	} else
 		wake_up(&host->wq);
@@ -2031,6 +2048,19 @@ int __mmc_claim_host(struct mmc_host *host, atomic_t *abort)
 		host->ops->enable(host);
 	return stop;
 }
+EXPORT_SYMBOL(__mmc_claim_host_ctx);
+
+/**
+ *	__mmc_claim_host - exclusively claim a host
+ *	@host: mmc host to claim
+ *	@abort: whether or not the operation should be aborted
+ *
+ *	Same as __mmc_claim_host_ctx() with the claim tied to the current task.
+ */
+int __mmc_claim_host(struct mmc_host *host, atomic_t *abort)
+{
+	return __mmc_claim_host_ctx(host, NULL, abort);
+}
 
 EXPORT_SYMBOL(__mmc_claim_host);
 
@@ -2050,7 +2080,7 @@ int mmc_try_claim_host(struct mmc_host *host, unsigned int delay_ms)
 
 	do {
 		spin_lock_irqsave(&host->lock, flags);
-		if (!host->claimed || host->claimer == current) {
+		if (!host->claimed || mmc_claimed_by(host, NULL)) {
 			host->claimed = 1;
 			host->claimer = current;
 			host->claim_cnt += 1;
@@ -2089,6 +2119,7 @@ void mmc_release_host(struct mmc_host *host)
 	} else {
 		host->claimed = 0;
 		host->claimer = NULL;
+		host->claim_ctx = NULL;
 		spin_unlock_irqrestore(&host->lock, flags);
 		wake_up(&host->wq);
 	}
@@ -2097,17 +2128,23 @@ EXPORT_SYMBOL(mmc_release_host);
 
 /*
  * This is a helper function, which fetches a runtime pm reference for the
- * card device and also claims the host.
+ * card device and also claims the host on behalf of @ctx.
  */
-void mmc_get_card(struct mmc_card *card)
+void mmc_get_card_ctx(struct mmc_card *card, void *ctx)
 {
 	pm_runtime_get_sync(&card->dev);
-	mmc_claim_host(card->host);
+	__mmc_claim_host_ctx(card->host, ctx, NULL);
 #ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
 	if (mmc_bus_needs_resume(card->host))
 		mmc_resume_bus(card->host);
 #endif
 }
+EXPORT_SYMBOL(mmc_get_card_ctx);
+
+void mmc_get_card(struct mmc_card *card)
+{
+	mmc_get_card_ctx(card, NULL);
+}
 EXPORT_SYMBOL(mmc_get_card);
 
 
@@ -92,10 +92,12 @@ static void sdhci_runtime_pm_bus_off(struct sdhci_host *host)
 static void sdhci_dump_state(struct sdhci_host *host)
 {
 	struct mmc_host *mmc = host->mmc;
+	/* NULL while unclaimed or claimed for a context */
+	struct task_struct *claimer = ACCESS_ONCE(mmc->claimer);
 
 	pr_info("%s: clk: %d clk-gated: %d claimer: %s pwr: %d host->irq = %d\n",
 		mmc_hostname(mmc), host->clock, mmc->clk_gated,
-		mmc->claimer->comm, host->pwr,
+		claimer ? claimer->comm : "none", host->pwr,
 		(host->flags & SDHCI_HOST_IRQ_STATUS));
 	pr_info("%s: rpmstatus[pltfm](runtime-suspend:usage_count:disable_depth)(%d:%d:%d)\n",
 		mmc_hostname(mmc), mmc->parent->power.runtime_status,
@@ -41,6 +41,10 @@
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
 #include <linux/cpuset.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/wait.h>
 
 #define CREATE_TRACE_POINTS
 #include "trace/lowmemorykiller.h"
@@ -73,6 +77,10 @@ static int lowmem_per_minfree_count[6];
 
 static unsigned long lowmem_deathpending_timeout;
 
+/* unmap the anonymous memory of killed tasks from lmk_reaper */
+static int lowmem_reap = 1;
+module_param_named(reap, lowmem_reap, int, S_IRUGO | S_IWUSR);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -107,10 +115,525 @@ static int test_task_flag(struct task_struct *p, int flag)
 	return 0;
 }
 
+/*
+ * A killed task only frees its memory once it runs its exit path, which
+ * may take a while if it is blocked or stuck on a slow core. Meanwhile
+ * lowmem_deathpending_timeout holds off further kills. lmk_reaper tears
+ * down the private memory of victims right away instead, and flags them
+ * TIF_MM_RELEASED so they no longer hold up the next kill.
+ */
+#define LMK_REAP_QUEUE		8
+#define LMK_REAP_RETRIES	10
+
+static struct task_struct *lmk_reaper_th;
+static DECLARE_WAIT_QUEUE_HEAD(lmk_reaper_wait);
+static DEFINE_SPINLOCK(lmk_reap_lock);
+static struct task_struct *lmk_reap_queue[LMK_REAP_QUEUE];
+static unsigned int lmk_reap_head, lmk_reap_tail;
+
+/* The memory can't go away under someone who isn't being killed with it */
+static bool lmk_mm_shared(struct task_struct *tsk, struct mm_struct *mm)
+{
+	struct task_struct *p;
+	bool shared = false;
+
+	if (atomic_read(&mm->mm_users) <= get_nr_threads(tsk) + 1)
+		return false;
+
+	rcu_read_lock();
+	for_each_process(p) {
+		if (same_thread_group(p, tsk) || (p->flags & PF_KTHREAD))
+			continue;
+		if (p->mm == mm) {
+			shared = true;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return shared;
+}
+
+static bool lmk_reap_task(struct task_struct *tsk)
+{
+	struct vm_area_struct *vma;
+	struct task_struct *p, *t;
+	struct mm_struct *mm;
+	unsigned long rss;
+	bool reaped = true;
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return true;
+	mm = p->mm;
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		task_unlock(p);
+		return true;
+	}
+	task_unlock(p);
+
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		reaped = false;
+		goto out;
+	}
+
+	if (lmk_mm_shared(tsk, mm)) {
+		up_read(&mm->mmap_sem);
+		goto out;
+	}
+
+	rss = get_mm_rss(mm);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (is_vm_hugetlb_page(vma))
+			continue;
+		if (vma->vm_flags & (VM_LOCKED | VM_PFNMAP | VM_SHARED))
+			continue;
+		/* file pages stay in the page cache, only COWed ones go */
+		if (!vma->anon_vma)
+			continue;
+		zap_page_range(vma, vma->vm_start,
+			       vma->vm_end - vma->vm_start, NULL);
+	}
+	lowmem_print(2, "reaped '%s' (%d), freed %ldkB\n", tsk->comm,
+		     tsk->pid,
+		     (long)(rss - get_mm_rss(mm)) * (long)(PAGE_SIZE / 1024));
+	up_read(&mm->mmap_sem);
+
+	rcu_read_lock();
+	for_each_thread(tsk, t)
+		set_tsk_thread_flag(t, TIF_MM_RELEASED);
+	rcu_read_unlock();
+out:
+	mmput(mm);
+	return reaped;
+}
+
+static int lmk_reaper(void *unused)
+{
+	struct task_struct *tsk;
+	int retries;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(lmk_reaper_wait,
+				     lmk_reap_head != lmk_reap_tail ||
+				     kthread_should_stop());
+
+		spin_lock(&lmk_reap_lock);
+		if (lmk_reap_head == lmk_reap_tail) {
+			spin_unlock(&lmk_reap_lock);
+			continue;
+		}
+		tsk = lmk_reap_queue[lmk_reap_tail % LMK_REAP_QUEUE];
+		lmk_reap_tail++;
+		spin_unlock(&lmk_reap_lock);
+
+		/* The victim may hold mmap_sem for a bit, try again later */
+		for (retries = 0; retries < LMK_REAP_RETRIES; retries++) {
+			if (lmk_reap_task(tsk))
+				break;
+			schedule_timeout_interruptible(HZ / 10);
+		}
+		put_task_struct(tsk);
+	}
+
+	return 0;
+}
+
+static void lmk_queue_reap(struct task_struct *tsk)
+{
+	bool queued = false;
+
+	if (!lowmem_reap || !lmk_reaper_th)
+		return;
+
+	spin_lock(&lmk_reap_lock);
+	if (lmk_reap_head - lmk_reap_tail < LMK_REAP_QUEUE) {
+		get_task_struct(tsk);
+		lmk_reap_queue[lmk_reap_head % LMK_REAP_QUEUE] = tsk;
+		lmk_reap_head++;
+		queued = true;
+	}
+	spin_unlock(&lmk_reap_lock);
+
+	if (queued)
+		wake_up(&lmk_reaper_wait);
+}
+
+enum lowmem_check {
+	LMK_SKIP,
+	LMK_ABORT,
+	LMK_CANDIDATE,
+};
+
+/*
+ * Check whether @tsk may be killed. On LMK_CANDIDATE, @victim is the thread
+ * holding the mm and @tasksize/@oom_score_adj are filled in. LMK_ABORT means
+ * an earlier victim is still dying and nothing should be killed yet.
+ */
+static enum lowmem_check lowmem_check_task(struct task_struct *tsk,
+					   short min_score_adj,
+					   struct task_struct **victim,
+					   int *tasksize, short *oom_score_adj)
+{
+	struct task_struct *p;
+
+	if (tsk->flags & PF_KTHREAD)
+		return LMK_SKIP;
+
+	/* if task no longer has any memory ignore it */
+	if (test_task_flag(tsk, TIF_MM_RELEASED))
+		return LMK_SKIP;
+
+	if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		if (test_task_flag(tsk, TIF_MEMDIE)) {
+			if (same_thread_group(current, tsk))
+				set_tsk_thread_flag(current, TIF_MEMDIE);
+			return LMK_ABORT;
+		}
+	}
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return LMK_SKIP;
+
+	*oom_score_adj = p->signal->oom_score_adj;
+	if (*oom_score_adj < min_score_adj) {
+		task_unlock(p);
+		return LMK_SKIP;
+	}
+	if (fatal_signal_pending(p) ||
+			((p->flags & PF_EXITING) &&
+				test_tsk_thread_flag(p, TIF_MEMDIE))) {
+		lowmem_print(2, "skip slow dying process %d\n", p->pid);
+		task_unlock(p);
+		return LMK_SKIP;
+	}
+	*tasksize = get_mm_rss(p->mm);
+	task_unlock(p);
+	if (*tasksize <= 0)
+		return LMK_SKIP;
+
+	*victim = p;
+	return LMK_CANDIDATE;
+}
+
 #ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-static struct task_struct *pick_next_from_adj_tree(struct task_struct *task);
-static struct task_struct *pick_first_task(void);
-static struct task_struct *pick_last_task(void);
+/*
+ * Thread group leaders are kept in one rbtree per oom_score_adj value,
+ * ordered by the RSS cached in lmk_rss, with a bitmap of the non-empty
+ * buckets. The best victim is the last node of the highest bucket, so
+ * selection only has to check candidates until one of them is killable.
+ *
+ * lmk_rss is refreshed from the owning process whenever its mm counters
+ * move by more than LMK_RSS_DELTA pages. Pages unmapped by reclaim are
+ * not seen there, so a candidate whose real RSS has dropped is requeued
+ * and the lookup restarted.
+ */
+#define LMK_NR_BUCKETS	(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+#define LMK_RSS_DELTA	256
+#define LMK_BATCH	8
+#define LMK_MAX_REQUEUE	16
+
+static DEFINE_SPINLOCK(lmk_lock);
+static struct rb_root lmk_buckets[LMK_NR_BUCKETS];
+static DECLARE_BITMAP(lmk_bucket_map, LMK_NR_BUCKETS);
+
+struct lmk_cursor {
+	short adj;
+	unsigned long rss;
+	struct task_struct *task;
+};
+
+static inline int lmk_bucket(short adj)
+{
+	return adj - OOM_SCORE_ADJ_MIN;
+}
+
+/* Order by rss, then by address so every key is unique */
+static inline bool lmk_key_less(unsigned long rss_a, struct task_struct *a,
+				unsigned long rss_b, struct task_struct *b)
+{
+	if (rss_a != rss_b)
+		return rss_a < rss_b;
+	return (unsigned long)a < (unsigned long)b;
+}
+
+static void __lmk_insert(struct task_struct *task)
+{
+	int bucket = lmk_bucket(task->lmk_adj);
+	struct rb_node **link = &lmk_buckets[bucket].rb_node;
+	struct rb_node *parent = NULL;
+	struct task_struct *entry;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct task_struct, adj_node);
+
+		if (lmk_key_less(task->lmk_rss, task, entry->lmk_rss, entry))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&task->adj_node, parent, link);
+	rb_insert_color(&task->adj_node, &lmk_buckets[bucket]);
+	__set_bit(bucket, lmk_bucket_map);
+}
+
+static void __lmk_erase(struct task_struct *task)
+{
+	int bucket = lmk_bucket(task->lmk_adj);
+
+	rb_erase(&task->adj_node, &lmk_buckets[bucket]);
+	RB_CLEAR_NODE(&task->adj_node);
+	if (RB_EMPTY_ROOT(&lmk_buckets[bucket]))
+		__clear_bit(bucket, lmk_bucket_map);
+}
+
+/*
+ * Called from fork for a child that has not run yet and from exec for
+ * current, so task->mm can't go away while its RSS is read.
+ */
+void add_2_adj_tree(struct task_struct *task)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_lock, flags);
+	task->lmk_adj = task->signal->oom_score_adj;
+	task->lmk_rss = task->mm ? get_mm_rss(task->mm) : 0;
+	__lmk_insert(task);
+	spin_unlock_irqrestore(&lmk_lock, flags);
+}
+
+void delete_from_adj_tree(struct task_struct *task)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_lock, flags);
+	if (!RB_EMPTY_NODE(&task->adj_node))
+		__lmk_erase(task);
+	spin_unlock_irqrestore(&lmk_lock, flags);
+}
+
+/*
+ * Re-index the process of @task after its oom_score_adj was written
+ * through /proc. @task may be any thread of it, only the group leader is
+ * in the index. The caller holds a reference but no locks: the mm of the
+ * foreign task is only looked at through find_lock_task_mm(), and a
+ * leader that has left the index meanwhile, e.g. to a de_thread(), stays
+ * out of it.
+ */
+void adj_tree_update_adj(struct task_struct *task)
+{
+	struct task_struct *leader, *p;
+	unsigned long rss = 0, flags;
+
+	/* the leader can change under exec, RCU keeps the old one around */
+	rcu_read_lock();
+	leader = ACCESS_ONCE(task->group_leader);
+	p = find_lock_task_mm(leader);
+	if (p) {
+		rss = get_mm_rss(p->mm);
+		task_unlock(p);
+	}
+
+	spin_lock_irqsave(&lmk_lock, flags);
+	if (!RB_EMPTY_NODE(&leader->adj_node)) {
+		__lmk_erase(leader);
+		leader->lmk_adj = leader->signal->oom_score_adj;
+		leader->lmk_rss = rss;
+		__lmk_insert(leader);
+	}
+	spin_unlock_irqrestore(&lmk_lock, flags);
+	rcu_read_unlock();
+}
+
+/* Caller holds rcu_read_lock() or runs in the thread group of @task */
+static void lmk_requeue(struct task_struct *task, unsigned long rss)
+{
+	struct task_struct *leader = ACCESS_ONCE(task->group_leader);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_lock, flags);
+	if (!RB_EMPTY_NODE(&leader->adj_node)) {
+		__lmk_erase(leader);
+		leader->lmk_rss = rss;
+		__lmk_insert(leader);
+	}
+	spin_unlock_irqrestore(&lmk_lock, flags);
+}
+
+/* Called as the RSS of @mm changes, only acts for the current process */
+void adj_tree_update_rss(struct mm_struct *mm)
+{
+	struct task_struct *leader = current->group_leader;
+	unsigned long rss, cached;
+
+	if (!mm || current->mm != mm)
+		return;
+
+	rss = get_mm_rss(mm);
+	cached = ACCESS_ONCE(leader->lmk_rss);
+	if (rss < cached + LMK_RSS_DELTA && cached < rss + LMK_RSS_DELTA)
+		return;
+
+	lmk_requeue(leader, rss);
+}
+
+/* Greatest node of @root whose key is below the cursor's */
+static struct rb_node *lmk_seek_before(struct rb_root *root,
+				       struct lmk_cursor *cursor)
+{
+	struct rb_node *node = root->rb_node, *best = NULL;
+	struct task_struct *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct task_struct, adj_node);
+		if (lmk_key_less(entry->lmk_rss, entry,
+				 cursor->rss, cursor->task)) {
+			best = node;
+			node = node->rb_right;
+		} else {
+			node = node->rb_left;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Fill @batch with the next candidates after @cursor, best first. The
+ * candidates are checked with lmk_lock dropped, the caller holds
+ * rcu_read_lock() so they stay valid even if they leave the index.
+ */
+static int lmk_collect(short min_score_adj, struct lmk_cursor *cursor,
+		       struct task_struct **batch)
+{
+	int min_bucket = lmk_bucket(min_score_adj);
+	struct rb_node *node = NULL;
+	struct task_struct *last;
+	unsigned long flags;
+	int bucket, next, n = 0;
+
+	spin_lock_irqsave(&lmk_lock, flags);
+	if (cursor->task) {
+		bucket = lmk_bucket(cursor->adj);
+		node = lmk_seek_before(&lmk_buckets[bucket], cursor);
+	} else {
+		bucket = LMK_NR_BUCKETS;
+	}
+
+	while (n < LMK_BATCH) {
+		if (!node) {
+			if (!bucket)
+				break;
+			next = find_last_bit(lmk_bucket_map, bucket);
+			if (next == bucket || next < min_bucket)
+				break;
+			bucket = next;
+			node = rb_last(&lmk_buckets[bucket]);
+			continue;
+		}
+		batch[n++] = rb_entry(node, struct task_struct, adj_node);
+		node = rb_prev(node);
+	}
+
+	if (n) {
+		last = batch[n - 1];
+		cursor->adj = last->lmk_adj;
+		cursor->rss = last->lmk_rss;
+		cursor->task = last;
+	}
+	spin_unlock_irqrestore(&lmk_lock, flags);
+
+	return n;
+}
+
+static enum lowmem_check lowmem_select(short min_score_adj,
+				       struct task_struct **selected,
+				       int *selected_tasksize,
+				       short *selected_oom_score_adj,
+				       int *visited)
+{
+	struct task_struct *batch[LMK_BATCH];
+	struct lmk_cursor cursor;
+	enum lowmem_check ret;
+	int tasksize, requeued = 0;
+	short oom_score_adj;
+	int i, n;
+
+restart:
+	cursor.task = NULL;
+	while ((n = lmk_collect(min_score_adj, &cursor, batch))) {
+		for (i = 0; i < n; i++) {
+			struct task_struct *p;
+
+			(*visited)++;
+			ret = lowmem_check_task(batch[i], min_score_adj, &p,
+						&tasksize, &oom_score_adj);
+			if (ret == LMK_ABORT)
+				return ret;
+			if (ret != LMK_CANDIDATE)
+				continue;
+
+			if (tasksize + LMK_RSS_DELTA <= batch[i]->lmk_rss &&
+			    requeued < LMK_MAX_REQUEUE) {
+				lmk_requeue(batch[i], tasksize);
+				requeued++;
+				goto restart;
+			}
+
+			*selected = p;
+			*selected_tasksize = tasksize;
+			*selected_oom_score_adj = oom_score_adj;
+			lowmem_print(3, "select '%s' (%d), adj %hd, size %d, to kill\n",
+				     p->comm, p->pid, oom_score_adj, tasksize);
+			return ret;
+		}
+	}
+
+	return LMK_SKIP;
+}
+#else
+static enum lowmem_check lowmem_select(short min_score_adj,
+				       struct task_struct **selected,
+				       int *selected_tasksize,
+				       short *selected_oom_score_adj,
+				       int *visited)
+{
+	struct task_struct *tsk;
+	enum lowmem_check ret;
+	int tasksize;
+	short oom_score_adj;
+
+	for_each_process(tsk) {
+		struct task_struct *p;
+
+		(*visited)++;
+		ret = lowmem_check_task(tsk, min_score_adj, &p, &tasksize,
+					&oom_score_adj);
+		if (ret == LMK_ABORT)
+			return ret;
+		if (ret != LMK_CANDIDATE)
+			continue;
+
+		if (*selected) {
+			if (oom_score_adj < *selected_oom_score_adj)
+				continue;
+			if (oom_score_adj == *selected_oom_score_adj &&
+			    tasksize <= *selected_tasksize)
+				continue;
+		}
+		*selected = p;
+		*selected_tasksize = tasksize;
+		*selected_oom_score_adj = oom_score_adj;
+		lowmem_print(3, "select '%s' (%d), adj %hd, size %d, to kill\n",
+			     p->comm, p->pid, oom_score_adj, tasksize);
+	}
+
+	return *selected ? LMK_CANDIDATE : LMK_SKIP;
+}
 #endif
 
 static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
@@ -118,7 +641,6 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
 	unsigned long rem = 0;
-	int tasksize;
 	int i;
 	short min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int minfree = 0;
@@ -131,6 +653,9 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 						global_page_state(NR_UNEVICTABLE) -
 						total_swapcache_pages();
 	int minfree_count_offset = 0;
+	enum lowmem_check ret;
+	int visited = 0;
+	ktime_t start;
 
 	rcu_read_lock();
 	tsk = current->group_leader;
@@ -166,76 +691,21 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 
 	selected_oom_score_adj = min_score_adj;
 
+	start = ktime_get();
 	rcu_read_lock();
-#ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-	for (tsk = pick_first_task();
-		tsk != pick_last_task() && tsk != NULL;
-		tsk = pick_next_from_adj_tree(tsk)) {
-#else
-	for_each_process(tsk) {
-#endif
-		struct task_struct *p;
-		short oom_score_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
-
-		/* if task no longer has any memory ignore it */
-		if (test_task_flag(tsk, TIF_MM_RELEASED))
-			continue;
-
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				rcu_read_unlock();
-				if (same_thread_group(current, tsk))
-					set_tsk_thread_flag(current,
-								TIF_MEMDIE);
-				return 0;
-			}
-		}
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-#ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-			break;
-#else
-			continue;
-#endif
-		}
-		if (fatal_signal_pending(p) ||
-				((p->flags & PF_EXITING) &&
-					test_tsk_thread_flag(p, TIF_MEMDIE))) {
-			lowmem_print(2, "skip slow dying process %d\n", p->pid);
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-#ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-				break;
-#else
-				continue;
-#endif
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		lowmem_print(3, "select '%s' (%d), adj %hd, size %d, to kill\n",
-			     p->comm, p->pid, oom_score_adj, tasksize);
+	ret = lowmem_select(min_score_adj, &selected, &selected_tasksize,
+			   &selected_oom_score_adj, &visited);
+	trace_lowmemory_select(min_score_adj,
+			       ret == LMK_CANDIDATE ? selected : NULL,
+			       selected_oom_score_adj, selected_tasksize,
+			       visited, ktime_to_ns(ktime_sub(ktime_get(),
+							      start)));
+	if (ret == LMK_ABORT) {
+		rcu_read_unlock();
+		return 0;
 	}
-	if (selected) {
+
+	if (ret == LMK_CANDIDATE) {
 		long cache_size = other_file * (long)(PAGE_SIZE / 1024);
 		long cache_limit = minfree * (long)(PAGE_SIZE / 1024);
 		long free = other_free * (long)(PAGE_SIZE / 1024);
@@ -274,6 +744,7 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 		lowmem_deathpending_timeout = jiffies + HZ;
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
 		send_sig(SIGKILL, selected, 0);
+		lmk_queue_reap(selected);
 		rem += selected_tasksize;
 		rcu_read_unlock();
 	} else
@@ -284,88 +755,6 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 	return rem;
 }
 
-#ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-DEFINE_SPINLOCK(lmk_lock);
-struct rb_root tasks_scoreadj = RB_ROOT;
-void add_2_adj_tree(struct task_struct *task)
-{
-	struct rb_node **link;
-	struct rb_node *parent = NULL;
-	struct task_struct *task_entry;
-	s64 key = task->signal->oom_score_adj;
-
-	/*
-	 * Find the right place in the rbtree:
-	 */
-	spin_lock(&lmk_lock);
-	link =  &tasks_scoreadj.rb_node;
-	while (*link) {
-		parent = *link;
-		task_entry = rb_entry(parent, struct task_struct, adj_node);
-
-		if (key < task_entry->signal->oom_score_adj)
-			link = &parent->rb_right;
-		else
-			link = &parent->rb_left;
-	}
-
-	rb_link_node(&task->adj_node, parent, link);
-	rb_insert_color(&task->adj_node, &tasks_scoreadj);
-	spin_unlock(&lmk_lock);
-}
-
-void delete_from_adj_tree(struct task_struct *task)
-{
-	spin_lock(&lmk_lock);
-	if (!RB_EMPTY_NODE(&task->adj_node)) {
-		rb_erase(&task->adj_node, &tasks_scoreadj);
-		RB_CLEAR_NODE(&task->adj_node);
-	}
-	spin_unlock(&lmk_lock);
-}
-
-static struct task_struct *pick_next_from_adj_tree(struct task_struct *task)
-{
-	struct rb_node *next;
-
-	spin_lock(&lmk_lock);
-	next = rb_next(&task->adj_node);
-	spin_unlock(&lmk_lock);
-
-	if (!next)
-		return NULL;
-
-	return rb_entry(next, struct task_struct, adj_node);
-}
-
-static struct task_struct *pick_first_task(void)
-{
-	struct rb_node *left;
-
-	spin_lock(&lmk_lock);
-	left = rb_first(&tasks_scoreadj);
-	spin_unlock(&lmk_lock);
-
-	if (!left)
-		return NULL;
-
-	return rb_entry(left, struct task_struct, adj_node);
-}
-static struct task_struct *pick_last_task(void)
-{
-	struct rb_node *right;
-
-	spin_lock(&lmk_lock);
-	right = rb_last(&tasks_scoreadj);
-	spin_unlock(&lmk_lock);
-
-	if (!right)
-		return NULL;
-
-	return rb_entry(right, struct task_struct, adj_node);
-}
-#endif
-
 static struct shrinker lowmem_shrinker = {
 	.scan_objects = lowmem_scan,
 	.count_objects = lowmem_count,
@@ -374,6 +763,12 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	lmk_reaper_th = kthread_run(lmk_reaper, NULL, "lmk_reaper");
+	if (IS_ERR(lmk_reaper_th)) {
+		pr_err("failed to start lmk_reaper: %ld\n",
+		       PTR_ERR(lmk_reaper_th));
+		lmk_reaper_th = NULL;
+	}
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -381,6 +776,8 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	if (lmk_reaper_th)
+		kthread_stop(lmk_reaper_th);
 }
 
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
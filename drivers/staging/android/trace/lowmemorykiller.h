@@ -34,6 +34,37 @@ TRACE_EVENT(lowmemory_kill,
 		__entry->pagecache_limit, __entry->free)
 );
 
+TRACE_EVENT(lowmemory_select,
+	TP_PROTO(short min_score_adj, struct task_struct *selected,
+		 short oom_score_adj, int tasksize, int visited, s64 latency),
+
+	TP_ARGS(min_score_adj, selected, oom_score_adj, tasksize, visited,
+		latency),
+
+	TP_STRUCT__entry(
+			__field(short, min_score_adj)
+			__field(pid_t, pid)
+			__field(short, oom_score_adj)
+			__field(long, size)
+			__field(int, visited)
+			__field(s64, latency)
+	),
+
+	TP_fast_assign(
+			__entry->min_score_adj = min_score_adj;
+			__entry->pid = selected ? selected->pid : -1;
+			__entry->oom_score_adj = selected ? oom_score_adj : 0;
+			__entry->size = selected ?
+				tasksize * (long)(PAGE_SIZE / 1024) : 0;
+			__entry->visited = visited;
+			__entry->latency = latency;
+	),
+
+	TP_printk("min_adj %hd, selected %d (adj %hd, %ldkB), visited %d, took %lldns",
+		__entry->min_score_adj, __entry->pid, __entry->oom_score_adj,
+		__entry->size, __entry->visited, __entry->latency)
+);
+
 
 #endif /* if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ) */
 
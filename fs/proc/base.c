@@ -407,6 +407,27 @@ static int proc_oom_score(struct seq_file *m, struct pid_namespace *ns,
 	return seq_printf(m, "%lu\n", points);
 }
 
+#ifdef CONFIG_PROCESS_RECLAIM
+static int proc_pid_reclaim_stat(struct seq_file *m, struct pid_namespace *ns,
+				 struct pid *pid, struct task_struct *task)
+{
+	struct mm_struct *mm = get_task_mm(task);
+	struct process_reclaim_stat *stat;
+
+	if (!mm)
+		return 0;
+
+	stat = &mm->reclaim_stat;
+	seq_printf(m, "reclaimed %lu\n", stat->reclaimed);
+	seq_printf(m, "swap_refaults %lu\n",
+		   atomic_long_read(&stat->swap_refaults));
+	seq_printf(m, "refault_ratio %d\n", stat->refault_ratio);
+	mmput(mm);
+
+	return 0;
+}
+#endif
+
 struct limit_names {
 	const char *name;
 	const char *unit;
@@ -920,14 +941,14 @@ static ssize_t oom_adj_write(struct file *file, const char __user *buf,
 		  current->comm, task_pid_nr(current), task_pid_nr(task),
 		  task_pid_nr(task));
 
-	delete_from_adj_tree(task);
 	task->signal->oom_score_adj = oom_adj;
-	add_2_adj_tree(task);
 	trace_oom_score_adj_update(task);
 err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		adj_tree_update_adj(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1008,9 +1029,7 @@ static ssize_t oom_score_adj_write(struct file *file, const char __user *buf,
 		goto err_sighand;
 	}
 
-	delete_from_adj_tree(task);
 	task->signal->oom_score_adj = (short)oom_score_adj;
-	add_2_adj_tree(task);
 
 	if (has_capability_noaudit(current, CAP_SYS_RESOURCE))
 		task->signal->oom_score_adj_min = (short)oom_score_adj;
@@ -1020,6 +1039,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		adj_tree_update_adj(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -2629,6 +2650,7 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("mountstats", S_IRUSR, proc_mountstats_operations),
 #ifdef CONFIG_PROCESS_RECLAIM
 	REG("reclaim", S_IWUSR, proc_reclaim_operations),
+	ONE("reclaim_stat", S_IRUGO, proc_pid_reclaim_stat),
 #endif
 #ifdef CONFIG_PROC_PAGE_MONITOR
 	REG("clear_refs", S_IWUSR, proc_clear_refs_operations),
@@ -52,6 +52,9 @@ static int seq_show(struct seq_file *m, void *v)
 		seq_printf(m, "pos:\t%lli\nflags:\t0%o\nmnt_id:\t%i\n",
 			   (long long)file->f_pos, f_flags,
 			   real_mount(file->f_path.mnt)->mnt_id);
+		if (S_ISREG(file_inode(file)->i_mode))
+			seq_printf(m, "refaults:\t%lu\n",
+				   atomic_long_read(&file->f_mapping->nrrefaults));
 		if (file->f_op->show_fdinfo)
 			ret = file->f_op->show_fdinfo(m, file);
 		fput(file);
@@ -1438,19 +1438,31 @@ cont:
 		if (!page)
 			continue;
 
+		/* reclaiming a shared page would only unmap it from here */
+		if (rp->madvise && page_mapcount(page) != 1)
+			continue;
+
 		if (isolate_lru_page(page))
 			continue;
 
+		/* don't let the next reclaim pass promote it again */
+		if (rp->deactivate)
+			ptep_test_and_clear_young(vma, addr, pte);
+
 		list_add(&page->lru, &page_list);
 		inc_zone_page_state(page, NR_ISOLATED_ANON +
 				page_is_file_cache(page));
 		isolated++;
 		rp->nr_scanned++;
-		if ((isolated >= SWAP_CLUSTER_MAX) || !rp->nr_to_reclaim)
+		if ((isolated >= SWAP_CLUSTER_MAX && !rp->madvise) ||
+		    !rp->nr_to_reclaim)
 			break;
 	}
 	pte_unmap_unlock(pte - 1, ptl);
-	reclaimed = reclaim_pages_from_list(&page_list, vma);
+	if (rp->deactivate)
+		reclaimed = deactivate_pages_from_list(&page_list);
+	else
+		reclaimed = reclaim_pages_from_list(&page_list, vma);
 	rp->nr_reclaimed += reclaimed;
 	rp->nr_to_reclaim -= reclaimed;
 	if (rp->nr_to_reclaim < 0)
@@ -1480,6 +1492,8 @@ struct reclaim_param reclaim_task_anon(struct task_struct *task,
 
 	rp.nr_reclaimed = 0;
 	rp.nr_scanned = 0;
+	rp.deactivate = false;
+	rp.madvise = false;
 	get_task_struct(task);
 	mm = get_task_mm(task);
 	if (!mm)
@@ -1518,6 +1532,35 @@ out:
 	return rp;
 }
 
+/*
+ * Deactivate or reclaim the pages of [start, end) in @vma for madvise().
+ * Pages are isolated a pmd at a time, pages mapped by other processes are
+ * left alone. The caller holds mmap_sem.
+ */
+struct reclaim_param reclaim_vma_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end, bool deactivate)
+{
+	struct mm_walk reclaim_walk = {};
+	struct reclaim_param rp;
+
+	rp.vma = vma;
+	rp.nr_scanned = 0;
+	rp.nr_to_reclaim = INT_MAX;
+	rp.nr_reclaimed = 0;
+	rp.deactivate = deactivate;
+	rp.madvise = true;
+
+	reclaim_walk.mm = vma->vm_mm;
+	reclaim_walk.pmd_entry = reclaim_pte_range;
+	reclaim_walk.private = &rp;
+
+	walk_page_range(start, end, &reclaim_walk);
+	if (deactivate)
+		flush_tlb_range(vma, start, end);
+
+	return rp;
+}
+
 static ssize_t reclaim_write(struct file *file, const char __user *buf,
 				size_t count, loff_t *ppos)
 {
@@ -1592,8 +1635,10 @@ static ssize_t reclaim_write(struct file *file, const char __user *buf,
 	reclaim_walk.mm = mm;
 	reclaim_walk.pmd_entry = reclaim_pte_range;
 
-	rp.nr_to_reclaim = ~0;
+	rp.nr_to_reclaim = INT_MAX;
 	rp.nr_reclaimed = 0;
+	rp.deactivate = false;
+	rp.madvise = false;
 	reclaim_walk.private = &rp;
 
 	down_read(&mm->mmap_sem);
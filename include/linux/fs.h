@@ -403,6 +403,34 @@ int pagecache_write_end(struct file *, struct address_space *mapping,
 				struct page *page, void *fsdata);
 
 struct backing_dev_info;
+
+/* Access patterns told apart by adaptive readahead */
+enum {
+	RA_PATTERN_RANDOM,
+	RA_PATTERN_SEQ,
+	RA_PATTERN_STRIDE,
+};
+
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+/*
+ * Per-inode readahead history, see mm/readahead.c. It is shared by every
+ * open file and mapping of the inode and is only a hint, the page level
+ * updates are done without the lock. Allocated on the first cache miss
+ * and freed along with the inode.
+ */
+struct ra_history {
+	spinlock_t		lock;		/* serialises cache misses */
+	unsigned char		pattern;	/* RA_PATTERN_* of the last miss */
+	unsigned char		scale;		/* read-around, in 1/8 of ra_pages */
+	pgoff_t			last_miss;	/* offset of the last cache miss */
+	pgoff_t			next;		/* end of what was read after it */
+	long			stride;		/* distance between the last misses */
+	pgoff_t			win_start;	/* window opened by the last miss */
+	unsigned long		win_read;	/* pages of it read ahead */
+	unsigned long		win_used;	/* pages of it accessed since */
+};
+#endif
+
 struct address_space {
 	struct inode		*host;		/* owner: inode, block_device */
 	struct radix_tree_root	page_tree;	/* radix tree of all pages */
@@ -414,6 +442,10 @@ struct address_space {
 	/* Protected by tree_lock together with the radix tree */
 	unsigned long		nrpages;	/* number of total pages */
 	unsigned long		nrshadows;	/* number of shadow entries */
+	atomic_long_t		nrrefaults;	/* refaults of evicted pages */
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+	struct ra_history	*ra_hist;	/* access history for readahead */
+#endif
 	pgoff_t			writeback_index;/* writeback starts here */
 	const struct address_space_operations *a_ops;	/* methods */
 	unsigned long		flags;		/* error bits/gfp mask */
@@ -24,6 +24,7 @@ struct mempolicy;
 struct anon_vma;
 struct anon_vma_chain;
 struct file_ra_state;
+struct ra_history;
 struct user_struct;
 struct writeback_control;
 struct super_block;
@@ -710,11 +711,12 @@ void do_set_pte(struct vm_area_struct *vma, unsigned long address,
  * sets it, so none of the operations on it need to be atomic.
  */
 
-/* Page flags: | [SECTION] | [NODE] | ZONE | [LAST_CPUPID] | ... | FLAGS | */
+/* Page flags: | [SECTION] | [NODE] | ZONE | [LAST_CPUPID] | [LRU_GEN] | ... | FLAGS | */
 #define SECTIONS_PGOFF		((sizeof(unsigned long)*8) - SECTIONS_WIDTH)
 #define NODES_PGOFF		(SECTIONS_PGOFF - NODES_WIDTH)
 #define ZONES_PGOFF		(NODES_PGOFF - ZONES_WIDTH)
 #define LAST_CPUPID_PGOFF	(ZONES_PGOFF - LAST_CPUPID_WIDTH)
+#define LRU_GEN_PGOFF		(LAST_CPUPID_PGOFF - LRU_GEN_WIDTH)
 
 /*
  * Define the bit shifts to access each section.  For non-existent
@@ -743,11 +745,16 @@ void do_set_pte(struct vm_area_struct *vma, unsigned long address,
 #error SECTIONS_WIDTH+NODES_WIDTH+ZONES_WIDTH > BITS_PER_LONG - NR_PAGEFLAGS
 #endif
 
+#if SECTIONS_WIDTH+NODES_WIDTH+ZONES_WIDTH+LAST_CPUPID_WIDTH+LRU_GEN_WIDTH > BITS_PER_LONG - NR_PAGEFLAGS
+#error "No space for the multi-gen LRU generation in page flags"
+#endif
+
 #define ZONES_MASK		((1UL << ZONES_WIDTH) - 1)
 #define NODES_MASK		((1UL << NODES_WIDTH) - 1)
 #define SECTIONS_MASK		((1UL << SECTIONS_WIDTH) - 1)
 #define LAST_CPUPID_MASK	((1UL << LAST_CPUPID_SHIFT) - 1)
 #define ZONEID_MASK		((1UL << ZONEID_SHIFT) - 1)
+#define LRU_GEN_MASK		(((1UL << LRU_GEN_WIDTH) - 1) << LRU_GEN_PGOFF)
 
 static inline enum zone_type page_zonenum(const struct page *page)
 {
@@ -1928,6 +1935,22 @@ void page_cache_async_readahead(struct address_space *mapping,
 
 unsigned long max_sane_readahead(unsigned long nr);
 
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+extern int sysctl_adaptive_readahead;
+void ra_history_free(struct address_space *mapping);
+unsigned long adaptive_readaround(struct address_space *mapping,
+				  struct file *filp, pgoff_t offset,
+				  unsigned long ra_pages);
+#else
+static inline unsigned long adaptive_readaround(struct address_space *mapping,
+						struct file *filp,
+						pgoff_t offset,
+						unsigned long ra_pages)
+{
+	return ra_pages;
+}
+#endif
+
 extern unsigned long stack_guard_gap;
 /* Generic expand stack which grows the stack according to GROWS{UP,DOWN} */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
@@ -2203,9 +2226,22 @@ struct reclaim_param {
 	int nr_to_reclaim;
 	/* pages reclaimed */
 	int nr_reclaimed;
+	/* only move the pages to the inactive list */
+	bool deactivate;
+	/* from madvise(): skip shared pages, isolate a whole pmd at once */
+	bool madvise;
 };
 extern struct reclaim_param reclaim_task_anon(struct task_struct *task,
 		int nr_to_reclaim);
+extern struct reclaim_param reclaim_vma_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end, bool deactivate);
+
+static inline void count_swap_refault(struct mm_struct *mm)
+{
+	atomic_long_inc(&mm->reclaim_stat.swap_refaults);
+}
+#else
+static inline void count_swap_refault(struct mm_struct *mm) { }
 #endif
 
 #endif /* __KERNEL__ */
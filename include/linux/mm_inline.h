@@ -3,6 +3,7 @@
 
 #include <linux/huge_mm.h>
 #include <linux/swap.h>
+#include <linux/jump_label.h>
 
 /**
  * page_is_file_cache - should the page be on a file LRU or anon LRU?
@@ -22,12 +23,140 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+extern struct static_key lru_gen_key;
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_key_false(&lru_gen_key);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Generation of a page on a multi-gen LRU list, -1 for any other page */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((ACCESS_ONCE(page->flags) & LRU_GEN_MASK) >>
+		     LRU_GEN_PGOFF) - 1;
+}
+
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+	unsigned long old_flags, flags;
+
+	do {
+		old_flags = flags = ACCESS_ONCE(page->flags);
+		flags &= ~LRU_GEN_MASK;
+		flags |= (unsigned long)(gen + 1) << LRU_GEN_PGOFF;
+	} while (unlikely(cmpxchg(&page->flags, old_flags, flags) != old_flags));
+}
+
+static __always_inline bool lru_gen_add_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type = is_file_lru(lru);
+	unsigned long seq;
+	int gen;
+
+	if (!lru_gen_enabled() || lru == LRU_UNEVICTABLE)
+		return false;
+
+	/*
+	 * Active pages go to the youngest generation. Anon pages that never
+	 * went to swap and pages that reclaim is writing back get another
+	 * aging cycle, everything else starts out in the oldest generation
+	 * like it would on the inactive list.
+	 */
+	if (is_active_lru(lru))
+		seq = lrugen->max_seq;
+	else if ((!type && !PageSwapCache(page)) ||
+		 (PageReclaim(page) && (PageDirty(page) || PageWriteback(page))))
+		seq = lrugen->max_seq - 1;
+	else
+		seq = lrugen->min_seq[type];
+
+	gen = lru_gen_from_seq(seq);
+	set_page_lru_gen(page, gen);
+	lrugen->nr_pages[gen][type] += hpage_nr_pages(page);
+	list_add(&page->lru, &lrugen->lists[gen][type]);
+
+	return true;
+}
+
+static __always_inline bool lru_gen_del_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	set_page_lru_gen(page, -1);
+	lruvec->lrugen.nr_pages[gen][is_file_lru(lru)] -= hpage_nr_pages(page);
+	list_del(&page->lru);
+
+	return true;
+}
+
+/* Move a page to the end of the oldest generation, reclaim's next pick */
+static __always_inline bool lru_gen_rotate_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type = is_file_lru(lru);
+	int gen = page_lru_gen(page);
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+	if (gen < 0)
+		return false;
+
+	if (gen != old_gen) {
+		int nr_pages = hpage_nr_pages(page);
+
+		set_page_lru_gen(page, old_gen);
+		lrugen->nr_pages[gen][type] -= nr_pages;
+		lrugen->nr_pages[old_gen][type] += nr_pages;
+	}
+	list_move_tail(&page->lru, &lrugen->lists[old_gen][type]);
+
+	return true;
+}
+#else
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	return false;
+}
+
+static inline bool lru_gen_rotate_page(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	return false;
+}
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-	list_add(&page->lru, &lruvec->lists[lru]);
+	if (!lru_gen_add_page(page, lruvec, lru))
+		list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
 }
 
@@ -36,10 +165,23 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 {
 	int nr_pages = hpage_nr_pages(page);
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
-	list_del(&page->lru);
+	if (!lru_gen_del_page(page, lruvec, lru))
+		list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
 }
 
+/*
+ * move_page_to_lru_tail - queue a page on @lru for reclaim to look at next
+ *
+ * The caller holds the zone's lru_lock and the page is on @lru already.
+ */
+static __always_inline void move_page_to_lru_tail(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	if (!lru_gen_rotate_page(page, lruvec, lru))
+		list_move_tail(&page->lru, &lruvec->lists[lru]);
+}
+
 /**
  * page_lru_base_type - which LRU list type should a page be on?
  * @page: the page to test
@@ -361,6 +361,18 @@ struct mm_rss_stat {
 };
 
 struct kioctx_table;
+
+#ifdef CONFIG_PROCESS_RECLAIM
+/* Refault feedback for process reclaim, see mm/process_reclaim.c */
+struct process_reclaim_stat {
+	atomic_long_t swap_refaults;	/* swapins that read the swap device */
+	unsigned long reclaimed;	/* pages taken by process reclaim */
+	unsigned long last_reclaimed;	/* pages taken by the last pass */
+	unsigned long last_refaults;	/* swap_refaults at the last pass */
+	unsigned long last_stamp;	/* jiffies of the last pass */
+	int refault_ratio;		/* average % of pages swapped back in */
+};
+#endif
 struct mm_struct {
 	struct vm_area_struct *mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
@@ -477,6 +489,13 @@ struct mm_struct {
 #ifdef CONFIG_MSM_APP_SETTINGS
 	int app_setting;
 #endif
+#ifdef CONFIG_PROCESS_RECLAIM
+	struct process_reclaim_stat reclaim_stat;
+#endif
+#ifdef CONFIG_LRU_GEN
+	/* Aging walk that last looked at this mm, see mm/vmscan.c */
+	unsigned long lru_gen_seq;
+#endif
 };
 
 static inline void mm_init_cpumask(struct mm_struct *mm)
@@ -198,10 +198,13 @@ extern void mmc_set_data_timeout(struct mmc_data *, const struct mmc_card *);
 extern unsigned int mmc_align_data_size(struct mmc_card *, unsigned int);
 
 extern int __mmc_claim_host(struct mmc_host *host, atomic_t *abort);
+extern int __mmc_claim_host_ctx(struct mmc_host *host, void *ctx,
+				atomic_t *abort);
 extern void mmc_release_host(struct mmc_host *host);
 extern int mmc_try_claim_host(struct mmc_host *host, unsigned int delay);
 
 extern void mmc_get_card(struct mmc_card *card);
+extern void mmc_get_card_ctx(struct mmc_card *card, void *ctx);
 extern void mmc_put_card(struct mmc_card *card);
 extern void __mmc_put_card(struct mmc_card *card);
 
@@ -538,6 +538,7 @@ struct mmc_host {
 
 	wait_queue_head_t	wq;
 	struct task_struct	*claimer;	/* task that has host claimed */
+	void			*claim_ctx;	/* context host is claimed for */
 	struct task_struct	*suspend_task;
 	int			claim_cnt;	/* "claim" nesting count */
 
@@ -233,12 +233,36 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-gen LRU, evictable pages are kept on generation lists
+ * instead of the active and inactive lists. Both types share the youngest
+ * generation, max_seq, which aging advances. Eviction takes pages from the
+ * oldest generation of a type, min_seq, and retires it once it is empty.
+ * At least MIN_NR_GENS generations are kept so that recently used pages
+ * are never evicted right away.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+struct lru_gen {
+	unsigned long max_seq;
+	unsigned long min_seq[2];
+	/* Indexed by seq % MAX_NR_GENS, then anon [0] or file [1] */
+	struct list_head lists[MAX_NR_GENS][2];
+	long nr_pages[MAX_NR_GENS][2];
+};
+#endif
+
 struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen lrugen;
+#endif
 };
 
 /* Mask used at gathering information at once (see memcontrol.c) */
@@ -518,6 +542,17 @@ struct zone {
 	/* Evictions & activations on the inactive file list */
 	atomic_long_t		inactive_age;
 
+	/*
+	 * Refault feedback for reclaim, sampled from inactive_age and
+	 * WORKINGSET_ACTIVATE at most once per second. While the share of
+	 * activating refaults is above vm.refault_protect_ratio the active
+	 * file list is left alone.
+	 */
+	unsigned long		refault_stamp;
+	unsigned long		refault_age;
+	unsigned long		refault_activate;
+	bool			refault_protect;
+
 	/*
 	 * When free pages are below this point, additional steps are taken
 	 * when reading the number of free pages to avoid per-cpu counter
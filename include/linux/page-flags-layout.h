@@ -79,6 +79,16 @@
 #define LAST_CPUPID_WIDTH 0
 #endif
 
+/*
+ * The multi-gen LRU keeps the generation of a page, plus one so that zero
+ * means "not on a generation list", next to the other fields.
+ */
+#ifdef CONFIG_LRU_GEN
+#define LRU_GEN_WIDTH		3
+#else
+#define LRU_GEN_WIDTH		0
+#endif
+
 /*
  * We are going to use the flags for the page to node mapping if its in
  * there.  This includes the case where there is no node, so it is implicit.
@@ -245,6 +245,30 @@ static inline struct page *page_cache_alloc_readahead(struct address_space *x)
 				  __GFP_COLD | __GFP_NORETRY | __GFP_NOWARN);
 }
 
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+/*
+ * The page at @index was found in the page cache: count it as used if it
+ * belongs to the window adaptive readahead is watching.
+ */
+static inline void ra_history_access(struct address_space *mapping,
+				     pgoff_t index)
+{
+	struct ra_history *h = ACCESS_ONCE(mapping->ra_hist);
+	unsigned long bit;
+
+	if (!h)
+		return;
+	bit = index - ACCESS_ONCE(h->win_start);
+	if (bit < BITS_PER_LONG && !test_bit(bit, &h->win_used))
+		set_bit(bit, &h->win_used);
+}
+#else
+static inline void ra_history_access(struct address_space *mapping,
+				     pgoff_t index)
+{
+}
+#endif
+
 typedef int filler_t(void *, struct page *);
 
 pgoff_t page_cache_next_hole(struct address_space *mapping,
@@ -0,0 +1,29 @@
+#ifndef _LINUX_PREFETCH_TRACE_H
+#define _LINUX_PREFETCH_TRACE_H
+
+#include <linux/fs.h>
+#include <linux/jump_label.h>
+#include <uapi/linux/prefetch_trace.h>
+
+#ifdef CONFIG_PREFETCH_TRACE
+
+extern struct static_key prefetch_trace_key;
+
+void __prefetch_trace_fault(struct file *file, pgoff_t index);
+
+/* Page @index of @file was faulted in, record it if a trace is running */
+static inline void prefetch_trace_fault(struct file *file, pgoff_t index)
+{
+	if (static_key_false(&prefetch_trace_key))
+		__prefetch_trace_fault(file, index);
+}
+
+#else /* CONFIG_PREFETCH_TRACE */
+
+static inline void prefetch_trace_fault(struct file *file, pgoff_t index)
+{
+}
+
+#endif /* CONFIG_PREFETCH_TRACE */
+
+#endif /* _LINUX_PREFETCH_TRACE_H */
@@ -14,6 +14,7 @@ extern int isolate_lru_page(struct page *page);
 extern void putback_lru_page(struct page *page);
 extern unsigned long reclaim_pages_from_list(struct list_head *page_list,
 					     struct vm_area_struct *vma);
+extern unsigned long deactivate_pages_from_list(struct list_head *page_list);
 
 /*
  * The anon_vma heads a list of private "related" vmas, to scan if
@@ -1757,7 +1757,9 @@ struct task_struct {
 
 	struct list_head tasks;
 #ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
-       struct rb_node adj_node;
+	struct rb_node adj_node;
+	short lmk_adj;			/* index key, see lowmemorykiller.c */
+	unsigned long lmk_rss;
 #endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
@@ -1788,6 +1790,9 @@ struct task_struct {
 	unsigned sched_reset_on_fork:1;
 	unsigned sched_contributes_to_load:1;
 	unsigned sched_migrated:1;
+#ifdef CONFIG_PSI
+	unsigned sched_psi_wake_requeue:1;
+#endif
 
 #ifdef CONFIG_COMPAT_BRK
 	unsigned brk_randomized:1;
@@ -2074,6 +2079,10 @@ struct task_struct {
 #ifdef	CONFIG_TASK_DELAY_ACCT
 	struct task_delay_info *delays;
 #endif
+#ifdef CONFIG_PSI
+	/* Pressure stall state */
+	unsigned int psi_flags;
+#endif
 #ifdef CONFIG_FAULT_INJECTION
 	int make_it_fail;
 #endif
@@ -2199,9 +2208,13 @@ static inline struct pid *task_tgid(struct task_struct *task)
 #ifdef CONFIG_ANDROID_LMK_ADJ_RBTREE
 extern void add_2_adj_tree(struct task_struct *task);
 extern void delete_from_adj_tree(struct task_struct *task);
+extern void adj_tree_update_adj(struct task_struct *task);
+extern void adj_tree_update_rss(struct mm_struct *mm);
 #else
 static inline void add_2_adj_tree(struct task_struct *task) { }
 static inline void delete_from_adj_tree(struct task_struct *task) { }
+static inline void adj_tree_update_adj(struct task_struct *task) { }
+static inline void adj_tree_update_rss(struct mm_struct *mm) { }
 #endif
 
 /*
@@ -2421,6 +2434,7 @@ extern int task_free_unregister(struct notifier_block *n);
 #define PF_KTHREAD	0x00200000	/* I am a kernel thread */
 #define PF_RANDOMIZE	0x00400000	/* randomize virtual address space */
 #define PF_SWAPWRITE	0x00800000	/* Allowed to write to swap */
+#define PF_MEMSTALL	0x01000000	/* Stalled due to lack of memory */
 #define PF_NO_SETAFFINITY 0x04000000	/* Userland is not allowed to meddle with cpus_allowed */
 #define PF_MCE_EARLY    0x08000000      /* Early kill for mce process policy */
 #define PF_MUTEX_TESTER	0x20000000	/* Thread belongs to the rt mutex tester */
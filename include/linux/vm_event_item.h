@@ -38,6 +38,14 @@ enum vm_event_item { PGPGIN, PGPGOUT, PGPGOUTCLEAN, PSWPIN, PSWPOUT,
 		KSWAPD_LOW_WMARK_HIT_QUICKLY, KSWAPD_HIGH_WMARK_HIT_QUICKLY,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
 		DROP_PAGECACHE, DROP_SLAB,
+#ifdef CONFIG_PROCESS_RECLAIM
+		MADVISE_COLD, MADVISE_PAGEOUT,
+#endif
+#ifdef CONFIG_LRU_GEN
+		LRU_GEN_AGING, LRU_GEN_WALK_MM, LRU_GEN_WALK_PTE,
+		LRU_GEN_PROMOTE, LRU_GEN_PROTECT, LRU_GEN_FORCE_AGE,
+		LRU_GEN_RMAP_SKIP,
+#endif
 #ifdef CONFIG_NUMA_BALANCING
 		NUMA_PTE_UPDATES,
 		NUMA_HUGE_PTE_UPDATES,
@@ -37,6 +37,9 @@ enum zs_mapmode {
 struct zs_pool_stats {
 	/* How many pages were migrated (freed) */
 	unsigned long pages_compacted;
+	/* zs_malloc/zs_free calls served (or not) by per-cpu magazines */
+	unsigned long mag_hit;
+	unsigned long mag_miss;
 };
 
 struct zs_pool;
@@ -45,6 +48,8 @@ struct zs_pool *zs_create_pool(const char *name);
 void zs_destroy_pool(struct zs_pool *pool);
 
 unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags);
+int zs_malloc_bulk(struct zs_pool *pool, const size_t *sizes,
+		unsigned long *handles, int nr, gfp_t flags);
 void zs_free(struct zs_pool *pool, unsigned long obj);
 
 void *zs_map_object(struct zs_pool *pool, unsigned long handle,
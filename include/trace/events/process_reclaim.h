@@ -79,6 +79,31 @@ TRACE_EVENT(process_reclaim_eff,
 		__entry->reclaim_avg_efficiency)
 );
 
+TRACE_EVENT(process_reclaim_refault,
+
+	TP_PROTO(pid_t pid, int anon, int refault_ratio, int nr_reclaimed),
+
+	TP_ARGS(pid, anon, refault_ratio, nr_reclaimed),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(int, anon)
+		__field(int, refault_ratio)
+		__field(int, nr_reclaimed)
+	),
+
+	TP_fast_assign(
+		__entry->pid		= pid;
+		__entry->anon		= anon;
+		__entry->refault_ratio	= refault_ratio;
+		__entry->nr_reclaimed	= nr_reclaimed;
+	),
+
+	TP_printk("pid %d, anon %d, refault %d%%, reclaimed %d",
+		__entry->pid, __entry->anon, __entry->refault_ratio,
+		__entry->nr_reclaimed)
+);
+
 #endif
 
 #include <trace/define_trace.h>
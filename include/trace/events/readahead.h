@@ -0,0 +1,92 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+
+#define show_ra_pattern(pattern)					\
+	__print_symbolic(pattern,					\
+		{ RA_PATTERN_RANDOM,	"random" },			\
+		{ RA_PATTERN_SEQ,	"seq" },			\
+		{ RA_PATTERN_STRIDE,	"stride" })
+
+TRACE_EVENT(readahead_miss,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, int pattern, long stride,
+		 unsigned int scale),
+
+	TP_ARGS(mapping, offset, req_size, pattern, stride, scale),
+
+	TP_STRUCT__entry(
+		__field(dev_t, s_dev)
+		__field(unsigned long, i_ino)
+		__field(pgoff_t, offset)
+		__field(unsigned long, req_size)
+		__field(int, pattern)
+		__field(long, stride)
+		__field(unsigned int, scale)
+	),
+
+	TP_fast_assign(
+		if (mapping->host->i_sb)
+			__entry->s_dev = mapping->host->i_sb->s_dev;
+		else
+			__entry->s_dev = mapping->host->i_rdev;
+		__entry->i_ino = mapping->host->i_ino;
+		__entry->offset = offset;
+		__entry->req_size = req_size;
+		__entry->pattern = pattern;
+		__entry->stride = stride;
+		__entry->scale = scale;
+	),
+
+	TP_printk("dev %d:%d ino %lx offset=%lu req=%lu pattern=%s stride=%ld scale=%u",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino, (unsigned long)__entry->offset,
+		__entry->req_size, show_ra_pattern(__entry->pattern),
+		__entry->stride, __entry->scale)
+);
+
+TRACE_EVENT(readahead_window,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t start,
+		 unsigned int read, unsigned int hits),
+
+	TP_ARGS(mapping, start, read, hits),
+
+	TP_STRUCT__entry(
+		__field(dev_t, s_dev)
+		__field(unsigned long, i_ino)
+		__field(pgoff_t, start)
+		__field(unsigned int, read)
+		__field(unsigned int, hits)
+	),
+
+	TP_fast_assign(
+		if (mapping->host->i_sb)
+			__entry->s_dev = mapping->host->i_sb->s_dev;
+		else
+			__entry->s_dev = mapping->host->i_rdev;
+		__entry->i_ino = mapping->host->i_ino;
+		__entry->start = start;
+		__entry->read = read;
+		__entry->hits = hits;
+	),
+
+	TP_printk("dev %d:%d ino %lx start=%lu read=%u hits=%u misses=%u",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino, (unsigned long)__entry->start,
+		__entry->read, __entry->hits,
+		__entry->read - __entry->hits)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
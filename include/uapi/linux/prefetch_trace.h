@@ -0,0 +1,43 @@
+#ifndef _UAPI_LINUX_PREFETCH_TRACE_H
+#define _UAPI_LINUX_PREFETCH_TRACE_H
+
+#include <linux/types.h>
+
+/*
+ * Page cache prefetch trace, as read from /proc/prefetch/record and
+ * written to /proc/prefetch/replay. Fields are in native byte order and
+ * page offsets are in pages of 1 << page_shift bytes:
+ *
+ *	struct prefetch_trace_header	header;
+ *	struct prefetch_trace_file	files[nr_files];
+ *	struct prefetch_trace_range	ranges[nr_ranges];
+ *	char				paths[paths_size];
+ *
+ * Ranges are in the order they were first faulted on, paths are NUL
+ * terminated.
+ */
+#define PREFETCH_TRACE_MAGIC	0x50465452	/* "PFTR" */
+#define PREFETCH_TRACE_VERSION	1
+
+struct prefetch_trace_header {
+	__u32	magic;
+	__u16	version;
+	__u16	page_shift;
+	__u32	nr_files;
+	__u32	nr_ranges;
+	__u32	paths_size;
+};
+
+struct prefetch_trace_file {
+	__u64	ino;		/* inode number when recorded */
+	__u32	path;		/* offset of the path in paths */
+	__u32	pad;
+};
+
+struct prefetch_trace_range {
+	__u32	file;		/* index into files */
+	__u32	start;		/* first page */
+	__u32	nr;		/* number of pages */
+};
+
+#endif /* _UAPI_LINUX_PREFETCH_TRACE_H */
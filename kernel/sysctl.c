@@ -1345,6 +1345,26 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
 	},
+	{
+		.procname	= "refault_protect_ratio",
+		.data		= &vm_refault_protect_ratio,
+		.maxlen		= sizeof(vm_refault_protect_ratio),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+	{
+		.procname	= "adaptive_readahead",
+		.data		= &sysctl_adaptive_readahead,
+		.maxlen		= sizeof(sysctl_adaptive_readahead),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 	{
 		.procname	= "nr_hugepages",
@@ -0,0 +1,119 @@
+/*
+ * Benchmark for the UKSM NEON page helpers
+ *
+ * Measures how many pages per second UKSM can compare and check for zero
+ * content with the generic code and with the NEON versions from
+ * mm/uksm_arm64.h. Identical and all zero pages are used, the worst case
+ * where every byte has to be looked at.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+
+#include "../mm/uksm_arm64.h"
+
+static unsigned int loops = 100000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "pages processed per test");
+
+static int generic_cmp(const void *s1, const void *s2)
+{
+	return memcmp(s1, s2, PAGE_SIZE);
+}
+
+static int neon_cmp(const void *s1, const void *s2)
+{
+	return uksm_memcmp(s1, s2, PAGE_SIZE);
+}
+
+static int generic_zero(const void *s1, const void *s2)
+{
+	const unsigned long *src = s1;
+	size_t i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*src); i++) {
+		if (src[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static int neon_zero(const void *s1, const void *s2)
+{
+	return uksm_neon_is_full_zero(s1, PAGE_SIZE);
+}
+
+static void run_test(const char *name, int (*fn)(const void *, const void *),
+		     const void *s1, const void *s2, int expect)
+{
+	unsigned int i;
+	int bad = 0;
+	ktime_t start;
+	s64 ns;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		if (fn(s1, s2) != expect)
+			bad++;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("%s: %u pages, %lld ns, %llu pages/s%s\n", name, loops, ns,
+		ns ? div64_u64((u64)loops * NSEC_PER_SEC, ns) : 0ULL,
+		bad ? ", WRONG RESULT" : "");
+}
+
+static int __init uksm_page_test_init(void)
+{
+	struct page *p1, *p2;
+	void *a1, *a2;
+	int ret = -ENOMEM;
+
+	uksm_neon_init(true);
+	if (!uksm_use_neon)
+		return -ENODEV;
+
+	p1 = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	p2 = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!p1 || !p2)
+		goto out;
+
+	a1 = page_address(p1);
+	a2 = page_address(p2);
+
+	run_test("zero generic", generic_zero, a1, NULL, 1);
+	run_test("zero neon", neon_zero, a1, NULL, 1);
+
+	memset(a1, 0x5a, PAGE_SIZE);
+	memset(a2, 0x5a, PAGE_SIZE);
+	run_test("cmp generic", generic_cmp, a1, a2, 0);
+	run_test("cmp neon", neon_cmp, a1, a2, 0);
+
+	/* Fail the load so the benchmark can simply be run again */
+	ret = -EAGAIN;
+out:
+	if (p2)
+		__free_page(p2);
+	if (p1)
+		__free_page(p1);
+	return ret;
+}
+
+static void __exit uksm_page_test_exit(void)
+{
+}
+
+module_init(uksm_page_test_init)
+module_exit(uksm_page_test_exit)
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("UKSM NEON page helper benchmark");
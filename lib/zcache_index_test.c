@@ -0,0 +1,251 @@
+/*
+ * Benchmark for the zcache inode index
+ *
+ * Compares the former zcache index, an rbtree of inodes under a pool wide
+ * rwlock, with the RCU protected inode hash table zcache uses now. Each
+ * online cpu runs the lookup path of zcache_load_page(): find the inode,
+ * take a reference, look the page up in its radix tree under the per
+ * inode lock and drop the reference again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/hashtable.h>
+#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
+#include <linux/random.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+
+static unsigned int nr_inodes = 4096;
+module_param(nr_inodes, uint, 0444);
+MODULE_PARM_DESC(nr_inodes, "number of inodes in the index");
+
+static unsigned int pages_per_inode = 16;
+module_param(pages_per_inode, uint, 0444);
+MODULE_PARM_DESC(pages_per_inode, "number of pages per inode");
+
+static unsigned int loops = 1000000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "lookups per cpu");
+
+#define TEST_HASH_BITS	10
+
+struct test_inode {
+	struct rb_node rb;
+	struct hlist_node hash;
+	int ino;
+	struct radix_tree_root ratree;
+	spinlock_t ra_lock;
+	struct kref refcount;
+};
+
+static struct test_inode *inodes;
+
+static struct rb_root rbtree = RB_ROOT;
+static DEFINE_RWLOCK(rb_lock);
+
+static DEFINE_HASHTABLE(inode_hash, TEST_HASH_BITS);
+
+static void test_inode_release(struct kref *kref)
+{
+	/* inodes are static for the duration of the test */
+}
+
+static struct test_inode *rb_find_get(int ino)
+{
+	struct rb_node *node;
+	struct test_inode *entry = NULL;
+	unsigned long flags;
+
+	read_lock_irqsave(&rb_lock, flags);
+	node = rbtree.rb_node;
+	while (node) {
+		entry = rb_entry(node, struct test_inode, rb);
+		if (entry->ino > ino)
+			node = node->rb_left;
+		else if (entry->ino < ino)
+			node = node->rb_right;
+		else
+			break;
+	}
+	if (node)
+		kref_get(&entry->refcount);
+	else
+		entry = NULL;
+	read_unlock_irqrestore(&rb_lock, flags);
+
+	return entry;
+}
+
+static void rb_insert(struct test_inode *inode)
+{
+	struct rb_node **link = &rbtree.rb_node, *parent = NULL;
+	struct test_inode *entry;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct test_inode, rb);
+		if (entry->ino > inode->ino)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&inode->rb, parent, link);
+	rb_insert_color(&inode->rb, &rbtree);
+}
+
+static struct test_inode *hash_find_get(int ino)
+{
+	struct test_inode *entry;
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu(inode_hash, entry, hash, ino) {
+		if (entry->ino == ino) {
+			if (!kref_get_unless_zero(&entry->refcount))
+				entry = NULL;
+			rcu_read_unlock();
+			return entry;
+		}
+	}
+	rcu_read_unlock();
+
+	return NULL;
+}
+
+struct test_ctx {
+	struct test_inode *(*find_get)(int ino);
+	atomic_t running;
+	struct completion done;
+	atomic64_t hits;
+};
+
+static int test_thread(void *data)
+{
+	struct test_ctx *ctx = data;
+	struct test_inode *inode;
+	struct rnd_state rnd;
+	unsigned long flags;
+	unsigned int i;
+	u64 hits = 0;
+	u32 r;
+
+	prandom_seed_state(&rnd,
+			3141592653589793238ULL + raw_smp_processor_id());
+
+	for (i = 0; i < loops; i++) {
+		r = prandom_u32_state(&rnd);
+		inode = ctx->find_get(r % nr_inodes);
+		if (!inode)
+			continue;
+
+		spin_lock_irqsave(&inode->ra_lock, flags);
+		if (radix_tree_lookup(&inode->ratree,
+				(r >> 16) % pages_per_inode))
+			hits++;
+		spin_unlock_irqrestore(&inode->ra_lock, flags);
+
+		kref_put(&inode->refcount, test_inode_release);
+	}
+
+	atomic64_add(hits, &ctx->hits);
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+
+	return 0;
+}
+
+static void run_test(const char *name, struct test_inode *(*find_get)(int))
+{
+	struct test_ctx ctx;
+	struct task_struct *task;
+	ktime_t start;
+	s64 ns;
+	int cpu, nr_cpus = num_online_cpus();
+
+	ctx.find_get = find_get;
+	atomic_set(&ctx.running, nr_cpus);
+	atomic64_set(&ctx.hits, 0);
+	init_completion(&ctx.done);
+
+	get_online_cpus();
+	start = ktime_get();
+	for_each_online_cpu(cpu) {
+		task = kthread_create(test_thread, &ctx, "zci_test/%d", cpu);
+		if (IS_ERR(task)) {
+			if (atomic_dec_and_test(&ctx.running))
+				complete(&ctx.done);
+			continue;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+	}
+	put_online_cpus();
+
+	wait_for_completion(&ctx.done);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("%s: %d cpus, %u lookups/cpu, %lld ns, %llu ns/lookup, %lld hits\n",
+		name, nr_cpus, loops, ns,
+		div_u64(ns, loops), (long long)atomic64_read(&ctx.hits));
+}
+
+static int __init zcache_index_test_init(void)
+{
+	unsigned int i, j;
+	int ret = 0;
+
+	if (!nr_inodes || !pages_per_inode)
+		return -EINVAL;
+
+	inodes = vzalloc(nr_inodes * sizeof(*inodes));
+	if (!inodes)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_inodes; i++) {
+		struct test_inode *inode = &inodes[i];
+
+		inode->ino = i;
+		INIT_RADIX_TREE(&inode->ratree, GFP_KERNEL);
+		spin_lock_init(&inode->ra_lock);
+		kref_init(&inode->refcount);
+		for (j = 0; j < pages_per_inode; j++) {
+			ret = radix_tree_insert(&inode->ratree, j, inode);
+			if (ret)
+				goto out;
+		}
+		rb_insert(inode);
+		hash_add_rcu(inode_hash, &inode->hash, inode->ino);
+	}
+
+	run_test("rbtree", rb_find_get);
+	run_test("hash", hash_find_get);
+
+out:
+	for (i = 0; i < nr_inodes; i++)
+		for (j = 0; j < pages_per_inode; j++)
+			radix_tree_delete(&inodes[i].ratree, j);
+	vfree(inodes);
+
+	/* Fail the load so the benchmark can simply be run again */
+	return ret ? ret : -EAGAIN;
+}
+
+static void __exit zcache_index_test_exit(void)
+{
+}
+
+module_init(zcache_index_test_init)
+module_exit(zcache_index_test_exit)
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("zcache inode index benchmark");
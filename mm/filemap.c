@@ -35,6 +35,8 @@
 #include <linux/memcontrol.h>
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
+#include <linux/psi.h>
+#include <linux/prefetch_trace.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -630,7 +632,7 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 		 * recently, in which case it should be activated like
 		 * any other repeatedly accessed page.
 		 */
-		if (shadow && workingset_refault(shadow)) {
+		if (shadow && workingset_refault(mapping, page, shadow)) {
 			SetPageActive(page);
 			workingset_activation(page);
 		} else
@@ -680,25 +682,59 @@ wait_queue_head_t *page_waitqueue(struct page *page)
 }
 EXPORT_SYMBOL(page_waitqueue);
 
+/*
+ * A page that was refaulted while its shadow entry was still recent is
+ * activated by add_to_page_cache_lru() before the read is submitted.
+ * Waiting for such a page to come in means the workingset does not fit
+ * in memory, which counts as a memory stall rather than plain IO.
+ */
+static inline bool page_thrashing(struct page *page, int bit_nr)
+{
+	return bit_nr == PG_locked && PageActive(page) && !PageUptodate(page);
+}
+
 void wait_on_page_bit(struct page *page, int bit_nr)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, bit_nr);
+	unsigned long pflags;
+	bool thrashing;
+
+	if (!test_bit(bit_nr, &page->flags))
+		return;
+
+	thrashing = page_thrashing(page, bit_nr);
+	if (thrashing)
+		psi_memstall_enter(&pflags);
 
-	if (test_bit(bit_nr, &page->flags))
-		__wait_on_bit(page_waitqueue(page), &wait, bit_wait_io,
+	__wait_on_bit(page_waitqueue(page), &wait, bit_wait_io,
 							TASK_UNINTERRUPTIBLE);
+
+	if (thrashing)
+		psi_memstall_leave(&pflags);
 }
 EXPORT_SYMBOL(wait_on_page_bit);
 
 int wait_on_page_bit_killable(struct page *page, int bit_nr)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, bit_nr);
+	unsigned long pflags;
+	bool thrashing;
+	int ret;
 
 	if (!test_bit(bit_nr, &page->flags))
 		return 0;
 
-	return __wait_on_bit(page_waitqueue(page), &wait,
-			     bit_wait_io, TASK_KILLABLE);
+	thrashing = page_thrashing(page, bit_nr);
+	if (thrashing)
+		psi_memstall_enter(&pflags);
+
+	ret = __wait_on_bit(page_waitqueue(page), &wait,
+			    bit_wait_io, TASK_KILLABLE);
+
+	if (thrashing)
+		psi_memstall_leave(&pflags);
+
+	return ret;
 }
 
 int wait_on_page_bit_killable_timeout(struct page *page,
@@ -811,18 +847,37 @@ EXPORT_SYMBOL_GPL(page_endio);
 void __lock_page(struct page *page)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, PG_locked);
+	bool thrashing = page_thrashing(page, PG_locked);
+	unsigned long pflags;
+
+	if (thrashing)
+		psi_memstall_enter(&pflags);
 
 	__wait_on_bit_lock(page_waitqueue(page), &wait, bit_wait_io,
 							TASK_UNINTERRUPTIBLE);
+
+	if (thrashing)
+		psi_memstall_leave(&pflags);
 }
 EXPORT_SYMBOL(__lock_page);
 
 int __lock_page_killable(struct page *page)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, PG_locked);
+	bool thrashing = page_thrashing(page, PG_locked);
+	unsigned long pflags;
+	int ret;
+
+	if (thrashing)
+		psi_memstall_enter(&pflags);
 
-	return __wait_on_bit_lock(page_waitqueue(page), &wait,
+	ret = __wait_on_bit_lock(page_waitqueue(page), &wait,
 					bit_wait_io, TASK_KILLABLE);
+
+	if (thrashing)
+		psi_memstall_leave(&pflags);
+
+	return ret;
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
@@ -1498,6 +1553,7 @@ find_page:
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
+		ra_history_access(mapping, index);
 		if (PageReadahead(page)) {
 			page_cache_async_readahead(mapping,
 					ra, filp, page,
@@ -1813,6 +1869,9 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 	 * mmap read-around
 	 */
 	ra_pages = max_sane_readahead(ra->ra_pages);
+	ra_pages = adaptive_readaround(mapping, file, offset, ra_pages);
+	if (!ra_pages)
+		return;
 	ra->start = max_t(long, 0, offset - ra_pages / 2);
 	ra->size = ra_pages;
 	ra->async_size = ra_pages / 4;
@@ -1902,6 +1961,8 @@ retry_find:
 		if (!page)
 			goto no_cached_page;
 	}
+	ra_history_access(mapping, offset);
+	prefetch_trace_fault(file, offset);
 
 	if (!lock_page_or_retry(page, vma->vm_mm, vmf->flags)) {
 		page_cache_release(page);
@@ -2043,6 +2104,7 @@ repeat:
 		if (file->f_ra.mmap_miss > 0)
 			file->f_ra.mmap_miss--;
 		addr = address + (page->index - vmf->pgoff) * PAGE_SIZE;
+		prefetch_trace_fault(file, page->index);
 		do_set_pte(vma, addr, page, pte, false, false);
 		unlock_page(page);
 		goto next;
@@ -99,6 +99,14 @@ extern unsigned long highest_memmap_pfn;
 extern int isolate_lru_page(struct page *page);
 extern void putback_lru_page(struct page *page);
 extern bool zone_reclaimable(struct zone *zone);
+struct seq_file;
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_show_zone(struct seq_file *m, struct zone *zone);
+#else
+static inline void lru_gen_show_zone(struct seq_file *m, struct zone *zone)
+{
+}
+#endif
 
 /*
  * in mm/rmap.c:
@@ -19,6 +19,7 @@
 #include <linux/blkdev.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/vmstat.h>
 
 /*
  * Any behaviour which results in changes to the vma->vm_flags needs to
@@ -31,6 +32,8 @@ static int madvise_need_mmap_write(int behavior)
 	case MADV_REMOVE:
 	case MADV_WILLNEED:
 	case MADV_DONTNEED:
+	case MADV_COLD:
+	case MADV_PAGEOUT:
 		return 0;
 	default:
 		/* be safe, default to 1. list exceptions explicitly */
@@ -289,6 +292,51 @@ static long madvise_dontneed(struct vm_area_struct *vma,
 	return 0;
 }
 
+#ifdef CONFIG_PROCESS_RECLAIM
+/*
+ * Reclaiming file pages shows whether somebody else had them in memory,
+ * only allow it to those who could write the file anyway.
+ */
+static bool can_do_pageout(struct vm_area_struct *vma)
+{
+	struct inode *inode;
+
+	if (!vma->vm_file)
+		return true;
+
+	inode = file_inode(vma->vm_file);
+	return inode_owner_or_capable(inode) ||
+		inode_permission(inode, MAY_WRITE) == 0;
+}
+
+/*
+ * Application is done with these pages for now.  MADV_COLD moves them to
+ * the inactive lists so they are reclaimed before others, MADV_PAGEOUT
+ * reclaims them right away.  Pages are kept either way, they are read
+ * back in on the next access.
+ */
+static long madvise_cold_or_pageout(struct vm_area_struct *vma,
+				    struct vm_area_struct **prev,
+				    unsigned long start, unsigned long end,
+				    int behavior)
+{
+	struct reclaim_param rp;
+
+	*prev = vma;
+	if (vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP))
+		return -EINVAL;
+
+	if (behavior == MADV_PAGEOUT && !can_do_pageout(vma))
+		return 0;
+
+	rp = reclaim_vma_range(vma, start, end, behavior == MADV_COLD);
+	count_vm_events(behavior == MADV_COLD ? MADVISE_COLD : MADVISE_PAGEOUT,
+			rp.nr_reclaimed);
+
+	return 0;
+}
+#endif
+
 /*
  * Application wants to free up the pages and associated backing store.
  * This is effectively punching a hole into the middle of a file.
@@ -383,6 +431,11 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 		return madvise_willneed(vma, prev, start, end);
 	case MADV_DONTNEED:
 		return madvise_dontneed(vma, prev, start, end);
+#ifdef CONFIG_PROCESS_RECLAIM
+	case MADV_COLD:
+	case MADV_PAGEOUT:
+		return madvise_cold_or_pageout(vma, prev, start, end, behavior);
+#endif
 	default:
 		return madvise_behavior(vma, prev, start, end, behavior);
 	}
@@ -410,6 +463,10 @@ madvise_behavior_valid(int behavior)
 #endif
 	case MADV_DONTDUMP:
 	case MADV_DODUMP:
+#ifdef CONFIG_PROCESS_RECLAIM
+	case MADV_COLD:
+	case MADV_PAGEOUT:
+#endif
 		return 1;
 
 	default:
@@ -447,6 +504,10 @@ madvise_behavior_valid(int behavior)
  *  MADV_MERGEABLE - the application recommends that KSM try to merge pages in
  *		this area with pages of identical content from other such areas.
  *  MADV_UNMERGEABLE- cancel MADV_MERGEABLE: no longer merge pages with others.
+ *  MADV_COLD - the application won't touch the range for a while, so its
+ *		pages can be reclaimed before others.
+ *  MADV_PAGEOUT - the application won't touch the range for a while, so
+ *		its pages can be reclaimed right away.
  *
  * return values:
  *  zero    - success
@@ -102,6 +102,8 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_PGPGOUT,	/* # of pages paged out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+	MEM_CGROUP_EVENTS_REFAULT,	/* # of refaults of evicted cache */
+	MEM_CGROUP_EVENTS_ACTIVATE,	/* # of refaults that got activated */
 	MEM_CGROUP_EVENTS_NSTATS,
 };
 
@@ -110,6 +112,8 @@ static const char * const mem_cgroup_events_names[] = {
 	"pgpgout",
 	"pgfault",
 	"pgmajfault",
+	"workingset_refault",
+	"workingset_activate",
 };
 
 static const char * const mem_cgroup_lru_names[] = {
@@ -1293,6 +1297,29 @@ out:
 }
 EXPORT_SYMBOL(__mem_cgroup_count_vm_event);
 
+/**
+ * __mem_cgroup_count_refault - account a page cache refault
+ * @page: the refaulting page, already charged
+ * @activate: whether the refault distance made it go active
+ */
+void __mem_cgroup_count_refault(struct page *page, bool activate)
+{
+	struct page_cgroup *pc;
+	struct mem_cgroup *memcg;
+
+	rcu_read_lock();
+	pc = lookup_page_cgroup(page);
+	memcg = pc->mem_cgroup;
+	if (unlikely(!memcg || !PageCgroupUsed(pc)))
+		goto out;
+
+	this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_REFAULT]);
+	if (activate)
+		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_ACTIVATE]);
+out:
+	rcu_read_unlock();
+}
+
 /**
  * mem_cgroup_zone_lruvec - get the lru list vector for a zone and memcg
  * @zone: zone of the wanted lruvec
@@ -2462,6 +2489,7 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	struct res_counter *fail_res;
 	unsigned long nr_reclaimed;
 	unsigned long long size;
+	u64 stall;
 	bool may_swap = true;
 	bool drained = false;
 	int ret = 0;
@@ -2507,8 +2535,10 @@ retry:
 	if (!(gfp_mask & __GFP_WAIT))
 		goto nomem;
 
+	stall = ktime_get_ns();
 	nr_reclaimed = try_to_free_mem_cgroup_pages(mem_over_limit, nr_pages,
 						    gfp_mask, may_swap);
+	vmpressure_stall(gfp_mask, mem_over_limit, stall);
 
 	if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
 		goto retry;
@@ -3748,26 +3778,18 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 /**
  * mem_cgroup_force_empty_list - clears LRU of a group
  * @memcg: group to clear
- * @node: NUMA node
- * @zid: zone id
- * @lru: lru to to clear
+ * @zone: zone of the list
+ * @list: lru or multi-gen LRU list to clear
  *
  * Traverse a specified page_cgroup list and try to drop them all.  This doesn't
  * reclaim the pages page themselves - pages are moved to the parent (or root)
  * group.
  */
 static void mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
-				int node, int zid, enum lru_list lru)
+				struct zone *zone, struct list_head *list)
 {
-	struct lruvec *lruvec;
 	unsigned long flags;
-	struct list_head *list;
 	struct page *busy;
-	struct zone *zone;
-
-	zone = &NODE_DATA(node)->node_zones[zid];
-	lruvec = mem_cgroup_zone_lruvec(zone, memcg);
-	list = &lruvec->lists[lru];
 
 	busy = NULL;
 	do {
@@ -3809,6 +3831,9 @@ static void mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
 static void mem_cgroup_reparent_charges(struct mem_cgroup *memcg)
 {
 	int node, zid;
+#ifdef CONFIG_LRU_GEN
+	int gen;
+#endif
 	u64 usage;
 
 	do {
@@ -3818,11 +3843,24 @@ static void mem_cgroup_reparent_charges(struct mem_cgroup *memcg)
 		mem_cgroup_start_move(memcg);
 		for_each_node_state(node, N_MEMORY) {
 			for (zid = 0; zid < MAX_NR_ZONES; zid++) {
+				struct zone *zone;
+				struct lruvec *lruvec;
 				enum lru_list lru;
+
+				zone = &NODE_DATA(node)->node_zones[zid];
+				lruvec = mem_cgroup_zone_lruvec(zone, memcg);
 				for_each_lru(lru) {
-					mem_cgroup_force_empty_list(memcg,
-							node, zid, lru);
+					mem_cgroup_force_empty_list(memcg, zone,
+							&lruvec->lists[lru]);
 				}
+#ifdef CONFIG_LRU_GEN
+				for (gen = 0; gen < MAX_NR_GENS; gen++) {
+					mem_cgroup_force_empty_list(memcg, zone,
+						&lruvec->lrugen.lists[gen][0]);
+					mem_cgroup_force_empty_list(memcg, zone,
+						&lruvec->lrugen.lists[gen][1]);
+				}
+#endif
 			}
 		}
 		mem_cgroup_end_move(memcg);
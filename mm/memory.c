@@ -167,6 +167,7 @@ void sync_mm_rss(struct mm_struct *mm)
 		}
 	}
 	current->rss_stat.events = 0;
+	adj_tree_update_rss(mm);
 }
 
 static void add_mm_counter_fast(struct mm_struct *mm, int member, int val)
@@ -197,6 +198,8 @@ static void check_sync_rss_stat(struct task_struct *task)
 
 static void check_sync_rss_stat(struct task_struct *task)
 {
+	if (task == current)
+		adj_tree_update_rss(task->mm);
 }
 
 #endif /* SPLIT_RSS_COUNTING */
@@ -646,6 +649,7 @@ static inline void add_mm_rss_vec(struct mm_struct *mm, int *rss)
 	for (i = 0; i < NR_MM_COUNTERS; i++)
 		if (rss[i])
 			add_mm_counter(mm, i, rss[i]);
+	adj_tree_update_rss(mm);
 }
 
 /*
@@ -2477,6 +2481,7 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		ret = VM_FAULT_MAJOR;
 		count_vm_event(PGMAJFAULT);
 		mem_cgroup_count_vm_event(mm, PGMAJFAULT);
+		count_swap_refault(mm);
 	} else if (PageHWPoison(page)) {
 		/*
 		 * hwpoisoned dirty swapcache pages are kept for killing
@@ -90,11 +90,21 @@ int memmap_valid_within(unsigned long pfn,
 void lruvec_init(struct lruvec *lruvec)
 {
 	enum lru_list lru;
+#ifdef CONFIG_LRU_GEN
+	int gen, type;
+#endif
 
 	memset(lruvec, 0, sizeof(struct lruvec));
 
 	for_each_lru(lru)
 		INIT_LIST_HEAD(&lruvec->lists[lru]);
+
+#ifdef CONFIG_LRU_GEN
+	for (gen = 0; gen < MAX_NR_GENS; gen++)
+		for (type = 0; type < 2; type++)
+			INIT_LIST_HEAD(&lruvec->lrugen.lists[gen][type]);
+	lruvec->lrugen.max_seq = MIN_NR_GENS - 1;
+#endif
 }
 
 #if defined(CONFIG_NUMA_BALANCING) && !defined(LAST_CPUPID_NOT_IN_PAGE_FLAGS)
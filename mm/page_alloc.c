@@ -66,6 +66,8 @@
 #include <linux/lockdep.h>
 #include <linux/nmi.h>
 #include <linux/random.h>
+#include <linux/psi.h>
+#include <linux/vmpressure.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -2548,11 +2550,15 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 {
 	struct zone *last_compact_zone = NULL;
 	unsigned long compact_result;
+	unsigned long pflags;
 	struct page *page;
+	u64 stall;
 
 	if (!order)
 		return NULL;
 
+	psi_memstall_enter(&pflags);
+	stall = ktime_get_ns();
 	current->flags |= PF_MEMALLOC;
 	compact_result = try_to_compact_pages(zonelist, order, gfp_mask,
 						nodemask, mode,
@@ -2560,6 +2566,8 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 						alloc_flags, classzone_idx,
 						&last_compact_zone);
 	current->flags &= ~PF_MEMALLOC;
+	vmpressure_stall(gfp_mask, NULL, stall);
+	psi_memstall_leave(&pflags);
 
 	switch (compact_result) {
 	case COMPACT_DEFERRED:
@@ -2631,12 +2639,16 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order, struct zonelist *zonelist,
 		  nodemask_t *nodemask)
 {
 	struct reclaim_state reclaim_state;
+	unsigned long pflags;
 	int progress;
+	u64 stall;
 
 	cond_resched();
 
 	/* We now go into synchronous reclaim */
 	cpuset_memory_pressure_bump();
+	psi_memstall_enter(&pflags);
+	stall = ktime_get_ns();
 	current->flags |= PF_MEMALLOC;
 	lockdep_set_current_reclaim_state(gfp_mask);
 	reclaim_state.reclaimed_slab = 0;
@@ -2647,6 +2659,8 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order, struct zonelist *zonelist,
 	current->reclaim_state = NULL;
 	lockdep_clear_current_reclaim_state();
 	current->flags &= ~PF_MEMALLOC;
+	vmpressure_stall(gfp_mask, NULL, stall);
+	psi_memstall_leave(&pflags);
 
 	cond_resched();
 
@@ -0,0 +1,511 @@
+/*
+ * Page cache prefetch traces
+ *
+ * Launching an app faults in the same ranges of the same apk, dex and
+ * shared library files every time. While a launch is marked, the file
+ * pages faulted in by a task and its descendants are recorded. Userspace
+ * reads the trace out in the binary format of
+ * include/uapi/linux/prefetch_trace.h, stores it, and writes it back
+ * before the next launch to have the recorded ranges read ahead in one
+ * batch:
+ *
+ *	echo "<pid> [<seconds>]" > /proc/prefetch/record
+ *	echo 0 > /proc/prefetch/record
+ *	cat /proc/prefetch/record > trace
+ *	cat trace > /proc/prefetch/replay
+ *
+ * Recording stops on its own after the given number of seconds, 10 by
+ * default. Files are stored by path and opened with the credentials of
+ * the task replaying the trace; a file whose inode number changed since
+ * it was recorded is skipped.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/pid.h>
+#include <linux/hash.h>
+#include <linux/proc_fs.h>
+#include <linux/blkdev.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/prefetch_trace.h>
+
+#define PREFETCH_MAX_FILES	1024
+#define PREFETCH_MAX_RANGES	16384
+#define PREFETCH_PATHS_SIZE	(64 << 10)
+#define PREFETCH_HASH_BITS	8
+#define PREFETCH_DEFAULT_SECS	10
+#define PREFETCH_MAX_SECS	60
+#define PREFETCH_NONE		U32_MAX
+
+#define PREFETCH_TRACE_MAX					\
+	(sizeof(struct prefetch_trace_header) +			\
+	 PREFETCH_MAX_FILES * sizeof(struct prefetch_trace_file) +	\
+	 PREFETCH_MAX_RANGES * sizeof(struct prefetch_trace_range) +	\
+	 PREFETCH_PATHS_SIZE)
+
+struct prefetch_file {
+	struct hlist_node hash;
+	struct inode *inode;	/* pinned while recording */
+	u64 ino;
+	u32 path;		/* into paths, PREFETCH_NONE if unusable */
+	u32 last;		/* last range recorded for the file */
+	u32 index;		/* in the trace read out */
+};
+
+struct prefetch_session {
+	bool recording;
+	unsigned int nr_files;
+	unsigned int nr_ranges;
+	unsigned int paths_size;
+	struct hlist_head hash[1 << PREFETCH_HASH_BITS];
+	struct prefetch_file files[PREFETCH_MAX_FILES];
+	struct prefetch_trace_range ranges[PREFETCH_MAX_RANGES];
+	char paths[PREFETCH_PATHS_SIZE];
+	/* built once recording is done */
+	void *trace;
+	size_t trace_size;
+};
+
+struct static_key prefetch_trace_key = STATIC_KEY_INIT_FALSE;
+
+/*
+ * The mutex serialises the control files, the spinlock protects the
+ * session against the fault path. The traced pid is RCU protected.
+ */
+static DEFINE_MUTEX(prefetch_mutex);
+static DEFINE_SPINLOCK(prefetch_lock);
+static struct prefetch_session *session;
+static struct pid __rcu *prefetch_pid;
+
+static void prefetch_timeout(struct work_struct *work);
+static DECLARE_DELAYED_WORK(prefetch_timeout_work, prefetch_timeout);
+
+/* Is current in the traced thread group or one of its descendants? */
+static bool prefetch_current_traced(void)
+{
+	struct task_struct *p;
+	struct pid *pid;
+	bool ret = false;
+
+	rcu_read_lock();
+	pid = rcu_dereference(prefetch_pid);
+	if (!pid)
+		goto out;
+	for (p = current; p != &init_task; p = rcu_dereference(p->real_parent)) {
+		if (task_tgid(p) == pid) {
+			ret = true;
+			break;
+		}
+	}
+out:
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static struct prefetch_file *prefetch_find_file(struct prefetch_session *s,
+						struct file *file)
+{
+	struct inode *inode = file_inode(file);
+	struct hlist_head *head = &s->hash[hash_ptr(inode, PREFETCH_HASH_BITS)];
+	struct prefetch_file *pf;
+	char *path;
+	int len;
+
+	hlist_for_each_entry(pf, head, hash) {
+		if (pf->inode == inode)
+			return pf;
+	}
+
+	if (s->nr_files == PREFETCH_MAX_FILES || !igrab(inode))
+		return NULL;
+
+	pf = &s->files[s->nr_files++];
+	pf->inode = inode;
+	pf->ino = inode->i_ino;
+	pf->path = PREFETCH_NONE;
+	pf->last = PREFETCH_NONE;
+	hlist_add_head(&pf->hash, head);
+
+	/* Unlinked files are tracked but left out of the trace */
+	if (d_unlinked(file->f_path.dentry))
+		return pf;
+
+	path = d_path(&file->f_path, s->paths + s->paths_size,
+		      PREFETCH_PATHS_SIZE - s->paths_size);
+	if (IS_ERR(path))
+		return pf;
+
+	len = strlen(path) + 1;
+	memmove(s->paths + s->paths_size, path, len);
+	pf->path = s->paths_size;
+	s->paths_size += len;
+
+	return pf;
+}
+
+void __prefetch_trace_fault(struct file *file, pgoff_t index)
+{
+	struct prefetch_session *s;
+	struct prefetch_file *pf;
+	struct prefetch_trace_range *r;
+
+	if (!S_ISREG(file_inode(file)->i_mode) || index >= PREFETCH_NONE)
+		return;
+	if (!prefetch_current_traced())
+		return;
+
+	spin_lock(&prefetch_lock);
+	s = session;
+	if (!s || !s->recording)
+		goto out;
+
+	pf = prefetch_find_file(s, file);
+	if (!pf)
+		goto out;
+
+	/* Extend the last range of the file if the fault is in or next to it */
+	if (pf->last != PREFETCH_NONE) {
+		r = &s->ranges[pf->last];
+		if (index >= r->start && index <= r->start + r->nr) {
+			if (index == r->start + r->nr)
+				r->nr++;
+			goto out;
+		}
+	}
+
+	if (s->nr_ranges == PREFETCH_MAX_RANGES)
+		goto out;
+
+	pf->last = s->nr_ranges;
+	r = &s->ranges[s->nr_ranges++];
+	r->file = pf - s->files;
+	r->start = index;
+	r->nr = 1;
+out:
+	spin_unlock(&prefetch_lock);
+}
+
+static void prefetch_free(struct prefetch_session *s)
+{
+	if (!s)
+		return;
+	vfree(s->trace);
+	vfree(s);
+}
+
+/* Called with prefetch_mutex held */
+static void prefetch_stop(void)
+{
+	struct pid *pid;
+	unsigned int i;
+
+	pid = rcu_dereference_protected(prefetch_pid,
+					lockdep_is_held(&prefetch_mutex));
+	if (!pid)
+		return;
+
+	cancel_delayed_work(&prefetch_timeout_work);
+	static_key_slow_dec(&prefetch_trace_key);
+	RCU_INIT_POINTER(prefetch_pid, NULL);
+
+	spin_lock(&prefetch_lock);
+	session->recording = false;
+	spin_unlock(&prefetch_lock);
+
+	/* The fault path is done with the session, drop the inodes */
+	for (i = 0; i < session->nr_files; i++) {
+		iput(session->files[i].inode);
+		session->files[i].inode = NULL;
+	}
+
+	synchronize_rcu();
+	put_pid(pid);
+}
+
+/* Called with prefetch_mutex held */
+static int prefetch_start(struct pid *pid, unsigned int secs)
+{
+	struct prefetch_session *s, *old;
+
+	s = vzalloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->recording = true;
+
+	prefetch_stop();
+
+	spin_lock(&prefetch_lock);
+	old = session;
+	session = s;
+	spin_unlock(&prefetch_lock);
+	prefetch_free(old);
+
+	rcu_assign_pointer(prefetch_pid, pid);
+	static_key_slow_inc(&prefetch_trace_key);
+	schedule_delayed_work(&prefetch_timeout_work, secs * HZ);
+
+	return 0;
+}
+
+static void prefetch_timeout(struct work_struct *work)
+{
+	mutex_lock(&prefetch_mutex);
+	/* Rearmed by a new recording while this one waited for the mutex */
+	if (!delayed_work_pending(&prefetch_timeout_work))
+		prefetch_stop();
+	mutex_unlock(&prefetch_mutex);
+}
+
+/* Lay the recorded session out as a trace, leaving out unusable files */
+static int prefetch_build(struct prefetch_session *s)
+{
+	struct prefetch_trace_header *hdr;
+	struct prefetch_trace_file *tf;
+	struct prefetch_trace_range *tr;
+	unsigned int i, nr_files = 0, nr_ranges = 0;
+	void *buf;
+
+	buf = vmalloc(sizeof(*hdr) + s->nr_files * sizeof(*tf) +
+		      s->nr_ranges * sizeof(*tr) + s->paths_size);
+	if (!buf)
+		return -ENOMEM;
+
+	hdr = buf;
+	tf = (void *)(hdr + 1);
+	for (i = 0; i < s->nr_files; i++) {
+		struct prefetch_file *pf = &s->files[i];
+
+		if (pf->path == PREFETCH_NONE) {
+			pf->index = PREFETCH_NONE;
+			continue;
+		}
+		pf->index = nr_files;
+		tf[nr_files].ino = pf->ino;
+		tf[nr_files].path = pf->path;
+		tf[nr_files].pad = 0;
+		nr_files++;
+	}
+
+	tr = (void *)(tf + nr_files);
+	for (i = 0; i < s->nr_ranges; i++) {
+		u32 index = s->files[s->ranges[i].file].index;
+
+		if (index == PREFETCH_NONE)
+			continue;
+		tr[nr_ranges] = s->ranges[i];
+		tr[nr_ranges].file = index;
+		nr_ranges++;
+	}
+
+	memcpy(tr + nr_ranges, s->paths, s->paths_size);
+
+	hdr->magic = PREFETCH_TRACE_MAGIC;
+	hdr->version = PREFETCH_TRACE_VERSION;
+	hdr->page_shift = PAGE_SHIFT;
+	hdr->nr_files = nr_files;
+	hdr->nr_ranges = nr_ranges;
+	hdr->paths_size = s->paths_size;
+
+	s->trace = buf;
+	s->trace_size = (void *)(tr + nr_ranges) + s->paths_size - buf;
+
+	return 0;
+}
+
+static ssize_t prefetch_record_read(struct file *file, char __user *ubuf,
+				    size_t count, loff_t *ppos)
+{
+	ssize_t ret = 0;
+
+	mutex_lock(&prefetch_mutex);
+	if (!session)
+		goto out;
+
+	if (session->recording) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!session->trace) {
+		ret = prefetch_build(session);
+		if (ret)
+			goto out;
+	}
+
+	ret = simple_read_from_buffer(ubuf, count, ppos, session->trace,
+				      session->trace_size);
+out:
+	mutex_unlock(&prefetch_mutex);
+
+	return ret;
+}
+
+static ssize_t prefetch_record_write(struct file *file,
+				     const char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	unsigned int secs = PREFETCH_DEFAULT_SECS;
+	size_t len = min(count, (size_t)31);
+	struct pid *pid;
+	char buf[32];
+	int nr, ret = 0;
+
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	if (sscanf(buf, "%d %u", &nr, &secs) < 1)
+		return -EINVAL;
+	if (nr < 0 || !secs || secs > PREFETCH_MAX_SECS)
+		return -EINVAL;
+
+	mutex_lock(&prefetch_mutex);
+	if (!nr) {
+		prefetch_stop();
+	} else {
+		pid = find_get_pid(nr);
+		if (!pid) {
+			ret = -ESRCH;
+		} else {
+			ret = prefetch_start(pid, secs);
+			if (ret)
+				put_pid(pid);
+		}
+	}
+	mutex_unlock(&prefetch_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations prefetch_record_fops = {
+	.read		= prefetch_record_read,
+	.write		= prefetch_record_write,
+	.llseek		= default_llseek,
+};
+
+static void prefetch_replay(const struct prefetch_trace_header *hdr)
+{
+	const struct prefetch_trace_file *tf = (void *)(hdr + 1);
+	const struct prefetch_trace_range *tr = (void *)(tf + hdr->nr_files);
+	const char *paths = (void *)(tr + hdr->nr_ranges);
+	struct blk_plug plug;
+	struct file **files;
+	unsigned int i;
+
+	files = kcalloc(hdr->nr_files, sizeof(*files), GFP_KERNEL);
+	if (!files)
+		return;
+
+	for (i = 0; i < hdr->nr_files; i++) {
+		struct file *f;
+
+		if (tf[i].path >= hdr->paths_size)
+			continue;
+		f = filp_open(paths + tf[i].path, O_RDONLY | O_LARGEFILE, 0);
+		if (IS_ERR(f))
+			continue;
+		if (!S_ISREG(file_inode(f)->i_mode) ||
+		    file_inode(f)->i_ino != tf[i].ino) {
+			fput(f);
+			continue;
+		}
+		files[i] = f;
+	}
+
+	blk_start_plug(&plug);
+	for (i = 0; i < hdr->nr_ranges; i++) {
+		struct file *f;
+
+		if (tr[i].file >= hdr->nr_files)
+			continue;
+		f = files[tr[i].file];
+		if (!f)
+			continue;
+		force_page_cache_readahead(f->f_mapping, f, tr[i].start,
+					   tr[i].nr);
+		cond_resched();
+	}
+	blk_finish_plug(&plug);
+
+	for (i = 0; i < hdr->nr_files; i++) {
+		if (files[i])
+			fput(files[i]);
+	}
+	kfree(files);
+}
+
+static ssize_t prefetch_replay_write(struct file *file,
+				     const char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	struct prefetch_trace_header *hdr;
+	const char *paths;
+	size_t size;
+	ssize_t ret = -EINVAL;
+
+	if (count < sizeof(*hdr) || count > PREFETCH_TRACE_MAX)
+		return -EINVAL;
+
+	hdr = vmalloc(count);
+	if (!hdr)
+		return -ENOMEM;
+
+	if (copy_from_user(hdr, ubuf, count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (hdr->magic != PREFETCH_TRACE_MAGIC ||
+	    hdr->version != PREFETCH_TRACE_VERSION ||
+	    hdr->page_shift != PAGE_SHIFT)
+		goto out;
+	if (hdr->nr_files > PREFETCH_MAX_FILES ||
+	    hdr->nr_ranges > PREFETCH_MAX_RANGES ||
+	    hdr->paths_size > PREFETCH_PATHS_SIZE)
+		goto out;
+
+	size = sizeof(*hdr) +
+		hdr->nr_files * sizeof(struct prefetch_trace_file) +
+		hdr->nr_ranges * sizeof(struct prefetch_trace_range);
+	if (size + hdr->paths_size != count)
+		goto out;
+
+	/* Every path offset below paths_size has to end in the blob */
+	paths = (void *)hdr + size;
+	if (hdr->paths_size && paths[hdr->paths_size - 1])
+		goto out;
+
+	prefetch_replay(hdr);
+	ret = count;
+out:
+	vfree(hdr);
+
+	return ret;
+}
+
+static const struct file_operations prefetch_replay_fops = {
+	.write		= prefetch_replay_write,
+	.llseek		= noop_llseek,
+};
+
+static int __init prefetch_trace_init(void)
+{
+	if (!proc_mkdir("prefetch", NULL))
+		return -ENOMEM;
+	proc_create("prefetch/record", 0600, NULL, &prefetch_record_fops);
+	proc_create("prefetch/replay", 0200, NULL, &prefetch_replay_fops);
+
+	return 0;
+}
+module_init(prefetch_trace_init);
@@ -71,9 +71,23 @@ static atomic_t skip_reclaim = ATOMIC_INIT(0);
 /* Not atomic since only a single instance of swap_fn run at a time */
 static int monitor_eff;
 
+/*
+ * Per task refault feedback. Each pass records how many pages it took
+ * from a task and how many swapins the task had done by then; swapins
+ * after that are pages the task wanted back. The refaulting share is
+ * averaged over passes and tasks are ranked by their anon size scaled
+ * down by it, so reclaim goes to tasks whose pages stay out. A task left
+ * alone for refault_window seconds has its average halved, so it becomes
+ * a target again once it has gone idle.
+ */
+static int refault_window = 30;
+module_param_named(refault_window, refault_window, int, S_IRUGO | S_IWUSR);
+
 struct selected_task {
 	struct task_struct *p;
+	struct mm_struct *mm;
 	int tasksize;
+	int anon;
 	short oom_score_adj;
 };
 
@@ -107,16 +121,51 @@ static int test_task_flag(struct task_struct *p, int flag)
 	return 0;
 }
 
+static int refault_ratio(struct process_reclaim_stat *stat)
+{
+	unsigned long refaults;
+
+	if (!stat->last_reclaimed)
+		return stat->refault_ratio;
+
+	refaults = atomic_long_read(&stat->swap_refaults) - stat->last_refaults;
+	refaults = min(refaults * 100 / stat->last_reclaimed, 100UL);
+
+	return (stat->refault_ratio + refaults) / 2;
+}
+
+static void refault_age(struct process_reclaim_stat *stat)
+{
+	if (time_before(jiffies, stat->last_stamp + refault_window * HZ))
+		return;
+
+	stat->refault_ratio = refault_ratio(stat) / 2;
+	stat->last_reclaimed = 0;
+	stat->last_stamp = jiffies;
+}
+
+static void refault_account(struct process_reclaim_stat *stat,
+			    int nr_reclaimed)
+{
+	stat->refault_ratio = refault_ratio(stat);
+	stat->reclaimed += nr_reclaimed;
+	stat->last_reclaimed = nr_reclaimed;
+	stat->last_refaults = atomic_long_read(&stat->swap_refaults);
+	stat->last_stamp = jiffies;
+}
+
 static void swap_fn(struct work_struct *work)
 {
 	struct task_struct *tsk;
 	struct reclaim_param rp;
 
 	/* Pick the best MAX_SWAP_TASKS tasks in terms of anon size */
-	struct selected_task selected[MAX_SWAP_TASKS] = {{0, 0, 0},};
+	struct selected_task selected[MAX_SWAP_TASKS] = {{0, 0, 0, 0, 0},};
 	int si = 0;
 	int i;
 	int tasksize;
+	int anon;
+	int ratio;
 	int total_sz = 0;
 	int total_scan = 0;
 	int total_reclaimed = 0;
@@ -144,9 +193,12 @@ static void swap_fn(struct work_struct *work)
 			continue;
 		}
 
-		tasksize = get_mm_counter(p->mm, MM_ANONPAGES);
+		anon = get_mm_counter(p->mm, MM_ANONPAGES);
+		refault_age(&p->mm->reclaim_stat);
+		ratio = refault_ratio(&p->mm->reclaim_stat);
 		task_unlock(p);
 
+		tasksize = anon - anon * ratio / 100;
 		if (tasksize <= 0)
 			continue;
 
@@ -159,10 +211,12 @@ static void swap_fn(struct work_struct *work)
 			selected[0].p = p;
 			selected[0].oom_score_adj = oom_score_adj;
 			selected[0].tasksize = tasksize;
+			selected[0].anon = anon;
 		} else {
 			selected[si].p = p;
 			selected[si].oom_score_adj = oom_score_adj;
 			selected[si].tasksize = tasksize;
+			selected[si].anon = anon;
 			si++;
 		}
 	}
@@ -176,8 +230,16 @@ static void swap_fn(struct work_struct *work)
 		return;
 	}
 
-	for (i = 0; i < si; i++)
-		get_task_struct(selected[i].p);
+	for (i = 0; i < si; i++) {
+		struct task_struct *p = selected[i].p;
+
+		get_task_struct(p);
+		task_lock(p);
+		selected[i].mm = p->mm;
+		if (selected[i].mm)
+			atomic_inc(&selected[i].mm->mm_count);
+		task_unlock(p);
+	}
 
 	rcu_read_unlock();
 
@@ -196,6 +258,19 @@ static void swap_fn(struct work_struct *work)
 				nr_to_reclaim);
 		total_scan += rp.nr_scanned;
 		total_reclaimed += rp.nr_reclaimed;
+
+		if (selected[si].mm) {
+			struct process_reclaim_stat *stat =
+				&selected[si].mm->reclaim_stat;
+
+			trace_process_reclaim_refault(selected[si].p->pid,
+					selected[si].anon,
+					refault_ratio(stat),
+					rp.nr_reclaimed);
+			if (rp.nr_reclaimed)
+				refault_account(stat, rp.nr_reclaimed);
+			mmdrop(selected[si].mm);
+		}
 		put_task_struct(selected[si].p);
 	}
 
@@ -225,7 +300,8 @@ static int vmpressure_notifier(struct notifier_block *nb,
 	if (!enable_process_reclaim)
 		return 0;
 
-	if (!current_is_kswapd())
+	/* In stall mode the notifications come from stalled allocators */
+	if (!current_is_kswapd() && !vmpressure_stall_mode())
 		return 0;
 
 	if (0 <= atomic_dec_if_positive(&skip_reclaim))
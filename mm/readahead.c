@@ -9,6 +9,7 @@
 
 #include <linux/kernel.h>
 #include <linux/gfp.h>
+#include <linux/slab.h>
 #include <linux/export.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
@@ -20,6 +21,11 @@
 
 #include "internal.h"
 
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+#endif
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -141,6 +147,246 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_ADAPTIVE_READAHEAD
+/*
+ * Adaptive readahead
+ *
+ * ondemand_readahead() and the mmap read-around only know the readahead
+ * state of one open file. Apk and dex files are mostly mapped and read in
+ * small strided chunks, so every fault pulls in a full read-around window
+ * of which little is ever used. Instead each inode keeps a short history
+ * of its cache misses and of how much of the last readahead was used:
+ *
+ * - a miss at or right behind the pages read for the previous one is
+ *   sequential and left to the regular heuristics,
+ * - a miss as far from the previous one as that one was from its own
+ *   predecessor is strided: the request is read along with the same range
+ *   one stride further, and nothing in between,
+ * - anything else is random. Its read-around window is halved while less
+ *   than a quarter of the pages read ahead after the last miss got used,
+ *   and doubled again once three quarters of them did.
+ *
+ * Only the first BITS_PER_LONG pages after the start of a window are
+ * tracked, and pages mapped by fault-around without a fault of their own
+ * are not seen as used. The history is allocated on the first miss, so
+ * inodes that are never read only pay for the pointer to it.
+ */
+int sysctl_adaptive_readahead __read_mostly = 1;
+
+#define RA_SCALE_MAX	8
+
+/*
+ * Return the history of @mapping, allocating it on the first miss. NULL if
+ * that failed, the miss is then left to the regular heuristics.
+ */
+static struct ra_history *ra_history_get(struct address_space *mapping)
+{
+	struct ra_history *h = ACCESS_ONCE(mapping->ra_hist);
+
+	if (likely(h))
+		return h;
+
+	h = kmalloc(sizeof(*h), (mapping_gfp_mask(mapping) & GFP_KERNEL) |
+		    __GFP_NORETRY | __GFP_NOWARN);
+	if (!h)
+		return NULL;
+
+	spin_lock_init(&h->lock);
+	h->pattern = RA_PATTERN_RANDOM;
+	h->scale = RA_SCALE_MAX;
+	h->last_miss = 0;
+	h->next = 0;
+	h->stride = 0;
+	h->win_start = 0;
+	h->win_read = 0;
+	h->win_used = 0;
+
+	/* the history is published with a full barrier, see cmpxchg() */
+	if (cmpxchg(&mapping->ra_hist, NULL, h)) {
+		kfree(h);
+		h = ACCESS_ONCE(mapping->ra_hist);
+	}
+	return h;
+}
+
+/* Called from __destroy_inode(), nothing can reach the mapping anymore */
+void ra_history_free(struct address_space *mapping)
+{
+	kfree(mapping->ra_hist);
+	mapping->ra_hist = NULL;
+}
+
+/* A page was allocated at @index to be read ahead */
+static inline void ra_history_read(struct address_space *mapping,
+				   pgoff_t index)
+{
+	struct ra_history *h = ACCESS_ONCE(mapping->ra_hist);
+	unsigned long bit;
+
+	if (!h)
+		return;
+	bit = index - h->win_start;
+	if (bit < BITS_PER_LONG)
+		set_bit(bit, &h->win_read);
+	if (index >= h->next)
+		h->next = index + 1;
+}
+
+/*
+ * Report how much of the window opened by the previous miss got used and
+ * adjust the read-around size to it. Called with h->lock held.
+ */
+static void ra_history_close(struct address_space *mapping,
+			     struct ra_history *h)
+{
+	unsigned int read = hweight_long(h->win_read);
+	unsigned int hits = hweight_long(h->win_read & h->win_used);
+
+	if (!read)
+		return;
+
+	trace_readahead_window(mapping, h->win_start, read, hits);
+
+	if (hits * 4 < read)
+		h->scale = max(h->scale / 2, 1);
+	else if (hits * 4 >= read * 3)
+		h->scale = min(h->scale * 2, RA_SCALE_MAX);
+}
+
+/*
+ * Record a cache miss of @req_size pages at @offset and open the window
+ * for the readahead that follows at @start. Returns the access pattern.
+ */
+static int ra_history_miss(struct address_space *mapping,
+			   struct ra_history *h, pgoff_t offset,
+			   unsigned long req_size, pgoff_t start)
+{
+	long delta;
+	int pattern;
+
+	spin_lock(&h->lock);
+	ra_history_close(mapping, h);
+
+	delta = (long)(offset - h->last_miss);
+	if (offset >= h->last_miss && offset <= h->next)
+		pattern = RA_PATTERN_SEQ;
+	else if (delta == h->stride)
+		pattern = RA_PATTERN_STRIDE;
+	else
+		pattern = RA_PATTERN_RANDOM;
+
+	trace_readahead_miss(mapping, offset, req_size, pattern, delta,
+			     h->scale);
+
+	h->pattern = pattern;
+	h->stride = delta;
+	h->last_miss = offset;
+	h->next = offset + req_size;
+	h->win_start = start;
+	h->win_read = 0;
+	h->win_used = 0;
+	spin_unlock(&h->lock);
+
+	return pattern;
+}
+
+/*
+ * Read a strided miss and the same range one stride ahead. The miss is
+ * moved to the prefetched range, so that the next one is a stride away.
+ */
+static unsigned long ra_stride_readahead(struct address_space *mapping,
+					 struct ra_history *h,
+					 struct file *filp, pgoff_t offset,
+					 unsigned long req_size)
+{
+	long stride = ACCESS_ONCE(h->stride);
+	unsigned long nr;
+
+	nr = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	if (stride < 0 && offset < -stride)
+		return nr;
+
+	h->last_miss = offset + stride;
+	return nr + __do_page_cache_readahead(mapping, filp, offset + stride,
+					      req_size, 0);
+}
+
+/*
+ * Cache miss in ondemand_readahead(). Returns the number of pages read if
+ * the miss was strided, 0 to leave it to the regular heuristics.
+ */
+static unsigned long adaptive_readahead(struct address_space *mapping,
+					struct file *filp, pgoff_t offset,
+					unsigned long req_size)
+{
+	struct ra_history *h;
+
+	if (!sysctl_adaptive_readahead)
+		return 0;
+
+	h = ra_history_get(mapping);
+	if (!h)
+		return 0;
+
+	if (ra_history_miss(mapping, h, offset, req_size,
+			    offset) != RA_PATTERN_STRIDE)
+		return 0;
+
+	return ra_stride_readahead(mapping, h, filp, offset, req_size);
+}
+
+/**
+ * adaptive_readaround - size the mmap read-around for a fault
+ * @mapping: address_space the fault missed in
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @offset: page offset of the fault
+ * @ra_pages: regular read-around size
+ *
+ * Returns the number of pages to read around @offset, or 0 if the fault
+ * was strided and has been read already.
+ */
+unsigned long adaptive_readaround(struct address_space *mapping,
+				  struct file *filp, pgoff_t offset,
+				  unsigned long ra_pages)
+{
+	struct ra_history *h;
+	unsigned long size;
+
+	if (!sysctl_adaptive_readahead)
+		return ra_pages;
+
+	h = ra_history_get(mapping);
+	if (!h)
+		return ra_pages;
+
+	size = ra_pages * ACCESS_ONCE(h->scale) / RA_SCALE_MAX;
+	size = max(size, 1UL);
+
+	switch (ra_history_miss(mapping, h, offset, 1,
+				offset - min(offset, size / 2))) {
+	case RA_PATTERN_STRIDE:
+		ra_stride_readahead(mapping, h, filp, offset, 1);
+		return 0;
+	case RA_PATTERN_RANDOM:
+		return size;
+	}
+	return ra_pages;
+}
+#else
+static inline void ra_history_read(struct address_space *mapping,
+				   pgoff_t index)
+{
+}
+
+static inline unsigned long adaptive_readahead(struct address_space *mapping,
+					       struct file *filp,
+					       pgoff_t offset,
+					       unsigned long req_size)
+{
+	return 0;
+}
+#endif
+
 /*
  * __do_page_cache_readahead() actually reads a chunk of disk.  It allocates all
  * the pages first, then submits them all for I/O. This avoids the very bad
@@ -188,6 +434,7 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		list_add(&page->lru, &page_pool);
 		if (page_idx == nr_to_read - lookahead_size)
 			SetPageReadahead(page);
+		ra_history_read(mapping, page_offset);
 		ret++;
 	}
 
@@ -384,6 +631,16 @@ ondemand_readahead(struct address_space *mapping,
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
 	pgoff_t prev_offset;
+	unsigned long nr;
+
+	/*
+	 * strided cache miss, read by adaptive readahead
+	 */
+	if (!hit_readahead_marker) {
+		nr = adaptive_readahead(mapping, filp, offset, req_size);
+		if (nr)
+			return nr;
+	}
 
 	/*
 	 * start of file
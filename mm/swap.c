@@ -443,7 +443,7 @@ static void pagevec_move_tail_fn(struct page *page, struct lruvec *lruvec,
 
 	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 		enum lru_list lru = page_lru_base_type(page);
-		list_move_tail(&page->lru, &lruvec->lists[lru]);
+		move_page_to_lru_tail(page, lruvec, lru);
 		(*pgmoved)++;
 	}
 }
@@ -779,7 +779,7 @@ static void lru_deactivate_file_fn(struct page *page, struct lruvec *lruvec,
 		 * The page's writeback ends up during pagevec
 		 * We moves tha page into tail of inactive.
 		 */
-		list_move_tail(&page->lru, &lruvec->lists[lru]);
+		move_page_to_lru_tail(page, lruvec, lru);
 		__count_vm_event(PGROTATED);
 	}
 
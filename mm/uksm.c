@@ -69,6 +69,7 @@
 #include <linux/gcd.h>
 #include <linux/freezer.h>
 #include <linux/sradix-tree.h>
+#include <linux/moduleparam.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -165,6 +166,12 @@ static int is_full_zero(const void *s1, size_t len)
 #endif
 #elif defined(CONFIG_ARM)
 #include "uksm_arm.h"
+#elif defined(CONFIG_UKSM_NEON)
+#include "uksm_arm64.h"
+
+/* uksm.neon=0 on the command line keeps the generic code */
+static bool uksm_neon = true;
+module_param_named(neon, uksm_neon, bool, 0444);
 #else
 static int is_full_zero(void *s1, size_t len)
 {
@@ -571,6 +578,14 @@ static unsigned int uksm_run = 1;
 static DECLARE_WAIT_QUEUE_HEAD(uksm_thread_wait);
 static DEFINE_MUTEX(uksm_thread_mutex);
 
+/*
+ * Serializes the scan workers on what is shared between slots: the stable
+ * and unstable trees, the rmap_item and tree node lists and the scan and
+ * benefit counters. Page table walks, hashing and zero page merging are done
+ * without it.
+ */
+static DEFINE_MUTEX(uksm_tree_mutex);
+
 /*
  * List vma_slot_new is for newly created vma_slot waiting to be added by
  * ksmd. If one cannot be added(e.g. due to it's too small), it's moved to
@@ -1328,25 +1343,26 @@ static inline void inc_rshash_neg(unsigned long delta)
 }
 
 
+static inline unsigned long page_hash_cost(unsigned long hash_strength)
+{
+	if (HASH_STRENGTH_FULL > hash_strength)
+		return HASH_STRENGTH_FULL - hash_strength;
+	else
+		return 0;
+}
+
 static inline u32 page_hash(struct page *page, unsigned long hash_strength,
 			    int cost_accounting)
 {
 	u32 val;
-	unsigned long delta;
 
 	void *addr = kmap_atomic(page);
 
 	val = random_sample_hash(addr, hash_strength);
 	kunmap_atomic(addr);
 
-	if (cost_accounting) {
-		if (HASH_STRENGTH_FULL > hash_strength)
-			delta = HASH_STRENGTH_FULL - hash_strength;
-		else
-			delta = 0;
-
-		inc_rshash_pos(delta);
-	}
+	if (cost_accounting)
+		inc_rshash_pos(page_hash_cost(hash_strength));
 
 	return val;
 }
@@ -1359,7 +1375,11 @@ static int memcmp_pages(struct page *page1, struct page *page2,
 
 	addr1 = kmap_atomic(page1);
 	addr2 = kmap_atomic(page2);
+#ifdef CONFIG_UKSM_NEON
+	ret = uksm_memcmp(addr1, addr2, PAGE_SIZE);
+#else
 	ret = memcmp(addr1, addr2, PAGE_SIZE);
+#endif
 	kunmap_atomic(addr2);
 	kunmap_atomic(addr1);
 
@@ -3178,17 +3198,73 @@ static inline int vma_fully_scanned(struct vma_slot *slot)
 	return slot->pages_scanned == slot->pages;
 }
 
+enum {
+	UKSM_SCAN_NOPAGE,	/* nothing to merge at this address */
+	UKSM_SCAN_PAGE,		/* page hashed, goes on to the trees */
+	UKSM_SCAN_ZERO_MISS,	/* zero page hash, but not a zero page */
+	UKSM_SCAN_ZERO,		/* page merged with the zero page */
+};
+
+/**
+ * scan_get_page() - look up and hash the page at @addr of @slot, merging it
+ * with the zero page if it is full of zeroes. This only touches the page and
+ * its page table, so it runs without uksm_tree_mutex held and the scan
+ * workers do it in parallel.
+ */
+static int scan_get_page(struct vma_slot *slot, unsigned long addr,
+			 struct page **pagep, u32 *hash)
+{
+	struct page *page;
+	int ret = UKSM_SCAN_PAGE;
+
+	page = follow_page(slot->vma, addr, FOLL_GET);
+	if (IS_ERR_OR_NULL(page))
+		return UKSM_SCAN_NOPAGE;
+
+	if (!PageAnon(page) && !page_trans_compound_anon(page))
+		goto putpage;
+
+	/*check is zero_page pfn or uksm_zero_page*/
+	if ((page_to_pfn(page) == zero_pfn)
+			|| (page_to_pfn(page) == uksm_zero_pfn))
+		goto putpage;
+
+	flush_anon_page(slot->vma, page, addr);
+	flush_dcache_page(page);
+
+	*hash = page_hash(page, hash_strength, 0);
+	/*if the page content all zero, re-map to zero-page*/
+	if (find_zero_page_hash(hash_strength, *hash)) {
+		if (!cmp_and_merge_zero_page(slot->vma, page)) {
+			inc_zone_page_state(page, NR_UKSM_ZERO_PAGES);
+			dec_mm_counter(slot->mm, MM_ANONPAGES);
+			put_page(page);
+			return UKSM_SCAN_ZERO;
+		}
+		ret = UKSM_SCAN_ZERO_MISS;
+	}
+
+	*pagep = page;
+	return ret;
+
+putpage:
+	put_page(page);
+	return UKSM_SCAN_NOPAGE;
+}
+
 /**
  * get_next_rmap_item() - Get the next rmap_item in a vma_slot according to
  * its random permutation. This function is embedded with the random
- * permutation index management code.
+ * permutation index management code. Called with uksm_tree_mutex held,
+ * which is dropped while the page itself is scanned.
  */
 static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 {
 	unsigned long rand_range, addr, swap_index, scan_index;
 	struct rmap_item *item = NULL;
 	struct rmap_list_entry *scan_entry, *swap_entry = NULL;
-	struct page *page;
+	struct page *page = NULL;
+	int ret;
 
 	scan_index = swap_index = slot->pages_scanned % slot->pages;
 
@@ -3233,36 +3309,22 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 	item = get_entry_item(scan_entry);
 	BUG_ON(addr > slot->vma->vm_end || addr < slot->vma->vm_start);
 
-	page = follow_page(slot->vma, addr, FOLL_GET);
-	if (IS_ERR_OR_NULL(page))
-		goto nopage;
-
-	if (!PageAnon(page) && !page_trans_compound_anon(page))
-		goto putpage;
-
-	/*check is zero_page pfn or uksm_zero_page*/
-	if ((page_to_pfn(page) == zero_pfn)
-			|| (page_to_pfn(page) == uksm_zero_pfn))
-		goto putpage;
-
-	flush_anon_page(slot->vma, page, addr);
-	flush_dcache_page(page);
+	mutex_unlock(&uksm_tree_mutex);
+	ret = scan_get_page(slot, addr, &page, hash);
+	mutex_lock(&uksm_tree_mutex);
 
+	if (ret == UKSM_SCAN_NOPAGE)
+		goto nopage;
 
-	*hash = page_hash(page, hash_strength, 1);
+	inc_rshash_pos(page_hash_cost(hash_strength));
 	inc_uksm_pages_scanned();
-	/*if the page content all zero, re-map to zero-page*/
-	if (find_zero_page_hash(hash_strength, *hash)) {
-		if (!cmp_and_merge_zero_page(slot->vma, page)) {
-			slot->pages_merged++;
-			__inc_zone_page_state(page, NR_UKSM_ZERO_PAGES);
-			dec_mm_counter(slot->mm, MM_ANONPAGES);
+	if (ret == UKSM_SCAN_ZERO) {
+		slot->pages_merged++;
 
-			/* For full-zero pages, no need to create rmap item */
-			goto putpage;
-		} else {
-			inc_rshash_neg(memcmp_cost / 2);
-		}
+		/* For full-zero pages, no need to create rmap item */
+		goto nopage;
+	} else if (ret == UKSM_SCAN_ZERO_MISS) {
+		inc_rshash_neg(memcmp_cost / 2);
 	}
 
 	if (!item) {
@@ -3288,7 +3350,6 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 
 putpage:
 	put_page(page);
-	page = NULL;
 nopage:
 	/* no page, store addr back and free rmap_item if possible */
 	free_entry_item(scan_entry);
@@ -3318,6 +3379,7 @@ static void scan_vma_one_page(struct vma_slot *slot)
 	BUG_ON(!mm);
 	BUG_ON(!slot);
 
+	mutex_lock(&uksm_tree_mutex);
 	rmap_item = get_next_rmap_item(slot, &hash);
 	if (!rmap_item)
 		goto out1;
@@ -3335,6 +3397,7 @@ out1:
 
 	if (vma_fully_scanned(slot))
 		slot->fully_scanned_round = fully_scanned_round;
+	mutex_unlock(&uksm_tree_mutex);
 }
 
 static inline unsigned long rung_get_pages(struct scan_rung *rung)
@@ -4346,9 +4409,12 @@ static inline int rung_round_finished(struct scan_rung *rung)
 	return rung->flags & UKSM_RUNG_ROUND_FINISHED;
 }
 
-static inline void judge_slot(struct vma_slot *slot)
+/*
+ * Move the slot up or down the ladder after it was scanned for this round.
+ * Returns 1 if the slot left its rung, which then was already advanced.
+ */
+static int __judge_slot(struct vma_slot *slot)
 {
-	struct scan_rung *rung = slot->rung;
 	unsigned long dedup;
 	int deleted;
 
@@ -4368,8 +4434,15 @@ static inline void judge_slot(struct vma_slot *slot)
 
 	slot->last_scanned = slot->pages_scanned;
 
+	return deleted;
+}
+
+static inline void judge_slot(struct vma_slot *slot)
+{
+	struct scan_rung *rung = slot->rung;
+
 	/* If its deleted in above, then rung was already advanced. */
-	if (!deleted)
+	if (!__judge_slot(slot))
 		advance_current_scan(rung);
 }
 
@@ -4390,6 +4463,213 @@ static inline int hash_round_finished(void)
 #define UKSM_MMSEM_BATCH	8
 #define BUSY_RETRY		64
 
+/*
+ * With scan_workers set, uksmd cuts the quota of a rung into chunks, each a
+ * run of pages of one slot, and scans them together with a pool of worker
+ * threads. Only uksmd touches the ladder: it plans a batch of chunks,
+ * advancing the rung as the serial scan would, and judges the slots once the
+ * batch is done. The workers are only ever busy while uksmd holds
+ * uksm_thread_mutex.
+ */
+#define UKSM_SCAN_CHUNKS	32
+#define UKSM_MAX_SCAN_WORKERS	8
+
+struct uksm_scan_chunk {
+	struct vma_slot *slot;
+	unsigned long pages;	/* pages to scan */
+	unsigned long scanned;	/* pages actually scanned */
+	int err;		/* -ENOENT or -EBUSY from taking mmap_sem */
+	int finish;		/* ends the slot's turn in this rung */
+};
+
+static struct uksm_scan_chunk uksm_chunks[UKSM_SCAN_CHUNKS];
+static unsigned int uksm_nr_chunks, uksm_next_chunk, uksm_chunks_pending;
+static unsigned long uksm_chunk_seq;
+static DEFINE_SPINLOCK(uksm_chunk_lock);
+static DECLARE_COMPLETION(uksm_chunks_done);
+static DECLARE_WAIT_QUEUE_HEAD(uksm_worker_wait);
+
+static unsigned int uksm_scan_workers;
+static struct task_struct *uksm_worker_tasks[UKSM_MAX_SCAN_WORKERS];
+/* cpu time the workers spent in the current uksm_do_scan() */
+static atomic64_t uksm_worker_runtime = ATOMIC64_INIT(0);
+
+static void uksm_scan_chunk(struct uksm_scan_chunk *chunk)
+{
+	struct vma_slot *slot = chunk->slot;
+	unsigned long batch;
+	int err;
+
+	while (chunk->scanned < chunk->pages) {
+		err = try_down_read_slot_mmap_sem(slot);
+		if (err) {
+			chunk->err = err;
+			return;
+		}
+
+		if (uksm_test_exit(slot->mm)) {
+			up_read(&slot->mm->mmap_sem);
+			chunk->err = -ENOENT;
+			return;
+		}
+
+		batch = min_t(unsigned long, UKSM_MMSEM_BATCH,
+			      chunk->pages - chunk->scanned);
+		while (batch--) {
+			scan_vma_one_page(slot);
+			chunk->scanned++;
+		}
+
+		up_read(&slot->mm->mmap_sem);
+		cond_resched();
+	}
+}
+
+static void uksm_run_chunks(void)
+{
+	struct uksm_scan_chunk *chunk;
+	int done;
+
+	for (;;) {
+		spin_lock(&uksm_chunk_lock);
+		if (uksm_next_chunk >= uksm_nr_chunks) {
+			spin_unlock(&uksm_chunk_lock);
+			return;
+		}
+		chunk = &uksm_chunks[uksm_next_chunk++];
+		spin_unlock(&uksm_chunk_lock);
+
+		uksm_scan_chunk(chunk);
+
+		spin_lock(&uksm_chunk_lock);
+		done = !--uksm_chunks_pending;
+		spin_unlock(&uksm_chunk_lock);
+
+		if (done)
+			complete(&uksm_chunks_done);
+	}
+}
+
+static int uksm_worker_thread(void *nothing)
+{
+	unsigned long seq = 0;
+	unsigned long long start;
+
+	set_freezable();
+	set_user_nice(current, 15);
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(uksm_worker_wait,
+			ACCESS_ONCE(uksm_chunk_seq) != seq ||
+			kthread_should_stop());
+		seq = ACCESS_ONCE(uksm_chunk_seq);
+
+		start = task_sched_runtime(current);
+		uksm_run_chunks();
+		atomic64_add(task_sched_runtime(current) - start,
+			     &uksm_worker_runtime);
+	}
+
+	return 0;
+}
+
+/*
+ * Cut the next batch of chunks from the quota of @rung. Stops when the rung
+ * wraps around so that no slot is handed out twice in a batch.
+ */
+static unsigned int uksm_plan_chunks(struct scan_rung *rung)
+{
+	struct uksm_scan_chunk *chunk;
+	struct vma_slot *slot;
+	unsigned long pages, end;
+	unsigned int nr = 0;
+
+	while (nr < UKSM_SCAN_CHUNKS && rung->pages_to_scan &&
+	       rung->vma_root.num) {
+		slot = rung->current_scan;
+
+		BUG_ON(vma_fully_scanned(slot));
+
+		/* Pages the serial scan would take before judging the slot */
+		if (rung->current_offset < slot->pages)
+			end = (slot->pages - 1 - rung->current_offset) /
+			      rung->step + 1;
+		else
+			end = 1;
+		end = min(end, slot->pages - slot->pages_scanned);
+		pages = min(end, rung->pages_to_scan);
+
+		chunk = &uksm_chunks[nr++];
+		chunk->slot = slot;
+		chunk->pages = pages;
+		chunk->scanned = 0;
+		chunk->err = 0;
+		chunk->finish = (pages == end);
+
+		rung->pages_to_scan -= pages;
+		if (!chunk->finish) {
+			rung->current_offset += pages * rung->step;
+			break;
+		}
+
+		/* advance_current_scan() works from the last page scanned */
+		rung->current_offset += (pages - 1) * rung->step;
+		if (advance_current_scan(rung))
+			break;
+	}
+
+	return nr;
+}
+
+/*
+ * Scan the quota of @rung with the worker threads. Returns the number of
+ * pages scanned; the rung may be left with quota if its mms were all busy.
+ */
+static unsigned long uksm_scan_rung_parallel(struct scan_rung *rung)
+{
+	struct uksm_scan_chunk *chunk;
+	unsigned long vpages = 0;
+	unsigned int i, nr, busy;
+
+	while (rung->pages_to_scan && rung->vma_root.num) {
+		nr = uksm_plan_chunks(rung);
+
+		reinit_completion(&uksm_chunks_done);
+		spin_lock(&uksm_chunk_lock);
+		uksm_nr_chunks = nr;
+		uksm_next_chunk = 0;
+		uksm_chunks_pending = nr;
+		uksm_chunk_seq++;
+		spin_unlock(&uksm_chunk_lock);
+		wake_up_all(&uksm_worker_wait);
+
+		uksm_run_chunks();
+		wait_for_completion(&uksm_chunks_done);
+
+		busy = 0;
+		for (i = 0; i < nr; i++) {
+			chunk = &uksm_chunks[i];
+			vpages += chunk->scanned;
+
+			if (chunk->err == -ENOENT) {
+				rung_rm_slot(chunk->slot);
+			} else if (chunk->err == -EBUSY) {
+				/* try again when the rung comes back here */
+				rung->pages_to_scan += chunk->pages -
+						       chunk->scanned;
+				busy++;
+			} else if (chunk->finish) {
+				__judge_slot(chunk->slot);
+			}
+		}
+
+		if (busy == nr || unlikely(freezing(current)))
+			break;
+	}
+
+	return vpages;
+}
+
 /**
  * uksm_do_scan()  - the main worker function.
  */
@@ -4411,6 +4691,7 @@ static void uksm_do_scan(void)
 
 	start_time = task_sched_runtime(current);
 	start_wall = ktime_get();
+	atomic64_set(&uksm_worker_runtime, 0);
 	mmsem_batch = 0;
 
 	for (i = 0; i < SCAN_LADDER_SIZE;) {
@@ -4428,6 +4709,14 @@ static void uksm_do_scan(void)
 			continue;
 		}
 
+		if (uksm_scan_workers) {
+			vpages += uksm_scan_rung_parallel(rung);
+			if (unlikely(freezing(current)))
+				return;
+			i++;
+			continue;
+		}
+
 		busy_retry = BUSY_RETRY;
 		/*
 		 * Do not consider rung_round_finished() here, just used up the
@@ -4515,7 +4804,8 @@ rm_slot:
 		if (unlikely(freezing(current)))
 			return;
 	}
-	end_time = task_sched_runtime(current);
+	end_time = task_sched_runtime(current) +
+		   atomic64_read(&uksm_worker_runtime);
 	end_wall = ktime_get();
 
 	cleanup_vma_slots();
@@ -5257,6 +5547,43 @@ static ssize_t sleep_times_show(struct kobject *kobj,
 }
 UKSM_ATTR_RO(sleep_times);
 
+static ssize_t scan_workers_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_scan_workers);
+}
+
+static ssize_t scan_workers_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct task_struct *task;
+	unsigned long nr;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr);
+	if (err || nr > min_t(unsigned int, UKSM_MAX_SCAN_WORKERS,
+			      num_possible_cpus() - 1))
+		return -EINVAL;
+
+	mutex_lock(&uksm_thread_mutex);
+	while (uksm_scan_workers < nr) {
+		task = kthread_run(uksm_worker_thread, NULL, "uksmd/%u",
+				   uksm_scan_workers);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		uksm_worker_tasks[uksm_scan_workers++] = task;
+	}
+	while (uksm_scan_workers > nr)
+		kthread_stop(uksm_worker_tasks[--uksm_scan_workers]);
+	mutex_unlock(&uksm_thread_mutex);
+
+	return err ? err : count;
+}
+UKSM_ATTR(scan_workers);
+
 
 static struct attribute *uksm_attrs[] = {
 	&max_cpu_percentage_attr.attr,
@@ -5276,6 +5603,7 @@ static struct attribute *uksm_attrs[] = {
 	&cpu_ratios_attr.attr,
 	&cpu_scales_attr.attr,
 	&eval_intervals_attr.attr,
+	&scan_workers_attr.attr,
 	NULL,
 };
 
@@ -5576,6 +5904,9 @@ static int __init uksm_init(void)
 	int err;
 
 	uksm_sleep_jiffies = msecs_to_jiffies(500);
+#ifdef CONFIG_UKSM_NEON
+	uksm_neon_init(uksm_neon);
+#endif
 
 	slot_tree_init();
 	init_scan_ladder();
@@ -0,0 +1,110 @@
+#ifndef _UKSM_ARM64_H
+#define _UKSM_ARM64_H
+
+#include <linux/string.h>
+#include <asm/hwcap.h>
+#include <asm/neon.h>
+#include <asm/page.h>
+
+/*
+ * NEON versions of the page comparison and zero page check. Both walk the
+ * page in 64 byte blocks using v0-v7, and are only used when the cpu has
+ * advanced SIMD: uksm_neon_init() decides at boot. Callers use
+ * uksm_memcmp() explicitly, plain memcmp() is left alone.
+ */
+#define UKSM_NEON_BLOCK		64
+
+static bool uksm_use_neon __read_mostly;
+
+static inline void uksm_neon_init(bool enable)
+{
+	uksm_use_neon = enable && (elf_hwcap & HWCAP_ASIMD);
+}
+
+/* Byte offset of the first block that differs, or n if none does */
+static inline size_t uksm_neon_first_diff(const void *s1, const void *s2,
+					  size_t n)
+{
+	const void *start = s1, *end = s1 + n;
+	unsigned long d0, d1;
+
+	kernel_neon_begin_partial(8);
+	do {
+		__asm__ __volatile__(
+		"	ld1	{v0.16b-v3.16b}, [%2], #64\n"
+		"	ld1	{v4.16b-v7.16b}, [%3], #64\n"
+		"	eor	v0.16b, v0.16b, v4.16b\n"
+		"	eor	v1.16b, v1.16b, v5.16b\n"
+		"	eor	v2.16b, v2.16b, v6.16b\n"
+		"	eor	v3.16b, v3.16b, v7.16b\n"
+		"	orr	v0.16b, v0.16b, v1.16b\n"
+		"	orr	v2.16b, v2.16b, v3.16b\n"
+		"	orr	v0.16b, v0.16b, v2.16b\n"
+		"	umov	%0, v0.d[0]\n"
+		"	umov	%1, v0.d[1]\n"
+		: "=r" (d0), "=r" (d1), "+r" (s1), "+r" (s2)
+		: : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",
+		    "memory");
+	} while (!(d0 | d1) && s1 < end);
+	kernel_neon_end();
+
+	if (!(d0 | d1))
+		return n;
+	return s1 - start - UKSM_NEON_BLOCK;
+}
+
+static inline int uksm_memcmp(const void *s1, const void *s2, size_t n)
+{
+	size_t off;
+
+	if (!uksm_use_neon || n % UKSM_NEON_BLOCK)
+		return memcmp(s1, s2, n);
+
+	/* Let memcmp() order the differing block, trees rely on the sign */
+	off = uksm_neon_first_diff(s1, s2, n);
+	if (off == n)
+		return 0;
+	return memcmp(s1 + off, s2 + off, UKSM_NEON_BLOCK);
+}
+
+static inline int uksm_neon_is_full_zero(const void *s1, size_t n)
+{
+	const void *end = s1 + n;
+	unsigned long d0, d1;
+
+	kernel_neon_begin_partial(8);
+	do {
+		__asm__ __volatile__(
+		"	ld1	{v0.16b-v3.16b}, [%2], #64\n"
+		"	orr	v0.16b, v0.16b, v1.16b\n"
+		"	orr	v2.16b, v2.16b, v3.16b\n"
+		"	orr	v0.16b, v0.16b, v2.16b\n"
+		"	umov	%0, v0.d[0]\n"
+		"	umov	%1, v0.d[1]\n"
+		: "=r" (d0), "=r" (d1), "+r" (s1)
+		: : "v0", "v1", "v2", "v3", "memory");
+	} while (!(d0 | d1) && s1 < end);
+	kernel_neon_end();
+
+	return !(d0 | d1);
+}
+
+static inline int is_full_zero(const void *s1, size_t len)
+{
+	const unsigned long *src = s1;
+	size_t i;
+
+	if (uksm_use_neon && !(len % UKSM_NEON_BLOCK))
+		return uksm_neon_is_full_zero(s1, len);
+
+	len /= sizeof(*src);
+
+	for (i = 0; i < len; i++) {
+		if (src[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <linux/notifier.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/ktime.h>
 #include <linux/vmpressure.h>
 
 /*
@@ -61,7 +62,102 @@ static unsigned long allocstall_threshold = 70;
 module_param_named(allocstall_threshold, allocstall_threshold,
 			ulong, S_IRUGO | S_IWUSR);
 
-static struct vmpressure global_vmpressure;
+/*
+ * Stall mode
+ *
+ * The scanned/reclaimed ratio is only looked at every vmpressure_win pages
+ * and reported from a work item, which is too late and too noisy to react
+ * to a launch that is stuck in reclaim. Pressure can also be taken from
+ * the time tasks really spend stalled in direct reclaim, direct compaction
+ * and memcg limit reclaim: when a stall ends its time is added to the
+ * memcg it was on behalf of and that memcg's ancestors, and the share of
+ * the last window of at least stall_window_ms that was spent stalled is
+ * the stall pressure.
+ *
+ * Events registered as "<level>,stall" are signalled by the stalling task
+ * itself as soon as the stall pressure reaches their level. The level is
+ * only left again once the pressure drops stall_hysteresis below its
+ * threshold, so a memcg that hovers around a threshold does not flood its
+ * listeners. With stall_mode set, the global stall pressure also replaces
+ * the scanned/reclaimed ratio on the vmpressure_notify chain.
+ */
+static bool stall_mode;
+module_param_named(stall_mode, stall_mode, bool, S_IRUGO | S_IWUSR);
+
+static unsigned int stall_window_ms = 10;
+module_param_named(stall_window_ms, stall_window_ms, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int stall_hysteresis = 10;
+module_param_named(stall_hysteresis, stall_hysteresis,
+			uint, S_IRUGO | S_IWUSR);
+
+/*
+ * Stall pressure thresholds of the low, medium and critical levels. A write
+ * that would leave them out of order is rejected as a whole, as
+ * vmpressure_stall_level() relies on them ascending.
+ */
+static unsigned int stall_levels[] = { 10, 30, 60 };
+
+static int stall_levels_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int levels[ARRAY_SIZE(stall_levels)];
+	struct kparam_array arr = *kp->arr;
+	struct kernel_param tmp = *kp;
+	int i, ret;
+
+	memcpy(levels, stall_levels, sizeof(levels));
+	arr.elem = levels;
+	tmp.arr = &arr;
+	ret = param_array_ops.set(val, &tmp);
+	if (ret)
+		return ret;
+
+	for (i = 1; i < ARRAY_SIZE(levels); i++)
+		if (levels[i] <= levels[i - 1])
+			return -EINVAL;
+
+	memcpy(stall_levels, levels, sizeof(levels));
+	return 0;
+}
+
+static int stall_levels_get(char *buffer, const struct kernel_param *kp)
+{
+	return param_array_ops.get(buffer, kp);
+}
+
+static struct kernel_param_ops stall_levels_ops = {
+	.set = stall_levels_set,
+	.get = stall_levels_get,
+};
+
+static const struct kparam_array stall_levels_arr = {
+	.max = ARRAY_SIZE(stall_levels),
+	.elemsize = sizeof(stall_levels[0]),
+	.ops = &param_ops_uint,
+	.elem = stall_levels,
+};
+module_param_cb(stall_levels, &stall_levels_ops, &stall_levels_arr,
+		S_IRUGO | S_IWUSR);
+__MODULE_PARM_TYPE(stall_levels, "array of uint");
+
+bool vmpressure_stall_mode(void)
+{
+	return stall_mode;
+}
+
+static void vmpressure_work_fn(struct work_struct *work);
+
+/*
+ * Initialised statically: vmpressure_global() and vmpressure_stall() can
+ * run from the first reclaim, long before any initcall.
+ */
+static struct vmpressure global_vmpressure = {
+	.sr_lock = __SPIN_LOCK_UNLOCKED(global_vmpressure.sr_lock),
+	.stall_level = -1,
+	.events = LIST_HEAD_INIT(global_vmpressure.events),
+	.events_lock = __MUTEX_INITIALIZER(global_vmpressure.events_lock),
+	.work = __WORK_INITIALIZER(global_vmpressure.work, vmpressure_work_fn),
+};
 BLOCKING_NOTIFIER_HEAD(vmpressure_notifier);
 
 int vmpressure_notifier_register(struct notifier_block *nb)
@@ -183,6 +279,7 @@ static unsigned long vmpressure_account_stall(unsigned long pressure,
 struct vmpressure_event {
 	struct eventfd_ctx *efd;
 	enum vmpressure_levels level;
+	bool stall;
 	struct list_head node;
 };
 
@@ -200,7 +297,7 @@ static bool vmpressure_event(struct vmpressure *vmpr,
 	mutex_lock(&vmpr->events_lock);
 
 	list_for_each_entry(ev, &vmpr->events, node) {
-		if (level >= ev->level) {
+		if (!ev->stall && level >= ev->level) {
 			eventfd_signal(ev->efd, 1);
 			signalled = true;
 		}
@@ -300,6 +397,10 @@ void vmpressure_global(gfp_t gfp, unsigned long scanned,
 	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
 		return;
 
+	/* The notify chain is fed from vmpressure_stall() instead */
+	if (stall_mode)
+		return;
+
 	if (!scanned)
 		return;
 
@@ -382,6 +483,158 @@ void vmpressure_prio(gfp_t gfp, struct mem_cgroup *memcg, int prio)
 	vmpressure(gfp, memcg, vmpressure_win, 0);
 }
 
+/* Stall level for @pressure, holding on to @cur within the hysteresis */
+static int vmpressure_stall_level(int cur, unsigned long pressure)
+{
+	int level;
+
+	for (level = VMPRESSURE_NUM_LEVELS - 1; level >= 0; level--) {
+		if (pressure >= stall_levels[level])
+			break;
+	}
+
+	if (level < cur && pressure + stall_hysteresis >= stall_levels[cur])
+		return cur;
+	return level;
+}
+
+static void vmpressure_stall_event(struct vmpressure *vmpr, int old, int level)
+{
+	struct vmpressure_event *ev;
+
+	mutex_lock(&vmpr->events_lock);
+	list_for_each_entry(ev, &vmpr->events, node) {
+		if (ev->stall && ev->level > old && ev->level <= level)
+			eventfd_signal(ev->efd, 1);
+	}
+	mutex_unlock(&vmpr->events_lock);
+}
+
+/*
+ * Add a stall of @delta ns that ended at @now. Returns the stall pressure
+ * if that closed the window, -1 otherwise.
+ */
+static long vmpressure_stall_account(struct vmpressure *vmpr,
+				     u64 now, u64 delta)
+{
+	s64 window = (s64)stall_window_ms * NSEC_PER_MSEC;
+	unsigned long pressure;
+	int old, level;
+
+	spin_lock(&vmpr->sr_lock);
+	/* Start over if the window ran out before this stall began */
+	if ((s64)(now - delta - vmpr->stall_start) > window) {
+		vmpr->stall_start = now - delta;
+		vmpr->stall_time = 0;
+	}
+
+	vmpr->stall_time += delta;
+	if ((s64)(now - vmpr->stall_start) < window) {
+		spin_unlock(&vmpr->sr_lock);
+		return -1;
+	}
+
+	/* Overlapping stalls of several tasks can add up to more than 100% */
+	pressure = div64_u64(vmpr->stall_time * 100,
+			     max_t(u64, now - vmpr->stall_start, 1));
+	pressure = min(pressure, 100UL);
+	vmpr->stall_start = now;
+	vmpr->stall_time = 0;
+
+	old = vmpr->stall_level;
+	level = vmpressure_stall_level(old, pressure);
+	vmpr->stall_level = level;
+	spin_unlock(&vmpr->sr_lock);
+
+	if (level > old)
+		vmpressure_stall_event(vmpr, old, level);
+
+	return pressure;
+}
+
+static void vmpressure_stall_tree(struct vmpressure *vmpr, u64 now, u64 delta)
+{
+	for (; vmpr; vmpr = vmpressure_parent(vmpr))
+		vmpressure_stall_account(vmpr, now, delta);
+}
+
+#ifdef CONFIG_MEMCG
+/* vmpressure of the memcg of current, with a reference held on it */
+static struct vmpressure *vmpressure_get_current(void)
+{
+	struct vmpressure *vmpr = NULL;
+	struct mem_cgroup *memcg;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(current);
+	if (memcg) {
+		vmpr = memcg_to_vmpressure(memcg);
+		if (!css_tryget_online(vmpressure_to_css(vmpr)))
+			vmpr = NULL;
+	}
+	rcu_read_unlock();
+
+	return vmpr;
+}
+
+static void vmpressure_put_current(struct vmpressure *vmpr)
+{
+	css_put(vmpressure_to_css(vmpr));
+}
+#else
+static struct vmpressure *vmpressure_get_current(void)
+{
+	return NULL;
+}
+
+static void vmpressure_put_current(struct vmpressure *vmpr)
+{
+}
+#endif
+
+/**
+ * vmpressure_stall() - Account memory pressure through reclaim stall time
+ * @gfp:	gfp mask of the allocation that stalled
+ * @memcg:	memcg whose limit was reclaimed from, NULL for direct reclaim
+ * @start:	ktime_get_ns() when the stall began
+ *
+ * This function should be called when a task comes back from direct
+ * reclaim or compaction, or from reclaim to make room under a memcg
+ * limit. Direct reclaim stalls are charged to the memcg of the task and,
+ * in stall mode, to the global pressure.
+ *
+ * This function does not return any value.
+ */
+void vmpressure_stall(gfp_t gfp, struct mem_cgroup *memcg, u64 start)
+{
+	struct vmpressure *vmpr;
+	u64 now = ktime_get_ns();
+	long pressure;
+
+	/* See vmpressure_memcg() */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (memcg) {
+		vmpressure_stall_tree(memcg_to_vmpressure(memcg),
+				      now, now - start);
+		return;
+	}
+
+	if (stall_mode) {
+		pressure = vmpressure_stall_account(&global_vmpressure,
+						    now, now - start);
+		if (pressure >= 0)
+			vmpressure_notify(pressure);
+	}
+
+	vmpr = vmpressure_get_current();
+	if (vmpr) {
+		vmpressure_stall_tree(vmpr, now, now - start);
+		vmpressure_put_current(vmpr);
+	}
+}
+
 /**
  * vmpressure_register_event() - Bind vmpressure notifications to an eventfd
  * @memcg:	memcg that is interested in vmpressure notifications
@@ -392,7 +645,8 @@ void vmpressure_prio(gfp_t gfp, struct mem_cgroup *memcg, int prio)
  * infrastructure, so that the notifications will be delivered to the
  * @eventfd. The @args parameter is a string that denotes pressure level
  * threshold (one of vmpressure_str_levels, i.e. "low", "medium", or
- * "critical").
+ * "critical"), optionally followed by ",stall" to be notified from the
+ * stall time instead of the scanned/reclaimed ratio.
  *
  * To be used as memcg event method.
  */
@@ -401,24 +655,34 @@ int vmpressure_register_event(struct mem_cgroup *memcg,
 {
 	struct vmpressure *vmpr = memcg_to_vmpressure(memcg);
 	struct vmpressure_event *ev;
+	const char *mode;
+	size_t len;
 	int level;
 
 	BUG_ON(!vmpr);
 
+	mode = strchr(args, ',');
+	len = mode ? mode - args : strlen(args);
+
 	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++) {
-		if (!strcmp(vmpressure_str_levels[level], args))
+		if (strlen(vmpressure_str_levels[level]) == len &&
+		    !strncmp(vmpressure_str_levels[level], args, len))
 			break;
 	}
 
 	if (level >= VMPRESSURE_NUM_LEVELS)
 		return -EINVAL;
 
+	if (mode && strcmp(mode + 1, "stall"))
+		return -EINVAL;
+
 	ev = kzalloc(sizeof(*ev), GFP_KERNEL);
 	if (!ev)
 		return -ENOMEM;
 
 	ev->efd = eventfd;
 	ev->level = level;
+	ev->stall = mode != NULL;
 
 	mutex_lock(&vmpr->events_lock);
 	list_add(&ev->node, &vmpr->events);
@@ -470,6 +734,7 @@ void vmpressure_init(struct vmpressure *vmpr)
 	mutex_init(&vmpr->events_lock);
 	INIT_LIST_HEAD(&vmpr->events);
 	INIT_WORK(&vmpr->work, vmpressure_work_fn);
+	vmpr->stall_level = -1;
 }
 
 /**
@@ -487,10 +752,3 @@ void vmpressure_cleanup(struct vmpressure *vmpr)
 	 */
 	flush_work(&vmpr->work);
 }
-
-int vmpressure_global_init(void)
-{
-	vmpressure_init(&global_vmpressure);
-	return 0;
-}
-late_initcall(vmpressure_global_init);
@@ -29,6 +29,8 @@
 #include <linux/buffer_head.h>	/* for try_to_release_page(),
 					buffer_heads_over_limit */
 #include <linux/mm_inline.h>
+#include <linux/pagevec.h>
+#include <linux/seq_file.h>
 #include <linux/backing-dev.h>
 #include <linux/rmap.h>
 #include <linux/topology.h>
@@ -46,6 +48,7 @@
 #include <linux/oom.h>
 #include <linux/prefetch.h>
 #include <linux/printk.h>
+#include <linux/psi.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -144,6 +147,12 @@ struct scan_control {
  * From 0 .. 100.  Higher means more swappy.
  */
 int vm_swappiness = 1;
+/*
+ * Percentage of inactive file list turnover that has to come from
+ * activating refaults before the active file list is protected.
+ * 0 disables the protection.
+ */
+int vm_refault_protect_ratio = 10;
 /*
  * The total number of pages which are beyond the high watermark within all
  * zones.
@@ -732,14 +741,40 @@ enum page_references {
 	PAGEREF_ACTIVATE,
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-gen LRU the aging walk clears the accessed bits, and
+ * try_to_unmap() refuses pages that were accessed since. Leave the rmap
+ * walk to unmapping instead of doing it twice.
+ */
+static bool lru_gen_skip_rmap(struct page *page, struct scan_control *sc)
+{
+	if (!lru_gen_enabled() || sc->target_vma || !page_mapped(page))
+		return false;
+
+	count_vm_event(LRU_GEN_RMAP_SKIP);
+	return true;
+}
+#else
+static inline bool lru_gen_skip_rmap(struct page *page,
+				     struct scan_control *sc)
+{
+	return false;
+}
+#endif
+
 static enum page_references page_check_references(struct page *page,
 						  struct scan_control *sc)
 {
 	int referenced_ptes, referenced_page;
 	unsigned long vm_flags;
 
-	referenced_ptes = page_referenced(page, 1, sc->target_mem_cgroup,
-					  &vm_flags);
+	if (lru_gen_skip_rmap(page, sc)) {
+		referenced_ptes = 0;
+		vm_flags = 0;
+	} else
+		referenced_ptes = page_referenced(page, 1,
+				sc->target_mem_cgroup, &vm_flags);
 	referenced_page = TestClearPageReferenced(page);
 
 	/*
@@ -1236,6 +1271,26 @@ unsigned long reclaim_pages_from_list(struct list_head *page_list,
 
 	return nr_reclaimed;
 }
+
+/* Put isolated pages back on the inactive lists, as if never referenced */
+unsigned long deactivate_pages_from_list(struct list_head *page_list)
+{
+	unsigned long nr_deactivated = 0;
+	struct page *page;
+
+	while (!list_empty(page_list)) {
+		page = lru_to_page(page_list);
+		list_del(&page->lru);
+		dec_zone_page_state(page, NR_ISOLATED_ANON +
+				page_is_file_cache(page));
+		ClearPageActive(page);
+		ClearPageReferenced(page);
+		putback_lru_page(page);
+		nr_deactivated++;
+	}
+
+	return nr_deactivated;
+}
 #endif
 
 /*
@@ -1465,6 +1520,11 @@ static int __too_many_isolated(struct zone *zone, int file,
 	 * won't get blocked by normal direct-reclaimers, forming a circular
 	 * deadlock.
 	 */
+	/* The multi-gen LRU evicts active pages too */
+	if (lru_gen_enabled())
+		inactive += zone_page_state(zone,
+				file ? NR_ACTIVE_FILE : NR_ACTIVE_ANON);
+
 	if ((sc->gfp_mask & GFP_IOFS) == GFP_IOFS)
 		inactive >>= 3;
 
@@ -1953,10 +2013,73 @@ static int inactive_file_is_low(struct lruvec *lruvec)
 	return active > inactive;
 }
 
-static int inactive_list_is_low(struct lruvec *lruvec, enum lru_list lru)
+/*
+ * zone_file_thrashing - check if the file working set is being evicted
+ * @zone: zone to check
+ *
+ * Every eviction and activation on the inactive file list ages it by
+ * one. If a large share of that turnover is refaults that the workingset
+ * code activated, pages that were in use not long ago are being pushed
+ * out, typically by a stream of use-once pages going through the cache.
+ * Deactivating more of the active list then only makes it worse.
+ */
+static bool zone_file_thrashing(struct zone *zone)
+{
+	unsigned long age, activate;
+	unsigned long delta_age;
+
+	if (!vm_refault_protect_ratio)
+		return false;
+
+	if (time_before(jiffies, zone->refault_stamp + HZ))
+		return zone->refault_protect;
+
+	age = atomic_long_read(&zone->inactive_age);
+	activate = zone_page_state(zone, WORKINGSET_ACTIVATE);
+	delta_age = age - zone->refault_age;
+
+	/* Too little turnover to say anything, keep the last verdict */
+	if (delta_age < SWAP_CLUSTER_MAX)
+		return zone->refault_protect;
+
+	zone->refault_protect = (activate - zone->refault_activate) * 100 >
+				delta_age * vm_refault_protect_ratio;
+	zone->refault_age = age;
+	zone->refault_activate = activate;
+	zone->refault_stamp = jiffies;
+
+	return zone->refault_protect;
+}
+
+/*
+ * While the zone is thrashing, only deactivate file pages once the
+ * inactive list has shrunk to a fifth of the file LRU, or when reclaim
+ * is struggling and the working set has to give way anyway.
+ */
+static int inactive_file_is_low_protected(struct lruvec *lruvec,
+					  struct scan_control *sc)
+{
+	unsigned long inactive;
+	unsigned long active;
+
+	if (!inactive_file_is_low(lruvec))
+		return 0;
+
+	if (sc->priority < DEF_PRIORITY - 2 ||
+	    !zone_file_thrashing(lruvec_zone(lruvec)))
+		return 1;
+
+	inactive = get_lru_size(lruvec, LRU_INACTIVE_FILE);
+	active = get_lru_size(lruvec, LRU_ACTIVE_FILE);
+
+	return active > inactive * 4;
+}
+
+static int inactive_list_is_low(struct lruvec *lruvec, enum lru_list lru,
+				struct scan_control *sc)
 {
 	if (is_file_lru(lru))
-		return inactive_file_is_low(lruvec);
+		return inactive_file_is_low_protected(lruvec, sc);
 	else
 		return inactive_anon_is_low(lruvec);
 }
@@ -1965,7 +2088,7 @@ static unsigned long shrink_list(enum lru_list lru, unsigned long nr_to_scan,
 				 struct lruvec *lruvec, struct scan_control *sc)
 {
 	if (is_active_lru(lru)) {
-		if (inactive_list_is_low(lruvec, lru))
+		if (inactive_list_is_low(lruvec, lru, sc))
 			shrink_active_list(nr_to_scan, lruvec, sc, lru);
 		return 0;
 	}
@@ -2157,6 +2280,586 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-gen LRU
+ *
+ * Instead of sampling the rmap of every page that reaches the end of the
+ * inactive list, kswapd ages pages by walking the page tables of each mm
+ * and moving the pages it finds accessed to the youngest generation.
+ * Eviction then takes the oldest generation in list order. Direct reclaim
+ * never walks: it only opens a new generation when it runs out of old
+ * ones, and try_to_unmap() still refuses mapped pages that were accessed
+ * since the last walk, which sends them to the youngest generation.
+ */
+struct static_key lru_gen_key = STATIC_KEY_INIT_FALSE;
+
+static bool lru_gen_enable __initdata = IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+static int __init setup_lru_gen(char *str)
+{
+	return strtobool(str, &lru_gen_enable) == 0;
+}
+__setup("lru_gen=", setup_lru_gen);
+
+void __init lru_gen_init(void)
+{
+	if (lru_gen_enable)
+		static_key_slow_inc(&lru_gen_key);
+}
+
+/* Pages moved before dropping the lru_lock when merging generations */
+#define LRU_GEN_BATCH		64
+/* Number of mms pinned at a time by the aging walk */
+#define LRU_GEN_MM_BATCH	16
+
+static DEFINE_MUTEX(lru_gen_walk_lock);
+static unsigned long lru_gen_walk_seq;
+static unsigned long lru_gen_walk_stamp;
+
+struct lru_gen_walk {
+	struct vm_area_struct *vma;
+	struct pagevec pvec;
+	unsigned long nr_scanned;
+};
+
+static int lru_gen_nr_gens(struct lru_gen *lrugen, int type)
+{
+	return lrugen->max_seq - lrugen->min_seq[type] + 1;
+}
+
+/* Retire the oldest generations of @type that reclaim has emptied */
+static void lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+
+	while (lru_gen_nr_gens(lrugen, type) > MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		if (!list_empty(&lrugen->lists[gen][type]))
+			break;
+		lrugen->min_seq[type]++;
+	}
+}
+
+/*
+ * Make room for a new generation by merging the oldest generation of
+ * @type into the next one. This is needed when reclaim does not evict
+ * @type, anon without swap for example. Called with the lru_lock held,
+ * which is dropped every LRU_GEN_BATCH pages.
+ */
+static void lru_gen_force_min_seq(struct lruvec *lruvec, int type)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long seq = lrugen->min_seq[type];
+	int old_gen = lru_gen_from_seq(seq);
+	int new_gen = lru_gen_from_seq(seq + 1);
+	struct list_head *list = &lrugen->lists[old_gen][type];
+	unsigned long nr_moved = 0;
+
+	while (!list_empty(list)) {
+		struct page *page = list_first_entry(list, struct page, lru);
+		int nr_pages = hpage_nr_pages(page);
+
+		/* Youngest first, so the oldest page ends up at the tail */
+		set_page_lru_gen(page, new_gen);
+		lrugen->nr_pages[old_gen][type] -= nr_pages;
+		lrugen->nr_pages[new_gen][type] += nr_pages;
+		list_move_tail(&page->lru, &lrugen->lists[new_gen][type]);
+
+		if (++nr_moved % LRU_GEN_BATCH)
+			continue;
+
+		spin_unlock_irq(&zone->lru_lock);
+		cond_resched();
+		spin_lock_irq(&zone->lru_lock);
+		/* Reclaim emptied it meanwhile and retired it already */
+		if (lrugen->min_seq[type] != seq)
+			goto out;
+	}
+	lrugen->min_seq[type]++;
+out:
+	__count_vm_events(LRU_GEN_FORCE_AGE, nr_moved);
+}
+
+/*
+ * Open a new youngest generation. Returns false if somebody else advanced
+ * max_seq since the caller sampled it.
+ */
+static bool lru_gen_inc_max_seq(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	bool ret = false;
+	int type;
+
+	spin_lock_irq(&zone->lru_lock);
+	for (type = 0; type < 2 && max_seq == lrugen->max_seq; type++) {
+		lru_gen_inc_min_seq(lruvec, type);
+		if (lru_gen_nr_gens(lrugen, type) == MAX_NR_GENS)
+			lru_gen_force_min_seq(lruvec, type);
+	}
+	if (max_seq == lrugen->max_seq &&
+	    lru_gen_nr_gens(lrugen, 0) < MAX_NR_GENS &&
+	    lru_gen_nr_gens(lrugen, 1) < MAX_NR_GENS) {
+		lrugen->max_seq++;
+		__count_vm_event(LRU_GEN_AGING);
+		ret = true;
+	}
+	spin_unlock_irq(&zone->lru_lock);
+
+	return ret;
+}
+
+/* Move pages whose accessed bit the walk cleared to the youngest generation */
+static void lru_gen_promote(struct pagevec *pvec)
+{
+	struct zone *zone = NULL;
+	int nr_promoted = 0;
+	int i;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+		struct zone *pagezone = page_zone(page);
+		struct lruvec *lruvec;
+		int gen;
+
+		if (pagezone != zone) {
+			if (zone) {
+				__count_vm_events(LRU_GEN_PROMOTE, nr_promoted);
+				spin_unlock_irq(&zone->lru_lock);
+				nr_promoted = 0;
+			}
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+
+		/* Isolated, unevictable or on its way out */
+		gen = page_lru_gen(page);
+		if (!PageLRU(page) || gen < 0)
+			continue;
+
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		if (PageActive(page) &&
+		    gen == lru_gen_from_seq(lruvec->lrugen.max_seq))
+			continue;
+
+		del_page_from_lru_list(page, lruvec, page_lru(page));
+		SetPageActive(page);
+		add_page_to_lru_list(page, lruvec, page_lru(page));
+		nr_promoted++;
+	}
+	if (zone) {
+		__count_vm_events(LRU_GEN_PROMOTE, nr_promoted);
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	release_pages(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_reinit(pvec);
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *gw = walk->private;
+	struct vm_area_struct *vma = gw->vma;
+	pte_t *orig_pte, *pte, ptent;
+	spinlock_t *ptl;
+	struct page *page;
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	while (addr != end) {
+		orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+		for (; addr != end; pte++, addr += PAGE_SIZE) {
+			ptent = *pte;
+			gw->nr_scanned++;
+			if (!pte_present(ptent) || !pte_young(ptent))
+				continue;
+
+			page = vm_normal_page(vma, addr, ptent);
+			if (!page || !PageLRU(page))
+				continue;
+
+			/*
+			 * No TLB flush: a stale entry only hides accesses
+			 * until the next walk, and reclaim flushes anyway
+			 * when it unmaps the page.
+			 */
+			if (!ptep_test_and_clear_young(vma, addr, pte))
+				continue;
+
+			get_page(page);
+			if (!pagevec_add(&gw->pvec, page)) {
+				addr += PAGE_SIZE;
+				break;
+			}
+		}
+		pte_unmap_unlock(orig_pte, ptl);
+
+		/* Promotion takes the lru_lock, not under the pte lock */
+		if (!pagevec_space(&gw->pvec))
+			lru_gen_promote(&gw->pvec);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm, struct lru_gen_walk *gw)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd,
+		.mm = mm,
+		.private = gw,
+	};
+	struct vm_area_struct *vma;
+
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_LOCKED | VM_IO | VM_PFNMAP))
+			continue;
+		if (is_vm_hugetlb_page(vma))
+			continue;
+
+		gw->vma = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &walk);
+	}
+	up_read(&mm->mmap_sem);
+
+	count_vm_event(LRU_GEN_WALK_MM);
+}
+
+/*
+ * Walk the page tables of every mm once and promote the pages accessed
+ * since the previous walk, whatever lruvec they are on. The walk is global,
+ * so one per second is enough no matter how many lruvecs age meanwhile.
+ */
+static void lru_gen_walk_mms(void)
+{
+	struct mm_struct *mms[LRU_GEN_MM_BATCH];
+	struct lru_gen_walk gw;
+	struct task_struct *p, *t;
+	unsigned long seq;
+	int i, nr;
+
+	if (!mutex_trylock(&lru_gen_walk_lock))
+		return;
+
+	if (lru_gen_walk_stamp &&
+	    time_before(jiffies, lru_gen_walk_stamp + HZ))
+		goto unlock;
+
+	seq = ++lru_gen_walk_seq;
+	pagevec_init(&gw.pvec, 0);
+	gw.nr_scanned = 0;
+
+	do {
+		nr = 0;
+		rcu_read_lock();
+		for_each_process(p) {
+			if (p->flags & PF_KTHREAD)
+				continue;
+
+			t = find_lock_task_mm(p);
+			if (!t)
+				continue;
+
+			if (t->mm->lru_gen_seq != seq &&
+			    atomic_inc_not_zero(&t->mm->mm_users)) {
+				t->mm->lru_gen_seq = seq;
+				mms[nr++] = t->mm;
+			}
+			task_unlock(t);
+
+			if (nr == LRU_GEN_MM_BATCH)
+				break;
+		}
+		rcu_read_unlock();
+
+		for (i = 0; i < nr; i++) {
+			lru_gen_walk_mm(mms[i], &gw);
+			/* The last reference must not tear down the mm here */
+			mmput_async(mms[i]);
+		}
+	} while (nr == LRU_GEN_MM_BATCH);
+
+	if (pagevec_count(&gw.pvec))
+		lru_gen_promote(&gw.pvec);
+
+	count_vm_events(LRU_GEN_WALK_PTE, gw.nr_scanned);
+	lru_gen_walk_stamp = jiffies;
+unlock:
+	mutex_unlock(&lru_gen_walk_lock);
+}
+
+/*
+ * Isolate pages from the oldest generation of @type and reclaim them. Pages
+ * that mark_page_accessed() referenced after they were promoted are given
+ * another round in the youngest generation instead.
+ */
+static unsigned long lru_gen_evict(struct lruvec *lruvec, int type,
+				   unsigned long nr_to_scan,
+				   struct scan_control *sc,
+				   unsigned long *nr_scanned)
+{
+	LIST_HEAD(page_list);
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
+	unsigned long nr_taken = 0;
+	unsigned long nr_protected = 0;
+	unsigned long nr_reclaimed;
+	unsigned long nr_dirty = 0;
+	unsigned long nr_congested = 0;
+	unsigned long nr_unqueued_dirty = 0;
+	unsigned long nr_writeback = 0;
+	unsigned long nr_immediate = 0;
+	isolate_mode_t isolate_mode = 0;
+	struct list_head *list;
+	unsigned long scan = 0;
+	int safe = 0;
+
+	while (unlikely(too_many_isolated(zone, type, sc, safe))) {
+		congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current)) {
+			*nr_scanned = nr_to_scan;
+			return SWAP_CLUSTER_MAX;
+		}
+
+		safe = 1;
+	}
+
+	lru_add_drain();
+
+	if (!sc->may_unmap)
+		isolate_mode |= ISOLATE_UNMAPPED;
+	if (!sc->may_writepage)
+		isolate_mode |= ISOLATE_CLEAN;
+
+	spin_lock_irq(&zone->lru_lock);
+
+	/* Only the protected generations are left, the caller has to age */
+	lru_gen_inc_min_seq(lruvec, type);
+	if (lru_gen_nr_gens(lrugen, type) <= MIN_NR_GENS)
+		goto unlock;
+
+	list = &lrugen->lists[lru_gen_from_seq(lrugen->min_seq[type])][type];
+	for (; scan < nr_to_scan && !list_empty(list); scan++) {
+		struct page *page = lru_to_page(list);
+		enum lru_list lru = page_lru(page);
+
+		prefetchw_prev_lru_page(page, list, flags);
+
+		VM_BUG_ON_PAGE(!PageLRU(page), page);
+
+		if (PageActive(page) && TestClearPageReferenced(page)) {
+			del_page_from_lru_list(page, lruvec, lru);
+			add_page_to_lru_list(page, lruvec, lru);
+			nr_protected++;
+			continue;
+		}
+
+		if (__isolate_lru_page(page, isolate_mode)) {
+			/* else it is being freed elsewhere */
+			list_move(&page->lru, list);
+			continue;
+		}
+
+		del_page_from_lru_list(page, lruvec, lru);
+		ClearPageActive(page);
+		list_add(&page->lru, &page_list);
+		nr_taken += hpage_nr_pages(page);
+	}
+
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + type, nr_taken);
+	reclaim_stat->recent_scanned[type] += nr_taken;
+	__count_vm_events(LRU_GEN_PROTECT, nr_protected);
+
+	if (global_reclaim(sc)) {
+		__mod_zone_page_state(zone, NR_PAGES_SCANNED, scan);
+		if (current_is_kswapd())
+			__count_zone_vm_events(PGSCAN_KSWAPD, zone, scan);
+		else
+			__count_zone_vm_events(PGSCAN_DIRECT, zone, scan);
+	}
+unlock:
+	spin_unlock_irq(&zone->lru_lock);
+
+	*nr_scanned = scan;
+	if (nr_taken == 0)
+		return 0;
+
+	nr_reclaimed = shrink_page_list(&page_list, zone, sc, TTU_UNMAP,
+				&nr_dirty, &nr_unqueued_dirty, &nr_congested,
+				&nr_writeback, &nr_immediate,
+				false);
+
+	spin_lock_irq(&zone->lru_lock);
+
+	if (global_reclaim(sc)) {
+		if (current_is_kswapd())
+			__count_zone_vm_events(PGSTEAL_KSWAPD, zone,
+					       nr_reclaimed);
+		else
+			__count_zone_vm_events(PGSTEAL_DIRECT, zone,
+					       nr_reclaimed);
+	}
+
+	putback_inactive_pages(lruvec, &page_list);
+
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + type, -nr_taken);
+
+	spin_unlock_irq(&zone->lru_lock);
+
+	mem_cgroup_uncharge_list(&page_list);
+	free_hot_cold_page_list(&page_list, true);
+
+	/* Same writeback throttling as shrink_inactive_list() */
+	if (nr_writeback && nr_writeback == nr_taken)
+		set_bit(ZONE_WRITEBACK, &zone->flags);
+
+	if (global_reclaim(sc)) {
+		if (nr_dirty && nr_dirty == nr_congested)
+			set_bit(ZONE_CONGESTED, &zone->flags);
+		if (nr_unqueued_dirty == nr_taken)
+			set_bit(ZONE_DIRTY, &zone->flags);
+		if (nr_immediate && current_may_throttle())
+			congestion_wait(BLK_RW_ASYNC, HZ/10);
+	}
+
+	if (!sc->hibernation_mode && !current_is_kswapd() &&
+	    current_may_throttle())
+		wait_iff_congested(zone, BLK_RW_ASYNC, HZ/10);
+
+	return nr_reclaimed;
+}
+
+/*
+ * Evict the type whose oldest generation is older. When both are the same
+ * age, weigh their sizes by swappiness like get_scan_count() does.
+ */
+static int lru_gen_pick_type(struct lruvec *lruvec, int swappiness,
+			     bool can_swap)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long anon, file;
+	int gen;
+
+	if (!can_swap)
+		return 1;
+
+	if (lrugen->min_seq[0] != lrugen->min_seq[1])
+		return lrugen->min_seq[0] > lrugen->min_seq[1];
+
+	gen = lru_gen_from_seq(lrugen->min_seq[0]);
+	anon = max(lrugen->nr_pages[gen][0], 0L) * swappiness;
+	file = max(lrugen->nr_pages[gen][1], 0L) * (200 - swappiness);
+
+	return file >= anon;
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_reclaimed = 0;
+	unsigned long nr_to_scan;
+	struct blk_plug plug;
+	bool scan_adjusted;
+	bool can_swap;
+
+	can_swap = sc->may_swap && swappiness && get_nr_swap_pages() > 0;
+
+	nr_to_scan = get_lru_size(lruvec, LRU_INACTIVE_FILE) +
+		     get_lru_size(lruvec, LRU_ACTIVE_FILE);
+	if (can_swap)
+		nr_to_scan += get_lru_size(lruvec, LRU_INACTIVE_ANON) +
+			      get_lru_size(lruvec, LRU_ACTIVE_ANON);
+	nr_to_scan >>= sc->priority;
+
+	/* Same as force_scan in get_scan_count() */
+	if (!nr_to_scan && (!global_reclaim(sc) ||
+	    (current_is_kswapd() && !zone_reclaimable(lruvec_zone(lruvec)))))
+		nr_to_scan = SWAP_CLUSTER_MAX;
+
+	/* See shrink_lruvec() */
+	scan_adjusted = (global_reclaim(sc) && !current_is_kswapd() &&
+			 sc->priority == DEF_PRIORITY);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan) {
+		unsigned long batch = min(nr_to_scan, SWAP_CLUSTER_MAX);
+		unsigned long max_seq = ACCESS_ONCE(lrugen->max_seq);
+		unsigned long nr_scanned;
+		int type;
+
+		type = lru_gen_pick_type(lruvec, swappiness, can_swap);
+		nr_reclaimed += lru_gen_evict(lruvec, type, batch, sc,
+					      &nr_scanned);
+		if (!nr_scanned && lru_gen_inc_max_seq(lruvec, max_seq) &&
+		    current_is_kswapd())
+			lru_gen_walk_mms();
+
+		nr_to_scan -= batch;
+		if (nr_reclaimed >= nr_to_reclaim && !scan_adjusted)
+			break;
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+
+	throttle_vm_writeout(sc->gfp_mask);
+}
+
+/* Sizes of the generations in @zone, youngest first, for /proc/zoneinfo */
+void lru_gen_show_zone(struct seq_file *m, struct zone *zone)
+{
+	unsigned long nr[MAX_NR_GENS][2] = { };
+	struct mem_cgroup *memcg;
+	int age, type;
+
+	if (!lru_gen_enabled())
+		return;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		struct lru_gen *lrugen;
+
+		lrugen = &mem_cgroup_zone_lruvec(zone, memcg)->lrugen;
+		for (age = 0; age < MAX_NR_GENS; age++) {
+			unsigned long seq = lrugen->max_seq - age;
+
+			for (type = 0; type < 2; type++) {
+				int gen = lru_gen_from_seq(seq);
+
+				if (age > lrugen->max_seq ||
+				    seq < lrugen->min_seq[type])
+					continue;
+				nr[age][type] += max(lrugen->nr_pages[gen][type],
+						     0L);
+			}
+		}
+		memcg = mem_cgroup_iter(NULL, memcg, NULL);
+	} while (memcg);
+
+	for (age = 0; age < MAX_NR_GENS; age++)
+		seq_printf(m, "\n  lru_gen %d: anon %lu file %lu",
+			   age, nr[age][0], nr[age][1]);
+}
+#else
+static inline void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+					 int swappiness,
+					 struct scan_control *sc)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2172,6 +2875,11 @@ static void shrink_lruvec(struct lruvec *lruvec, int swappiness,
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, swappiness, sc);
+		return;
+	}
+
 	get_scan_count(lruvec, swappiness, sc, nr);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2894,7 +3602,7 @@ static void age_active_anon(struct zone *zone, struct scan_control *sc)
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
@@ -3124,6 +3832,7 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 	int end_zone = 0;	/* Inclusive.  0 = ZONE_DMA */
 	unsigned long nr_soft_reclaimed;
 	unsigned long nr_soft_scanned;
+	unsigned long pflags;
 	struct scan_control sc = {
 		.gfp_mask = GFP_KERNEL,
 		.order = order,
@@ -3132,6 +3841,8 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		.may_unmap = 1,
 		.may_swap = 1,
 	};
+
+	psi_memstall_enter(&pflags);
 	count_vm_event(PAGEOUTRUN);
 
 	do {
@@ -3305,6 +4016,7 @@ out:
 	 * was awake, order will remain at the higher level
 	 */
 	*classzone_idx = end_zone;
+	psi_memstall_leave(&pflags);
 	return order;
 }
 
@@ -845,6 +845,21 @@ const char * const vmstat_text[] = {
 	"drop_pagecache",
 	"drop_slab",
 
+#ifdef CONFIG_PROCESS_RECLAIM
+	"madvise_cold",
+	"madvise_pageout",
+#endif
+
+#ifdef CONFIG_LRU_GEN
+	"lru_gen_aging",
+	"lru_gen_walk_mm",
+	"lru_gen_walk_pte",
+	"lru_gen_promote",
+	"lru_gen_protect",
+	"lru_gen_force_age",
+	"lru_gen_rmap_skip",
+#endif
+
 #ifdef CONFIG_NUMA_BALANCING
 	"numa_pte_updates",
 	"numa_huge_pte_updates",
@@ -1238,6 +1253,7 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   !zone_reclaimable(zone),
 		   zone->zone_start_pfn,
 		   zone->inactive_ratio);
+	lru_gen_show_zone(m, zone);
 	seq_putc(m, '\n');
 }
 
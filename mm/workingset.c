@@ -221,26 +221,33 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
 
 /**
  * workingset_refault - evaluate the refault of a previously evicted page
+ * @mapping: address space the page is coming back to
+ * @page: the page being read back in, charged and locked
  * @shadow: shadow entry of the evicted page
  *
  * Calculates and evaluates the refault distance of the previously
- * evicted page in the context of the zone it was allocated in.
+ * evicted page in the context of the zone it was allocated in, and
+ * accounts the refault to the zone, the memcg and the mapping.
  *
  * Returns %true if the page should be activated, %false otherwise.
  */
-bool workingset_refault(void *shadow)
+bool workingset_refault(struct address_space *mapping, struct page *page,
+			void *shadow)
 {
 	unsigned long refault_distance;
 	struct zone *zone;
+	bool activate;
 
 	unpack_shadow(shadow, &zone, &refault_distance);
 	inc_zone_state(zone, WORKINGSET_REFAULT);
+	atomic_long_inc(&mapping->nrrefaults);
 
-	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+	activate = refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE);
+	if (activate)
 		inc_zone_state(zone, WORKINGSET_ACTIVATE);
-		return true;
-	}
-	return false;
+	mem_cgroup_count_refault(page, activate);
+
+	return activate;
 }
 
 /**
@@ -35,9 +35,10 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/radix-tree.h>
-#include <linux/rbtree.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
 #include <linux/types.h>
-#include <linux/zbud.h>
+#include <linux/zpool.h>
 
 /*
  * Enable/disable zcache (disabled by default)
@@ -52,6 +53,13 @@ module_param_named(enabled, zcache_enabled, bool, 0);
 static char *zcache_compressor = ZCACHE_COMPRESSOR_DEFAULT;
 module_param_named(compressor, zcache_compressor, charp, 0);
 
+/*
+ * zpool backend to be used by zcache, e.g. zcache.zpool=zsmalloc
+ */
+#define ZCACHE_ZPOOL_DEFAULT "zbud"
+static char *zcache_zpool_type = ZCACHE_ZPOOL_DEFAULT;
+module_param_named(zpool, zcache_zpool_type, charp, 0);
+
 /*
  * The maximum percentage of memory that the compressed pool can occupy.
  */
@@ -65,7 +73,7 @@ module_param_named(clear_percent, zcache_clear_percent, uint, 0644);
  */
 static u64 zcache_pool_limit_hit;
 static u64 zcache_dup_entry;
-static u64 zcache_zbud_alloc_fail;
+static u64 zcache_zpool_alloc_fail;
 static u64 zcache_evict_zpages;
 static u64 zcache_evict_filepages;
 static u64 zcache_inactive_pages_refused;
@@ -92,33 +100,41 @@ static atomic_t zcache_stored_zero_pages = ATOMIC_INIT(0);
  * to evict pages from its own compressed pool on an LRU basis in the case that
  * the compressed pool is full.
  *
- * Zcache makes use of zbud for the managing the compressed memory pool. Each
- * allocation in zbud is not directly accessible by address.  Rather, a handle
+ * Zcache makes use of zpool (zbud or zsmalloc) for managing the compressed
+ * memory pool. Each allocation in zpool is not directly accessible by address.
+ * Rather, a handle
  * (zaddr) is return by the allocation routine and that handle(zaddr must be
  * mapped before being accessed. The compressed memory pool grows on demand and
  * shrinks as compressed pages are freed.
  *
  * When a file page is passed from cleancache to zcache, zcache maintains a
- * mapping of the <filesystem_type, inode_number, page_index> to the zbud
+ * mapping of the <filesystem_type, inode_number, page_index> to the zpool
  * address that references that compressed file page. This mapping is achieved
- * with a red-black tree per filesystem type, plus a radix tree per red-black
- * node.
+ * with a hash table of inodes per filesystem type, plus a radix tree per inode.
  *
  * A zcache pool with pool_id as the index is created when a filesystem mounted
- * Each zcache pool has a red-black tree, the inode number(rb_index) is the
- * search key. Each red-black tree node has a radix tree which use
- * page->index(ra_index) as the index. Each radix tree slot points to the zbud
- * address combining with some extra information(zcache_ra_handle).
+ * Each zcache pool has an RCU protected hash table keyed by the inode
+ * number(ino), so looking an inode up takes no pool wide lock. Each inode
+ * has a radix tree which use page->index(ra_index) as the index. Each radix
+ * tree slot points to the zpool address combining with some extra
+ * information(zcache_ra_handle).
+ *
+ * zbud evicts on its own through zpool_shrink(). Backends that cannot (such
+ * as zsmalloc) get a per-pool LRU list of zcache_lru_entry instead, which
+ * zcache walks from the tail when the pool is full.
  */
 #define MAX_ZCACHE_POOLS 32
+#define ZCACHE_INODE_HASH_BITS 10
 /*
  * One zcache_pool per (cleancache aware) filesystem mount instance
  */
 struct zcache_pool {
-	struct rb_root rbtree;
-	rwlock_t rb_lock;		/* Protects rbtree */
+	DECLARE_HASHTABLE(inode_hash, ZCACHE_INODE_HASH_BITS);
+	spinlock_t hash_lock;		/* Serializes inode_hash updates */
 	u64 size;
-	struct zbud_pool *pool;         /* Zbud pool used */
+	struct zpool *pool;		/* zpool used */
+	struct list_head lru;		/* LRU for non-evictable zpools */
+	spinlock_t lru_lock;		/* Protects lru */
 };
 
 /*
@@ -132,25 +148,43 @@ struct _zcache {
 struct _zcache zcache;
 
 /*
- * Redblack tree node, each node has a page index radix-tree.
- * Indexed by inode nubmer.
+ * Hash table node, each node has a page index radix-tree.
+ * Indexed by inode number.
+ *
+ * The hash table holds one reference. Once a node is unhashed, which only
+ * happens with both hash_lock and ra_lock held, nothing may be added to its
+ * radix tree any more; it is freed after an RCU grace period.
  */
-struct zcache_rbnode {
-	struct rb_node rb_node;
-	int rb_index;
-	struct radix_tree_root ratree; /* Page radix tree per inode rbtree */
+struct zcache_inode {
+	struct hlist_node hash;
+	int ino;
+	struct radix_tree_root ratree; /* Page radix tree per inode */
 	spinlock_t ra_lock;		/* Protects radix tree */
 	struct kref refcount;
+	struct rcu_head rcu;
 };
 
 /*
  * Radix-tree leaf, indexed by page->index
  */
 struct zcache_ra_handle {
-	int rb_index;			/* Redblack tree index */
+	int ino;			/* Inode number, hash key */
 	int ra_index;			/* Radix tree index */
 	int zlen;			/* Compressed page size */
 	struct zcache_pool *zpool;	/* Finding zcache_pool during evict */
+	struct zcache_lru_entry *lru;	/* NULL if the zpool is evictable */
+};
+
+/*
+ * LRU entry of a compressed page, kept outside of the zpool object so it
+ * can be walked without mapping.
+ */
+struct zcache_lru_entry {
+	struct list_head list;
+	unsigned long zaddr;
+	int ino;
+	int ra_index;
+	int zlen;
 };
 
 u64 zcache_pages(void)
@@ -164,17 +198,35 @@ u64 zcache_pages(void)
 	return count;
 }
 
-static struct kmem_cache *zcache_rbnode_cache;
-static int zcache_rbnode_cache_create(void)
+static struct kmem_cache *zcache_inode_cache;
+static int zcache_inode_cache_create(void)
+{
+	zcache_inode_cache = KMEM_CACHE(zcache_inode, 0);
+	return zcache_inode_cache == NULL;
+}
+static void zcache_inode_cache_destroy(void)
+{
+	kmem_cache_destroy(zcache_inode_cache);
+}
+
+static struct kmem_cache *zcache_lru_cache;
+static int zcache_lru_cache_create(void)
 {
-	zcache_rbnode_cache = KMEM_CACHE(zcache_rbnode, 0);
-	return zcache_rbnode_cache == NULL;
+	zcache_lru_cache = KMEM_CACHE(zcache_lru_entry, 0);
+	return zcache_lru_cache == NULL;
 }
-static void zcache_rbnode_cache_destroy(void)
+static void zcache_lru_cache_destroy(void)
 {
-	kmem_cache_destroy(zcache_rbnode_cache);
+	kmem_cache_destroy(zcache_lru_cache);
 }
 
+static void zcache_update_size(struct zcache_pool *zpool)
+{
+	zpool->size = zpool_get_total_size(zpool->pool) >> PAGE_SHIFT;
+}
+
+static int zcache_reclaim_page(struct zcache_pool *zpool);
+
 static unsigned long zcache_count(struct shrinker *s,
 				  struct shrink_control *sc)
 {
@@ -234,7 +286,7 @@ reclaim:
 			zcache.pools[i++ % MAX_ZCACHE_POOLS];
 		if (!zpool || !zpool->size)
 			continue;
-		if (zbud_reclaim_page(zpool->pool, 8)) {
+		if (zcache_reclaim_page(zpool)) {
 			zcache_pool_shrink_fail++;
 			retries--;
 			continue;
@@ -245,8 +297,7 @@ reclaim:
 
 	zcache_pool_shrink_pages += freed;
 	for (i = 0; (i < MAX_ZCACHE_POOLS) && zcache.pools[i]; i++)
-		zcache.pools[i]->size =
-			zbud_get_pool_size(zcache.pools[i]->pool);
+		zcache_update_size(zcache.pools[i]);
 
 	running = false;
 end:
@@ -311,6 +362,19 @@ static int __init zcache_comp_init(void)
 	return 0;
 }
 
+static int __init zcache_zpool_init(void)
+{
+	if (!zpool_has_pool(zcache_zpool_type)) {
+		pr_info("%s zpool not available\n", zcache_zpool_type);
+		/* fall back to default zpool */
+		zcache_zpool_type = ZCACHE_ZPOOL_DEFAULT;
+		if (!zpool_has_pool(zcache_zpool_type))
+			return -ENODEV;
+	}
+	pr_info("using %s zpool\n", zcache_zpool_type);
+	return 0;
+}
+
 static void zcache_comp_exit(void)
 {
 	/* free percpu transforms */
@@ -408,218 +472,328 @@ static bool zcache_is_full(void)
 }
 
 /*
- * The caller must hold zpool->rb_lock at least
+ * The caller must hold zpool->hash_lock or rcu_read_lock()
  */
-static struct zcache_rbnode *zcache_find_rbnode(struct rb_root *rbtree,
-	int index, struct rb_node **rb_parent, struct rb_node ***rb_link)
+static struct zcache_inode *zcache_find_inode(struct zcache_pool *zpool,
+					int ino)
 {
-	struct zcache_rbnode *entry;
-	struct rb_node **__rb_link, *__rb_parent, *rb_prev;
-
-	__rb_link = &rbtree->rb_node;
-	rb_prev = __rb_parent = NULL;
-
-	while (*__rb_link) {
-		__rb_parent = *__rb_link;
-		entry = rb_entry(__rb_parent, struct zcache_rbnode, rb_node);
-		if (entry->rb_index > index)
-			__rb_link = &__rb_parent->rb_left;
-		else if (entry->rb_index < index) {
-			rb_prev = __rb_parent;
-			__rb_link = &__rb_parent->rb_right;
-		} else
-			return entry;
-	}
+	struct zcache_inode *znode;
+
+	hash_for_each_possible_rcu(zpool->inode_hash, znode, hash, ino)
+		if (znode->ino == ino)
+			return znode;
 
-	if (rb_parent)
-		*rb_parent = __rb_parent;
-	if (rb_link)
-		*rb_link = __rb_link;
 	return NULL;
 }
 
-static struct zcache_rbnode *zcache_find_get_rbnode(struct zcache_pool *zpool,
-					int rb_index)
+static struct zcache_inode *zcache_find_get_inode(struct zcache_pool *zpool,
+					int ino)
 {
-	unsigned long flags;
-	struct zcache_rbnode *rbnode;
-
-	read_lock_irqsave(&zpool->rb_lock, flags);
-	rbnode = zcache_find_rbnode(&zpool->rbtree, rb_index, 0, 0);
-	if (rbnode)
-		kref_get(&rbnode->refcount);
-	read_unlock_irqrestore(&zpool->rb_lock, flags);
-	return rbnode;
+	struct zcache_inode *znode;
+
+	rcu_read_lock();
+	znode = zcache_find_inode(zpool, ino);
+	if (znode && !kref_get_unless_zero(&znode->refcount))
+		znode = NULL;
+	rcu_read_unlock();
+	return znode;
+}
+
+static void zcache_inode_free_rcu(struct rcu_head *rcu)
+{
+	struct zcache_inode *znode;
+
+	znode = container_of(rcu, struct zcache_inode, rcu);
+	kmem_cache_free(zcache_inode_cache, znode);
 }
 
 /*
- * kref_put callback for zcache_rbnode.
+ * kref_put callback for zcache_inode.
  *
- * The rbnode must have been isolated from rbtree already.
+ * The znode must have been isolated from inode_hash already.
  */
-static void zcache_rbnode_release(struct kref *kref)
+static void zcache_inode_release(struct kref *kref)
 {
-	struct zcache_rbnode *rbnode;
+	struct zcache_inode *znode;
 
-	rbnode = container_of(kref, struct zcache_rbnode, refcount);
-	BUG_ON(rbnode->ratree.rnode);
-	kmem_cache_free(zcache_rbnode_cache, rbnode);
+	znode = container_of(kref, struct zcache_inode, refcount);
+	BUG_ON(znode->ratree.rnode);
+	call_rcu(&znode->rcu, zcache_inode_free_rcu);
 }
 
 /*
- * Check whether the radix-tree of this rbnode is empty.
- * If that's true, then we can delete this zcache_rbnode from
- * zcache_pool->rbtree
+ * Check whether the radix-tree of this znode is empty.
+ * If that's true, then we can delete this zcache_inode from
+ * zcache_pool->inode_hash
  *
- * Caller must hold zcache_rbnode->ra_lock
+ * Caller must hold zcache_inode->ra_lock
  */
-static int zcache_rbnode_empty(struct zcache_rbnode *rbnode)
+static int zcache_inode_empty(struct zcache_inode *znode)
 {
-	return rbnode->ratree.rnode == NULL;
+	return znode->ratree.rnode == NULL;
 }
 
 /*
- * Remove zcache_rbnode from zpool->rbtree
+ * Caller must hold zcache_inode->ra_lock
+ */
+static bool zcache_inode_hashed(struct zcache_inode *znode)
+{
+	return !hlist_unhashed(&znode->hash);
+}
+
+/*
+ * Remove an empty zcache_inode from zpool->inode_hash
  *
- * holded_rblock - whether the caller has holded zpool->rb_lock
+ * Caller must hold zpool->hash_lock and znode->ra_lock, and a reference
+ * on znode besides the one held by the hash table.
  */
-static void zcache_rbnode_isolate(struct zcache_pool *zpool,
-		struct zcache_rbnode *rbnode, bool holded_rblock)
+static void __zcache_inode_isolate(struct zcache_pool *zpool,
+		struct zcache_inode *znode)
+{
+	if (!zcache_inode_empty(znode) || !zcache_inode_hashed(znode))
+		return;
+
+	hash_del_rcu(&znode->hash);
+	kref_put(&znode->refcount, zcache_inode_release);
+}
+
+static void zcache_inode_isolate(struct zcache_pool *zpool,
+		struct zcache_inode *znode)
 {
 	unsigned long flags;
 
-	if (!holded_rblock)
-		write_lock_irqsave(&zpool->rb_lock, flags);
-	/*
-	 * Someone can get reference on this rbnode before we could
-	 * acquire write lock above.
-	 * We want to remove it from zpool->rbtree when only the caller and
-	 * corresponding ratree holds a reference to this rbnode.
-	 * Below check ensures that a racing zcache put will not end up adding
-	 * a page to an isolated node and thereby losing that memory.
-	 */
-	if (atomic_read(&rbnode->refcount.refcount) == 2) {
-		rb_erase(&rbnode->rb_node, &zpool->rbtree);
-		RB_CLEAR_NODE(&rbnode->rb_node);
-		kref_put(&rbnode->refcount, zcache_rbnode_release);
-	}
-	if (!holded_rblock)
-		write_unlock_irqrestore(&zpool->rb_lock, flags);
+	spin_lock_irqsave(&zpool->hash_lock, flags);
+	spin_lock(&znode->ra_lock);
+	__zcache_inode_isolate(zpool, znode);
+	spin_unlock(&znode->ra_lock);
+	spin_unlock_irqrestore(&zpool->hash_lock, flags);
+}
+
+static void zcache_lru_add(struct zcache_pool *zpool,
+		struct zcache_lru_entry *lru)
+{
+	unsigned long flags;
+
+	if (!lru)
+		return;
+
+	spin_lock_irqsave(&zpool->lru_lock, flags);
+	list_add(&lru->list, &zpool->lru);
+	spin_unlock_irqrestore(&zpool->lru_lock, flags);
 }
 
 /*
- * Store zaddr which allocated by zbud_alloc() to the hierarchy rbtree-ratree.
+ * Only whoever removed the page from the ratree may call this; the entry
+ * may already have been taken off the list by zcache_lru_evict().
+ */
+static void zcache_lru_del(struct zcache_pool *zpool,
+		struct zcache_lru_entry *lru)
+{
+	unsigned long flags;
+
+	if (!lru)
+		return;
+
+	spin_lock_irqsave(&zpool->lru_lock, flags);
+	list_del_init(&lru->list);
+	spin_unlock_irqrestore(&zpool->lru_lock, flags);
+	kmem_cache_free(zcache_lru_cache, lru);
+}
+
+/*
+ * Free a compressed page which has already been removed from the ratree.
+ */
+static void zcache_free_zaddr(struct zcache_pool *zpool, unsigned long zaddr)
+{
+	struct zcache_ra_handle *zhandle;
+	struct zcache_lru_entry *lru;
+
+	zhandle = (struct zcache_ra_handle *)zpool_map_handle(zpool->pool,
+			zaddr, ZPOOL_MM_RO);
+	lru = zhandle->lru;
+	zpool_unmap_handle(zpool->pool, zaddr);
+
+	zcache_lru_del(zpool, lru);
+	zpool_free(zpool->pool, zaddr);
+	atomic_dec(&zcache_stored_pages);
+	zcache_update_size(zpool);
+}
+
+/*
+ * Store zaddr which allocated by zpool_malloc() to the hierarchy hash-ratree.
+ *
+ * lru is put on the LRU under ra_lock once the insert succeeded, so
+ * zcache_lru_evict() never sees an entry it can't find in the ratree, and
+ * a racing load can't free it before it is linked.
  */
 static int zcache_store_zaddr(struct zcache_pool *zpool,
-		int ra_index, int rb_index, unsigned long zaddr)
+		int ra_index, int ino, unsigned long zaddr,
+		struct zcache_lru_entry *lru)
 {
 	unsigned long flags;
-	struct zcache_rbnode *rbnode, *tmp;
-	struct rb_node **link = NULL, *parent = NULL;
+	struct zcache_inode *znode, *tmp;
+	bool empty;
 	int ret;
 	void *dup_zaddr;
 
-	rbnode = zcache_find_get_rbnode(zpool, rb_index);
-	if (!rbnode) {
-		/* alloc and init a new rbnode */
-		rbnode = kmem_cache_alloc(zcache_rbnode_cache,
+retry:
+	znode = zcache_find_get_inode(zpool, ino);
+	if (!znode) {
+		/* alloc and init a new znode */
+		znode = kmem_cache_alloc(zcache_inode_cache,
 			GFP_ZCACHE);
-		if (!rbnode)
+		if (!znode)
 			return -ENOMEM;
 
-		INIT_RADIX_TREE(&rbnode->ratree, GFP_ATOMIC|__GFP_NOWARN);
-		spin_lock_init(&rbnode->ra_lock);
-		rbnode->rb_index = rb_index;
-		kref_init(&rbnode->refcount);
-		RB_CLEAR_NODE(&rbnode->rb_node);
+		INIT_RADIX_TREE(&znode->ratree, GFP_ATOMIC|__GFP_NOWARN);
+		spin_lock_init(&znode->ra_lock);
+		znode->ino = ino;
+		kref_init(&znode->refcount);
 
-		/* add that rbnode to rbtree */
-		write_lock_irqsave(&zpool->rb_lock, flags);
-		tmp = zcache_find_rbnode(&zpool->rbtree, rb_index,
-				&parent, &link);
+		/* add that znode to inode_hash */
+		spin_lock_irqsave(&zpool->hash_lock, flags);
+		tmp = zcache_find_inode(zpool, ino);
 		if (tmp) {
-			/* somebody else allocated new rbnode */
-			kmem_cache_free(zcache_rbnode_cache, rbnode);
-			rbnode = tmp;
+			/* somebody else allocated new znode */
+			kmem_cache_free(zcache_inode_cache, znode);
+			znode = tmp;
 		} else {
-			rb_link_node(&rbnode->rb_node, parent, link);
-			rb_insert_color(&rbnode->rb_node, &zpool->rbtree);
+			hash_add_rcu(zpool->inode_hash, &znode->hash, ino);
 		}
 
-		/* Inc the reference of this zcache_rbnode */
-		kref_get(&rbnode->refcount);
-		write_unlock_irqrestore(&zpool->rb_lock, flags);
+		/* Inc the reference of this zcache_inode */
+		kref_get(&znode->refcount);
+		spin_unlock_irqrestore(&zpool->hash_lock, flags);
 	}
 
-	/* Succfully got a zcache_rbnode when arriving here */
-	spin_lock_irqsave(&rbnode->ra_lock, flags);
-	dup_zaddr = radix_tree_delete(&rbnode->ratree, ra_index);
+	/* Succfully got a zcache_inode when arriving here */
+	spin_lock_irqsave(&znode->ra_lock, flags);
+	if (unlikely(!zcache_inode_hashed(znode))) {
+		/* Raced with isolation, the node is on its way out */
+		spin_unlock_irqrestore(&znode->ra_lock, flags);
+		kref_put(&znode->refcount, zcache_inode_release);
+		goto retry;
+	}
+
+	dup_zaddr = radix_tree_delete(&znode->ratree, ra_index);
 	if (unlikely(dup_zaddr)) {
 		WARN_ON("duplicated, will be replaced!\n");
-		if (dup_zaddr == ZERO_HANDLE) {
+		if (dup_zaddr == ZERO_HANDLE)
 			atomic_dec(&zcache_stored_zero_pages);
-		} else {
-			zbud_free(zpool->pool, (unsigned long)dup_zaddr);
-			atomic_dec(&zcache_stored_pages);
-			zpool->size = zbud_get_pool_size(zpool->pool);
-		}
+		else
+			zcache_free_zaddr(zpool, (unsigned long)dup_zaddr);
 		zcache_dup_entry++;
 	}
 
 	/* Insert zcache_ra_handle to ratree */
-	ret = radix_tree_insert(&rbnode->ratree, ra_index,
+	ret = radix_tree_insert(&znode->ratree, ra_index,
 				(void *)zaddr);
-	spin_unlock_irqrestore(&rbnode->ra_lock, flags);
-	if (unlikely(ret)) {
-		write_lock_irqsave(&zpool->rb_lock, flags);
-		spin_lock(&rbnode->ra_lock);
-
-		if (zcache_rbnode_empty(rbnode))
-			zcache_rbnode_isolate(zpool, rbnode, 1);
-
-		spin_unlock(&rbnode->ra_lock);
-		write_unlock_irqrestore(&zpool->rb_lock, flags);
-	}
-
-	kref_put(&rbnode->refcount, zcache_rbnode_release);
+	if (!ret)
+		zcache_lru_add(zpool, lru);
+	empty = zcache_inode_empty(znode);
+	spin_unlock_irqrestore(&znode->ra_lock, flags);
+	if (unlikely(ret) && empty)
+		zcache_inode_isolate(zpool, znode);
+
+	kref_put(&znode->refcount, zcache_inode_release);
 	return ret;
 }
 
 /*
  * Load zaddr and delete it from radix tree.
- * If the radix tree of the corresponding rbnode is empty, delete the rbnode
- * from zpool->rbtree also.
+ * If the radix tree of the corresponding znode is empty, delete the znode
+ * from zpool->inode_hash also.
+ *
+ * If expected is not NULL, the slot is only deleted while it still holds
+ * expected; NULL is returned otherwise.
  */
-static void *zcache_load_delete_zaddr(struct zcache_pool *zpool,
-				int rb_index, int ra_index)
+static void *__zcache_load_delete_zaddr(struct zcache_pool *zpool,
+				int ino, int ra_index, void *expected)
 {
-	struct zcache_rbnode *rbnode;
+	struct zcache_inode *znode;
 	void *zaddr = NULL;
 	unsigned long flags;
+	bool empty;
 
-	rbnode = zcache_find_get_rbnode(zpool, rb_index);
-	if (!rbnode)
+	znode = zcache_find_get_inode(zpool, ino);
+	if (!znode)
 		goto out;
 
-	BUG_ON(rbnode->rb_index != rb_index);
+	BUG_ON(znode->ino != ino);
 
-	spin_lock_irqsave(&rbnode->ra_lock, flags);
-	zaddr = radix_tree_delete(&rbnode->ratree, ra_index);
-	spin_unlock_irqrestore(&rbnode->ra_lock, flags);
+	spin_lock_irqsave(&znode->ra_lock, flags);
+	if (!expected ||
+	    radix_tree_lookup(&znode->ratree, ra_index) == expected)
+		zaddr = radix_tree_delete(&znode->ratree, ra_index);
+	empty = zcache_inode_empty(znode);
+	spin_unlock_irqrestore(&znode->ra_lock, flags);
 
-	/* rb_lock and ra_lock must be taken again in the given sequence */
-	write_lock_irqsave(&zpool->rb_lock, flags);
-	spin_lock(&rbnode->ra_lock);
-	if (zcache_rbnode_empty(rbnode))
-		zcache_rbnode_isolate(zpool, rbnode, 1);
-	spin_unlock(&rbnode->ra_lock);
-	write_unlock_irqrestore(&zpool->rb_lock, flags);
+	/* Only take the pool wide hash_lock once the inode runs empty */
+	if (empty)
+		zcache_inode_isolate(zpool, znode);
 
-	kref_put(&rbnode->refcount, zcache_rbnode_release);
+	kref_put(&znode->refcount, zcache_inode_release);
 out:
 	return zaddr;
 }
 
+static void *zcache_load_delete_zaddr(struct zcache_pool *zpool,
+				int ino, int ra_index)
+{
+	return __zcache_load_delete_zaddr(zpool, ino, ra_index, NULL);
+}
+
+/*
+ * Evict compressed pages from the tail of the zcache LRU until about a page
+ * worth of compressed data has been released. Used when the zpool cannot
+ * evict by itself.
+ */
+static int zcache_lru_evict(struct zcache_pool *zpool)
+{
+	struct zcache_lru_entry *lru;
+	unsigned long flags, zaddr;
+	int ino, ra_index, zlen;
+	unsigned int freed = 0;
+	int retries = 8;
+
+	while (freed < PAGE_SIZE && retries) {
+		spin_lock_irqsave(&zpool->lru_lock, flags);
+		if (list_empty(&zpool->lru)) {
+			spin_unlock_irqrestore(&zpool->lru_lock, flags);
+			break;
+		}
+		lru = list_last_entry(&zpool->lru, struct zcache_lru_entry,
+				list);
+		list_del_init(&lru->list);
+		/* lru may be freed by a racing load once the lock is dropped */
+		zaddr = lru->zaddr;
+		ino = lru->ino;
+		ra_index = lru->ra_index;
+		zlen = lru->zlen;
+		spin_unlock_irqrestore(&zpool->lru_lock, flags);
+
+		if (!__zcache_load_delete_zaddr(zpool, ino, ra_index,
+				(void *)zaddr)) {
+			retries--;
+			continue;
+		}
+
+		zcache_free_zaddr(zpool, zaddr);
+		zcache_evict_zpages++;
+		freed += zlen;
+	}
+
+	return freed ? 0 : -EAGAIN;
+}
+
+static int zcache_reclaim_page(struct zcache_pool *zpool)
+{
+	if (zpool_evictable(zpool->pool))
+		return zpool_shrink(zpool->pool, 1, NULL);
+
+	return zcache_lru_evict(zpool);
+}
+
 static bool zero_page(struct page *page)
 {
 	unsigned long *ptr = kmap_atomic(page);
@@ -640,6 +814,7 @@ static void zcache_store_page(int pool_id, struct cleancache_filekey key,
 		pgoff_t index, struct page *page)
 {
 	struct zcache_ra_handle *zhandle;
+	struct zcache_lru_entry *lru = NULL;
 	u8 *zpage, *src, *dst;
 	/* Address of zhandle + compressed data(zpage) */
 	unsigned long zaddr = 0;
@@ -666,7 +841,7 @@ static void zcache_store_page(int pool_id, struct cleancache_filekey key,
 
 	if (zcache_is_full()) {
 		zcache_pool_limit_hit++;
-		if (zbud_reclaim_page(zpool->pool, 8)) {
+		if (zcache_reclaim_page(zpool)) {
 			zcache_reclaim_fail++;
 			return;
 		}
@@ -674,7 +849,7 @@ static void zcache_store_page(int pool_id, struct cleancache_filekey key,
 		 * Continue if reclaimed a page frame succ.
 		 */
 		zcache_evict_filepages++;
-		zpool->size = zbud_get_pool_size(zpool->pool);
+		zcache_update_size(zpool);
 	}
 
 	/* compress */
@@ -690,20 +865,41 @@ static void zcache_store_page(int pool_id, struct cleancache_filekey key,
 	}
 
 	/* store zcache handle together with compressed page data */
-	ret = zbud_alloc(zpool->pool, zlen + sizeof(struct zcache_ra_handle),
+	ret = zpool_malloc(zpool->pool, zlen + sizeof(struct zcache_ra_handle),
 			GFP_ZCACHE, &zaddr);
 	if (ret) {
-		zcache_zbud_alloc_fail++;
+		zcache_zpool_alloc_fail++;
 		put_cpu_var(zcache_dstmem);
 		return;
 	}
 
-	zhandle = (struct zcache_ra_handle *)zbud_map(zpool->pool, zaddr);
+	if (!zpool_evictable(zpool->pool)) {
+		lru = kmem_cache_alloc(zcache_lru_cache, GFP_ZCACHE);
+		if (!lru) {
+			zcache_zpool_alloc_fail++;
+			zpool_free(zpool->pool, zaddr);
+			put_cpu_var(zcache_dstmem);
+			return;
+		}
+		INIT_LIST_HEAD(&lru->list);
+		lru->zaddr = zaddr;
+		lru->ino = key.u.ino;
+		lru->ra_index = index;
+		lru->zlen = zlen;
+	}
+
+	zhandle = (struct zcache_ra_handle *)zpool_map_handle(zpool->pool,
+			zaddr, ZPOOL_MM_WO);
+	zhandle->ra_index = index;
+	zhandle->ino = key.u.ino;
+	zhandle->zlen = zlen;
+	zhandle->zpool = zpool;
+	zhandle->lru = lru;
 
 	/* Compressed page data stored at the end of zcache_ra_handle */
 	zpage = (u8 *)(zhandle + 1);
 	memcpy(zpage, dst, zlen);
-	zbud_unmap(zpool->pool, zaddr);
+	zpool_unmap_handle(zpool->pool, zaddr);
 	put_cpu_var(zcache_dstmem);
 
 zero:
@@ -711,11 +907,13 @@ zero:
 		zaddr = (unsigned long)ZERO_HANDLE;
 
 	/* store zcache handle */
-	ret = zcache_store_zaddr(zpool, index, key.u.ino, zaddr);
+	ret = zcache_store_zaddr(zpool, index, key.u.ino, zaddr, lru);
 	if (ret) {
 		zcache_store_failed++;
-		if (!zero)
-			zbud_free(zpool->pool, zaddr);
+		if (!zero) {
+			zcache_lru_del(zpool, lru);
+			zpool_free(zpool->pool, zaddr);
+		}
 		return;
 	}
 
@@ -723,12 +921,8 @@ zero:
 	if (zero) {
 		atomic_inc(&zcache_stored_zero_pages);
 	} else {
-		zhandle->ra_index = index;
-		zhandle->rb_index = key.u.ino;
-		zhandle->zlen = zlen;
-		zhandle->zpool = zpool;
 		atomic_inc(&zcache_stored_pages);
-		zpool->size = zbud_get_pool_size(zpool->pool);
+		zcache_update_size(zpool);
 	}
 
 	return;
@@ -742,6 +936,7 @@ static int zcache_load_page(int pool_id, struct cleancache_filekey key,
 	void *zaddr;
 	unsigned int dlen = PAGE_SIZE;
 	struct zcache_ra_handle *zhandle;
+	struct zcache_lru_entry *lru;
 	struct zcache_pool *zpool = zcache.pools[pool_id];
 
 	zaddr = zcache_load_delete_zaddr(zpool, key.u.ino, index);
@@ -750,8 +945,8 @@ static int zcache_load_page(int pool_id, struct cleancache_filekey key,
 	else if (zaddr == ZERO_HANDLE)
 		goto map;
 
-	zhandle = (struct zcache_ra_handle *)zbud_map(zpool->pool,
-			(unsigned long)zaddr);
+	zhandle = (struct zcache_ra_handle *)zpool_map_handle(zpool->pool,
+			(unsigned long)zaddr, ZPOOL_MM_RO);
 	/* Compressed page data stored at the end of zcache_ra_handle */
 	src = (u8 *)(zhandle + 1);
 
@@ -769,15 +964,17 @@ map:
 		goto out;
 	}
 	kunmap_atomic(dst);
-	zbud_unmap(zpool->pool, (unsigned long)zaddr);
-	zbud_free(zpool->pool, (unsigned long)zaddr);
+	lru = zhandle->lru;
+	zpool_unmap_handle(zpool->pool, (unsigned long)zaddr);
+	zcache_lru_del(zpool, lru);
+	zpool_free(zpool->pool, (unsigned long)zaddr);
 
 	BUG_ON(ret);
 	BUG_ON(dlen != PAGE_SIZE);
 
 	/* update stats */
 	atomic_dec(&zcache_stored_pages);
-	zpool->size = zbud_get_pool_size(zpool->pool);
+	zcache_update_size(zpool);
 out:
 	SetPageWasActive(page);
 	return ret;
@@ -790,13 +987,10 @@ static void zcache_flush_page(int pool_id, struct cleancache_filekey key,
 	void *zaddr = NULL;
 
 	zaddr = zcache_load_delete_zaddr(zpool, key.u.ino, index);
-	if (zaddr && (zaddr != ZERO_HANDLE)) {
-		zbud_free(zpool->pool, (unsigned long)zaddr);
-		atomic_dec(&zcache_stored_pages);
-		zpool->size = zbud_get_pool_size(zpool->pool);
-	} else if (zaddr == ZERO_HANDLE) {
+	if (zaddr && (zaddr != ZERO_HANDLE))
+		zcache_free_zaddr(zpool, (unsigned long)zaddr);
+	else if (zaddr == ZERO_HANDLE)
 		atomic_dec(&zcache_stored_zero_pages);
-	}
 }
 
 #define FREE_BATCH 16
@@ -804,7 +998,7 @@ static void zcache_flush_page(int pool_id, struct cleancache_filekey key,
  * Callers must hold the lock
  */
 static void zcache_flush_ratree(struct zcache_pool *zpool,
-		struct zcache_rbnode *rbnode)
+		struct zcache_inode *znode)
 {
 	unsigned long index = 0;
 	int count, i;
@@ -815,28 +1009,28 @@ static void zcache_flush_ratree(struct zcache_pool *zpool,
 		void *zaddrs[FREE_BATCH];
 		unsigned long indices[FREE_BATCH];
 
-		count = radix_tree_gang_lookup_index(&rbnode->ratree,
+		count = radix_tree_gang_lookup_index(&znode->ratree,
 				(void **)zaddrs, indices,
 				index, FREE_BATCH);
 
 		for (i = 0; i < count; i++) {
 			if (zaddrs[i] == ZERO_HANDLE) {
-				zaddr = radix_tree_delete(&rbnode->ratree,
+				zaddr = radix_tree_delete(&znode->ratree,
 					indices[i]);
 				if (zaddr)
 					atomic_dec(&zcache_stored_zero_pages);
 				continue;
 			}
-			zhandle = (struct zcache_ra_handle *)zbud_map(
-					zpool->pool, (unsigned long)zaddrs[i]);
+			zhandle = (struct zcache_ra_handle *)zpool_map_handle(
+					zpool->pool, (unsigned long)zaddrs[i],
+					ZPOOL_MM_RO);
 			index = zhandle->ra_index;
-			zaddr = radix_tree_delete(&rbnode->ratree, index);
+			zpool_unmap_handle(zpool->pool,
+					(unsigned long)zaddrs[i]);
+			zaddr = radix_tree_delete(&znode->ratree, index);
 			if (!zaddr)
 				continue;
-			zbud_unmap(zpool->pool, (unsigned long)zaddrs[i]);
-			zbud_free(zpool->pool, (unsigned long)zaddrs[i]);
-			atomic_dec(&zcache_stored_pages);
-			zpool->size = zbud_get_pool_size(zpool->pool);
+			zcache_free_zaddr(zpool, (unsigned long)zaddrs[i]);
 		}
 
 		index++;
@@ -845,41 +1039,33 @@ static void zcache_flush_ratree(struct zcache_pool *zpool,
 
 static void zcache_flush_inode(int pool_id, struct cleancache_filekey key)
 {
-	struct zcache_rbnode *rbnode;
-	unsigned long flags1, flags2;
+	struct zcache_inode *znode;
+	unsigned long flags;
+	bool empty;
 	struct zcache_pool *zpool = zcache.pools[pool_id];
 
-	/*
-	 * Refuse new pages added in to the same rbinode, so get rb_lock at
-	 * first.
-	 */
-	write_lock_irqsave(&zpool->rb_lock, flags1);
-	rbnode = zcache_find_rbnode(&zpool->rbtree, key.u.ino, 0, 0);
-	if (!rbnode) {
-		write_unlock_irqrestore(&zpool->rb_lock, flags1);
+	znode = zcache_find_get_inode(zpool, key.u.ino);
+	if (!znode)
 		return;
-	}
-
-	kref_get(&rbnode->refcount);
-	spin_lock_irqsave(&rbnode->ra_lock, flags2);
 
-	zcache_flush_ratree(zpool, rbnode);
-	if (zcache_rbnode_empty(rbnode))
-		/* When arrvied here, we already hold rb_lock */
-		zcache_rbnode_isolate(zpool, rbnode, 1);
+	spin_lock_irqsave(&znode->ra_lock, flags);
+	zcache_flush_ratree(zpool, znode);
+	empty = zcache_inode_empty(znode);
+	spin_unlock_irqrestore(&znode->ra_lock, flags);
 
-	spin_unlock_irqrestore(&rbnode->ra_lock, flags2);
-	write_unlock_irqrestore(&zpool->rb_lock, flags1);
-	kref_put(&rbnode->refcount, zcache_rbnode_release);
+	if (empty)
+		zcache_inode_isolate(zpool, znode);
+	kref_put(&znode->refcount, zcache_inode_release);
 }
 
 static void zcache_destroy_pool(struct zcache_pool *zpool);
 static void zcache_flush_fs(int pool_id)
 {
-	struct zcache_rbnode *z_rbnode = NULL;
-	struct rb_node *rbnode;
-	unsigned long flags1, flags2;
+	struct zcache_inode *znode;
+	struct hlist_node *tmp;
+	unsigned long flags;
 	struct zcache_pool *zpool;
+	int bkt;
 
 	if (pool_id < 0)
 		return;
@@ -889,64 +1075,59 @@ static void zcache_flush_fs(int pool_id)
 		return;
 
 	/*
-	 * Refuse new pages added in, so get rb_lock at first.
+	 * Refuse new inodes added in, so get hash_lock at first.
 	 */
-	write_lock_irqsave(&zpool->rb_lock, flags1);
-
-	rbnode = rb_first(&zpool->rbtree);
-	while (rbnode) {
-		z_rbnode = rb_entry(rbnode, struct zcache_rbnode, rb_node);
-		rbnode = rb_next(rbnode);
-		if (z_rbnode) {
-			kref_get(&z_rbnode->refcount);
-			spin_lock_irqsave(&z_rbnode->ra_lock, flags2);
-			zcache_flush_ratree(zpool, z_rbnode);
-			if (zcache_rbnode_empty(z_rbnode))
-				zcache_rbnode_isolate(zpool, z_rbnode, 1);
-			spin_unlock_irqrestore(&z_rbnode->ra_lock, flags2);
-			kref_put(&z_rbnode->refcount, zcache_rbnode_release);
-		}
+	spin_lock_irqsave(&zpool->hash_lock, flags);
+
+	hash_for_each_safe(zpool->inode_hash, bkt, tmp, znode, hash) {
+		kref_get(&znode->refcount);
+		spin_lock(&znode->ra_lock);
+		zcache_flush_ratree(zpool, znode);
+		__zcache_inode_isolate(zpool, znode);
+		spin_unlock(&znode->ra_lock);
+		kref_put(&znode->refcount, zcache_inode_release);
 	}
 
-	write_unlock_irqrestore(&zpool->rb_lock, flags1);
+	spin_unlock_irqrestore(&zpool->hash_lock, flags);
 	zcache_destroy_pool(zpool);
 }
 
 /*
  * Evict compressed pages from zcache pool on an LRU basis after the compressed
- * pool is full.
+ * pool is full. Called back by evictable zpools (zbud) from zpool_shrink().
  */
-static int zcache_evict_zpage(struct zbud_pool *pool, unsigned long zaddr)
+static int zcache_evict_zpage(struct zpool *pool, unsigned long zaddr)
 {
 	struct zcache_pool *zpool;
 	struct zcache_ra_handle *zhandle;
 	void *zaddr_intree;
+	int ino, ra_index;
 
 	BUG_ON(zaddr == (unsigned long)ZERO_HANDLE);
 
-	zhandle = (struct zcache_ra_handle *)zbud_map(pool, zaddr);
-
+	zhandle = (struct zcache_ra_handle *)zpool_map_handle(pool, zaddr,
+			ZPOOL_MM_RO);
 	zpool = zhandle->zpool;
+	ino = zhandle->ino;
+	ra_index = zhandle->ra_index;
+	zpool_unmap_handle(pool, zaddr);
+
 	/* There can be a race with zcache store */
 	if (!zpool)
 		return -EINVAL;
 
 	BUG_ON(pool != zpool->pool);
 
-	zaddr_intree = zcache_load_delete_zaddr(zpool, zhandle->rb_index,
-			zhandle->ra_index);
+	zaddr_intree = zcache_load_delete_zaddr(zpool, ino, ra_index);
 	if (zaddr_intree) {
 		BUG_ON((unsigned long)zaddr_intree != zaddr);
-		zbud_unmap(pool, zaddr);
-		zbud_free(pool, zaddr);
-		atomic_dec(&zcache_stored_pages);
-		zpool->size = zbud_get_pool_size(pool);
+		zcache_free_zaddr(zpool, zaddr);
 		zcache_evict_zpages++;
 	}
 	return 0;
 }
 
-static struct zbud_ops zcache_zbud_ops = {
+static const struct zpool_ops zcache_zpool_ops = {
 	.evict = zcache_evict_zpage
 };
 
@@ -962,7 +1143,8 @@ static int zcache_create_pool(void)
 		goto out;
 	}
 
-	zpool->pool = zbud_create_pool(GFP_KERNEL, &zcache_zbud_ops);
+	zpool->pool = zpool_create_pool(zcache_zpool_type, "zcache",
+			GFP_KERNEL, &zcache_zpool_ops);
 	if (!zpool->pool) {
 		kfree(zpool);
 		ret = -ENOMEM;
@@ -972,14 +1154,16 @@ static int zcache_create_pool(void)
 	spin_lock(&zcache.pool_lock);
 	if (zcache.num_pools == MAX_ZCACHE_POOLS) {
 		pr_err("Cannot create new pool (limit:%u)\n", MAX_ZCACHE_POOLS);
-		zbud_destroy_pool(zpool->pool);
+		zpool_destroy_pool(zpool->pool);
 		kfree(zpool);
 		ret = -EPERM;
 		goto out_unlock;
 	}
 
-	rwlock_init(&zpool->rb_lock);
-	zpool->rbtree = RB_ROOT;
+	spin_lock_init(&zpool->hash_lock);
+	hash_init(zpool->inode_hash);
+	spin_lock_init(&zpool->lru_lock);
+	INIT_LIST_HEAD(&zpool->lru);
 	/* Add to pool list */
 	for (ret = 0; ret < MAX_ZCACHE_POOLS; ret++)
 		if (!zcache.pools[ret])
@@ -1009,10 +1193,10 @@ static void zcache_destroy_pool(struct zcache_pool *zpool)
 	zcache.pools[i] = NULL;
 	spin_unlock(&zcache.pool_lock);
 
-	if (!RB_EMPTY_ROOT(&zpool->rbtree))
+	if (!hash_empty(zpool->inode_hash))
 		WARN_ON("Memory leak detected. Freeing non-empty pool!\n");
 
-	zbud_destroy_pool(zpool->pool);
+	zpool_destroy_pool(zpool->pool);
 	kfree(zpool);
 }
 
@@ -1080,7 +1264,7 @@ static int __init zcache_debugfs_init(void)
 	debugfs_create_u64("pool_limit_hit", S_IRUGO, zcache_debugfs_root,
 			&zcache_pool_limit_hit);
 	debugfs_create_u64("reject_alloc_fail", S_IRUGO, zcache_debugfs_root,
-			&zcache_zbud_alloc_fail);
+			&zcache_zpool_alloc_fail);
 	debugfs_create_u64("duplicate_entry", S_IRUGO, zcache_debugfs_root,
 			&zcache_dup_entry);
 	debugfs_create_file("pool_pages", S_IRUGO, zcache_debugfs_root, NULL,
@@ -1131,11 +1315,21 @@ static int __init init_zcache(void)
 		return 0;
 
 	pr_info("loading zcache..\n");
-	if (zcache_rbnode_cache_create()) {
+	if (zcache_inode_cache_create()) {
 		pr_err("entry cache creation failed\n");
 		goto error;
 	}
 
+	if (zcache_lru_cache_create()) {
+		pr_err("lru cache creation failed\n");
+		goto lrufail;
+	}
+
+	if (zcache_zpool_init()) {
+		pr_err("zpool initialization failed\n");
+		goto compfail;
+	}
+
 	if (zcache_comp_init()) {
 		pr_err("compressor initialization failed\n");
 		goto compfail;
@@ -1155,7 +1349,9 @@ static int __init init_zcache(void)
 pcpufail:
 	zcache_comp_exit();
 compfail:
-	zcache_rbnode_cache_destroy();
+	zcache_lru_cache_destroy();
+lrufail:
+	zcache_inode_cache_destroy();
 error:
 	return -ENOMEM;
 }
@@ -184,6 +184,29 @@ static int zs_size_classes;
  */
 static const int fullness_threshold_frac = 4;
 
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+/*
+ * Upper bound on the number of free objects a cpu keeps per size_class.
+ * A magazine never holds more than a page worth of objects, so huge
+ * classes cache a single object.
+ */
+#define ZS_MAGAZINE_SIZE	16
+
+/*
+ * Per-cpu cache of free objects of one size_class. Objects sitting in a
+ * magazine are still accounted as used by their zspage, so zs_malloc and
+ * zs_free can hand them out and take them back without class->lock.
+ * The lock is only ever contended by a drain running on another cpu.
+ */
+struct zs_magazine {
+	spinlock_t lock;
+	unsigned int nr;
+	unsigned long objs[ZS_MAGAZINE_SIZE];
+	unsigned long hit;
+	unsigned long miss;
+};
+#endif
+
 struct size_class {
 	spinlock_t lock;
 	struct list_head fullness_list[2];
@@ -201,6 +224,12 @@ struct size_class {
 	int pages_per_zspage;
 	/* huge object: pages_per_zspage == 1 && maxobj_per_zspage == 1 */
 	bool huge;
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+	struct zs_magazine __percpu *mag;
+	unsigned int mag_limit;
+	/* non-zero while compaction needs the magazines to stay empty */
+	atomic_t mag_disabled;
+#endif
 };
 
 /*
@@ -538,6 +567,10 @@ static void __exit zs_stat_exit(void)
 }
 
 static unsigned long zs_can_compact(struct size_class *class);
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+static void zs_mag_stat(struct size_class *class, unsigned long *cached,
+			unsigned long *hit, unsigned long *miss);
+#endif
 
 static int zs_stats_size_show(struct seq_file *s, void *v)
 {
@@ -598,6 +631,55 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 	return 0;
 }
 
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+static int zs_stats_mag_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	struct size_class *class;
+	unsigned long cached, hit, miss;
+	unsigned long total_cached = 0, total_hit = 0, total_miss = 0;
+
+	seq_printf(s, " %5s %5s %5s %8s %12s %12s\n",
+			"class", "size", "limit", "cached", "hit", "miss");
+
+	for (i = 0; i < zs_size_classes; i++) {
+		class = pool->size_class[i];
+
+		if (class->index != i)
+			continue;
+
+		cached = hit = miss = 0;
+		zs_mag_stat(class, &cached, &hit, &miss);
+
+		seq_printf(s, " %5u %5u %5u %8lu %12lu %12lu\n",
+			i, class->size, class->mag_limit, cached, hit, miss);
+
+		total_cached += cached;
+		total_hit += hit;
+		total_miss += miss;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %5s %8lu %12lu %12lu\n",
+			"Total", "", "", total_cached, total_hit, total_miss);
+
+	return 0;
+}
+
+static int zs_stats_mag_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_mag_show, inode->i_private);
+}
+
+static const struct file_operations zs_stat_mag_ops = {
+	.open           = zs_stats_mag_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+#endif
+
 static int zs_stats_size_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, zs_stats_size_show, inode->i_private);
@@ -633,7 +715,16 @@ static void zs_pool_stat_create(struct zs_pool *pool, const char *name)
 				name, "classes");
 		debugfs_remove_recursive(pool->stat_dentry);
 		pool->stat_dentry = NULL;
+		return;
 	}
+
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+	entry = debugfs_create_file("magazines", S_IFREG | S_IRUGO,
+			pool->stat_dentry, pool, &zs_stat_mag_ops);
+	if (!entry)
+		pr_warn("%s: debugfs file entry <%s> creation failed\n",
+				name, "magazines");
+#endif
 }
 
 static void zs_pool_stat_destroy(struct zs_pool *pool)
@@ -1388,6 +1479,203 @@ static unsigned long obj_malloc(struct size_class *class,
 	return obj;
 }
 
+#ifdef CONFIG_ZSMALLOC_MAGAZINE
+/* Re-tag an object taken from a magazine with the handle now owning it */
+static void obj_set_handle(struct size_class *class, unsigned long obj,
+				unsigned long handle)
+{
+	struct link_free *link;
+	struct page *m_page;
+	unsigned int m_objidx;
+	unsigned long m_offset;
+	void *vaddr;
+
+	handle |= OBJ_ALLOCATED_TAG;
+	obj_to_location(obj, &m_page, &m_objidx);
+
+	if (class->huge) {
+		get_zspage(m_page)->first_page->index = handle;
+		return;
+	}
+
+	m_offset = (class->size * m_objidx) & ~PAGE_MASK;
+	vaddr = kmap_atomic(m_page);
+	link = (struct link_free *)(vaddr + m_offset);
+	link->handle = handle;
+	kunmap_atomic(vaddr);
+}
+
+static void __zs_free_obj(struct zs_pool *pool, struct size_class *class,
+			unsigned long obj);
+
+/*
+ * The new handle is recorded before the magazine lock is dropped, so a
+ * drain that has passed this cpu knows the object header is valid again.
+ */
+static bool zs_mag_pop(struct size_class *class, unsigned long handle)
+{
+	struct zs_magazine *mag;
+	unsigned long obj;
+	bool ret = false;
+
+	mag = raw_cpu_ptr(class->mag);
+	spin_lock(&mag->lock);
+	if (mag->nr && !atomic_read(&class->mag_disabled)) {
+		obj = mag->objs[--mag->nr];
+		obj_set_handle(class, obj, handle);
+		record_obj(handle, obj);
+		mag->hit++;
+		ret = true;
+	} else {
+		mag->miss++;
+	}
+	spin_unlock(&mag->lock);
+
+	return ret;
+}
+
+static bool zs_mag_push(struct size_class *class, unsigned long obj)
+{
+	struct zs_magazine *mag;
+	bool ret = false;
+
+	mag = raw_cpu_ptr(class->mag);
+	spin_lock(&mag->lock);
+	if (mag->nr < class->mag_limit &&
+			!atomic_read(&class->mag_disabled)) {
+		mag->objs[mag->nr++] = obj;
+		mag->hit++;
+		ret = true;
+	} else {
+		mag->miss++;
+	}
+	spin_unlock(&mag->lock);
+
+	return ret;
+}
+
+/*
+ * Hand every cached object of @class back to its zspage. Objects sitting
+ * in a magazine still carry a stale handle in their header, so this must
+ * run, with the magazines disabled, before the class is compacted.
+ */
+static void zs_mag_drain(struct zs_pool *pool, struct size_class *class)
+{
+	unsigned long objs[ZS_MAGAZINE_SIZE];
+	struct zs_magazine *mag;
+	unsigned int i, nr;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(class->mag, cpu);
+		spin_lock(&mag->lock);
+		nr = mag->nr;
+		memcpy(objs, mag->objs, nr * sizeof(objs[0]));
+		mag->nr = 0;
+		spin_unlock(&mag->lock);
+
+		if (!nr)
+			continue;
+
+		spin_lock(&class->lock);
+		for (i = 0; i < nr; i++)
+			__zs_free_obj(pool, class, objs[i]);
+		spin_unlock(&class->lock);
+	}
+}
+
+static void zs_mag_disable(struct zs_pool *pool, struct size_class *class)
+{
+	atomic_inc(&class->mag_disabled);
+	zs_mag_drain(pool, class);
+}
+
+static void zs_mag_enable(struct size_class *class)
+{
+	atomic_dec(&class->mag_disabled);
+}
+
+static int zs_mag_init(struct size_class *class)
+{
+	struct zs_magazine __percpu *mag;
+	int cpu;
+
+	mag = alloc_percpu(struct zs_magazine);
+	if (!mag)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(mag, cpu)->lock);
+
+	/* zs_mag_destroy() only looks at a fully set up magazine */
+	class->mag = mag;
+	class->mag_limit = clamp_t(unsigned int, PAGE_SIZE / class->size,
+					1, ZS_MAGAZINE_SIZE);
+	atomic_set(&class->mag_disabled, 0);
+	return 0;
+}
+
+static void zs_mag_destroy(struct zs_pool *pool, struct size_class *class)
+{
+	if (!class->mag)
+		return;
+
+	zs_mag_disable(pool, class);
+	free_percpu(class->mag);
+	class->mag = NULL;
+}
+
+static void zs_mag_stat(struct size_class *class, unsigned long *cached,
+			unsigned long *hit, unsigned long *miss)
+{
+	struct zs_magazine *mag;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(class->mag, cpu);
+		spin_lock(&mag->lock);
+		*cached += mag->nr;
+		*hit += mag->hit;
+		*miss += mag->miss;
+		spin_unlock(&mag->lock);
+	}
+}
+#else
+static inline bool zs_mag_pop(struct size_class *class,
+				unsigned long handle)
+{
+	return false;
+}
+
+static inline bool zs_mag_push(struct size_class *class, unsigned long obj)
+{
+	return false;
+}
+
+static inline void zs_mag_disable(struct zs_pool *pool,
+				struct size_class *class)
+{
+}
+
+static inline void zs_mag_enable(struct size_class *class)
+{
+}
+
+static inline int zs_mag_init(struct size_class *class)
+{
+	return 0;
+}
+
+static inline void zs_mag_destroy(struct zs_pool *pool,
+				struct size_class *class)
+{
+}
+
+static inline void zs_mag_stat(struct size_class *class,
+		unsigned long *cached, unsigned long *hit, unsigned long *miss)
+{
+}
+#endif
 
 /**
  * zs_malloc - Allocate block of given size from pool.
@@ -1415,6 +1703,9 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 	size += ZS_HANDLE_SIZE;
 	class = pool->size_class[get_size_class_index(size)];
 
+	if (zs_mag_pop(class, handle))
+		return handle;
+
 	spin_lock(&class->lock);
 	zspage = find_get_zspage(class);
 
@@ -1445,6 +1736,87 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
+/**
+ * zs_malloc_bulk - Allocate several blocks from pool.
+ * @pool: pool to allocate from
+ * @sizes: sizes of the blocks to allocate
+ * @handles: array receiving the handles
+ * @nr: number of blocks
+ * @gfp: allocation flags
+ *
+ * Same as @nr calls to zs_malloc(), except that the handles are taken
+ * up front and consecutive requests of one size class are served under
+ * a single class->lock hold.
+ *
+ * Returns the number of leading @handles that were allocated, allocation
+ * stops at the first request which can't be satisfied.
+ */
+int zs_malloc_bulk(struct zs_pool *pool, const size_t *sizes,
+		unsigned long *handles, int nr, gfp_t gfp)
+{
+	struct size_class *class, *locked = NULL;
+	struct zspage *zspage;
+	unsigned long obj;
+	int i, nr_handles;
+
+	for (nr_handles = 0; nr_handles < nr; nr_handles++) {
+		if (unlikely(!sizes[nr_handles] ||
+				sizes[nr_handles] > ZS_MAX_ALLOC_SIZE))
+			break;
+		handles[nr_handles] = cache_alloc_handle(pool, gfp);
+		if (!handles[nr_handles])
+			break;
+	}
+
+	for (i = 0; i < nr_handles; i++) {
+		/* extra space in chunk to keep the handle */
+		class = pool->size_class[get_size_class_index(sizes[i] +
+							ZS_HANDLE_SIZE)];
+		if (class != locked) {
+			if (locked)
+				spin_unlock(&locked->lock);
+			locked = NULL;
+
+			if (zs_mag_pop(class, handles[i]))
+				continue;
+
+			spin_lock(&class->lock);
+			locked = class;
+		}
+
+		zspage = find_get_zspage(class);
+		if (!zspage) {
+			spin_unlock(&class->lock);
+			locked = NULL;
+			zspage = alloc_zspage(pool, class, gfp);
+			if (unlikely(!zspage))
+				break;
+
+			set_zspage_mapping(zspage, class->index, ZS_EMPTY);
+			atomic_long_add(class->pages_per_zspage,
+						&pool->pages_allocated);
+
+			spin_lock(&class->lock);
+			locked = class;
+			zs_stat_inc(class, OBJ_ALLOCATED, get_maxobj_per_zspage(
+					class->size, class->pages_per_zspage));
+		}
+
+		obj = obj_malloc(class, zspage, handles[i]);
+		fix_fullness_group(class, zspage);
+		record_obj(handles[i], obj);
+	}
+	if (locked)
+		spin_unlock(&locked->lock);
+
+	nr = i;
+	for (; i < nr_handles; i++)
+		cache_free_handle(pool, handles[i]);
+
+	return nr;
+}
+EXPORT_SYMBOL_GPL(zs_malloc_bulk);
+
 static void obj_free(struct size_class *class, unsigned long obj)
 {
 	struct link_free *link;
@@ -1470,6 +1842,29 @@ static void obj_free(struct size_class *class, unsigned long obj)
 	zs_stat_dec(class, OBJ_USED, 1);
 }
 
+/* Return obj to its zspage and release the zspage once it is empty */
+static void __zs_free_obj(struct zs_pool *pool, struct size_class *class,
+			unsigned long obj)
+{
+	struct zspage *zspage;
+	struct page *f_page;
+	unsigned int f_objidx;
+	enum fullness_group fullness;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	zspage = get_zspage(f_page);
+
+	obj_free(class, obj);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY) {
+		zs_stat_dec(class, OBJ_ALLOCATED, get_maxobj_per_zspage(
+				class->size, class->pages_per_zspage));
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(pool, zspage);
+	}
+}
+
 void zs_free(struct zs_pool *pool, unsigned long handle)
 {
 	struct zspage *zspage;
@@ -1491,16 +1886,14 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	get_zspage_mapping(zspage, &class_idx, &fullness);
 	class = pool->size_class[class_idx];
 
-	spin_lock(&class->lock);
-	obj_free(class, obj);
-	fullness = fix_fullness_group(class, zspage);
-	if (fullness == ZS_EMPTY) {
-		zs_stat_dec(class, OBJ_ALLOCATED, get_maxobj_per_zspage(
-				class->size, class->pages_per_zspage));
-		atomic_long_sub(class->pages_per_zspage,
-				&pool->pages_allocated);
-		free_zspage(pool, zspage);
+	if (zs_mag_push(class, obj & ~OBJ_ALLOCATED_TAG)) {
+		unpin_tag(handle);
+		cache_free_handle(pool, handle);
+		return;
 	}
+
+	spin_lock(&class->lock);
+	__zs_free_obj(pool, class, obj);
 	spin_unlock(&class->lock);
 	unpin_tag(handle);
 
@@ -1733,6 +2126,7 @@ static void __zs_compact(struct zs_pool *pool, struct size_class *class)
 	struct zspage *src_zspage;
 	struct zspage *dst_zspage = NULL;
 
+	zs_mag_disable(pool, class);
 	spin_lock(&class->lock);
 	while ((src_zspage = isolate_zspage(class, true))) {
 
@@ -1776,6 +2170,7 @@ static void __zs_compact(struct zs_pool *pool, struct size_class *class)
 		putback_zspage(class, src_zspage);
 
 	spin_unlock(&class->lock);
+	zs_mag_enable(class);
 }
 
 unsigned long zs_compact(struct zs_pool *pool)
@@ -1798,7 +2193,23 @@ EXPORT_SYMBOL_GPL(zs_compact);
 
 void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
 {
+	int i;
+	struct size_class *class;
+	unsigned long cached = 0;
+
 	memcpy(stats, &pool->stats, sizeof(struct zs_pool_stats));
+	stats->mag_hit = 0;
+	stats->mag_miss = 0;
+
+	for (i = 0; i < zs_size_classes; i++) {
+		class = pool->size_class[i];
+		if (!class)
+			continue;
+		if (class->index != i)
+			continue;
+		zs_mag_stat(class, &cached, &stats->mag_hit,
+				&stats->mag_miss);
+	}
 }
 EXPORT_SYMBOL_GPL(zs_pool_stats);
 
@@ -1937,10 +2348,12 @@ struct zs_pool *zs_create_pool(const char *name)
 		if (pages_per_zspage == 1 && class->objs_per_zspage == 1)
 			class->huge = true;
 		spin_lock_init(&class->lock);
-		pool->size_class[i] = class;
 		for (fullness = ZS_ALMOST_FULL; fullness <= ZS_ALMOST_EMPTY;
 								fullness++)
 			INIT_LIST_HEAD(&class->fullness_list[fullness]);
+		pool->size_class[i] = class;
+		if (zs_mag_init(class))
+			goto err;
 
 		prev_class = class;
 	}
@@ -1979,6 +2392,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 		if (class->index != i)
 			continue;
 
+		zs_mag_destroy(pool, class);
 		for (fg = ZS_ALMOST_FULL; fg <= ZS_ALMOST_EMPTY; fg++) {
 			if (!list_empty(&class->fullness_list[fg])) {
 				pr_info("Freeing non-empty class with size %db, fullness group %d\n",